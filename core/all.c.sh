@@ -1,10 +1,23 @@
 #!/bin/bash
 
+# a child process hosting an idea is launched with an arg of nf7core_host
+has_host=false
+for name in $@; do
+  if [[ "$name" == "host" ]]; then
+    has_host=true
+  fi
+done
+
 echo "#include \"core/all.h\""
 echo
 echo "#include <assert.h>"
+echo "#include <string.h>"
 echo
 echo "#include \"util/log.h\""
+if $has_host; then
+  echo
+  echo "#include \"core/host/mod.h\""
+fi
 echo
 echo "const uint32_t NF7CORE_MAX_MODS = UINT32_C($#);"
 echo
@@ -15,19 +28,34 @@ echo
 echo "  nf7->mods.ptr = mods;"
 echo "  nf7->mods.n   = 0;"
 echo
+echo "  // a child process hosting an idea loads only modules marked as hosted"
+echo "  bool hosted = false;"
+if $has_host; then
+  echo "  for (uint32_t i = 1; i < nf7->argc; ++i) {"
+  echo "    if (0 == strcmp(nf7->argv[i], NF7CORE_HOST_ARG)) {"
+  echo "      hosted = true;"
+  echo "    }"
+  echo "  }"
+fi
+echo
 for name in $@; do
   echo "  {"
   echo "    extern const struct nf7_mod_meta nf7core_${name};"
   echo "    extern struct nf7_mod* nf7core_${name}_new(const struct nf7*);"
-  echo "    nf7util_log_debug(\"loading module: %s\", nf7core_${name}.name);"
-  echo "    struct nf7_mod* mod = nf7core_${name}_new(nf7);"
-  echo "    if (nullptr != mod) {"
-  echo "      assert(nullptr != mod->nf7);"
-  echo "      assert(nullptr != mod->meta);"
-  echo "      nf7->mods.ptr[nf7->mods.n++] = mod;"
-  echo "      nf7util_log_info(\"loaded module: %s\", nf7core_${name}.name);"
+  echo "    if (hosted && !nf7core_${name}.hosted) {"
+  echo "      nf7util_log_debug(\"skipping module in child process: %s\", nf7core_${name}.name);"
   echo "    } else {"
-  echo "      nf7util_log_warn(\"failed to load module: %s\", nf7core_${name}.name);"
+  echo "      nf7util_log_debug(\"loading module: %s\", nf7core_${name}.name);"
+  echo "      struct nf7_mod* mod = nf7core_${name}_new(nf7);"
+  echo "      if (nullptr != mod) {"
+  echo "        assert(nullptr != mod->nf7);"
+  echo "        assert(nullptr != mod->meta);"
+  echo "        mod->name = nf7util_str_atoms_intern_cstr(nf7->atoms, mod->meta->name);"
+  echo "        nf7->mods.ptr[nf7->mods.n++] = mod;"
+  echo "        nf7util_log_info(\"loaded module: %s\", nf7core_${name}.name);"
+  echo "      } else {"
+  echo "        nf7util_log_warn(\"failed to load module: %s\", nf7core_${name}.name);"
+  echo "      }"
   echo "    }"
   echo "  }"
   echo
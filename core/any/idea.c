@@ -5,8 +5,10 @@
 
 #include "util/log.h"
 #include "util/malloc.h"
+#include "util/msg.h"
 
 #include "core/exec/entity.h"
+#include "core/exec/snapshot.h"
 
 
 struct nf7core_any_entity {
@@ -19,7 +21,16 @@ struct nf7core_any_entity {
 
 struct nf7core_exec_entity* new_(struct nf7core_exec*);
 void del_(struct nf7core_exec_entity*);
-void send_(struct nf7core_exec_entity*, struct nf7util_buffer*);
+bool send_(struct nf7core_exec_entity*, struct nf7util_buffer*);
+static uint64_t send_batch_(struct nf7core_exec_entity*, struct nf7util_buffer**, uint64_t);
+static void on_recv_(struct nf7core_exec_entity*, struct nf7util_buffer*);
+static void on_recv_batch_(struct nf7core_exec_entity*, struct nf7util_buffer**, uint64_t);
+static void on_writable_(struct nf7core_exec_entity*);
+static bool cancel_(struct nf7core_exec_entity*, uint64_t);
+static struct nf7util_buffer* snapshot_(struct nf7core_exec_entity*);
+static bool restore_(struct nf7core_exec_entity*, const uint8_t*, uint64_t);
+static void attach_(struct nf7core_any_entity*, struct nf7core_exec_entity*);
+static bool reset_(struct nf7core_exec_entity*);
 
 
 struct nf7core_exec_entity* new_(struct nf7core_exec* exec) {
@@ -49,14 +60,13 @@ void del_(struct nf7core_exec_entity* entity) {
   }
 }
 
-void send_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+bool send_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
   assert(nullptr != entity);
   assert(nullptr != buf);
 
   struct nf7core_any_entity* this = (void*) entity;
   if (nullptr != this->entity) {
-    nf7core_exec_entity_send(this->entity, buf);
-    return;
+    return nf7core_exec_entity_send(this->entity, buf);
   }
 
   // get name of the requested idea
@@ -73,6 +83,7 @@ void send_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
   // assign the return value
   struct nf7util_buffer* result = nullptr;
   if (nullptr != this->entity) {
+    attach_(this, this->entity);
     result = nf7util_buffer_new_from_cstr(this->malloc, "");
     nf7util_log_debug("sub-entity is created: %.*s", (int) namelen, name);
   } else {
@@ -89,6 +100,166 @@ void send_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
 
 EXIT:
   nf7util_buffer_unref(buf);
+  return true;
+}
+
+static uint64_t send_batch_(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer** bufs, uint64_t n) {
+  assert(nullptr != entity);
+  assert(nullptr != bufs || 0U == n);
+
+  struct nf7core_any_entity* this = (void*) entity;
+
+  // consume buffers one by one until the sub-entity is created
+  uint64_t i = 0;
+  for (; i < n && nullptr == this->entity; ++i) {
+    send_(entity, bufs[i]);
+  }
+  if (i < n) {
+    i += nf7core_exec_entity_send_batch(this->entity, &bufs[i], n-i);
+  }
+  return i;
+}
+
+static void on_recv_(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  assert(nullptr != entity);
+  struct nf7core_any_entity* this = entity->data;
+  nf7core_exec_entity_recv(&this->super, buf);
+}
+
+static void on_recv_batch_(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer** bufs, uint64_t n) {
+  assert(nullptr != entity);
+  struct nf7core_any_entity* this = entity->data;
+  nf7core_exec_entity_recv_batch(&this->super, bufs, n);
+}
+
+static void on_writable_(struct nf7core_exec_entity* entity) {
+  assert(nullptr != entity);
+  struct nf7core_any_entity* this = entity->data;
+  nf7core_exec_entity_credit_return(&this->super, 0, 0);
+}
+
+
+static bool cancel_(struct nf7core_exec_entity* entity, uint64_t id) {
+  assert(nullptr != entity);
+
+  struct nf7core_any_entity* this = (void*) entity;
+  if (nullptr == this->entity) {
+    return false;
+  }
+  return nf7core_exec_entity_cancel(this->entity, id);
+}
+
+// The state is empty before the sub-entity is created, otherwise an array of
+// its idea name and its state, or nil if it doesn't support snapshot.
+static struct nf7util_buffer* snapshot_(struct nf7core_exec_entity* entity) {
+  assert(nullptr != entity);
+
+  struct nf7core_any_entity* this = (void*) entity;
+
+  struct nf7util_buffer* buf = nf7util_buffer_new(this->malloc, 0);
+  if (nullptr == buf) {
+    nf7util_log_error("failed to allocate a snapshot buffer");
+    return nullptr;
+  }
+  if (nullptr == this->entity) {
+    return buf;
+  }
+
+  const struct nf7core_exec_idea* idea = this->entity->idea;
+
+  struct nf7util_buffer* state = nullptr;
+  if (nullptr != idea->snapshot) {
+    state = idea->snapshot(this->entity);
+    if (nullptr == state) {
+      nf7util_buffer_unref(buf);
+      return nullptr;
+    }
+  }
+
+  struct nf7util_msg_writer w;
+  nf7util_msg_writer_init(&w, buf);
+  nf7util_msg_write_array(&w, 2);
+  nf7util_msg_write_cstr(&w, (const char*) idea->name);
+  if (nullptr != state) {
+    nf7util_msg_write_bin(&w, state->array.ptr, state->array.n);
+    nf7util_buffer_unref(state);
+  } else {
+    nf7util_msg_write_nil(&w);
+  }
+  if (!nf7util_msg_writer_finish(&w)) {
+    nf7util_log_error("failed to serialize a snapshot");
+    nf7util_buffer_unref(buf);
+    return nullptr;
+  }
+  return buf;
+}
+
+static bool restore_(
+    struct nf7core_exec_entity* entity, const uint8_t* ptr, uint64_t size) {
+  assert(nullptr != entity);
+
+  struct nf7core_any_entity* this = (void*) entity;
+  assert(nullptr == this->entity);
+  if (0U == size) {
+    return true;  // INIT state
+  }
+
+  struct nf7util_msg_reader r;
+  nf7util_msg_reader_init(&r, ptr, size);
+
+  struct nf7util_msg_value arr, name, state;
+  if (!nf7util_msg_read(&r, &arr)  || NF7UTIL_MSG_ARRAY != arr.type || 2U != arr.n ||
+      !nf7util_msg_read(&r, &name) || NF7UTIL_MSG_STR   != name.type ||
+      !nf7util_msg_read(&r, &state)) {
+    nf7util_log_error("broken snapshot");
+    return false;
+  }
+
+  struct nf7core_exec_entity* sub = nullptr;
+  switch (state.type) {
+  case NF7UTIL_MSG_BIN:
+    sub = nf7core_exec_snapshot_new_entity(
+        this->super.mod, name.bytes.ptr, name.bytes.len,
+        state.bytes.ptr, state.bytes.len);
+    break;
+  case NF7UTIL_MSG_NIL:
+    sub = nf7core_exec_entity_new(this->super.mod, name.bytes.ptr, name.bytes.len);
+    break;
+  default:
+    nf7util_log_error("broken snapshot");
+    return false;
+  }
+  if (nullptr == sub) {
+    return false;
+  }
+  attach_(this, sub);
+  return true;
+}
+
+// The sub-entity is owned by this, so its callbacks relay replies to the client of
+// this as they are, keeping batches.
+static void attach_(struct nf7core_any_entity* this, struct nf7core_exec_entity* sub) {
+  assert(nullptr != this);
+  assert(nullptr != sub);
+
+  this->entity       = sub;
+  sub->data          = this;
+  sub->on_recv       = on_recv_;
+  sub->on_recv_batch = on_recv_batch_;
+  sub->on_writable   = on_writable_;
+}
+
+static bool reset_(struct nf7core_exec_entity* entity) {
+  assert(nullptr != entity);
+
+  // returns to INIT state
+  struct nf7core_any_entity* this = (void*) entity;
+  nf7core_exec_entity_del(this->entity);
+  this->entity = nullptr;
+  return true;
 }
 
 
@@ -97,7 +268,12 @@ const struct nf7core_exec_idea nf7core_any_idea = {
   .details = (const uint8_t*) "creates and wraps other entity of an idea chosen at runtime",
   .mod     = &nf7core_any,
 
-  .new  = new_,
-  .del  = del_,
-  .send = send_,
+  .new        = new_,
+  .del        = del_,
+  .send       = send_,
+  .send_batch = send_batch_,
+  .cancel     = cancel_,
+  .snapshot   = snapshot_,
+  .restore    = restore_,
+  .reset      = reset_,
 };
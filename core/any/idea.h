@@ -5,3 +5,4 @@
 
 
 extern const struct nf7core_exec_idea nf7core_any_idea;
+extern const struct nf7core_exec_idea nf7core_any_mux_idea;
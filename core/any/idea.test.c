@@ -0,0 +1,115 @@
+// No copyright
+#include "core/any/idea.h"
+
+#include <string.h>
+
+#include "util/buffer.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/idea.h"
+
+#include "test/common.h"
+
+
+struct client_ {
+  uint32_t recvs;
+  uint32_t batches;
+  uint32_t batched;
+
+  uint64_t last;
+};
+
+static void on_recv_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  struct client_* this = entity->data;
+  ++this->recvs;
+  this->last = buf->array.n;
+  nf7util_buffer_unref(buf);
+}
+
+static void on_recv_batch_(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer** bufs, uint64_t n) {
+  struct client_* this = entity->data;
+  ++this->batches;
+  for (uint64_t i = 0; i < n; ++i) {
+    ++this->batched;
+    nf7util_buffer_unref(bufs[i]);
+  }
+}
+
+static struct nf7util_buffer* new_buf_(
+    struct nf7test* test_, uint8_t chan, const char* str) {
+  const uint64_t len = strlen(str);
+  struct nf7util_buffer* buf = nf7util_buffer_new(test_->malloc, 8U + len);
+  if (nf7test_expect(nullptr != buf)) {
+    memset(buf->array.ptr, 0, 8U);
+    buf->array.ptr[7] = chan;
+    memcpy(&buf->array.ptr[8], str, len);
+  }
+  return buf;
+}
+
+static bool send_cstr_(
+    struct nf7test* test_, struct nf7core_exec_entity* sut, const char* str) {
+  struct nf7util_buffer* buf = nf7util_buffer_new_from_cstr(test_->malloc, str);
+  if (!nf7test_expect(nullptr != buf)) {
+    return false;
+  }
+  if (!nf7test_expect(nf7core_exec_entity_send(sut, buf))) {
+    nf7util_buffer_unref(buf);
+    return false;
+  }
+  return true;
+}
+
+
+// replies of the sub-entity reach the client, keeping batches
+NF7TEST(nf7core_any_idea_test_relay) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  const char* any = (const char*) nf7core_any_idea.name;
+  const char* mux = (const char*) nf7core_any_mux_idea.name;
+
+  struct client_ client = {0};
+  struct nf7core_exec_entity* sut =
+      nf7core_exec_entity_new(mod, (const uint8_t*) any, strlen(any));
+  if (!nf7test_expect(nullptr != sut)) {
+    return false;
+  }
+  sut->data          = &client;
+  sut->on_recv       = on_recv_;
+  sut->on_recv_batch = on_recv_batch_;
+
+  // wraps another nf7core_any, whose result is a single reply to relay
+  bool ret =
+      send_cstr_(test_, sut, any) &&
+      nf7test_expect(1U == client.recvs && 0U == client.last) &&
+      send_cstr_(test_, sut, mux) &&
+      nf7test_expect(2U == client.recvs && 0U == client.last);
+
+  // the mux replies to a batch at once, and the batch passes both wrappers
+  struct nf7util_buffer* bufs[2];
+  if (ret) {
+    bufs[0] = new_buf_(test_, 1, any);
+    bufs[1] = new_buf_(test_, 2, "missing");
+    ret = nf7test_expect(nullptr != bufs[0] && nullptr != bufs[1]);
+    if (ret) {
+      ret =
+          nf7test_expect(2U == nf7core_exec_entity_send_batch(sut, bufs, 2)) &&
+          nf7test_expect(1U == client.batches && 2U == client.batched);
+    } else {
+      for (uint64_t i = 0; i < 2U; ++i) {
+        if (nullptr != bufs[i]) {
+          nf7util_buffer_unref(bufs[i]);
+        }
+      }
+    }
+  }
+
+  nf7core_exec_entity_del(sut);
+  return ret;
+}
@@ -43,6 +43,10 @@ struct nf7_mod* nf7core_any_new(struct nf7* nf7) {
     nf7util_log_error("failed to register an idea, nf7core_any");
     goto ABORT;
   }
+  if (!nf7core_exec_idea_register(exec, &nf7core_any_mux_idea)) {
+    nf7util_log_error("failed to register an idea, nf7core_any_mux");
+    goto ABORT;
+  }
   return &this->super;
 
 ABORT:
@@ -62,5 +66,7 @@ const struct nf7_mod_meta nf7core_any = {
   .desc = (const uint8_t*) "executes any things",
   .ver  = NF7_VERSION,
 
+  .hosted = true,
+
   .del = del_,
 };
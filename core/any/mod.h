@@ -11,7 +11,21 @@
 //   otherwise error.
 // PIPE state:
 //   All buffers from the client is passed to the sub-entity, and from the
-//   sub-entity is to the cleint.
+//   sub-entity is to the cleint.  The entity takes `data` and the callbacks of
+//   the sub-entity to relay its replies, batches of replies and writable
+//   notifications to the client.
+//
+// It also provides nf7core_any_mux, whose entity multiplexes many sub-entities
+// by channel id. Each buffer from/to the client is prefixed by an 8-byte
+// big-endian channel id.
+//   - A buffer to an unknown channel is an idea name, and a sub-entity of the
+//     idea is created for the channel. The result is returned on the channel
+//     as same as INIT state of nf7core_any.
+//   - A buffer with only the channel id closes the channel.
+//   - Other buffers are passed to the sub-entity of the channel.
+// Replies made while sends are handled are delivered at once by a batch. The
+// entity caches the last resolved idea, so delete it before unregistering the
+// idea.
 #pragma once
 
 #include "nf7.h"
@@ -0,0 +1,442 @@
+// No copyright
+#include "core/any/idea.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "util/array.h"
+#include "util/buffer.h"
+#include "util/hashmap.h"
+#include "util/log.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/idea.h"
+
+
+// a size of channel id prefixed to each buffer
+#define CHAN_SIZE_ 8U
+
+// a number of buffers held for a channel whose entity is out of credit
+//   Other channels keep flowing until the backlog of one channel is full.
+#define BACKLOG_MAX_ 64U
+
+struct nf7core_any_mux_chan;
+
+NF7UTIL_HASHMAP_INLINE(nf7core_any_mux_chans, struct nf7core_any_mux_chan*);
+NF7UTIL_ARRAY_INLINE(nf7core_any_mux_replies, struct nf7util_buffer*);
+NF7UTIL_ARRAY_INLINE(nf7core_any_mux_backlog, struct nf7util_buffer*);
+
+struct nf7core_any_mux_entity {
+  struct nf7core_exec_entity super;
+
+  struct nf7util_malloc* malloc;
+
+  // maps a channel id to its channel
+  struct nf7core_any_mux_chans chans;
+
+  // the last idea resolved by name
+  const struct nf7core_exec_idea* cache;
+
+  // replies held while sends are handled, and delivered at once after that
+  struct nf7core_any_mux_replies replies;
+  uint32_t depth;
+
+  // true if the client deletes this while sends are handled
+  bool deleted;
+};
+
+struct nf7core_any_mux_chan {
+  struct nf7core_any_mux_entity* mux;
+  struct nf7core_exec_entity*    entity;
+
+  uint64_t id;
+
+  // payloads refused by the entity, sent again in order on its on_writable
+  //   Closing the channel drops them.
+  struct nf7core_any_mux_backlog backlog;
+};
+
+static struct nf7core_exec_entity* new_(struct nf7core_exec*);
+static void del_(struct nf7core_exec_entity*);
+static void destroy_(struct nf7core_any_mux_entity*);
+static bool send_(struct nf7core_exec_entity*, struct nf7util_buffer*);
+static uint64_t send_batch_(struct nf7core_exec_entity*, struct nf7util_buffer**, uint64_t);
+static bool reset_(struct nf7core_exec_entity*);
+
+static bool route_(struct nf7core_any_mux_entity*, struct nf7util_buffer*);
+static void open_(struct nf7core_any_mux_entity*, uint64_t, const uint8_t*, uint64_t);
+static void close_(struct nf7core_any_mux_entity*, struct nf7core_any_mux_chan*);
+static void close_all_(struct nf7core_any_mux_entity*);
+static void chan_del_(struct nf7core_any_mux_chan*);
+static void reply_(struct nf7core_any_mux_entity*, uint64_t, struct nf7util_buffer*);
+static void flush_(struct nf7core_any_mux_entity*);
+static void leave_(struct nf7core_any_mux_entity*);
+
+static void on_recv_(struct nf7core_exec_entity*, struct nf7util_buffer*);
+static void on_writable_(struct nf7core_exec_entity*);
+
+static inline uint64_t get_id_(const uint8_t* ptr) {
+  uint64_t ret = 0;
+  for (uint32_t i = 0; i < CHAN_SIZE_; ++i) {
+    ret = (ret << 8) | ptr[i];
+  }
+  return ret;
+}
+static inline void put_id_(uint8_t* ptr, uint64_t id) {
+  for (uint32_t i = 0; i < CHAN_SIZE_; ++i) {
+    ptr[i] = (uint8_t) (id >> (8*(CHAN_SIZE_-1-i)));
+  }
+}
+
+
+static struct nf7core_exec_entity* new_(struct nf7core_exec* exec) {
+  assert(nullptr != exec);
+
+  struct nf7core_any_mux_entity* this = nf7util_malloc_alloc(exec->malloc, sizeof(*this));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate new entity");
+    return nullptr;
+  }
+
+  *this = (struct nf7core_any_mux_entity) {
+    .super = {
+      .idea = &nf7core_any_mux_idea,
+      .mod  = exec,
+    },
+    .malloc = exec->malloc,
+  };
+  nf7core_any_mux_chans_init(&this->chans, this->malloc);
+  nf7core_any_mux_replies_init(&this->replies, this->malloc);
+  return &this->super;
+}
+
+static void del_(struct nf7core_exec_entity* entity) {
+  struct nf7core_any_mux_entity* this = (void*) entity;
+  if (nullptr != this) {
+    if (0U < this->depth) {
+      this->deleted = true;  // will be destroyed by leave_()
+      return;
+    }
+    destroy_(this);
+  }
+}
+
+static void destroy_(struct nf7core_any_mux_entity* this) {
+  assert(nullptr != this);
+  assert(0U == this->depth);
+
+  close_all_(this);
+  for (uint64_t i = 0; i < this->replies.n; ++i) {
+    nf7util_buffer_unref(this->replies.ptr[i]);
+  }
+  nf7core_any_mux_replies_deinit(&this->replies);
+  nf7core_any_mux_chans_deinit(&this->chans);
+  nf7util_malloc_free(this->malloc, this);
+}
+
+static bool send_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  assert(nullptr != entity);
+  assert(nullptr != buf);
+
+  struct nf7core_any_mux_entity* this = (void*) entity;
+
+  ++this->depth;
+  const bool ret = route_(this, buf);
+  leave_(this);
+  return ret;
+}
+
+static uint64_t send_batch_(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer** bufs, uint64_t n) {
+  assert(nullptr != entity);
+  assert(nullptr != bufs || 0U == n);
+
+  struct nf7core_any_mux_entity* this = (void*) entity;
+
+  ++this->depth;
+  uint64_t i = 0;
+  for (; i < n && route_(this, bufs[i]); ++i) { }
+  leave_(this);
+  return i;
+}
+
+static bool reset_(struct nf7core_exec_entity* entity) {
+  assert(nullptr != entity);
+
+  struct nf7core_any_mux_entity* this = (void*) entity;
+  if (0U < this->depth) {
+    return false;  // deleted while sends are handled
+  }
+  assert(0U == this->replies.n);
+
+  close_all_(this);
+  this->cache = nullptr;
+  return true;
+}
+
+
+static bool route_(struct nf7core_any_mux_entity* this, struct nf7util_buffer* buf) {
+  assert(nullptr != this);
+  assert(nullptr != buf);
+
+  if (CHAN_SIZE_ > buf->array.n) {
+    nf7util_log_warn("expected a channel id, but got %" PRIu64 " bytes", buf->array.n);
+    nf7util_buffer_unref(buf);
+    return true;
+  }
+  const uint64_t id = get_id_(buf->array.ptr);
+
+  struct nf7core_any_mux_chan* chan = nullptr;
+  if (!nf7core_any_mux_chans_find(&this->chans, id, &chan)) {
+    open_(this, id, &buf->array.ptr[CHAN_SIZE_], buf->array.n - CHAN_SIZE_);
+    nf7util_buffer_unref(buf);
+    return true;
+  }
+  if (CHAN_SIZE_ == buf->array.n) {
+    close_(this, chan);
+    nf7util_buffer_unref(buf);
+    return true;
+  }
+
+  // checks the backlog before stripping the channel id not to modify a refused
+  // buffer as possible
+  struct nf7core_exec_entity* sub = chan->entity;
+  if (BACKLOG_MAX_ <= chan->backlog.n) {
+    return false;
+  }
+
+  // strips the channel id, a shared buffer is copied not to break other owners
+  struct nf7util_buffer* payload = buf;
+  if (1U < buf->refcnt) {
+    payload = nf7util_buffer_clone(buf, nullptr);
+    if (nullptr == payload) {
+      nf7util_log_error("failed to clone a shared buffer");
+      return false;
+    }
+  }
+  const uint64_t n = payload->array.n - CHAN_SIZE_;
+  memmove(payload->array.ptr, &payload->array.ptr[CHAN_SIZE_], n);
+  nf7util_array_u8_resize(&payload->array, n);
+
+  // holds the payload refused by the entity, or following others held
+  if ((0U == chan->backlog.n && nf7core_exec_entity_send(sub, payload)) ||
+      nf7core_any_mux_backlog_insert(&chan->backlog, UINT64_MAX, payload)) {
+    if (payload != buf) {
+      nf7util_buffer_unref(buf);
+    }
+    return true;
+  }
+  nf7util_log_error("failed to hold a buffer for channel %" PRIu64, id);
+
+  // gives back the refused buffer as it was
+  if (payload != buf) {
+    nf7util_buffer_unref(payload);
+    return false;
+  }
+  if (!nf7util_array_u8_resize(&buf->array, n + CHAN_SIZE_)) {
+    nf7util_log_error("failed to restore a refused buffer, the buffer is dropped");
+    nf7util_buffer_unref(buf);
+    return true;
+  }
+  memmove(&buf->array.ptr[CHAN_SIZE_], buf->array.ptr, n);
+  put_id_(buf->array.ptr, id);
+  return false;
+}
+
+static void open_(
+    struct nf7core_any_mux_entity* this, uint64_t id,
+    const uint8_t* name, uint64_t namelen) {
+  assert(nullptr != this);
+
+  const char* result = "FAIL";
+
+  // resolves the idea, sessions of the same idea hit the cache
+  const struct nf7core_exec_idea* idea = this->cache;
+  if (nullptr == idea ||
+      strlen((const char*) idea->name) != namelen ||
+      0 != memcmp(idea->name, name, namelen)) {
+    idea = nf7core_exec_idea_find(this->super.mod, name, namelen);
+  }
+  if (nullptr == idea) {
+    nf7util_log_warn("unknown idea requested: %.*s", (int) namelen, name);
+    goto EXIT;
+  }
+  this->cache = idea;
+
+  struct nf7core_any_mux_chan* chan = nf7util_malloc_alloc(this->malloc, sizeof(*chan));
+  if (nullptr == chan) {
+    nf7util_log_error("failed to allocate a channel");
+    goto EXIT;
+  }
+  *chan = (struct nf7core_any_mux_chan) {
+    .mux    = this,
+    .entity = nf7core_exec_entity_new_by_idea(this->super.mod, idea),
+    .id     = id,
+  };
+  nf7core_any_mux_backlog_init(&chan->backlog, this->malloc);
+  if (nullptr == chan->entity) {
+    nf7util_malloc_free(this->malloc, chan);
+    goto EXIT;
+  }
+  if (!nf7core_any_mux_chans_insert(&this->chans, id, chan)) {
+    nf7util_log_error("failed to register a channel");
+    nf7core_exec_entity_del(chan->entity);
+    nf7util_malloc_free(this->malloc, chan);
+    goto EXIT;
+  }
+  chan->entity->data        = chan;
+  chan->entity->on_recv     = on_recv_;
+  chan->entity->on_writable = on_writable_;
+  result = "";
+  nf7util_log_debug("channel %" PRIu64 " is opened: %.*s", id, (int) namelen, name);
+
+EXIT:;
+  struct nf7util_buffer* buf = nf7util_buffer_new_from_cstr(this->malloc, result);
+  if (nullptr == buf) {
+    nf7util_log_error("failed to allocate a buffer to return result");
+    return;
+  }
+  reply_(this, id, buf);
+}
+
+static void close_(struct nf7core_any_mux_entity* this, struct nf7core_any_mux_chan* chan) {
+  assert(nullptr != this);
+  assert(nullptr != chan);
+
+  nf7core_any_mux_chans_remove(&this->chans, chan->id, nullptr);
+  chan_del_(chan);
+}
+
+static void close_all_(struct nf7core_any_mux_entity* this) {
+  assert(nullptr != this);
+
+  for (uint64_t i = 0; i < this->chans.cap; ++i) {
+    if (this->chans.ptr[i].used) {
+      chan_del_(this->chans.ptr[i].value);
+    }
+  }
+  nf7core_any_mux_chans_deinit(&this->chans);
+  nf7core_any_mux_chans_init(&this->chans, this->malloc);
+}
+
+static void chan_del_(struct nf7core_any_mux_chan* this) {
+  assert(nullptr != this);
+
+  if (0U < this->backlog.n) {
+    nf7util_log_debug(
+        "channel %" PRIu64 " is closed with %" PRIu64 " buffers held",
+        this->id, this->backlog.n);
+  }
+  for (uint64_t i = 0; i < this->backlog.n; ++i) {
+    nf7util_buffer_unref(this->backlog.ptr[i]);
+  }
+  nf7core_any_mux_backlog_deinit(&this->backlog);
+  nf7core_exec_entity_del(this->entity);
+  nf7util_malloc_free(this->mux->malloc, this);
+}
+
+static void reply_(
+    struct nf7core_any_mux_entity* this, uint64_t id, struct nf7util_buffer* buf) {
+  assert(nullptr != this);
+  assert(nullptr != buf);
+
+  // prefixes the channel id
+  if (1U < buf->refcnt) {
+    struct nf7util_buffer* clone = nf7util_buffer_clone(buf, nullptr);
+    nf7util_buffer_unref(buf);
+    buf = clone;
+  }
+  const uint64_t n = nullptr != buf? buf->array.n: 0U;
+  if (nullptr == buf || !nf7util_array_u8_resize(&buf->array, n + CHAN_SIZE_)) {
+    nf7util_log_error("failed to prefix a channel id, the reply is dropped");
+    if (nullptr != buf) {
+      nf7util_buffer_unref(buf);
+    }
+    return;
+  }
+  memmove(&buf->array.ptr[CHAN_SIZE_], buf->array.ptr, n);
+  put_id_(buf->array.ptr, id);
+
+  if (0U < this->depth &&
+      nf7core_any_mux_replies_insert(&this->replies, UINT64_MAX, buf)) {
+    return;
+  }
+  nf7core_exec_entity_recv(&this->super, buf);
+}
+
+static void flush_(struct nf7core_any_mux_entity* this) {
+  assert(nullptr != this);
+  assert(0U == this->depth);
+
+  if (0U == this->replies.n) {
+    return;
+  }
+
+  // the client may delete this entity while receiving
+  struct nf7core_any_mux_replies replies = this->replies;
+  nf7core_any_mux_replies_init(&this->replies, this->malloc);
+  nf7core_exec_entity_recv_batch(&this->super, replies.ptr, replies.n);
+  nf7core_any_mux_replies_deinit(&replies);
+}
+
+static void leave_(struct nf7core_any_mux_entity* this) {
+  assert(nullptr != this);
+  assert(0U < this->depth);
+
+  if (0U < --this->depth) {
+    return;
+  }
+  if (this->deleted) {
+    destroy_(this);
+    return;
+  }
+  flush_(this);
+}
+
+
+static void on_recv_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  assert(nullptr != entity);
+  struct nf7core_any_mux_chan* chan = entity->data;
+  reply_(chan->mux, chan->id, buf);
+}
+
+static void on_writable_(struct nf7core_exec_entity* entity) {
+  assert(nullptr != entity);
+  struct nf7core_any_mux_chan*   chan = entity->data;
+  struct nf7core_any_mux_entity* mux  = chan->mux;
+
+  // holds replies and deletion while the backlog is sent
+  ++mux->depth;
+
+  uint64_t n = 0;
+  for (; n < chan->backlog.n; ++n) {
+    if (!nf7core_exec_entity_send(entity, chan->backlog.ptr[n])) {
+      break;
+    }
+  }
+  const uint64_t rest = chan->backlog.n - n;
+  if (0U < n) {
+    memmove(chan->backlog.ptr, &chan->backlog.ptr[n], rest*sizeof(chan->backlog.ptr[0]));
+    nf7core_any_mux_backlog_resize(&chan->backlog, rest);
+  }
+
+  // the client may close the channel in its on_writable
+  if (rest < BACKLOG_MAX_) {
+    nf7core_exec_entity_credit_return(&mux->super, 0, 0);
+  }
+  leave_(mux);
+}
+
+
+const struct nf7core_exec_idea nf7core_any_mux_idea = {
+  .name    = (const uint8_t*) "nf7core_any_mux",
+  .details = (const uint8_t*) "creates and wraps entities of ideas chosen at runtime for each channel",
+  .mod     = &nf7core_any,
+
+  .new        = new_,
+  .del        = del_,
+  .send       = send_,
+  .send_batch = send_batch_,
+  .reset      = reset_,
+};
@@ -0,0 +1,199 @@
+// No copyright
+#include "core/any/idea.h"
+
+#include <string.h>
+
+#include "util/buffer.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/idea.h"
+#include "core/exec/test_idea.h"
+
+#include "test/common.h"
+
+
+struct client_ {
+  struct nf7test* test;
+
+  uint32_t batches;
+  uint32_t recvs;
+
+  uint8_t  chans[8];
+  char     data[8][8];
+};
+
+NF7CORE_EXEC_TEST_IDEA(
+    echo_, "nf7core_any_mux_test_echo", nf7core_exec_test_idea_echo);
+
+// echoes buffers, but returns credit only when the test does
+static const struct nf7core_exec_idea hold_;
+static struct nf7core_exec_entity* held_;
+
+static struct nf7core_exec_entity* new_hold_(struct nf7core_exec* exec) {
+  struct nf7core_exec_entity* this =
+      nf7core_exec_test_idea_alloc(exec, &hold_, sizeof(*this));
+  if (nullptr != this) {
+    nf7core_exec_entity_credit_init(this, 1, 0);
+    held_ = this;
+  }
+  return this;
+}
+
+static const struct nf7core_exec_idea hold_ = {
+  .name = (const uint8_t*) "nf7core_any_mux_test_hold",
+  .new  = new_hold_,
+  .del  = nf7core_exec_test_idea_del,
+  .send = nf7core_exec_test_idea_echo,
+};
+
+static void on_recv_batch_(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer** bufs, uint64_t n) {
+  struct client_* this = entity->data;
+  ++this->batches;
+  for (uint64_t i = 0; i < n; ++i) {
+    struct nf7util_buffer* buf = bufs[i];
+    if (8U <= buf->array.n && this->recvs < 8U && buf->array.n - 8U < 8U) {
+      this->chans[this->recvs] = buf->array.ptr[7];
+      memcpy(this->data[this->recvs], &buf->array.ptr[8], buf->array.n - 8U);
+      ++this->recvs;
+    }
+    nf7util_buffer_unref(buf);
+  }
+}
+
+static bool send_str_(
+    struct nf7test* test_, struct nf7core_exec_entity* sut,
+    struct nf7util_buffer** bufs, uint64_t* n, uint8_t chan, const char* str) {
+  const uint64_t len = strlen(str);
+  struct nf7util_buffer* buf = nf7util_buffer_new(test_->malloc, 8U + len);
+  if (!nf7test_expect(nullptr != buf)) {
+    return false;
+  }
+  buf->array.ptr[7] = chan;
+  memcpy(&buf->array.ptr[8], str, len);
+  if (nullptr == bufs) {
+    if (!nf7test_expect(nf7core_exec_entity_send(sut, buf))) {
+      nf7util_buffer_unref(buf);
+      return false;
+    }
+    return true;
+  }
+  bufs[(*n)++] = buf;
+  return true;
+}
+
+
+NF7TEST(nf7core_any_mux_test_route) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod) ||
+      !nf7test_expect(nf7core_exec_idea_register(mod, &echo_))) {
+    return false;
+  }
+
+  const char* mux  = (const char*) nf7core_any_mux_idea.name;
+  const char* echo = (const char*) echo_.name;
+
+  struct client_ client = {.test = test_};
+  struct nf7core_exec_entity* sut =
+      nf7core_exec_entity_new(mod, (const uint8_t*) mux, strlen(mux));
+  if (!nf7test_expect(nullptr != sut)) {
+    nf7core_exec_idea_unregister(mod, &echo_);
+    return false;
+  }
+  sut->data          = &client;
+  sut->on_recv_batch = on_recv_batch_;
+
+  // replies of a batch are delivered at once
+  struct nf7util_buffer* bufs[5];
+  uint64_t n = 0;
+  bool ret =
+      send_str_(test_, sut, bufs, &n, 1, echo) &&
+      send_str_(test_, sut, bufs, &n, 2, echo) &&
+      send_str_(test_, sut, bufs, &n, 1, "a") &&
+      send_str_(test_, sut, bufs, &n, 2, "b") &&
+      send_str_(test_, sut, bufs, &n, 3, "missing");
+  if (ret) {
+    ret = nf7test_expect(n == nf7core_exec_entity_send_batch(sut, bufs, n));
+  } else {
+    for (uint64_t i = 0; i < n; ++i) {
+      nf7util_buffer_unref(bufs[i]);
+    }
+  }
+  ret = ret &&
+      nf7test_expect(1U == client.batches) &&
+      nf7test_expect(5U == client.recvs) &&
+      nf7test_expect(1U == client.chans[0] && 0 == strcmp(client.data[0], "")) &&
+      nf7test_expect(2U == client.chans[1] && 0 == strcmp(client.data[1], "")) &&
+      nf7test_expect(1U == client.chans[2] && 0 == strcmp(client.data[2], "a")) &&
+      nf7test_expect(2U == client.chans[3] && 0 == strcmp(client.data[3], "b")) &&
+      nf7test_expect(3U == client.chans[4] && 0 == strcmp(client.data[4], "FAIL"));
+
+  // a closed channel accepts an idea name again
+  ret = ret &&
+      send_str_(test_, sut, nullptr, nullptr, 1, "") &&
+      send_str_(test_, sut, nullptr, nullptr, 1, "x") &&
+      nf7test_expect(6U == client.recvs) &&
+      nf7test_expect(1U == client.chans[5] && 0 == strcmp(client.data[5], "FAIL"));
+
+  nf7core_exec_entity_del(sut);
+  nf7core_exec_idea_unregister(mod, &echo_);
+  return ret;
+}
+
+NF7TEST(nf7core_any_mux_test_blocked_chan) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+  if (!nf7test_expect(nf7core_exec_idea_register(mod, &echo_))) {
+    return false;
+  }
+  if (!nf7test_expect(nf7core_exec_idea_register(mod, &hold_))) {
+    nf7core_exec_idea_unregister(mod, &echo_);
+    return false;
+  }
+
+  const char* mux  = (const char*) nf7core_any_mux_idea.name;
+  const char* echo = (const char*) echo_.name;
+  const char* hold = (const char*) hold_.name;
+
+  struct client_ client = {.test = test_};
+  struct nf7core_exec_entity* sut =
+      nf7core_exec_entity_new(mod, (const uint8_t*) mux, strlen(mux));
+  bool ret = nf7test_expect(nullptr != sut);
+  if (ret) {
+    sut->data          = &client;
+    sut->on_recv_batch = on_recv_batch_;
+  }
+
+  // the channel out of credit holds buffers without blocking others
+  held_ = nullptr;
+  ret = ret &&
+      send_str_(test_, sut, nullptr, nullptr, 1, hold) &&
+      send_str_(test_, sut, nullptr, nullptr, 2, echo) &&
+      nf7test_expect(nullptr != held_) &&
+      send_str_(test_, sut, nullptr, nullptr, 1, "a") &&
+      send_str_(test_, sut, nullptr, nullptr, 1, "b") &&
+      send_str_(test_, sut, nullptr, nullptr, 1, "c") &&
+      send_str_(test_, sut, nullptr, nullptr, 2, "x") &&
+      nf7test_expect(4U == client.recvs) &&
+      nf7test_expect(1U == client.chans[2] && 0 == strcmp(client.data[2], "a")) &&
+      nf7test_expect(2U == client.chans[3] && 0 == strcmp(client.data[3], "x"));
+
+  // held buffers are sent in order as the channel gets credit
+  ret = ret &&
+      (nf7core_exec_entity_credit_return(held_, 1, 0), true) &&
+      nf7test_expect(5U == client.recvs) &&
+      nf7test_expect(1U == client.chans[4] && 0 == strcmp(client.data[4], "b")) &&
+      (nf7core_exec_entity_credit_return(held_, 1, 0), true) &&
+      nf7test_expect(6U == client.recvs) &&
+      nf7test_expect(1U == client.chans[5] && 0 == strcmp(client.data[5], "c"));
+
+  nf7core_exec_entity_del(sut);
+  nf7core_exec_idea_unregister(mod, &hold_);
+  nf7core_exec_idea_unregister(mod, &echo_);
+  return ret;
+}
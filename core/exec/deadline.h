@@ -0,0 +1,47 @@
+// No copyright
+//
+// Deadlines and cancellation bound the time spent on requests nobody waits for.
+//
+// DEADLINE
+//   A client sets `deadline` of a buffer by nf7core_exec_deadline_set() before
+//   sending it. nf7core_exec_entity_send() and its batch version drop buffers
+//   already expired, and offloaded buffers expired while queued are dropped
+//   before their works. An implementation may also check
+//   nf7core_exec_deadline_expired() at any time, e.g. before starting heavy
+//   processing.
+//
+// CANCELLATION
+//   A client cancels a request by nf7core_exec_entity_cancel() with its
+//   correlation id, see core/exec/pending.h. It's delivered to `cancel` of the
+//   idea, and an idea using core/exec/offload.h can set
+//   nf7core_exec_offload_cancel to drop the queued request or to tell its
+//   running work by nf7core_exec_offload_cancelled().
+//
+// Expired or cancelled requests are dropped without any response, so the
+// client should forget them by itself.
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <uv.h>
+
+#include "util/buffer.h"
+
+
+// Sets the deadline after the timeout in nanoseconds from now.
+static inline void nf7core_exec_deadline_set(
+    struct nf7util_buffer* buf, uint64_t timeout_ns) {
+  assert(nullptr != buf);
+  buf->deadline = uv_hrtime() + timeout_ns;
+  if (0U == buf->deadline) {
+    buf->deadline = 1;
+  }
+}
+
+// Returns true if the buffer has the deadline and it has passed.
+// Thread-safe as long as the buffer is not modified.
+static inline bool nf7core_exec_deadline_expired(const struct nf7util_buffer* buf) {
+  assert(nullptr != buf);
+  return 0U != buf->deadline && buf->deadline <= uv_hrtime();
+}
@@ -2,11 +2,16 @@
 #pragma once
 
 #include <assert.h>
+#include <string.h>
 
 #include "util/log.h"
 
+#include "core/exec/deadline.h"
 #include "core/exec/idea.h"
+#include "core/exec/metrics.h"
 #include "core/exec/mod.h"
+#include "core/exec/offload.h"
+#include "core/exec/pool.h"
 
 
 struct nf7core_exec_entity {
@@ -17,9 +22,73 @@ struct nf7core_exec_entity {
   void (*on_recv)(
       struct nf7core_exec_entity*,
       struct nf7util_buffer*);
+
+  // optional, receives are fallen back to a loop of `on_recv` if nullptr
+  // takes ownership of all buffers in the array, but not the array itself
+  void (*on_recv_batch)(
+      struct nf7core_exec_entity*,
+      struct nf7util_buffer**,
+      uint64_t);
+
+  // flow control
+  //   The implementation advertises a credit window by
+  //   nf7core_exec_entity_credit_init(), and gives credit back by
+  //   nf7core_exec_entity_credit_return() when it finishes processing.
+  //   A window of 0 means unlimited.
+  struct {
+    uint64_t msgs_window;
+    uint64_t bytes_window;
+    uint64_t msgs_used;
+    uint64_t bytes_used;
+
+    // true if a buffer has been refused since the last notification
+    bool blocked;
+  } credit;
+
+  // optional, called when the entity becomes able to accept buffers again
+  // after some sends are refused, or when it dies
+  void (*on_writable)(struct nf7core_exec_entity*);
+
+  // true after the implementation has lost its backend for good, e.g. a child
+  // process has gone, see nf7core_exec_entity_die()
+  // All sends are refused then without waiting for on_writable.
+  bool dead;
+
+  // managed by core/exec/offload.h
+  struct nf7core_exec_offload* offload;
+
+  // managed by core/exec/metrics.h, nullptr if not instrumented
+  struct nf7core_exec_metrics* metrics;
 };
 
 
+// Creates an entity of the idea already resolved, e.g. by
+// nf7core_exec_idea_find(), to skip the lookup by name.
+static inline struct nf7core_exec_entity* nf7core_exec_entity_new_by_idea(
+    struct nf7core_exec* mod, const struct nf7core_exec_idea* idea) {
+  assert(nullptr != mod);
+  assert(nullptr != idea);
+
+  struct nf7core_exec_entity* entity = nullptr;
+  if (nullptr != idea->reset) {
+    entity = nf7core_exec_pool_take(mod, idea);
+  }
+  if (nullptr == entity) {
+    entity = idea->new(mod);
+  }
+  if (nullptr == entity) {
+    nf7util_log_error("failed to create entity of '%s'", idea->name);
+    return nullptr;
+  }
+  assert(idea == entity->idea);
+  assert(mod  == entity->mod);
+
+  if (mod->metrics_enabled && !nf7core_exec_metrics_attach(entity)) {
+    nf7util_log_warn("failed to instrument entity of '%s'", idea->name);
+  }
+  return entity;
+}
+
 static inline struct nf7core_exec_entity* nf7core_exec_entity_new(
     struct nf7core_exec* mod, const uint8_t* name, size_t namelen) {
   const struct nf7core_exec_idea* idea =
@@ -28,15 +97,7 @@ static inline struct nf7core_exec_entity* nf7core_exec_entity_new(
     nf7util_log_error("missing idea: %.*s", (int) namelen, name);
     return nullptr;
   }
-
-  struct nf7core_exec_entity* entity = idea->new(mod);
-  if (nullptr == entity) {
-    nf7util_log_error("failed to create entity of '%.*s'", (int) namelen, name);
-    return nullptr;
-  }
-  assert(idea == entity->idea);
-  assert(mod  == entity->mod);
-  return entity;
+  return nf7core_exec_entity_new_by_idea(mod, idea);
 }
 
 // The implementation of entity use this to send buffer to the client.
@@ -45,6 +106,9 @@ static inline void nf7core_exec_entity_recv(struct nf7core_exec_entity* this, st
   assert(nullptr != this);
   assert(nullptr != buf);
 
+  if (nullptr != this->metrics) {
+    nf7core_exec_metrics_on_recv(this, buf->array.n, buf->id);
+  }
   if (nullptr != this->on_recv) {
     this->on_recv(this, buf);
   } else {
@@ -52,16 +116,241 @@ static inline void nf7core_exec_entity_recv(struct nf7core_exec_entity* this, st
   }
 }
 
+// The implementation of entity use this to answer a request whose id is the
+// id, see core/exec/pending.h.
+// Takes ownership of buf. A buffer shared by other owners is cloned not to
+// change their id.
+static inline void nf7core_exec_entity_reply(
+    struct nf7core_exec_entity* this, uint64_t id, struct nf7util_buffer* buf) {
+  assert(nullptr != buf);
+
+  if (1U < buf->refcnt) {
+    struct nf7util_buffer* clone = nf7util_buffer_clone(buf, nullptr);
+    nf7util_buffer_unref(buf);
+    if (nullptr == clone) {
+      nf7util_log_error("failed to clone a shared buffer, the reply is dropped");
+      return;
+    }
+    buf = clone;
+  }
+  buf->id = id;
+  nf7core_exec_entity_recv(this, buf);
+}
+
+// The implementation of entity use this to send buffers to the client at once.
+// Takes ownership of all buffers in bufs, but not bufs itself.
+static inline void nf7core_exec_entity_recv_batch(
+    struct nf7core_exec_entity* this, struct nf7util_buffer** bufs, uint64_t n) {
+  assert(nullptr != this);
+  assert(nullptr != bufs || 0U == n);
+
+  if (nullptr != this->on_recv_batch) {
+    if (nullptr != this->metrics) {
+      for (uint64_t i = 0; i < n; ++i) {
+        nf7core_exec_metrics_on_recv(this, bufs[i]->array.n, bufs[i]->id);
+      }
+    }
+    this->on_recv_batch(this, bufs, n);
+  } else {
+    for (uint64_t i = 0; i < n; ++i) {
+      nf7core_exec_entity_recv(this, bufs[i]);
+    }
+  }
+}
+
+// Returns true if the entity has credit to accept one more buffer.
+static inline bool nf7core_exec_entity_writable(
+    const struct nf7core_exec_entity* this) {
+  assert(nullptr != this);
+  return
+      (0U == this->credit.msgs_window ||
+       this->credit.msgs_used < this->credit.msgs_window) &&
+      (0U == this->credit.bytes_window ||
+       this->credit.bytes_used < this->credit.bytes_window);
+}
+
+// The implementation of entity use this to advertise its credit window.
+// A buffer is accepted while both of used messages and bytes are less than the
+// windows, so a single buffer may exceed the bytes window.
+static inline void nf7core_exec_entity_credit_init(
+    struct nf7core_exec_entity* this, uint64_t msgs, uint64_t bytes) {
+  assert(nullptr != this);
+  this->credit.msgs_window  = msgs;
+  this->credit.bytes_window = bytes;
+}
+
+// The implementation of entity use this to give credit back to the client.
+// The client is notified by on_writable if any send has been refused.
+static inline void nf7core_exec_entity_credit_return(
+    struct nf7core_exec_entity* this, uint64_t msgs, uint64_t bytes) {
+  assert(nullptr != this);
+
+  this->credit.msgs_used -= msgs < this->credit.msgs_used?
+      msgs: this->credit.msgs_used;
+  this->credit.bytes_used -= bytes < this->credit.bytes_used?
+      bytes: this->credit.bytes_used;
+
+  if (this->credit.blocked && nf7core_exec_entity_writable(this)) {
+    this->credit.blocked = false;
+    if (nullptr != this->on_writable) {
+      this->on_writable(this);
+    }
+  }
+}
+
+// The implementation of entity use this to tell the client that no buffer can
+// be accepted anymore. A client blocked by refused sends is notified by
+// on_writable once, and sees the entity dead.
+static inline void nf7core_exec_entity_die(struct nf7core_exec_entity* this) {
+  assert(nullptr != this);
+
+  if (this->dead) {
+    return;
+  }
+  this->dead = true;
+  if (this->credit.blocked) {
+    this->credit.blocked = false;
+    if (nullptr != this->on_writable) {
+      this->on_writable(this);
+    }
+  }
+}
+
 // The client of entity use this to send buffer to the implementation.
-// Takes ownership of buf.
-static inline void nf7core_exec_entity_send(
+// Takes ownership of buf only when returns true.
+// Returns false when the entity is out of credit or refuses the buffer, and
+// then on_writable will be called when it can accept again. A dead entity
+// refuses all buffers and never calls on_writable.
+static inline bool nf7core_exec_entity_send(
     struct nf7core_exec_entity* this, struct nf7util_buffer* buf) {
   assert(nullptr != this);
   assert(nullptr != this->idea);
   assert(nullptr != this->idea->send);
   assert(nullptr != buf);
 
-  this->idea->send(this, buf);
+  if (this->dead) {
+    return false;
+  }
+  if (nf7core_exec_deadline_expired(buf)) {
+    nf7util_buffer_unref(buf);
+    return true;
+  }
+  if (!nf7core_exec_entity_writable(this)) {
+    this->credit.blocked = true;
+    if (nullptr != this->metrics) {
+      nf7core_exec_metrics_on_refuse(this, 1);
+    }
+    return false;
+  }
+
+  // consumes credit before sending because the implementation may return it
+  // while the send
+  const uint64_t size = buf->array.n;
+  ++this->credit.msgs_used;
+  this->credit.bytes_used += size;
+
+  // records before sending because the implementation may reply while the send
+  if (nullptr != this->metrics) {
+    nf7core_exec_metrics_on_send(this, size, buf->id);
+  }
+  if (!this->idea->send(this, buf)) {
+    --this->credit.msgs_used;
+    this->credit.bytes_used -= size;
+    this->credit.blocked = true;
+    if (nullptr != this->metrics) {
+      nf7core_exec_metrics_on_unsend(this, size);
+    }
+    return false;
+  }
+  return true;
+}
+
+// The client of entity use this to send buffers to the implementation at once.
+// Takes ownership of the first N buffers in bufs and returns N, but never takes
+// bufs itself. When N < n, the rest is refused as same as
+// nf7core_exec_entity_send().
+// Expired buffers are dropped without credit as same as
+// nf7core_exec_entity_send(), so the refused buffers may be moved within bufs.
+// Read them from bufs[N] to bufs[n-1] again after the call.
+static inline uint64_t nf7core_exec_entity_send_batch(
+    struct nf7core_exec_entity* this, struct nf7util_buffer** bufs, uint64_t n) {
+  assert(nullptr != this);
+  assert(nullptr != this->idea);
+  assert(nullptr != bufs || 0U == n);
+
+  if (this->dead) {
+    return 0;
+  }
+  if (nullptr == this->idea->send_batch) {
+    for (uint64_t i = 0; i < n; ++i) {
+      if (!nf7core_exec_entity_send(this, bufs[i])) {
+        return i;
+      }
+    }
+    return n;
+  }
+
+  // drops expired buffers, and consumes credit for the acceptable part while
+  // packing them to the front
+  uint64_t i = 0;
+  uint64_t m = 0;
+  for (; i < n; ++i) {
+    if (nf7core_exec_deadline_expired(bufs[i])) {
+      nf7util_buffer_unref(bufs[i]);
+      continue;
+    }
+    if (!nf7core_exec_entity_writable(this)) {
+      break;
+    }
+    ++this->credit.msgs_used;
+    this->credit.bytes_used += bufs[i]->array.n;
+    bufs[m++] = bufs[i];
+  }
+  if (nullptr != this->metrics) {
+    for (uint64_t j = 0; j < m; ++j) {
+      nf7core_exec_metrics_on_send(this, bufs[j]->array.n, bufs[j]->id);
+    }
+  }
+
+  const uint64_t accepted = this->idea->send_batch(this, bufs, m);
+  assert(accepted <= m);
+
+  // gives back credit of refused buffers
+  for (uint64_t j = accepted; j < m; ++j) {
+    --this->credit.msgs_used;
+    this->credit.bytes_used -= bufs[j]->array.n;
+  }
+  if (nullptr != this->metrics) {
+    for (uint64_t j = m; j > accepted; --j) {
+      nf7core_exec_metrics_on_unsend(this, bufs[j-1]->array.n);
+    }
+    nf7core_exec_metrics_on_refuse(this, n - i);
+  }
+
+  // moves refused buffers back to just before the rest not tried
+  const uint64_t refused = m - accepted;
+  const uint64_t taken   = i - refused;
+  if (0U < refused && taken != accepted) {
+    memmove(&bufs[taken], &bufs[accepted], refused*sizeof(bufs[0]));
+  }
+  if (taken < n) {
+    this->credit.blocked = true;
+  }
+  return taken;
+}
+
+// The client of entity use this to cancel a request sent with the id.
+// Returns false if the entity doesn't support cancellation or the request is
+// not found.
+static inline bool nf7core_exec_entity_cancel(
+    struct nf7core_exec_entity* this, uint64_t id) {
+  assert(nullptr != this);
+  assert(nullptr != this->idea);
+
+  if (0U == id || nullptr == this->idea->cancel) {
+    return false;
+  }
+  return this->idea->cancel(this, id);
 }
 
 static inline void nf7core_exec_entity_del(struct nf7core_exec_entity* this) {
@@ -69,6 +358,13 @@ static inline void nf7core_exec_entity_del(struct nf7core_exec_entity* this) {
     assert(nullptr != this->idea);
     assert(nullptr != this->idea->del);
 
+    nf7core_exec_metrics_detach(this);
+    if (nf7core_exec_offload_release(this)) {
+      return;  // will be deleted after the running work
+    }
+    if (nullptr != this->idea->reset && nf7core_exec_pool_put(this)) {
+      return;  // will be recycled
+    }
     this->idea->del(this);
   }
 }
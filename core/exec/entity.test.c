@@ -0,0 +1,287 @@
+// No copyright
+#include "core/exec/entity.h"
+
+#include "util/buffer.h"
+#include "util/malloc.h"
+
+#include "core/exec/test_idea.h"
+
+#include "test/common.h"
+
+
+struct counter_ {
+  struct nf7core_exec_entity super;
+
+  uint64_t sends;
+  uint64_t batches;
+};
+
+static const struct nf7core_exec_idea idea_single_;
+static const struct nf7core_exec_idea idea_batch_;
+
+static struct nf7core_exec_entity* new_single_(struct nf7core_exec* exec) {
+  return nf7core_exec_test_idea_alloc(exec, &idea_single_, sizeof(struct counter_));
+}
+static struct nf7core_exec_entity* new_batch_(struct nf7core_exec* exec) {
+  return nf7core_exec_test_idea_alloc(exec, &idea_batch_, sizeof(struct counter_));
+}
+static bool send_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  struct counter_* this = (void*) entity;
+  ++this->sends;
+  nf7core_exec_entity_recv(entity, buf);
+  return true;
+}
+static uint64_t send_batch_(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer** bufs, uint64_t n) {
+  struct counter_* this = (void*) entity;
+  ++this->batches;
+  nf7core_exec_entity_recv_batch(entity, bufs, n);
+  return n;
+}
+
+static const struct nf7core_exec_idea idea_single_ = {
+  .name = (const uint8_t*) "nf7core_exec_entity_test_single",
+  .new  = new_single_,
+  .del  = nf7core_exec_test_idea_del,
+  .send = send_,
+};
+static const struct nf7core_exec_idea idea_batch_ = {
+  .name       = (const uint8_t*) "nf7core_exec_entity_test_batch",
+  .new        = new_batch_,
+  .del        = nf7core_exec_test_idea_del,
+  .send       = send_,
+  .send_batch = send_batch_,
+};
+
+static void on_recv_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  uint64_t* cnt = entity->data;
+  ++*cnt;
+  nf7util_buffer_unref(buf);
+}
+
+static bool test_batch_(
+    struct nf7test* test_, const struct nf7core_exec_idea* idea,
+    uint64_t expected_sends, uint64_t expected_batches) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  struct counter_* sut = (void*) idea->new(mod);
+  if (!nf7test_expect(nullptr != sut)) {
+    return false;
+  }
+
+  uint64_t recvs = 0;
+  sut->super.data    = &recvs;
+  sut->super.on_recv = on_recv_;
+
+  struct nf7util_buffer* bufs[3] = {0};
+  bool ret = true;
+  for (uint32_t i = 0; ret && i < 3; ++i) {
+    bufs[i] = nf7util_buffer_new(test_->malloc, 0);
+    ret = nf7test_expect(nullptr != bufs[i]);
+  }
+  if (ret) {
+    ret =
+      nf7test_expect(3 == nf7core_exec_entity_send_batch(&sut->super, bufs, 3)) &&
+      nf7test_expect(expected_sends == sut->sends) &&
+      nf7test_expect(expected_batches == sut->batches) &&
+      nf7test_expect(3 == recvs);
+  } else {
+    for (uint32_t i = 0; i < 3; ++i) {
+      if (nullptr != bufs[i]) {
+        nf7util_buffer_unref(bufs[i]);
+      }
+    }
+  }
+  nf7core_exec_entity_del(&sut->super);
+  return ret;
+}
+
+NF7TEST(nf7core_exec_entity_test_send_batch_fallback) {
+  return test_batch_(test_, &idea_single_, 3, 0);
+}
+NF7TEST(nf7core_exec_entity_test_send_batch) {
+  return test_batch_(test_, &idea_batch_, 0, 1);
+}
+
+
+NF7TEST(nf7core_exec_entity_test_send_batch_expired) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  struct counter_* sut = (void*) idea_batch_.new(mod);
+  if (!nf7test_expect(nullptr != sut)) {
+    return false;
+  }
+
+  uint64_t recvs = 0;
+  sut->super.data    = &recvs;
+  sut->super.on_recv = on_recv_;
+  nf7core_exec_entity_credit_init(&sut->super, 2, 0);
+
+  // expired buffers are dropped without consuming credit
+  struct nf7util_buffer* bufs[5] = {0};
+  bool ret = true;
+  for (uint32_t i = 0; ret && i < 5; ++i) {
+    bufs[i] = nf7util_buffer_new(test_->malloc, 0);
+    ret = nf7test_expect(nullptr != bufs[i]);
+  }
+  if (ret) {
+    bufs[0]->deadline = 1;
+    bufs[2]->deadline = 1;
+    struct nf7util_buffer* last = bufs[4];
+    ret =
+        nf7test_expect(4 == nf7core_exec_entity_send_batch(&sut->super, bufs, 5)) &&
+        nf7test_expect(1 == sut->batches) &&
+        nf7test_expect(2 == recvs) &&
+        nf7test_expect(last == bufs[4]);
+    nf7util_buffer_unref(bufs[4]);
+  } else {
+    for (uint32_t i = 0; i < 5; ++i) {
+      if (nullptr != bufs[i]) {
+        nf7util_buffer_unref(bufs[i]);
+      }
+    }
+  }
+  nf7core_exec_entity_del(&sut->super);
+  return ret;
+}
+
+
+static void on_reply_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  struct nf7util_buffer** ret = entity->data;
+  *ret = buf;
+}
+
+NF7TEST(nf7core_exec_entity_test_reply_shared) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  struct nf7core_exec_entity* sut = idea_single_.new(mod);
+  if (!nf7test_expect(nullptr != sut)) {
+    return false;
+  }
+
+  struct nf7util_buffer* recv = nullptr;
+  sut->data    = &recv;
+  sut->on_recv = on_reply_;
+
+  // a shared buffer is cloned, and the other owner keeps its id
+  bool ret = false;
+  struct nf7util_buffer* buf = nf7util_buffer_new_from_cstr(test_->malloc, "hi");
+  if (nf7test_expect(nullptr != buf)) {
+    buf->id = 1;
+    nf7util_buffer_ref(buf);
+    nf7core_exec_entity_reply(sut, 2, buf);
+    ret =
+        nf7test_expect(nullptr != recv && buf != recv) &&
+        nf7test_expect(1U == buf->id && 2U == recv->id) &&
+        nf7test_expect(1U == buf->refcnt);
+    nf7util_buffer_unref(buf);
+  }
+  if (nullptr != recv) {
+    nf7util_buffer_unref(recv);
+  }
+  nf7core_exec_entity_del(sut);
+  return ret;
+}
+
+
+static void on_writable_(struct nf7core_exec_entity* entity) {
+  uint64_t* cnt = entity->data;
+  *cnt += 100;
+}
+
+NF7TEST(nf7core_exec_entity_test_credit) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  struct nf7core_exec_entity* sut = idea_batch_.new(mod);
+  if (!nf7test_expect(nullptr != sut)) {
+    return false;
+  }
+
+  // the entity echoes buffers without returning credit
+  uint64_t cnt = 0;
+  sut->data        = &cnt;
+  sut->on_recv     = on_recv_;
+  sut->on_writable = on_writable_;
+  nf7core_exec_entity_credit_init(sut, 2, 0);
+
+  struct nf7util_buffer* bufs[3] = {0};
+  bool ret = true;
+  for (uint32_t i = 0; ret && i < 3; ++i) {
+    bufs[i] = nf7util_buffer_new(test_->malloc, 0);
+    ret = nf7test_expect(nullptr != bufs[i]);
+  }
+
+  ret = ret &&
+    nf7test_expect(nf7core_exec_entity_send(sut, bufs[0])) &&
+    nf7test_expect(1 == nf7core_exec_entity_send_batch(sut, &bufs[1], 2)) &&
+    nf7test_expect(!nf7core_exec_entity_writable(sut)) &&
+    nf7test_expect(2 == cnt) &&
+    (nf7core_exec_entity_credit_return(sut, 1, 0), true) &&
+    nf7test_expect(102 == cnt) &&
+    nf7test_expect(nf7core_exec_entity_send(sut, bufs[2])) &&
+    nf7test_expect(103 == cnt);
+
+  nf7core_exec_entity_del(sut);
+  return ret;
+}
+
+NF7TEST(nf7core_exec_entity_test_die) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  struct nf7core_exec_entity* sut = idea_batch_.new(mod);
+  if (!nf7test_expect(nullptr != sut)) {
+    return false;
+  }
+
+  uint64_t cnt = 0;
+  sut->data        = &cnt;
+  sut->on_recv     = on_recv_;
+  sut->on_writable = on_writable_;
+  nf7core_exec_entity_credit_init(sut, 1, 0);
+
+  struct nf7util_buffer* bufs[2] = {0};
+  bool ret = true;
+  for (uint32_t i = 0; ret && i < 2; ++i) {
+    bufs[i] = nf7util_buffer_new(test_->malloc, 0);
+    ret = nf7test_expect(nullptr != bufs[i]);
+  }
+
+  // a blocked client is woken up once, and all sends are refused after that
+  ret = ret &&
+    nf7test_expect(nf7core_exec_entity_send(sut, bufs[0])) &&
+    nf7test_expect(!nf7core_exec_entity_send(sut, bufs[1])) &&
+    (nf7core_exec_entity_die(sut), true) &&
+    nf7test_expect(sut->dead) &&
+    nf7test_expect(101 == cnt) &&
+    (nf7core_exec_entity_credit_return(sut, 1, 0), true) &&
+    nf7test_expect(!nf7core_exec_entity_send(sut, bufs[1])) &&
+    nf7test_expect(0 == nf7core_exec_entity_send_batch(sut, &bufs[1], 1)) &&
+    (nf7core_exec_entity_die(sut), true) &&
+    nf7test_expect(101 == cnt);
+
+  if (nullptr != bufs[1]) {
+    nf7util_buffer_unref(bufs[1]);
+  }
+  nf7core_exec_entity_del(sut);
+  return ret;
+}
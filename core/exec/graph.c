@@ -0,0 +1,289 @@
+// No copyright
+#include "core/exec/graph.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "util/log.h"
+
+
+// a number of buffers copied on the stack at once to send a batch
+#define BATCH_CHUNK_ 32U
+
+static struct nf7core_exec_graph_node* node_new_(
+    struct nf7core_exec_graph*, struct nf7core_exec_entity*);
+static void node_del_(struct nf7core_exec_graph_node*);
+static bool node_disconnect_(
+    struct nf7core_exec_graph_node*, struct nf7core_exec_entity*);
+static void node_leave_(struct nf7core_exec_graph_node*);
+
+static void on_recv_(struct nf7core_exec_entity*, struct nf7util_buffer*);
+static void on_recv_batch_(
+    struct nf7core_exec_entity*, struct nf7util_buffer**, uint64_t);
+
+
+void nf7core_exec_graph_init(
+    struct nf7core_exec_graph* this, struct nf7core_exec* mod) {
+  assert(nullptr != this);
+  assert(nullptr != mod);
+
+  *this = (struct nf7core_exec_graph) {
+    .mod    = mod,
+    .malloc = mod->malloc,
+  };
+  nf7core_exec_graph_nodes_init(&this->nodes, this->malloc);
+}
+
+void nf7core_exec_graph_deinit(struct nf7core_exec_graph* this) {
+  assert(nullptr != this);
+
+  for (uint64_t i = 0; i < this->nodes.n; ++i) {
+    node_del_(this->nodes.ptr[i]);
+  }
+  nf7core_exec_graph_nodes_deinit(&this->nodes);
+}
+
+bool nf7core_exec_graph_connect(
+    struct nf7core_exec_graph* this,
+    struct nf7core_exec_entity* src,
+    struct nf7core_exec_entity* dst) {
+  assert(nullptr != this);
+  assert(nullptr != src);
+  assert(nullptr != dst);
+
+  struct nf7core_exec_graph_node* node = nf7core_exec_graph_find(this, src);
+  if (nullptr == node) {
+    node = node_new_(this, src);
+    if (nullptr == node) {
+      return false;
+    }
+  }
+
+  uint64_t idx;
+  if (nf7core_exec_graph_dsts_find(&node->dsts, &idx, dst)) {
+    return true;
+  }
+  if (!nf7core_exec_graph_dsts_insert(&node->dsts, UINT64_MAX, dst)) {
+    nf7util_log_error("failed to insert new edge");
+    return false;
+  }
+  return true;
+}
+
+bool nf7core_exec_graph_disconnect(
+    struct nf7core_exec_graph* this,
+    struct nf7core_exec_entity* src,
+    struct nf7core_exec_entity* dst) {
+  assert(nullptr != this);
+  assert(nullptr != src);
+  assert(nullptr != dst);
+
+  struct nf7core_exec_graph_node* node = nf7core_exec_graph_find(this, src);
+  if (nullptr == node) {
+    return false;
+  }
+  return node_disconnect_(node, dst);
+}
+
+void nf7core_exec_graph_remove(
+    struct nf7core_exec_graph* this, struct nf7core_exec_entity* entity) {
+  assert(nullptr != this);
+  assert(nullptr != entity);
+
+  for (uint64_t i = 0; i < this->nodes.n;) {
+    struct nf7core_exec_graph_node* node = this->nodes.ptr[i];
+    if (node->entity == entity) {
+      nf7core_exec_graph_nodes_remove(&this->nodes, i);
+      node_del_(node);
+      continue;
+    }
+    node_disconnect_(node, entity);
+    ++i;
+  }
+}
+
+struct nf7core_exec_graph_node* nf7core_exec_graph_find(
+    const struct nf7core_exec_graph* this,
+    const struct nf7core_exec_entity* src) {
+  assert(nullptr != this);
+  assert(nullptr != src);
+
+  for (uint64_t i = 0; i < this->nodes.n; ++i) {
+    if (this->nodes.ptr[i]->entity == src) {
+      return this->nodes.ptr[i];
+    }
+  }
+  return nullptr;
+}
+
+
+static struct nf7core_exec_graph_node* node_new_(
+    struct nf7core_exec_graph* graph, struct nf7core_exec_entity* entity) {
+  assert(nullptr != graph);
+  assert(nullptr != entity);
+
+  struct nf7core_exec_graph_node* this =
+      nf7util_malloc_alloc(graph->malloc, sizeof(*this));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate new node");
+    return nullptr;
+  }
+  *this = (struct nf7core_exec_graph_node) {
+    .graph  = graph,
+    .entity = entity,
+  };
+  nf7core_exec_graph_dsts_init(&this->dsts, graph->malloc);
+
+  if (!nf7core_exec_graph_nodes_insert(&graph->nodes, UINT64_MAX, this)) {
+    nf7util_log_error("failed to insert new node");
+    node_del_(this);
+    return nullptr;
+  }
+
+  entity->data          = this;
+  entity->on_recv       = on_recv_;
+  entity->on_recv_batch = on_recv_batch_;
+  return this;
+}
+
+static void node_del_(struct nf7core_exec_graph_node* this) {
+  assert(nullptr != this);
+
+  struct nf7core_exec_entity* entity = this->entity;
+  if (entity->data == this) {
+    entity->data          = nullptr;
+    entity->on_recv       = nullptr;
+    entity->on_recv_batch = nullptr;
+  }
+  if (0U < this->depth) {
+    this->deleted = true;  // freed by node_leave_()
+    return;
+  }
+  nf7core_exec_graph_dsts_deinit(&this->dsts);
+  nf7util_malloc_free(this->graph->malloc, this);
+}
+
+static bool node_disconnect_(
+    struct nf7core_exec_graph_node* this, struct nf7core_exec_entity* dst) {
+  assert(nullptr != this);
+  assert(nullptr != dst);
+
+  uint64_t idx;
+  if (!nf7core_exec_graph_dsts_find(&this->dsts, &idx, dst)) {
+    return false;
+  }
+  if (0U < this->depth) {
+    this->dsts.ptr[idx] = nullptr;  // removed by node_leave_()
+  } else {
+    nf7core_exec_graph_dsts_remove(&this->dsts, idx);
+  }
+  return true;
+}
+
+static void node_leave_(struct nf7core_exec_graph_node* this) {
+  assert(nullptr != this);
+  assert(0U < this->depth);
+
+  if (0U < --this->depth) {
+    return;
+  }
+  if (this->deleted) {
+    node_del_(this);
+    return;
+  }
+  while (nf7core_exec_graph_dsts_find_and_remove(&this->dsts, nullptr)) { }
+}
+
+
+static void on_recv_(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  assert(nullptr != entity);
+  assert(nullptr != buf);
+
+  struct nf7core_exec_graph_node* this  = entity->data;
+  struct nf7core_exec_graph*      graph = this->graph;
+
+  const uint64_t n = this->dsts.n;
+  if (0U == n) {
+    if (nullptr != graph->on_recv) {
+      graph->on_recv(graph, entity, buf);
+    } else {
+      nf7util_buffer_unref(buf);
+    }
+    return;
+  }
+
+  // shares the buffer with destinations at this time
+  //   Sends can change the destinations, so they are read by index every time.
+  for (uint64_t i = 0; i+1 < n; ++i) {
+    nf7util_buffer_ref(buf);
+  }
+  ++this->depth;
+  for (uint64_t i = 0; i < n; ++i) {
+    struct nf7core_exec_entity* dst = this->dsts.ptr[i];
+    if (nullptr == dst) {
+      nf7util_buffer_unref(buf);
+    } else if (!nf7core_exec_entity_send(dst, buf)) {
+      nf7util_buffer_unref(buf);
+      ++this->drops;
+    }
+  }
+  node_leave_(this);
+}
+
+static void on_recv_batch_(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer** bufs, uint64_t n) {
+  assert(nullptr != entity);
+  assert(nullptr != bufs || 0U == n);
+
+  struct nf7core_exec_graph_node* this  = entity->data;
+  struct nf7core_exec_graph*      graph = this->graph;
+
+  const uint64_t dsts = this->dsts.n;
+  if (0U == dsts) {
+    for (uint64_t i = 0; i < n; ++i) {
+      if (nullptr != graph->on_recv) {
+        graph->on_recv(graph, entity, bufs[i]);
+      } else {
+        nf7util_buffer_unref(bufs[i]);
+      }
+    }
+    return;
+  }
+
+  // shares the buffers with destinations at this time, as same as on_recv_()
+  for (uint64_t i = 0; i+1 < dsts; ++i) {
+    for (uint64_t j = 0; j < n; ++j) {
+      nf7util_buffer_ref(bufs[j]);
+    }
+  }
+  ++this->depth;
+  for (uint64_t i = 0; i < dsts; ++i) {
+    struct nf7core_exec_entity* dst = this->dsts.ptr[i];
+
+    // sends a copy of bufs because send_batch may reorder refused buffers
+    uint64_t j = 0;
+    while (nullptr != dst && j < n) {
+      struct nf7util_buffer* chunk[BATCH_CHUNK_];
+      const uint64_t m = n-j < BATCH_CHUNK_? n-j: BATCH_CHUNK_;
+      memcpy(chunk, &bufs[j], m*sizeof(chunk[0]));
+
+      const uint64_t accepted = nf7core_exec_entity_send_batch(dst, chunk, m);
+      for (uint64_t k = accepted; k < m; ++k) {
+        nf7util_buffer_unref(chunk[k]);
+        ++this->drops;
+      }
+      j += m;
+      if (accepted < m) {
+        break;
+      }
+    }
+    for (; j < n; ++j) {
+      nf7util_buffer_unref(bufs[j]);
+      if (nullptr != dst) {
+        ++this->drops;
+      }
+    }
+  }
+  node_leave_(this);
+}
@@ -0,0 +1,103 @@
+// No copyright
+//
+// nf7core_exec_graph wires entities directly: outputs of an entity are sent to
+// inputs of other entities without going through client code.
+//
+// HOW TO USE
+//   Connect entities by nf7core_exec_graph_connect(). The graph becomes the
+//   client of every source entity, so don't touch their client side
+//   (`data`, `on_recv`, ...) while they are in the graph.
+//
+//   - Fan-out: outputs of a source are shared by all destinations by
+//     reference, so destinations must not modify received buffers unless they
+//     are unique owners.
+//   - Fan-in: any number of sources can be connected to the same destination.
+//   - Outputs of a source without destinations are passed to `on_recv` of the
+//     graph, or dropped if it's nullptr.
+//   - Buffers refused by destinations are dropped and counted on the source
+//     node.
+//
+//   The topology can be inspected through `nodes` and `dsts` of each node.
+//
+//   The graph never owns entities. Remove an entity from the graph by
+//   nf7core_exec_graph_remove() before deleting it.
+#pragma once
+
+#include <stdint.h>
+
+#include "util/array.h"
+#include "util/buffer.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/mod.h"
+
+
+struct nf7core_exec_graph;
+struct nf7core_exec_graph_node;
+
+NF7UTIL_ARRAY_INLINE(nf7core_exec_graph_nodes, struct nf7core_exec_graph_node*);
+NF7UTIL_ARRAY_INLINE(nf7core_exec_graph_dsts, struct nf7core_exec_entity*);
+
+
+struct nf7core_exec_graph {
+  struct nf7core_exec*   mod;
+  struct nf7util_malloc* malloc;
+
+  struct nf7core_exec_graph_nodes nodes;
+
+  void* data;
+  void (*on_recv)(
+      struct nf7core_exec_graph*,
+      struct nf7core_exec_entity* src,
+      struct nf7util_buffer*);
+};
+
+struct nf7core_exec_graph_node {
+  struct nf7core_exec_graph*  graph;
+  struct nf7core_exec_entity* entity;
+
+  struct nf7core_exec_graph_dsts dsts;
+
+  // a number of buffers refused by destinations
+  uint64_t drops;
+
+  // internal
+  //   While outputs are delivered, removed destinations are left as nullptr
+  //   and a deleted node is kept alive, until the outermost delivery ends.
+  uint32_t depth;
+  bool     deleted;
+};
+
+
+void nf7core_exec_graph_init(struct nf7core_exec_graph*, struct nf7core_exec*);
+
+// Releases all nodes and detaches from their entities, but never deletes the
+// entities.
+void nf7core_exec_graph_deinit(struct nf7core_exec_graph*);
+
+// Connects an output of the src to an input of the dst.
+// Returns false if failed to allocate. Connecting them again does nothing.
+//   Changes of connections while an output is being delivered, e.g. by a
+//   destination, take effect from the next output of the src. Destinations
+//   are visited in order of their connection, but a destination which makes
+//   the src output synchronously interleaves outputs, so don't rely on order
+//   between destinations.
+bool nf7core_exec_graph_connect(
+    struct nf7core_exec_graph*,
+    struct nf7core_exec_entity* src,
+    struct nf7core_exec_entity* dst);
+
+// Returns false if they are not connected.
+bool nf7core_exec_graph_disconnect(
+    struct nf7core_exec_graph*,
+    struct nf7core_exec_entity* src,
+    struct nf7core_exec_entity* dst);
+
+// Removes all connections from/to the entity.
+void nf7core_exec_graph_remove(
+    struct nf7core_exec_graph*, struct nf7core_exec_entity*);
+
+// Returns a node of the src, or nullptr if the entity is not a source.
+struct nf7core_exec_graph_node* nf7core_exec_graph_find(
+    const struct nf7core_exec_graph*, const struct nf7core_exec_entity* src);
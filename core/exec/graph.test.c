@@ -0,0 +1,212 @@
+// No copyright
+#include "core/exec/graph.h"
+
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/idea.h"
+#include "core/exec/test_idea.h"
+
+#include "test/common.h"
+
+
+NF7CORE_EXEC_TEST_IDEA(
+    idea_, "nf7core_exec_graph_test", nf7core_exec_test_idea_echo);
+
+
+struct sink_ {
+  uint32_t recvs;
+  uint32_t shared;
+};
+static void sink_recv_(struct sink_* this, struct nf7util_buffer* buf) {
+  ++this->recvs;
+  if (1U < buf->refcnt) {
+    ++this->shared;
+  }
+  nf7util_buffer_unref(buf);
+}
+static void on_recv_(
+    struct nf7core_exec_graph* graph,
+    struct nf7core_exec_entity*,
+    struct nf7util_buffer* buf) {
+  sink_recv_(graph->data, buf);
+}
+static void on_recv_entity_(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  sink_recv_(entity->data, buf);
+}
+
+NF7TEST(nf7core_exec_graph_test_fan_out_and_in) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+  if (!nf7test_expect(nf7core_exec_idea_register(mod, &idea_))) {
+    return false;
+  }
+
+  const uint8_t* name = idea_.name;
+  const size_t   len  = strlen((const char*) name);
+
+  struct nf7core_exec_entity* e[4] = {0};
+  bool ret = true;
+  for (uint32_t i = 0; i < 4; ++i) {
+    e[i] = nf7core_exec_entity_new(mod, name, len);
+    ret = ret && nf7test_expect(nullptr != e[i]);
+  }
+
+  struct sink_ sink = {0};
+  struct nf7core_exec_graph graph;
+  nf7core_exec_graph_init(&graph, mod);
+  graph.data    = &sink;
+  graph.on_recv = on_recv_;
+
+  // e0 -> e1, e0 -> e2, e3 -> e1
+  ret = ret &&
+    nf7test_expect(nf7core_exec_graph_connect(&graph, e[0], e[1])) &&
+    nf7test_expect(nf7core_exec_graph_connect(&graph, e[0], e[2])) &&
+    nf7test_expect(nf7core_exec_graph_connect(&graph, e[0], e[2])) &&
+    nf7test_expect(nf7core_exec_graph_connect(&graph, e[3], e[1])) &&
+    nf7test_expect(nf7core_exec_graph_connect(&graph, e[1], e[2])) &&
+    nf7test_expect(nf7core_exec_graph_disconnect(&graph, e[1], e[2])) &&
+    nf7test_expect(!nf7core_exec_graph_disconnect(&graph, e[2], e[1])) &&
+    nf7test_expect(3 == graph.nodes.n) &&
+    nf7test_expect(2 == nf7core_exec_graph_find(&graph, e[0])->dsts.n) &&
+    nf7test_expect(nullptr == nf7core_exec_graph_find(&graph, e[2]));
+
+  if (ret) {
+    // e2 is not a source so the client can still receive its outputs directly
+    e[2]->data    = &sink;
+    e[2]->on_recv = on_recv_entity_;
+
+    // e0 -> {e1, e2} -> sink
+    struct nf7util_buffer* buf = nf7util_buffer_new(mod->malloc, 4);
+    ret = nf7test_expect(nullptr != buf) &&
+      nf7test_expect(nf7core_exec_entity_send(e[0], buf)) &&
+      nf7test_expect(2 == sink.recvs) &&
+      nf7test_expect(1 == sink.shared);
+  }
+  if (ret) {
+    // e3 -> e1 -> sink
+    struct nf7util_buffer* buf = nf7util_buffer_new(mod->malloc, 4);
+    ret = nf7test_expect(nullptr != buf) &&
+      nf7test_expect(nf7core_exec_entity_send(e[3], buf)) &&
+      nf7test_expect(3 == sink.recvs);
+  }
+  if (ret) {
+
+    // e1 is removed from both of destinations of e0 and e3
+    nf7core_exec_graph_remove(&graph, e[1]);
+    ret = ret &&
+      nf7test_expect(2 == graph.nodes.n) &&
+      nf7test_expect(1 == nf7core_exec_graph_find(&graph, e[0])->dsts.n) &&
+      nf7test_expect(0 == nf7core_exec_graph_find(&graph, e[3])->dsts.n) &&
+      nf7test_expect(nullptr == e[1]->on_recv);
+  }
+
+  nf7core_exec_graph_deinit(&graph);
+  ret = ret && nf7test_expect(nullptr == e[0]->on_recv);
+  for (uint32_t i = 0; i < 4; ++i) {
+    if (nullptr != e[i]) {
+      nf7core_exec_entity_del(e[i]);
+    }
+  }
+  nf7core_exec_idea_unregister(mod, &idea_);
+  return ret;
+}
+
+// changes connections of the graph when it receives a buffer
+static struct mutation_ {
+  struct nf7core_exec_graph*  graph;
+  struct nf7core_exec_entity* src;
+  struct nf7core_exec_entity* disconnect;
+  struct nf7core_exec_entity* connect;
+  bool                        remove;
+} mutation_;
+
+static bool send_mutator_(struct nf7core_exec_entity*, struct nf7util_buffer* buf) {
+  nf7util_buffer_unref(buf);
+  if (nullptr != mutation_.disconnect) {
+    nf7core_exec_graph_disconnect(mutation_.graph, mutation_.src, mutation_.disconnect);
+  }
+  if (nullptr != mutation_.connect) {
+    nf7core_exec_graph_connect(mutation_.graph, mutation_.src, mutation_.connect);
+  }
+  if (mutation_.remove) {
+    nf7core_exec_graph_remove(mutation_.graph, mutation_.src);
+  }
+  return true;
+}
+
+NF7CORE_EXEC_TEST_IDEA(
+    mutator_, "nf7core_exec_graph_test_mutator", send_mutator_);
+
+NF7TEST(nf7core_exec_graph_test_mutate_while_delivering) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  // e0 -> {m, e1, e2}
+  struct nf7core_exec_entity* m = mutator_.new(mod);
+  struct nf7core_exec_entity* e[4] = {0};
+  bool ret = nf7test_expect(nullptr != m);
+  for (uint32_t i = 0; i < 4; ++i) {
+    e[i] = idea_.new(mod);
+    ret = ret && nf7test_expect(nullptr != e[i]);
+  }
+
+  struct sink_ sinks[4] = {0};
+  struct nf7core_exec_graph graph;
+  nf7core_exec_graph_init(&graph, mod);
+  for (uint32_t i = 1; ret && i < 4; ++i) {
+    e[i]->data    = &sinks[i];
+    e[i]->on_recv = on_recv_entity_;
+  }
+  ret = ret &&
+    nf7test_expect(nf7core_exec_graph_connect(&graph, e[0], m)) &&
+    nf7test_expect(nf7core_exec_graph_connect(&graph, e[0], e[1])) &&
+    nf7test_expect(nf7core_exec_graph_connect(&graph, e[0], e[2]));
+
+  // changes take effect from the next output
+  mutation_ = (struct mutation_) {
+    .graph      = &graph,
+    .src        = e[0],
+    .disconnect = e[1],
+    .connect    = e[3],
+  };
+  if (ret) {
+    struct nf7util_buffer* buf = nf7util_buffer_new(mod->malloc, 4);
+    ret = nf7test_expect(nullptr != buf) &&
+      nf7test_expect(nf7core_exec_entity_send(e[0], buf)) &&
+      nf7test_expect(0 == sinks[1].recvs) &&
+      nf7test_expect(1 == sinks[2].recvs) &&
+      nf7test_expect(0 == sinks[3].recvs) &&
+      nf7test_expect(3 == nf7core_exec_graph_find(&graph, e[0])->dsts.n);
+  }
+
+  // the node removed while delivering still reaches the rest
+  mutation_ = (struct mutation_) {
+    .graph  = &graph,
+    .src    = e[0],
+    .remove = true,
+  };
+  if (ret) {
+    struct nf7util_buffer* buf = nf7util_buffer_new(mod->malloc, 4);
+    ret = nf7test_expect(nullptr != buf) &&
+      nf7test_expect(nf7core_exec_entity_send(e[0], buf)) &&
+      nf7test_expect(2 == sinks[2].recvs) &&
+      nf7test_expect(1 == sinks[3].recvs) &&
+      nf7test_expect(nullptr == nf7core_exec_graph_find(&graph, e[0])) &&
+      nf7test_expect(nullptr == e[0]->on_recv);
+  }
+
+  nf7core_exec_graph_deinit(&graph);
+  nf7core_exec_entity_del(m);
+  for (uint32_t i = 0; i < 4; ++i) {
+    nf7core_exec_entity_del(e[i]);
+  }
+  return ret;
+}
@@ -6,9 +6,12 @@
 #include <string.h>
 
 #include "util/buffer.h"
+#include "util/log.h"
 #include "util/str.h"
 
+#include "core/exec/metrics.h"
 #include "core/exec/mod.h"
+#include "core/exec/pool.h"
 
 
 struct nf7core_exec_idea {
@@ -16,21 +19,109 @@ struct nf7core_exec_idea {
   const uint8_t* details;
   const struct nf7_mod_meta* mod;
 
+  // returns an entity whose `idea` is this idea and `mod` is the module
   struct nf7core_exec_entity* (*new)(struct nf7core_exec*);
   void (*del)(struct nf7core_exec_entity*);
 
-  void (*send)(
+  // returns false without taking ownership of the buffer when the entity
+  // cannot accept it now, the entity must notify the client by
+  // nf7core_exec_entity_credit_return() when it becomes able to accept
+  bool (*send)(
       struct nf7core_exec_entity*,
       struct nf7util_buffer*);
+
+  // optional, sends are fallen back to a loop of `send` if nullptr
+  // takes ownership of the first N buffers in the array and returns N,
+  // but never takes the array itself
+  uint64_t (*send_batch)(
+      struct nf7core_exec_entity*,
+      struct nf7util_buffer**,
+      uint64_t);
+
+  // optional, called on a worker thread when `send` is
+  // nf7core_exec_offload_send, see core/exec/offload.h
+  // takes ownership of the buffer and returns a buffer to be received by the
+  // client, or nullptr to reply nothing
+  struct nf7util_buffer* (*work)(
+      struct nf7core_exec_entity*,
+      struct nf7util_buffer*);
+
+  // optional, cancels a request whose correlation id is the id, see
+  // core/exec/deadline.h
+  // returns false if no such request is found
+  bool (*cancel)(struct nf7core_exec_entity*, uint64_t id);
+
+  // optional, serializes state of the entity, see core/exec/snapshot.h
+  // returns a buffer owned by the caller, or nullptr on failure
+  struct nf7util_buffer* (*snapshot)(struct nf7core_exec_entity*);
+
+  // optional, restores state serialized by `snapshot` to an entity right after
+  // `new`, see core/exec/snapshot.h
+  // the bytes are valid only while the call
+  bool (*restore)(struct nf7core_exec_entity*, const uint8_t*, uint64_t);
+
+  // optional, makes deleted entities recyclable, see core/exec/pool.h
+  // resets the entity to the state right after `new`, or returns false to let
+  // it be deleted
+  bool (*reset)(struct nf7core_exec_entity*);
+
+  // a maximum number of pooled entities, 0 means the default
+  uint32_t pool_max;
 };
 
 
+// Registers the idea. Fails if another idea with the same name is registered.
 static inline bool nf7core_exec_idea_register(
     struct nf7core_exec* mod, const struct nf7core_exec_idea* idea) {
   assert(nullptr != mod);
   assert(nullptr != idea);
+  assert(nullptr != idea->name);
+
+  const uint32_t atom = nf7util_str_atoms_intern_cstr(mod->atoms, idea->name);
+  if (0U == atom) {
+    return false;
+  }
+  if (nf7core_exec_idea_index_find(&mod->idea_index, atom, nullptr)) {
+    nf7util_log_error("idea name is duplicated: %s", idea->name);
+    return false;
+  }
+  if (!nf7core_exec_ideas_insert(&mod->ideas, UINT64_MAX, idea)) {
+    return false;
+  }
+  if (!nf7core_exec_idea_index_insert(&mod->idea_index, atom, idea)) {
+    nf7core_exec_ideas_remove(&mod->ideas, UINT64_MAX);
+    return false;
+  }
+  return true;
+}
+
+// Unregisters the idea. Returns false if the idea is not registered.
+// PRECONDS:
+//   - All entities of the idea have been deleted.
+static inline bool nf7core_exec_idea_unregister(
+    struct nf7core_exec* mod, const struct nf7core_exec_idea* idea) {
+  assert(nullptr != mod);
+  assert(nullptr != idea);
+  assert(nullptr != idea->name);
 
-  return nf7core_exec_ideas_insert(&mod->ideas, UINT64_MAX, idea);
+  if (!nf7core_exec_ideas_find_and_remove(&mod->ideas, idea)) {
+    return false;
+  }
+  nf7core_exec_pool_clear(mod, idea);
+  nf7core_exec_metrics_clear(mod, idea);
+  const uint32_t atom = nf7util_str_atoms_find(
+      mod->atoms, idea->name, strlen((const char*) idea->name));
+  nf7core_exec_idea_index_remove(&mod->idea_index, atom, nullptr);
+  return true;
+}
+
+static inline const struct nf7core_exec_idea* nf7core_exec_idea_find_by_atom(
+    const struct nf7core_exec* mod, uint32_t atom) {
+  assert(nullptr != mod);
+
+  const struct nf7core_exec_idea* idea = nullptr;
+  nf7core_exec_idea_index_find(&mod->idea_index, atom, &idea);
+  return idea;
 }
 
 static inline const struct nf7core_exec_idea* nf7core_exec_idea_find(
@@ -38,11 +129,23 @@ static inline const struct nf7core_exec_idea* nf7core_exec_idea_find(
   assert(nullptr != mod);
   assert(nullptr != name || 0U == namelen);
 
-  for (uint32_t i = 0; i < mod->ideas.n; ++i) {
-    const struct nf7core_exec_idea* idea = mod->ideas.ptr[i];
-    if (nf7util_str_equal_cstr(name, namelen, idea->name)) {
-      return idea;
-    }
+  const uint32_t atom = nf7util_str_atoms_find(mod->atoms, name, namelen);
+  if (0U == atom) {
+    return nullptr;
   }
-  return nullptr;
+  return nf7core_exec_idea_find_by_atom(mod, atom);
+}
+
+// Iterates all registered ideas in order of their registration like this:
+//   for (uint64_t i = 0; i < nf7core_exec_idea_count(mod); ++i) {
+//     const struct nf7core_exec_idea* idea = nf7core_exec_idea_at(mod, i);
+//   }
+static inline uint64_t nf7core_exec_idea_count(const struct nf7core_exec* mod) {
+  assert(nullptr != mod);
+  return mod->ideas.n;
+}
+static inline const struct nf7core_exec_idea* nf7core_exec_idea_at(
+    const struct nf7core_exec* mod, uint64_t i) {
+  assert(nullptr != mod);
+  return i < mod->ideas.n? mod->ideas.ptr[i]: nullptr;
 }
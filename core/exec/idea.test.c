@@ -0,0 +1,117 @@
+// No copyright
+#include "core/exec/idea.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <uv.h>
+
+#include "util/log.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/test_idea.h"
+
+#include "test/common.h"
+
+
+#define BENCH_IDEAS_    1000
+#define BENCH_ENTITIES_ 100000
+
+
+NF7CORE_EXEC_TEST_IDEA(idea_, "nf7core_exec_idea_test", nf7core_exec_test_idea_sink);
+
+// copies of idea_ share one `new`, which cannot tell which copy is called, so
+// the bench tells it the idea being created
+static const struct nf7core_exec_idea* bench_idea_;
+
+static struct nf7core_exec_entity* bench_new_(struct nf7core_exec* exec) {
+  return nf7core_exec_test_idea_alloc(
+      exec, bench_idea_, sizeof(struct nf7core_exec_entity));
+}
+
+
+NF7TEST(nf7core_exec_idea_test_register) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  const uint64_t n = nf7core_exec_idea_count(mod);
+  const bool ret =
+    nf7test_expect(nf7core_exec_idea_register(mod, &idea_)) &&
+    nf7test_expect(!nf7core_exec_idea_register(mod, &idea_)) &&
+    nf7test_expect(n+1 == nf7core_exec_idea_count(mod)) &&
+    nf7test_expect(&idea_ == nf7core_exec_idea_at(mod, n)) &&
+    nf7test_expect(&idea_ == nf7core_exec_idea_find(
+        mod, idea_.name, strlen((const char*) idea_.name))) &&
+    nf7test_expect(nf7core_exec_idea_unregister(mod, &idea_)) &&
+    nf7test_expect(!nf7core_exec_idea_unregister(mod, &idea_)) &&
+    nf7test_expect(n == nf7core_exec_idea_count(mod)) &&
+    nf7test_expect(nullptr == nf7core_exec_idea_find(
+        mod, idea_.name, strlen((const char*) idea_.name)));
+  return ret;
+}
+
+NF7TEST(nf7core_exec_idea_test_bench_new_entity) {
+  if (!test_->bench) {
+    return true;
+  }
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  bool     ret        = false;
+  uint32_t registered = 0;
+
+  struct nf7core_exec_idea* ideas =
+      nf7util_malloc_alloc(test_->malloc, BENCH_IDEAS_*sizeof(*ideas));
+  char (*names)[32] =
+      nf7util_malloc_alloc(test_->malloc, BENCH_IDEAS_*sizeof(*names));
+  if (!nf7test_expect(nullptr != ideas && nullptr != names)) {
+    goto EXIT;
+  }
+
+  for (; registered < BENCH_IDEAS_; ++registered) {
+    snprintf(names[registered], sizeof(names[0]),
+             "nf7core_exec_idea_test_%" PRIu32, registered);
+    ideas[registered] = idea_;
+    ideas[registered].name = (const uint8_t*) names[registered];
+    ideas[registered].new  = bench_new_;
+    if (!nf7test_expect(nf7core_exec_idea_register(mod, &ideas[registered]))) {
+      goto EXIT;
+    }
+  }
+
+  // resolves names across all ideas, and creates entities of them
+  const uint64_t begin = uv_hrtime();
+  for (uint32_t i = 0; i < BENCH_ENTITIES_; ++i) {
+    const uint32_t idx  = (i*7919) % BENCH_IDEAS_;
+    const char*    name = names[idx];
+
+    bench_idea_ = &ideas[idx];
+    struct nf7core_exec_entity* entity =
+        nf7core_exec_entity_new(mod, (const uint8_t*) name, strlen(name));
+    if (!nf7test_expect(nullptr != entity)) {
+      goto EXIT;
+    }
+    nf7core_exec_entity_del(entity);
+  }
+  const uint64_t elapsed = uv_hrtime() - begin;
+  nf7util_log_info(
+      "resolved and created %" PRIu32 " entities across %" PRIu32 " ideas: "
+      "%" PRIu64 " ns/entity",
+      BENCH_ENTITIES_, BENCH_IDEAS_, elapsed/BENCH_ENTITIES_);
+  ret = true;
+
+EXIT:
+  for (uint32_t i = 0; i < registered; ++i) {
+    nf7core_exec_idea_unregister(mod, &ideas[i]);
+  }
+  nf7util_malloc_free(test_->malloc, names);
+  nf7util_malloc_free(test_->malloc, ideas);
+  return ret;
+}
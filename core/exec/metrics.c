@@ -0,0 +1,300 @@
+// No copyright
+#include "core/exec/metrics.h"
+
+#include <assert.h>
+#include <inttypes.h>
+
+#include <uv.h>
+
+#include "util/log.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/idea.h"
+#include "core/exec/mod.h"
+
+
+static struct nf7core_exec_metrics* new_(struct nf7core_exec*);
+static struct nf7core_exec_metrics* get_idea_(
+    struct nf7core_exec*, const struct nf7core_exec_idea*);
+static void log_(const char* name, const struct nf7core_exec_metrics*);
+static bool take_stamp_(struct nf7core_exec_metrics*, uint64_t id, uint64_t* time);
+
+
+void nf7core_exec_metrics_enable(struct nf7core_exec* mod, bool enable) {
+  assert(nullptr != mod);
+  mod->metrics_enabled = enable;
+}
+
+bool nf7core_exec_metrics_attach(struct nf7core_exec_entity* entity) {
+  assert(nullptr != entity);
+  assert(nullptr != entity->idea);
+
+  if (nullptr != entity->metrics) {
+    return true;
+  }
+  struct nf7core_exec* mod = entity->mod;
+
+  struct nf7core_exec_metrics* idea = get_idea_(mod, entity->idea);
+  if (nullptr == idea) {
+    return false;
+  }
+  struct nf7core_exec_metrics* this = new_(mod);
+  if (nullptr == this) {
+    return false;
+  }
+  this->idea      = idea;
+  entity->metrics = this;
+  return true;
+}
+
+void nf7core_exec_metrics_detach(struct nf7core_exec_entity* entity) {
+  assert(nullptr != entity);
+
+  struct nf7core_exec_metrics* this = entity->metrics;
+  if (nullptr == this) {
+    return;
+  }
+  assert(this->idea->inflight >= this->inflight);
+  this->idea->inflight -= this->inflight;
+
+  entity->metrics = nullptr;
+  nf7util_malloc_free(entity->mod->malloc, this);
+}
+
+const struct nf7core_exec_metrics* nf7core_exec_metrics_get(
+    const struct nf7core_exec* mod, const struct nf7core_exec_idea* idea) {
+  assert(nullptr != mod);
+  assert(nullptr != idea);
+
+  struct nf7core_exec_metrics* ret = nullptr;
+  nf7core_exec_metrics_table_find(&mod->metrics, (uintptr_t) idea, &ret);
+  return ret;
+}
+
+void nf7core_exec_metrics_dump(const struct nf7core_exec* mod) {
+  assert(nullptr != mod);
+
+  for (uint64_t i = 0; i < mod->ideas.n; ++i) {
+    const struct nf7core_exec_idea*    idea = mod->ideas.ptr[i];
+    const struct nf7core_exec_metrics* this = nf7core_exec_metrics_get(mod, idea);
+    if (nullptr != this) {
+      log_((const char*) idea->name, this);
+    }
+  }
+}
+
+void nf7core_exec_metrics_dump_entity(const struct nf7core_exec_entity* entity) {
+  assert(nullptr != entity);
+  assert(nullptr != entity->idea);
+
+  if (nullptr == entity->metrics) {
+    nf7util_log_info("%s: not instrumented", entity->idea->name);
+    return;
+  }
+  log_((const char*) entity->idea->name, entity->metrics);
+}
+
+void nf7core_exec_metrics_clear(
+    struct nf7core_exec* mod, const struct nf7core_exec_idea* idea) {
+  assert(nullptr != mod);
+  assert(nullptr != idea);
+
+  struct nf7core_exec_metrics* this = nullptr;
+  if (nf7core_exec_metrics_table_remove(&mod->metrics, (uintptr_t) idea, &this)) {
+    nf7util_malloc_free(mod->malloc, this);
+  }
+}
+
+void nf7core_exec_metrics_clear_all(struct nf7core_exec* mod) {
+  assert(nullptr != mod);
+
+  for (uint64_t i = 0; i < mod->metrics.cap; ++i) {
+    if (mod->metrics.ptr[i].used) {
+      nf7util_malloc_free(mod->malloc, mod->metrics.ptr[i].value);
+    }
+  }
+  nf7core_exec_metrics_table_deinit(&mod->metrics);
+  nf7core_exec_metrics_table_init(&mod->metrics, mod->malloc);
+}
+
+
+void nf7core_exec_metrics_on_send(
+    struct nf7core_exec_entity* entity, uint64_t bytes, uint64_t id) {
+  assert(nullptr != entity);
+
+  struct nf7core_exec_metrics* this = entity->metrics;
+  assert(nullptr != this);
+
+  // times the send only when all in-flight sends are timed to keep the pairs
+  if (this->stamps_n == this->inflight &&
+      this->stamps_n < NF7CORE_EXEC_METRICS_MAX_STAMPS) {
+    const uint32_t idx =
+        (this->stamps_head + this->stamps_n) % NF7CORE_EXEC_METRICS_MAX_STAMPS;
+    this->stamps[idx] = (struct nf7core_exec_metrics_stamp) {
+      .id   = id,
+      .time = uv_hrtime(),
+    };
+    ++this->stamps_n;
+  }
+  ++this->sends;
+  ++this->inflight;
+  this->send_bytes += bytes;
+
+  ++this->idea->sends;
+  ++this->idea->inflight;
+  this->idea->send_bytes += bytes;
+}
+
+void nf7core_exec_metrics_on_unsend(
+    struct nf7core_exec_entity* entity, uint64_t bytes) {
+  assert(nullptr != entity);
+
+  struct nf7core_exec_metrics* this = entity->metrics;
+  assert(nullptr != this);
+  assert(0U < this->inflight);
+
+  // the latest send is timed only when all in-flight sends are timed
+  if (this->stamps_n == this->inflight) {
+    --this->stamps_n;
+  }
+  --this->sends;
+  --this->inflight;
+  this->send_bytes -= bytes;
+
+  --this->idea->sends;
+  --this->idea->inflight;
+  this->idea->send_bytes -= bytes;
+
+  nf7core_exec_metrics_on_refuse(entity, 1);
+}
+
+void nf7core_exec_metrics_on_refuse(
+    struct nf7core_exec_entity* entity, uint64_t n) {
+  assert(nullptr != entity);
+
+  struct nf7core_exec_metrics* this = entity->metrics;
+  assert(nullptr != this);
+
+  this->refusals       += n;
+  this->idea->refusals += n;
+}
+
+void nf7core_exec_metrics_on_recv(
+    struct nf7core_exec_entity* entity, uint64_t bytes, uint64_t id) {
+  assert(nullptr != entity);
+
+  struct nf7core_exec_metrics* this = entity->metrics;
+  assert(nullptr != this);
+
+  uint64_t time;
+  if (take_stamp_(this, id, &time)) {
+    const uint64_t elapsed = uv_hrtime() - time;
+    nf7util_hist_record(&this->latency, elapsed);
+    nf7util_hist_record(&this->idea->latency, elapsed);
+  }
+  if (0U < this->inflight) {
+    --this->inflight;
+    --this->idea->inflight;
+  }
+
+  // drops the oldest stamps left by sends which got no paired recv
+  while (this->stamps_n > this->inflight) {
+    this->stamps_head = (this->stamps_head + 1) % NF7CORE_EXEC_METRICS_MAX_STAMPS;
+    --this->stamps_n;
+  }
+  ++this->recvs;
+  this->recv_bytes += bytes;
+
+  ++this->idea->recvs;
+  this->idea->recv_bytes += bytes;
+}
+
+
+static struct nf7core_exec_metrics* new_(struct nf7core_exec* mod) {
+  assert(nullptr != mod);
+
+  struct nf7core_exec_metrics* this = nf7util_malloc_alloc(mod->malloc, sizeof(*this));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate metrics");
+    return nullptr;
+  }
+  *this = (struct nf7core_exec_metrics) {0};
+  nf7util_hist_init(&this->latency);
+  return this;
+}
+
+static struct nf7core_exec_metrics* get_idea_(
+    struct nf7core_exec* mod, const struct nf7core_exec_idea* idea) {
+  assert(nullptr != mod);
+  assert(nullptr != idea);
+
+  struct nf7core_exec_metrics** found =
+      nf7core_exec_metrics_table_get(&mod->metrics, (uintptr_t) idea);
+  if (nullptr != found) {
+    return *found;
+  }
+  struct nf7core_exec_metrics* this = new_(mod);
+  if (nullptr == this) {
+    return nullptr;
+  }
+  if (!nf7core_exec_metrics_table_insert(&mod->metrics, (uintptr_t) idea, this)) {
+    nf7util_log_error("failed to register metrics of idea");
+    nf7util_malloc_free(mod->malloc, this);
+    return nullptr;
+  }
+  return this;
+}
+
+static void log_(const char* name, const struct nf7core_exec_metrics* this) {
+  assert(nullptr != name);
+  assert(nullptr != this);
+
+  nf7util_log_info(
+      "%s: "
+      "send=%" PRIu64 " (%" PRIu64 " bytes), "
+      "recv=%" PRIu64 " (%" PRIu64 " bytes), "
+      "refused=%" PRIu64 ", inflight=%" PRIu64 ", "
+      "latency(ns) p50=%" PRIu64 " p99=%" PRIu64 " max=%" PRIu64,
+      name,
+      this->sends, this->send_bytes,
+      this->recvs, this->recv_bytes,
+      this->refusals, this->inflight,
+      nf7util_hist_percentile(&this->latency, 50),
+      nf7util_hist_percentile(&this->latency, 99),
+      this->latency.max);
+}
+
+// Removes a stamp paired with the recv of the id from the ring, and returns its
+// time.
+static bool take_stamp_(
+    struct nf7core_exec_metrics* this, uint64_t id, uint64_t* time) {
+  assert(nullptr != this);
+  assert(nullptr != time);
+
+  const uint32_t max = NF7CORE_EXEC_METRICS_MAX_STAMPS;
+  if (0U == this->stamps_n) {
+    return false;
+  }
+
+  // a recv without id is paired with the oldest as FIFO
+  uint32_t n = 0;
+  if (0U != id) {
+    while (n < this->stamps_n && this->stamps[(this->stamps_head + n) % max].id != id) {
+      ++n;
+    }
+    if (n == this->stamps_n) {
+      return false;
+    }
+  }
+  *time = this->stamps[(this->stamps_head + n) % max].time;
+
+  // fills the hole by shifting older ones, and pops the head
+  for (; 0U < n; --n) {
+    this->stamps[(this->stamps_head + n) % max] =
+        this->stamps[(this->stamps_head + n - 1) % max];
+  }
+  this->stamps_head = (this->stamps_head + 1) % max;
+  --this->stamps_n;
+  return true;
+}
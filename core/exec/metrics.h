@@ -0,0 +1,104 @@
+// No copyright
+//
+// Metrics records traffic of entities for diagnosis of slow entities.
+//
+// HOW TO USE
+//   Call nf7core_exec_metrics_enable() to instrument entities created after
+//   that, or nf7core_exec_metrics_attach() to instrument a specific entity.
+//   Metrics of each entity are available on `metrics` of the entity, and
+//   metrics of each idea, which sum up all instrumented entities of the idea,
+//   are available by nf7core_exec_metrics_get().
+//
+//   Entities without metrics pay only one branch for each send and recv.
+//
+// LATENCY
+//   Each recv with non-zero `id` of the buffer is paired with the in-flight
+//   send of the same id, and other recvs are paired with the oldest in-flight
+//   send. The elapsed time between them in nanoseconds is recorded as the
+//   latency. A recv whose id matches no timed send is not timed, so replies to
+//   untimed sends and notifications never skew the latency. Up to
+//   NF7CORE_EXEC_METRICS_MAX_STAMPS in-flight sends are timed, and sends over
+//   the limit are counted but not timed.
+#pragma once
+
+#include <stdint.h>
+
+#include "util/hist.h"
+
+
+struct nf7core_exec;
+struct nf7core_exec_entity;
+struct nf7core_exec_idea;
+
+#define NF7CORE_EXEC_METRICS_MAX_STAMPS 64
+
+struct nf7core_exec_metrics_stamp {
+  uint64_t id;    // `id` of the sent buffer, or 0
+  uint64_t time;  // [ns]
+};
+
+struct nf7core_exec_metrics {
+  uint64_t sends;
+  uint64_t send_bytes;
+  uint64_t recvs;
+  uint64_t recv_bytes;
+  uint64_t refusals;
+
+  // a number of sends not paired with recvs yet
+  uint64_t inflight;
+
+  // nanoseconds from send to recv
+  struct nf7util_hist latency;
+
+  // a ring of the oldest in-flight sends in order of the send (entity only)
+  struct nf7core_exec_metrics_stamp stamps[NF7CORE_EXEC_METRICS_MAX_STAMPS];
+  uint32_t stamps_head;
+  uint32_t stamps_n;
+
+  // metrics of the idea (entity only)
+  struct nf7core_exec_metrics* idea;
+};
+
+
+// Enables or disables instrumentation of entities created after this.
+void nf7core_exec_metrics_enable(struct nf7core_exec*, bool);
+
+// Starts instrumenting the entity. Returns false if failed to allocate, or true
+// if instrumented already.
+bool nf7core_exec_metrics_attach(struct nf7core_exec_entity*);
+
+// Stops instrumenting the entity and releases its metrics.
+void nf7core_exec_metrics_detach(struct nf7core_exec_entity*);
+
+// Returns metrics of the idea, or nullptr if no entity of the idea has been
+// instrumented.
+const struct nf7core_exec_metrics* nf7core_exec_metrics_get(
+    const struct nf7core_exec*, const struct nf7core_exec_idea*);
+
+// Logs metrics of all ideas.
+void nf7core_exec_metrics_dump(const struct nf7core_exec*);
+
+// Logs metrics of the entity.
+void nf7core_exec_metrics_dump_entity(const struct nf7core_exec_entity*);
+
+// Deletes metrics of the idea.
+// PRECONDS:
+//   - No entity of the idea is instrumented.
+void nf7core_exec_metrics_clear(
+    struct nf7core_exec*, const struct nf7core_exec_idea*);
+
+// Deletes metrics of all ideas.
+// PRECONDS:
+//   - No entity is instrumented.
+void nf7core_exec_metrics_clear_all(struct nf7core_exec*);
+
+
+// ---- hooks called by core/exec/entity.h
+// PRECONDS:
+//   - `nullptr != entity->metrics`
+void nf7core_exec_metrics_on_send(
+    struct nf7core_exec_entity*, uint64_t bytes, uint64_t id);
+void nf7core_exec_metrics_on_unsend(struct nf7core_exec_entity*, uint64_t bytes);
+void nf7core_exec_metrics_on_refuse(struct nf7core_exec_entity*, uint64_t n);
+void nf7core_exec_metrics_on_recv(
+    struct nf7core_exec_entity*, uint64_t bytes, uint64_t id);
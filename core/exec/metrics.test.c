@@ -0,0 +1,171 @@
+// No copyright
+#include "core/exec/metrics.h"
+
+#include <uv.h>
+
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/idea.h"
+#include "core/exec/test_idea.h"
+
+#include "test/common.h"
+
+
+// echoes buffers except empty ones
+static bool send_(struct nf7core_exec_entity* this, struct nf7util_buffer* buf) {
+  if (0U < buf->array.n) {
+    return nf7core_exec_test_idea_echo(this, buf);
+  }
+  return nf7core_exec_test_idea_sink(this, buf);
+}
+
+NF7CORE_EXEC_TEST_IDEA(idea_, "nf7core_exec_metrics_test", send_);
+
+// holds requests to reply them in any order
+static struct nf7util_buffer* held_[2];
+static uint32_t               held_n_;
+
+static bool send_hold_(struct nf7core_exec_entity*, struct nf7util_buffer* buf) {
+  if (held_n_ >= sizeof(held_)/sizeof(held_[0])) {
+    return false;
+  }
+  held_[held_n_++] = buf;
+  return true;
+}
+
+NF7CORE_EXEC_TEST_IDEA(hold_, "nf7core_exec_metrics_test_hold", send_hold_);
+
+
+static bool send_bytes_(struct nf7core_exec_entity* entity, uint64_t n) {
+  struct nf7util_buffer* buf = nf7util_buffer_new(entity->mod->malloc, n);
+  if (nullptr == buf) {
+    return false;
+  }
+  if (!nf7core_exec_entity_send(entity, buf)) {
+    nf7util_buffer_unref(buf);
+    return false;
+  }
+  return true;
+}
+
+NF7TEST(nf7core_exec_metrics_test_counts) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+  if (!nf7test_expect(nf7core_exec_idea_register(mod, &idea_))) {
+    return false;
+  }
+
+  const uint8_t* name = idea_.name;
+  const size_t   len  = strlen((const char*) name);
+
+  nf7core_exec_metrics_enable(mod, true);
+  struct nf7core_exec_entity* a = nf7core_exec_entity_new(mod, name, len);
+  nf7core_exec_metrics_enable(mod, false);
+  struct nf7core_exec_entity* b = nf7core_exec_entity_new(mod, name, len);
+
+  bool ret =
+    nf7test_expect(nullptr != a && nullptr != b) &&
+    nf7test_expect(nullptr != a->metrics) &&
+    nf7test_expect(nullptr == b->metrics);
+  if (ret) {
+    nf7core_exec_entity_credit_init(a, 2, 0);
+
+    // 2 echoes, 1 send without reply, and 1 refusal by credit
+    ret =
+      nf7test_expect(send_bytes_(a, 4)) &&
+      nf7test_expect(send_bytes_(a, 8)) &&
+      nf7test_expect(send_bytes_(b, 8));
+    nf7core_exec_entity_credit_return(a, 2, 12);
+    ret = ret &&
+      nf7test_expect(send_bytes_(a, 0)) &&
+      nf7test_expect(send_bytes_(a, 0)) &&
+      nf7test_expect(!send_bytes_(a, 0));
+  }
+
+  const struct nf7core_exec_metrics* idea = nf7core_exec_metrics_get(mod, &idea_);
+  if (ret) {
+    const struct nf7core_exec_metrics* m = a->metrics;
+    ret =
+      nf7test_expect(4 == m->sends) &&
+      nf7test_expect(12 == m->send_bytes) &&
+      nf7test_expect(2 == m->recvs) &&
+      nf7test_expect(12 == m->recv_bytes) &&
+      nf7test_expect(1 == m->refusals) &&
+      nf7test_expect(2 == m->inflight) &&
+      nf7test_expect(2 == m->latency.n) &&
+      nf7test_expect(nullptr != idea) &&
+      nf7test_expect(4 == idea->sends) &&
+      nf7test_expect(2 == idea->inflight) &&
+      nf7test_expect(2 == idea->latency.n);
+    nf7core_exec_metrics_dump(mod);
+    nf7core_exec_metrics_dump_entity(a);
+  }
+
+  nf7core_exec_entity_del(a);
+  nf7core_exec_entity_del(b);
+  ret = ret &&
+    nf7test_expect(nullptr != idea) &&
+    nf7test_expect(0 == idea->inflight);
+
+  nf7core_exec_idea_unregister(mod, &idea_);
+  return ret && nf7test_expect(nullptr == nf7core_exec_metrics_get(mod, &idea_));
+}
+
+NF7TEST(nf7core_exec_metrics_test_latency_by_id) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  struct nf7core_exec_entity* sut = hold_.new(mod);
+  if (!nf7test_expect(nullptr != sut) ||
+      !nf7test_expect(nf7core_exec_metrics_attach(sut))) {
+    nf7core_exec_entity_del(sut);
+    return false;
+  }
+  held_n_ = 0;
+
+  // sends 1 and 2, and replies 2 and 1, with 20 ms between each step
+  //   Pairing them by order records about 20 ms twice, but pairing by id
+  //   records about 0 and 40 ms.
+  bool ret = true;
+  for (uint64_t id = 1; ret && id <= 2; ++id) {
+    struct nf7util_buffer* buf = nf7util_buffer_new(mod->malloc, 0);
+    ret = nf7test_expect(nullptr != buf);
+    if (ret) {
+      buf->id = id;
+      ret = nf7test_expect(nf7core_exec_entity_send(sut, buf));
+      if (!ret) {
+        nf7util_buffer_unref(buf);
+      }
+    }
+    if (1 == id) {
+      uv_sleep(20);
+    }
+  }
+  if (ret) {
+    nf7core_exec_entity_recv(sut, held_[1]);
+    uv_sleep(20);
+    nf7core_exec_entity_recv(sut, held_[0]);
+  } else {
+    for (uint32_t i = 0; i < held_n_; ++i) {
+      nf7util_buffer_unref(held_[i]);
+    }
+  }
+
+  const struct nf7core_exec_metrics* m = sut->metrics;
+  ret = ret &&
+    nf7test_expect(2 == m->latency.n) &&
+    nf7test_expect(0 == m->inflight) &&
+    nf7test_expect(20*1000*1000 > m->latency.min) &&
+    nf7test_expect(40*1000*1000 <= m->latency.max);
+
+  nf7core_exec_entity_del(sut);
+  nf7core_exec_metrics_clear(mod, &hold_);
+  return ret;
+}
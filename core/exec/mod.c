@@ -5,6 +5,10 @@
 
 #include "util/log.h"
 
+#include "core/exec/metrics.h"
+#include "core/exec/pool.h"
+#include "core/exec/shard.h"
+
 
 static void del_(struct nf7_mod*);
 
@@ -24,9 +28,13 @@ struct nf7_mod* nf7core_exec_new(struct nf7* nf7) {
       .meta = &nf7core_exec,
     },
     .malloc = nf7->malloc,
+    .atoms  = nf7->atoms,
   };
 
   nf7core_exec_ideas_init(&this->ideas, this->malloc);
+  nf7core_exec_idea_index_init(&this->idea_index, this->malloc);
+  nf7core_exec_pools_init(&this->pools, this->malloc);
+  nf7core_exec_metrics_table_init(&this->metrics, this->malloc);
   return &this->super;
 
 ABORT:
@@ -37,7 +45,16 @@ ABORT:
 
 static void del_(struct nf7_mod* mod) {
   struct nf7core_exec* this = (void*) mod;
+  if (nullptr == this) {
+    return;
+  }
+  nf7core_exec_shard_stop(this);
+  nf7core_exec_pool_clear_all(this);
+  nf7core_exec_pools_deinit(&this->pools);
+  nf7core_exec_metrics_clear_all(this);
+  nf7core_exec_metrics_table_deinit(&this->metrics);
   nf7core_exec_ideas_deinit(&this->ideas);
+  nf7core_exec_idea_index_deinit(&this->idea_index);
   nf7util_malloc_free(this->malloc, this);
 }
 
@@ -46,5 +63,7 @@ const struct nf7_mod_meta nf7core_exec = {
   .desc = (const uint8_t*) "provides a registry for executables",
   .ver  = NF7_VERSION,
 
+  .hosted = true,
+
   .del = del_,
 };
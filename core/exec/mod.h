@@ -4,22 +4,47 @@
 #include "nf7.h"
 
 #include "util/array.h"
+#include "util/hashmap.h"
 #include "util/malloc.h"
+#include "util/str.h"
 
 
 struct nf7core_exec_idea;
 struct nf7core_exec_entity;
+struct nf7core_exec_pool;
+struct nf7core_exec_metrics;
+struct nf7core_exec_shards;
 
 NF7UTIL_ARRAY_INLINE(nf7core_exec_ideas, const struct nf7core_exec_idea*);
+NF7UTIL_HASHMAP_INLINE(nf7core_exec_idea_index, const struct nf7core_exec_idea*);
+NF7UTIL_HASHMAP_INLINE(nf7core_exec_pools, struct nf7core_exec_pool*);
+NF7UTIL_HASHMAP_INLINE(nf7core_exec_metrics_table, struct nf7core_exec_metrics*);
 
 
 struct nf7core_exec {
   struct nf7_mod super;
 
-  struct nf7*            nf7;
-  struct nf7util_malloc* malloc;
+  struct nf7*               nf7;
+  struct nf7util_malloc*    malloc;
+  struct nf7util_str_atoms* atoms;
 
+  // registered ideas in order of their registration
   struct nf7core_exec_ideas ideas;
+
+  // maps an atom of idea name to the idea
+  struct nf7core_exec_idea_index idea_index;
+
+  // maps an address of idea to its entity pool, see core/exec/pool.h
+  struct nf7core_exec_pools pools;
+
+  // maps an address of idea to its metrics, see core/exec/metrics.h
+  struct nf7core_exec_metrics_table metrics;
+
+  // instruments new entities if true
+  bool metrics_enabled;
+
+  // shard threads, or nullptr if not started, see core/exec/shard.h
+  struct nf7core_exec_shards* shards;
 };
 
 extern const struct nf7_mod_meta nf7core_exec;
@@ -0,0 +1,274 @@
+// No copyright
+#include "core/exec/offload.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+
+#include <uv.h>
+
+#include "nf7.h"
+
+#include "util/array.h"
+#include "util/log.h"
+#include "util/malloc.h"
+
+#include "core/exec/deadline.h"
+#include "core/exec/entity.h"
+
+
+NF7UTIL_ARRAY_INLINE(nf7core_exec_offload_queue, struct nf7util_buffer*);
+
+struct nf7core_exec_offload {
+  struct nf7core_exec_entity* entity;
+  struct nf7util_malloc*      malloc;
+  uv_loop_t*                  uv;
+
+  uv_work_t req;
+
+  // true while a work is running or its result is being delivered
+  bool busy;
+
+  // true if the entity has been deleted while busy
+  bool deleted;
+
+  struct nf7core_exec_offload_queue queue;
+
+  struct nf7util_buffer* in;
+  uint64_t               insize;
+  uint64_t               inid;
+  uint64_t               indeadline;
+
+  // true if the running work has been cancelled
+  atomic_bool cancelled;
+  struct nf7util_buffer* out;
+};
+
+static struct nf7core_exec_offload* new_(struct nf7core_exec_entity*);
+static void del_(struct nf7core_exec_offload*);
+static void start_(struct nf7core_exec_offload*);
+static void finalize_(struct nf7core_exec_offload*);
+
+static void work_(uv_work_t*);
+static void after_work_(uv_work_t*, int);
+
+
+bool nf7core_exec_offload_send(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  assert(nullptr != entity);
+  assert(nullptr != entity->idea);
+  assert(nullptr != entity->idea->work);
+  assert(nullptr != buf);
+
+  if (nullptr == entity->offload) {
+    entity->offload = new_(entity);
+    if (nullptr == entity->offload) {
+      nf7util_log_error("failed to allocate offloading context");
+      return false;
+    }
+  }
+  struct nf7core_exec_offload* this = entity->offload;
+
+  if (!nf7core_exec_offload_queue_insert(&this->queue, UINT64_MAX, buf)) {
+    nf7util_log_error("failed to queue a buffer to offload");
+    return false;
+  }
+  start_(this);
+  return true;
+}
+
+bool nf7core_exec_offload_cancel(struct nf7core_exec_entity* entity, uint64_t id) {
+  assert(nullptr != entity);
+
+  struct nf7core_exec_offload* this = entity->offload;
+  if (nullptr == this || 0U == id) {
+    return false;
+  }
+
+  // drops the queued request
+  for (uint64_t i = 0; i < this->queue.n; ++i) {
+    struct nf7util_buffer* buf = this->queue.ptr[i];
+    if (buf->id == id) {
+      const uint64_t size = buf->array.n;
+      nf7core_exec_offload_queue_remove(&this->queue, i);
+      nf7util_buffer_unref(buf);
+      nf7core_exec_entity_credit_return(entity, 1, size);
+      return true;
+    }
+  }
+
+  // tells the running work, and its result will be dropped
+  if (this->busy && this->inid == id) {
+    atomic_store(&this->cancelled, true);
+    return true;
+  }
+  return false;
+}
+
+bool nf7core_exec_offload_cancelled(const struct nf7core_exec_entity* entity) {
+  assert(nullptr != entity);
+
+  const struct nf7core_exec_offload* this = entity->offload;
+  if (nullptr == this) {
+    return false;
+  }
+  return
+      atomic_load(&this->cancelled) ||
+      (0U != this->indeadline && this->indeadline <= uv_hrtime());
+}
+
+bool nf7core_exec_offload_release(struct nf7core_exec_entity* entity) {
+  assert(nullptr != entity);
+
+  struct nf7core_exec_offload* this = entity->offload;
+  if (nullptr == this) {
+    return false;
+  }
+  if (this->busy) {
+    this->deleted = true;
+    return true;
+  }
+  entity->offload = nullptr;
+  del_(this);
+  return false;
+}
+
+
+static struct nf7core_exec_offload* new_(struct nf7core_exec_entity* entity) {
+  assert(nullptr != entity);
+  assert(nullptr != entity->mod);
+
+  const struct nf7* nf7 = entity->mod->super.nf7;
+
+  struct nf7core_exec_offload* this =
+      nf7util_malloc_alloc(entity->mod->malloc, sizeof(*this));
+  if (nullptr == this) {
+    return nullptr;
+  }
+  *this = (struct nf7core_exec_offload) {
+    .entity = entity,
+    .malloc = entity->mod->malloc,
+    .uv     = nf7->uv,
+  };
+  this->req.data = this;
+  nf7core_exec_offload_queue_init(&this->queue, this->malloc);
+  return this;
+}
+
+static void del_(struct nf7core_exec_offload* this) {
+  assert(nullptr != this);
+  assert(!this->busy);
+
+  for (uint64_t i = 0; i < this->queue.n; ++i) {
+    nf7util_buffer_unref(this->queue.ptr[i]);
+  }
+  nf7core_exec_offload_queue_deinit(&this->queue);
+  nf7util_malloc_free(this->malloc, this);
+}
+
+static void start_(struct nf7core_exec_offload* this) {
+  assert(nullptr != this);
+
+  if (this->busy) {
+    return;
+  }
+
+  // callbacks below may delete the entity
+  this->busy = true;
+  while (!this->deleted && 0U < this->queue.n) {
+    this->in         = this->queue.ptr[0];
+    this->insize     = this->in->array.n;
+    this->inid       = this->in->id;
+    this->indeadline = this->in->deadline;
+    nf7core_exec_offload_queue_remove(&this->queue, 0);
+
+    // nobody waits for the result
+    if (nf7core_exec_deadline_expired(this->in)) {
+      nf7util_buffer_unref(this->in);
+      this->in = nullptr;
+      nf7core_exec_entity_credit_return(this->entity, 1, this->insize);
+      continue;
+    }
+    atomic_store(&this->cancelled, false);
+
+    const int err = nf7util_log_uv(
+        uv_queue_work(this->uv, &this->req, work_, after_work_));
+    if (0 == err) {
+      return;  // keeps busy until after_work_()
+    }
+    nf7util_log_error("failed to queue a work, the buffer is dropped");
+    nf7util_buffer_unref(this->in);
+    this->in = nullptr;
+    nf7core_exec_entity_credit_return(this->entity, 1, this->insize);
+  }
+  this->busy = false;
+  if (this->deleted) {
+    finalize_(this);
+  }
+}
+
+static void finalize_(struct nf7core_exec_offload* this) {
+  assert(nullptr != this);
+  assert(this->deleted);
+
+  struct nf7core_exec_entity* entity = this->entity;
+  entity->offload = nullptr;
+  del_(this);
+  nf7core_exec_entity_del(entity);
+}
+
+
+static void work_(uv_work_t* req) {
+  struct nf7core_exec_offload* this = req->data;
+  assert(nullptr != this);
+
+  struct nf7core_exec_entity* entity = this->entity;
+
+  struct nf7util_buffer* in = this->in;
+  this->in  = nullptr;
+  this->out = entity->idea->work(entity, in);
+}
+
+static void after_work_(uv_work_t* req, int status) {
+  struct nf7core_exec_offload* this = req->data;
+  assert(nullptr != this);
+  assert(this->busy);
+
+  if (0 != status) {
+    nf7util_log_warn("offloaded work is not done: %s", uv_strerror(status));
+    if (nullptr != this->in) {
+      nf7util_buffer_unref(this->in);
+      this->in = nullptr;
+    }
+  }
+
+  struct nf7util_buffer* out = this->out;
+  this->out = nullptr;
+
+  if (nullptr != out && atomic_load(&this->cancelled)) {
+    nf7util_buffer_unref(out);
+    out = nullptr;
+  }
+
+  // callbacks below may delete the entity
+  if (!this->deleted) {
+    nf7core_exec_entity_credit_return(this->entity, 1, this->insize);
+  }
+  if (nullptr != out) {
+    // the result answers the request
+    if (0U == out->id) {
+      out->id = this->inid;
+    }
+    if (!this->deleted) {
+      nf7core_exec_entity_recv(this->entity, out);
+    } else {
+      nf7util_buffer_unref(out);
+    }
+  }
+
+  this->busy = false;
+  if (this->deleted) {
+    finalize_(this);
+    return;
+  }
+  start_(this);
+}
@@ -0,0 +1,52 @@
+// No copyright
+//
+// Offloading runs sends of an idea on the libuv worker pool instead of the
+// loop thread, to keep CPU-heavy entities from stalling everything else.
+//
+// HOW TO USE
+//   Set `nf7core_exec_offload_send` to `send` of your idea, and implement
+//   `work` of the idea. `work` is called on a worker thread with the sent
+//   buffer, and its returned buffer is delivered to the client through
+//   nf7core_exec_entity_recv() on the loop thread.
+//
+// RULES
+//   - Buffers are handed off between threads without copies, so the client
+//     must not keep any references to sent buffers, and `work` must not keep
+//     references to the returned buffer.
+//   - Works of the same entity never run at the same time and keep an order of
+//     sends. `work` may touch the entity context, but must not touch anything
+//     the loop thread touches.
+//   - Credit of each sent buffer is returned when its work is done, so an
+//     entity with a credit window never queues works more than the window.
+//   - Deletion of an entity is deferred until its running work is done.
+//   - A returned buffer without id takes over the id of the sent buffer, so
+//     responses are paired with their requests, see core/exec/pending.h.
+//   - Queued buffers are dropped when they expire. Set
+//     `nf7core_exec_offload_cancel` to `cancel` of the idea to support
+//     cancellation, and check nf7core_exec_offload_cancelled() in long `work`
+//     to give up early, see core/exec/deadline.h.
+#pragma once
+
+#include <stdint.h>
+
+#include "util/buffer.h"
+
+
+struct nf7core_exec_entity;
+struct nf7core_exec_offload;
+
+
+// An implementation of `send` of nf7core_exec_idea.
+bool nf7core_exec_offload_send(
+    struct nf7core_exec_entity*, struct nf7util_buffer*);
+
+// An implementation of `cancel` of nf7core_exec_idea.
+bool nf7core_exec_offload_cancel(struct nf7core_exec_entity*, uint64_t id);
+
+// Returns true if the request being processed by `work` has been cancelled or
+// expired. `work` can call this on the worker thread.
+bool nf7core_exec_offload_cancelled(const struct nf7core_exec_entity*);
+
+// Called from nf7core_exec_entity_del() to release the offloading context.
+// Returns true if the deletion of the entity is deferred.
+bool nf7core_exec_offload_release(struct nf7core_exec_entity*);
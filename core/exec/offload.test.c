@@ -0,0 +1,265 @@
+// No copyright
+#include "core/exec/offload.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include <uv.h>
+
+#include "util/buffer.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/test_idea.h"
+
+#include "test/common.h"
+
+
+struct upper_ {
+  struct nf7core_exec_entity super;
+
+  struct nf7test* test;
+  uv_thread_t     worker;
+  uint32_t        recvs;
+  uint32_t        writables;
+};
+
+static const struct nf7core_exec_idea idea_;
+
+static struct nf7core_exec_entity* new_(struct nf7core_exec* exec) {
+  return nf7core_exec_test_idea_alloc(exec, &idea_, sizeof(struct upper_));
+}
+static void del_(struct nf7core_exec_entity* entity) {
+  struct upper_* this = (void*) entity;
+  if (nullptr != this->test) {
+    nf7test_unref(this->test);
+  }
+  nf7core_exec_test_idea_del(entity);
+}
+static struct nf7util_buffer* work_(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  struct upper_* this = (void*) entity;
+  this->worker = uv_thread_self();
+  for (uint64_t i = 0; i < buf->array.n; ++i) {
+    buf->array.ptr[i] = (uint8_t) toupper(buf->array.ptr[i]);
+  }
+  return buf;
+}
+
+static const struct nf7core_exec_idea idea_ = {
+  .name   = (const uint8_t*) "nf7core_exec_offload_test",
+  .new    = new_,
+  .del    = del_,
+  .send   = nf7core_exec_offload_send,
+  .work   = work_,
+  .cancel = nf7core_exec_offload_cancel,
+};
+
+static void on_recv_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  struct upper_*  this  = (void*) entity;
+  struct nf7test* test_ = this->test;
+
+  const uv_thread_t self = uv_thread_self();
+  nf7test_expect(!uv_thread_equal(&self, &this->worker));
+  nf7test_expect(buf->array.n == 5 && 0 == memcmp(buf->array.ptr, "HELLO", 5));
+  nf7util_buffer_unref(buf);
+
+  if (2 == ++this->recvs) {
+    nf7core_exec_entity_del(entity);
+  }
+}
+
+static void on_recv_cancel_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  struct upper_*  this  = (void*) entity;
+  struct nf7test* test_ = this->test;
+
+  // only the first request is answered
+  nf7test_expect(1U == buf->id);
+  nf7test_expect(0U == this->recvs++);
+  nf7util_buffer_unref(buf);
+  nf7core_exec_entity_del(entity);
+}
+
+static struct upper_* setup_(struct nf7test* test_) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return nullptr;
+  }
+  struct upper_* this = (void*) idea_.new(mod);
+  if (!nf7test_expect(nullptr != this)) {
+    return nullptr;
+  }
+  this->test = test_;
+  nf7test_ref(test_);
+  return this;
+}
+
+NF7TEST(nf7core_exec_offload_test_send) {
+  struct upper_* sut = setup_(test_);
+  if (nullptr == sut) {
+    return false;
+  }
+  sut->super.on_recv = on_recv_;
+
+  // the second send is queued until the first work is done
+  nf7core_exec_entity_credit_init(&sut->super, 2, 0);
+  for (uint32_t i = 0; i < 2; ++i) {
+    struct nf7util_buffer* buf = nf7util_buffer_new_from_cstr(test_->malloc, "hello");
+    if (!nf7test_expect(nullptr != buf)) {
+      nf7core_exec_entity_del(&sut->super);
+      return false;
+    }
+    if (!nf7test_expect(nf7core_exec_entity_send(&sut->super, buf))) {
+      nf7util_buffer_unref(buf);
+      nf7core_exec_entity_del(&sut->super);
+      return false;
+    }
+  }
+  return nf7test_expect(!nf7core_exec_entity_writable(&sut->super));
+}
+
+NF7TEST(nf7core_exec_offload_test_del_while_working) {
+  struct upper_* sut = setup_(test_);
+  if (nullptr == sut) {
+    return false;
+  }
+  sut->super.on_recv = on_recv_;
+
+  struct nf7util_buffer* buf = nf7util_buffer_new_from_cstr(test_->malloc, "hello");
+  if (!nf7test_expect(nullptr != buf)) {
+    nf7core_exec_entity_del(&sut->super);
+    return false;
+  }
+  const bool ret = nf7test_expect(nf7core_exec_entity_send(&sut->super, buf));
+  if (!ret) {
+    nf7util_buffer_unref(buf);
+  }
+
+  // the entity is deleted after the work, and its result is dropped
+  nf7core_exec_entity_del(&sut->super);
+  return ret;
+}
+
+NF7TEST(nf7core_exec_offload_test_cancel) {
+  struct upper_* sut = setup_(test_);
+  if (nullptr == sut) {
+    return false;
+  }
+  sut->super.on_recv = on_recv_cancel_;
+
+  // the second request is still queued while the first work is running
+  bool ret = true;
+  for (uint64_t id = 1; ret && id <= 2; ++id) {
+    struct nf7util_buffer* buf = nf7util_buffer_new_from_cstr(test_->malloc, "hello");
+    ret = nf7test_expect(nullptr != buf);
+    if (ret) {
+      buf->id = id;
+      ret = nf7test_expect(nf7core_exec_entity_send(&sut->super, buf));
+      if (!ret) {
+        nf7util_buffer_unref(buf);
+      }
+    }
+  }
+  if (ret) {
+    ret =
+        nf7test_expect(nf7core_exec_entity_cancel(&sut->super, 2)) &&
+        nf7test_expect(!nf7core_exec_entity_cancel(&sut->super, 3)) &&
+        nf7test_expect(1U == sut->super.credit.msgs_used);
+  }
+  if (!ret) {
+    nf7core_exec_entity_del(&sut->super);
+  }
+  return ret;
+}
+
+NF7TEST(nf7core_exec_offload_test_expired) {
+  struct upper_* sut = setup_(test_);
+  if (nullptr == sut) {
+    return false;
+  }
+  sut->super.on_recv = on_recv_;
+
+  // an expired buffer is dropped without any work
+  struct nf7util_buffer* buf = nf7util_buffer_new_from_cstr(test_->malloc, "hello");
+  if (!nf7test_expect(nullptr != buf)) {
+    nf7core_exec_entity_del(&sut->super);
+    return false;
+  }
+  buf->deadline = 1;
+  const bool ret =
+      nf7test_expect(nf7core_exec_deadline_expired(buf)) &&
+      nf7test_expect(nf7core_exec_entity_send(&sut->super, buf)) &&
+      nf7test_expect(0U == sut->super.credit.msgs_used) &&
+      nf7test_expect(nullptr == sut->super.offload);
+  nf7core_exec_entity_del(&sut->super);
+  return ret;
+}
+
+
+static void on_recv_drop_(struct nf7core_exec_entity*, struct nf7util_buffer* buf) {
+  nf7util_buffer_unref(buf);
+}
+
+static bool send_hello_(struct upper_* this) {
+  struct nf7test* test_ = this->test;
+
+  struct nf7util_buffer* buf = nf7util_buffer_new_from_cstr(test_->malloc, "hello");
+  if (!nf7test_expect(nullptr != buf)) {
+    return false;
+  }
+  if (!nf7core_exec_entity_send(&this->super, buf)) {
+    nf7util_buffer_unref(buf);
+    return false;
+  }
+  return true;
+}
+
+static void on_writable_del_(struct nf7core_exec_entity* entity) {
+  struct upper_*  this  = (void*) entity;
+  struct nf7test* test_ = this->test;
+
+  // the first is by the finished work, and blocks again
+  if (1U == ++this->writables) {
+    nf7test_expect(send_hello_(this));
+    nf7test_expect(!send_hello_(this));
+    return;
+  }
+
+  // the second is by the expired buffer while starting the next work
+  nf7core_exec_entity_del(entity);
+}
+
+NF7TEST(nf7core_exec_offload_test_del_while_starting) {
+  struct upper_* sut = setup_(test_);
+  if (nullptr == sut) {
+    return false;
+  }
+  sut->super.on_recv     = on_recv_drop_;
+  sut->super.on_writable = on_writable_del_;
+  nf7core_exec_entity_credit_init(&sut->super, 2, 0);
+
+  // the second buffer expires in the queue while the first work is running,
+  // and the third send is refused
+  bool ret = nf7test_expect(send_hello_(sut));
+  if (ret) {
+    struct nf7util_buffer* buf = nf7util_buffer_new_from_cstr(test_->malloc, "hello");
+    ret = nf7test_expect(nullptr != buf);
+    if (ret && !nf7test_expect(nf7core_exec_entity_send(&sut->super, buf))) {
+      nf7util_buffer_unref(buf);
+      ret = false;
+    }
+    if (ret) {
+      buf->deadline = 1;  // still in the queue
+      ret =
+          nf7test_expect(!send_hello_(sut)) &&
+          nf7test_expect(sut->super.credit.blocked);
+    }
+  }
+
+  // the entity is deleted by on_writable_del_()
+  if (!ret) {
+    nf7core_exec_entity_del(&sut->super);
+  }
+  return ret;
+}
@@ -0,0 +1,115 @@
+// No copyright
+//
+// Pending table pairs responses with their requests by correlation ids, so
+// that a client can pipeline requests to an entity, and the entity can answer
+// them in any order.
+//
+// HOW TO USE
+//   Client:
+//     Send requests by nf7core_exec_pending_send() with any data to remember
+//     each request. When a buffer is received, take the data of its request by
+//     nf7core_exec_pending_take() with `id` of the buffer.
+//
+//   Entity implementation:
+//     Answer a request by nf7core_exec_entity_reply() with `id` of the
+//     request buffer. Buffers received without reply have id 0.
+//
+// Ids are carried by `id` of nf7util_buffer, so contents of buffers are never
+// changed, and buffers with ids pass through entities which don't know ids,
+// such as nf7core_any.
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "util/buffer.h"
+#include "util/hashmap.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+
+
+NF7UTIL_HASHMAP_INLINE(nf7core_exec_pending_map, void*);
+
+struct nf7core_exec_pending {
+  struct nf7core_exec_pending_map map;
+
+  uint64_t next;
+};
+
+
+static inline void nf7core_exec_pending_init(
+    struct nf7core_exec_pending* this, struct nf7util_malloc* malloc) {
+  assert(nullptr != this);
+  assert(nullptr != malloc);
+
+  *this = (struct nf7core_exec_pending) {
+    .next = 1,
+  };
+  nf7core_exec_pending_map_init(&this->map, malloc);
+}
+
+// Forgets all pending requests. Data of them are not released.
+static inline void nf7core_exec_pending_deinit(struct nf7core_exec_pending* this) {
+  assert(nullptr != this);
+  nf7core_exec_pending_map_deinit(&this->map);
+}
+
+// Returns a new id for the data, or 0 on failure.
+static inline uint64_t nf7core_exec_pending_add(
+    struct nf7core_exec_pending* this, void* data) {
+  assert(nullptr != this);
+
+  const uint64_t id = this->next;
+  if (!nf7core_exec_pending_map_insert(&this->map, id, data)) {
+    return 0;
+  }
+  ++this->next;
+  if (0U == this->next) {
+    this->next = 1;
+  }
+  return id;
+}
+
+// Removes the id and returns true with the data if it's pending.
+static inline bool nf7core_exec_pending_take(
+    struct nf7core_exec_pending* this, uint64_t id, void** data) {
+  assert(nullptr != this);
+  if (0U == id) {
+    return false;
+  }
+  return nf7core_exec_pending_map_remove(&this->map, id, data);
+}
+
+static inline uint64_t nf7core_exec_pending_count(
+    const struct nf7core_exec_pending* this) {
+  assert(nullptr != this);
+  return this->map.n;
+}
+
+// Assigns a new id to the buffer and sends it to the entity.
+// Returns the id, or 0 if failed to send, and then the ownership of buf is not
+// taken as same as nf7core_exec_entity_send().
+// PRECONDS:
+//   - The client is a unique owner of the buffer.
+static inline uint64_t nf7core_exec_pending_send(
+    struct nf7core_exec_pending* this,
+    struct nf7core_exec_entity* entity,
+    struct nf7util_buffer* buf,
+    void* data) {
+  assert(nullptr != this);
+  assert(nullptr != entity);
+  assert(nullptr != buf);
+
+  const uint64_t id = nf7core_exec_pending_add(this, data);
+  if (0U == id) {
+    return 0;
+  }
+  buf->id = id;
+  if (!nf7core_exec_entity_send(entity, buf)) {
+    nf7core_exec_pending_map_remove(&this->map, id, nullptr);
+    buf->id = 0;
+    return 0;
+  }
+  return id;
+}
@@ -0,0 +1,132 @@
+// No copyright
+#include "core/exec/pending.h"
+
+#include <string.h>
+
+#include "util/buffer.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/idea.h"
+
+#include "test/common.h"
+
+
+// answers 3 requests in reverse order
+struct reverse_ {
+  struct nf7core_exec_entity super;
+
+  struct nf7util_buffer* reqs[3];
+  uint32_t               n;
+};
+
+static const struct nf7core_exec_idea idea_;
+
+static struct nf7core_exec_entity* new_(struct nf7core_exec* exec) {
+  struct reverse_* this = nf7util_malloc_alloc(exec->malloc, sizeof(*this));
+  if (nullptr != this) {
+    *this = (struct reverse_) {
+      .super = {
+        .idea = &idea_,
+        .mod  = exec,
+      },
+    };
+  }
+  return &this->super;
+}
+static void del_(struct nf7core_exec_entity* entity) {
+  struct reverse_* this = (void*) entity;
+  for (uint32_t i = 0; i < this->n; ++i) {
+    nf7util_buffer_unref(this->reqs[i]);
+  }
+  nf7util_malloc_free(entity->mod->malloc, this);
+}
+static bool send_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  struct reverse_* this = (void*) entity;
+  this->reqs[this->n++] = buf;
+  if (3U == this->n) {
+    while (0U < this->n) {
+      struct nf7util_buffer* req = this->reqs[--this->n];
+
+      struct nf7util_buffer* res = nf7util_buffer_clone(req, nullptr);
+      const uint64_t id = req->id;
+      nf7util_buffer_unref(req);
+      if (nullptr != res) {
+        res->id = 0;
+        nf7core_exec_entity_reply(entity, id, res);
+      }
+    }
+  }
+  return true;
+}
+
+static const struct nf7core_exec_idea idea_ = {
+  .name = (const uint8_t*) "nf7core_exec_pending_test",
+  .new  = new_,
+  .del  = del_,
+  .send = send_,
+};
+
+
+struct client_ {
+  struct nf7test*             test;
+  struct nf7core_exec_pending pending;
+  uint32_t                    recvs;
+};
+
+static void on_recv_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  struct client_* this  = entity->data;
+  struct nf7test* test_ = this->test;
+
+  void* data = nullptr;
+  if (nf7test_expect(nf7core_exec_pending_take(&this->pending, buf->id, &data))) {
+    const char* expect = data;
+    nf7test_expect(strlen(expect) == buf->array.n);
+    nf7test_expect(0 == memcmp(expect, buf->array.ptr, buf->array.n));
+  }
+  ++this->recvs;
+  nf7util_buffer_unref(buf);
+}
+
+NF7TEST(nf7core_exec_pending_test_out_of_order) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+  if (!nf7test_expect(nf7core_exec_idea_register(mod, &idea_))) {
+    return false;
+  }
+
+  struct nf7core_exec_entity* entity = nf7core_exec_entity_new(
+      mod, idea_.name, strlen((const char*) idea_.name));
+  bool ret = nf7test_expect(nullptr != entity);
+
+  struct client_ client = {
+    .test = test_,
+  };
+  nf7core_exec_pending_init(&client.pending, mod->malloc);
+
+  if (ret) {
+    entity->data    = &client;
+    entity->on_recv = on_recv_;
+
+    static const char* kReqs[] = {"foo", "bar", "baz"};
+    for (uint32_t i = 0; ret && i < 3; ++i) {
+      struct nf7util_buffer* buf = nf7util_buffer_new_from_cstr(mod->malloc, kReqs[i]);
+      ret = nf7test_expect(nullptr != buf);
+      if (ret && 0U == nf7core_exec_pending_send(&client.pending, entity, buf, (void*) kReqs[i])) {
+        nf7util_buffer_unref(buf);
+        ret = nf7test_expect(false);
+      }
+    }
+    ret = ret &&
+      nf7test_expect(3 == client.recvs) &&
+      nf7test_expect(0 == nf7core_exec_pending_count(&client.pending));
+  }
+
+  nf7core_exec_pending_deinit(&client.pending);
+  nf7core_exec_entity_del(entity);
+  nf7core_exec_idea_unregister(mod, &idea_);
+  return ret;
+}
@@ -0,0 +1,168 @@
+// No copyright
+#include "core/exec/pool.h"
+
+#include <assert.h>
+
+#include "util/log.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/mod.h"
+
+
+static struct nf7core_exec_pool* get_(
+    struct nf7core_exec*, const struct nf7core_exec_idea*);
+static void shrink_(struct nf7core_exec_pool*, uint64_t);
+static void del_(struct nf7core_exec*, struct nf7core_exec_pool*);
+
+
+struct nf7core_exec_entity* nf7core_exec_pool_take(
+    struct nf7core_exec* mod, const struct nf7core_exec_idea* idea) {
+  assert(nullptr != mod);
+  assert(nullptr != idea);
+  assert(nullptr != idea->reset);
+
+  struct nf7core_exec_pool* this = get_(mod, idea);
+  if (nullptr == this) {
+    return nullptr;
+  }
+  if (0U == this->items.n) {
+    ++this->stats.misses;
+    return nullptr;
+  }
+  struct nf7core_exec_entity* entity = this->items.ptr[this->items.n-1];
+  nf7core_exec_pool_items_remove(&this->items, UINT64_MAX);
+  ++this->stats.hits;
+  return entity;
+}
+
+bool nf7core_exec_pool_put(struct nf7core_exec_entity* entity) {
+  assert(nullptr != entity);
+  assert(nullptr != entity->idea);
+  assert(nullptr != entity->idea->reset);
+  assert(nullptr == entity->offload);
+
+  struct nf7core_exec_pool* this = get_(entity->mod, entity->idea);
+  if (nullptr == this) {
+    return false;
+  }
+  if (entity->dead || this->items.n >= this->max || !entity->idea->reset(entity)) {
+    ++this->stats.drops;
+    return false;
+  }
+
+  // clears the client side
+  entity->data             = nullptr;
+  entity->on_recv          = nullptr;
+  entity->on_recv_batch    = nullptr;
+  entity->on_writable      = nullptr;
+  entity->credit.msgs_used  = 0;
+  entity->credit.bytes_used = 0;
+  entity->credit.blocked    = false;
+
+  if (!nf7core_exec_pool_items_insert(&this->items, UINT64_MAX, entity)) {
+    ++this->stats.drops;
+    return false;
+  }
+  ++this->stats.recycles;
+  return true;
+}
+
+bool nf7core_exec_pool_set_max(
+    struct nf7core_exec* mod, const struct nf7core_exec_idea* idea, uint64_t max) {
+  assert(nullptr != mod);
+  assert(nullptr != idea);
+
+  struct nf7core_exec_pool* this = get_(mod, idea);
+  if (nullptr == this) {
+    return false;
+  }
+  this->max = max;
+  shrink_(this, max);
+  return true;
+}
+
+bool nf7core_exec_pool_get_stats(
+    const struct nf7core_exec* mod, const struct nf7core_exec_idea* idea,
+    struct nf7core_exec_pool_stats* stats) {
+  assert(nullptr != mod);
+  assert(nullptr != idea);
+  assert(nullptr != stats);
+
+  struct nf7core_exec_pool* this = nullptr;
+  if (!nf7core_exec_pools_find(&mod->pools, (uintptr_t) idea, &this)) {
+    return false;
+  }
+  *stats = this->stats;
+  return true;
+}
+
+void nf7core_exec_pool_clear(
+    struct nf7core_exec* mod, const struct nf7core_exec_idea* idea) {
+  assert(nullptr != mod);
+  assert(nullptr != idea);
+
+  struct nf7core_exec_pool* this = nullptr;
+  if (nf7core_exec_pools_remove(&mod->pools, (uintptr_t) idea, &this)) {
+    del_(mod, this);
+  }
+}
+
+void nf7core_exec_pool_clear_all(struct nf7core_exec* mod) {
+  assert(nullptr != mod);
+
+  for (uint64_t i = 0; i < mod->pools.cap; ++i) {
+    if (mod->pools.ptr[i].used) {
+      del_(mod, mod->pools.ptr[i].value);
+    }
+  }
+  nf7core_exec_pools_deinit(&mod->pools);
+  nf7core_exec_pools_init(&mod->pools, mod->malloc);
+}
+
+
+static struct nf7core_exec_pool* get_(
+    struct nf7core_exec* mod, const struct nf7core_exec_idea* idea) {
+  assert(nullptr != mod);
+  assert(nullptr != idea);
+
+  struct nf7core_exec_pool** found = nf7core_exec_pools_get(&mod->pools, (uintptr_t) idea);
+  if (nullptr != found) {
+    return *found;
+  }
+  struct nf7core_exec_pool* this = nf7util_malloc_alloc(mod->malloc, sizeof(*this));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate an entity pool");
+    return nullptr;
+  }
+  *this = (struct nf7core_exec_pool) {
+    .idea = idea,
+    .max  = 0U < idea->pool_max? idea->pool_max: NF7CORE_EXEC_POOL_DEFAULT_MAX,
+  };
+  nf7core_exec_pool_items_init(&this->items, mod->malloc);
+
+  if (!nf7core_exec_pools_insert(&mod->pools, (uintptr_t) idea, this)) {
+    nf7util_log_error("failed to register an entity pool");
+    del_(mod, this);
+    return nullptr;
+  }
+  return this;
+}
+
+static void shrink_(struct nf7core_exec_pool* this, uint64_t n) {
+  assert(nullptr != this);
+
+  while (this->items.n > n) {
+    struct nf7core_exec_entity* entity = this->items.ptr[this->items.n-1];
+    nf7core_exec_pool_items_remove(&this->items, UINT64_MAX);
+    this->idea->del(entity);
+  }
+}
+
+static void del_(struct nf7core_exec* mod, struct nf7core_exec_pool* this) {
+  assert(nullptr != this);
+
+  shrink_(this, 0);
+  nf7core_exec_pool_items_deinit(&this->items);
+  nf7util_malloc_free(mod->malloc, this);
+}
@@ -0,0 +1,76 @@
+// No copyright
+//
+// Pooling recycles deleted entities of an idea to skip `new` and `del` of
+// short-lived entities.
+//
+// HOW TO USE
+//   Implement `reset` of your idea. When an entity created by
+//   nf7core_exec_entity_new() is deleted, it's reset and kept in a pool of the
+//   idea, and the next nf7core_exec_entity_new() for the idea takes it from the
+//   pool instead of calling `new`.
+//
+//   The pool keeps `pool_max` of the idea entities at most, and it can be
+//   changed at runtime by nf7core_exec_pool_set_max().
+#pragma once
+
+#include <stdint.h>
+
+#include "util/array.h"
+
+
+struct nf7core_exec;
+struct nf7core_exec_entity;
+struct nf7core_exec_idea;
+
+// A number of entities kept in a pool when `pool_max` of the idea is 0.
+#define NF7CORE_EXEC_POOL_DEFAULT_MAX 64
+
+NF7UTIL_ARRAY_INLINE(nf7core_exec_pool_items, struct nf7core_exec_entity*);
+
+struct nf7core_exec_pool_stats {
+  uint64_t hits;      // a number of entities taken from the pool
+  uint64_t misses;    // a number of entities created by `new`
+  uint64_t recycles;  // a number of entities put into the pool
+  uint64_t drops;     // a number of entities deleted because the pool is full
+                      // or reset failed
+};
+
+struct nf7core_exec_pool {
+  const struct nf7core_exec_idea* idea;
+
+  uint64_t max;
+  struct nf7core_exec_pool_items items;
+
+  struct nf7core_exec_pool_stats stats;
+};
+
+
+// Returns an entity taken from the pool of the idea, or nullptr if the pool is
+// empty.
+struct nf7core_exec_entity* nf7core_exec_pool_take(
+    struct nf7core_exec*, const struct nf7core_exec_idea*);
+// PRECONDS:
+//   - `nullptr != idea->reset`
+
+// Resets the entity and keeps it in the pool of its idea.
+// Returns false if the entity should be deleted.
+bool nf7core_exec_pool_put(struct nf7core_exec_entity*);
+// PRECONDS:
+//   - `nullptr != entity->idea->reset`
+
+// Changes a maximum number of pooled entities of the idea, and deletes
+// entities over the limit.
+bool nf7core_exec_pool_set_max(
+    struct nf7core_exec*, const struct nf7core_exec_idea*, uint64_t max);
+
+// Returns false if no pool exists for the idea.
+bool nf7core_exec_pool_get_stats(
+    const struct nf7core_exec*, const struct nf7core_exec_idea*,
+    struct nf7core_exec_pool_stats*);
+
+// Deletes all pooled entities of the idea and the pool.
+void nf7core_exec_pool_clear(
+    struct nf7core_exec*, const struct nf7core_exec_idea*);
+
+// Deletes all pools.
+void nf7core_exec_pool_clear_all(struct nf7core_exec*);
@@ -0,0 +1,87 @@
+// No copyright
+#include "core/exec/pool.h"
+
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/idea.h"
+#include "core/exec/test_idea.h"
+
+#include "test/common.h"
+
+
+struct resettable_ {
+  struct nf7core_exec_entity super;
+  uint32_t resets;
+};
+
+static const struct nf7core_exec_idea idea_;
+
+static struct nf7core_exec_entity* new_(struct nf7core_exec* exec) {
+  return nf7core_exec_test_idea_alloc(exec, &idea_, sizeof(struct resettable_));
+}
+static bool reset_(struct nf7core_exec_entity* entity) {
+  struct resettable_* this = (void*) entity;
+  ++this->resets;
+  return true;
+}
+
+static const struct nf7core_exec_idea idea_ = {
+  .name     = (const uint8_t*) "nf7core_exec_pool_test",
+  .new      = new_,
+  .del      = nf7core_exec_test_idea_del,
+  .send     = nf7core_exec_test_idea_sink,
+  .reset    = reset_,
+  .pool_max = 1,
+};
+
+
+NF7TEST(nf7core_exec_pool_test_recycle) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+  if (!nf7test_expect(nf7core_exec_idea_register(mod, &idea_))) {
+    return false;
+  }
+
+  const uint8_t* name = idea_.name;
+  const size_t   len  = strlen((const char*) name);
+
+  struct nf7core_exec_entity* a = nf7core_exec_entity_new(mod, name, len);
+  struct nf7core_exec_entity* b = nf7core_exec_entity_new(mod, name, len);
+  bool ret = nf7test_expect(nullptr != a && nullptr != b);
+  if (ret) {
+    a->data = &ret;
+
+    // `a` is pooled and `b` is dropped because pool_max is 1
+    nf7core_exec_entity_del(a);
+    nf7core_exec_entity_del(b);
+
+    struct nf7core_exec_entity* c = nf7core_exec_entity_new(mod, name, len);
+
+    struct nf7core_exec_pool_stats stats;
+    ret =
+      nf7test_expect(a == c) &&
+      nf7test_expect(nullptr == c->data) &&
+      nf7test_expect(1 == ((struct resettable_*) c)->resets) &&
+      nf7test_expect(nf7core_exec_pool_get_stats(mod, &idea_, &stats)) &&
+      nf7test_expect(1 == stats.hits) &&
+      nf7test_expect(2 == stats.misses) &&
+      nf7test_expect(1 == stats.recycles) &&
+      nf7test_expect(1 == stats.drops);
+
+    // disables the pool
+    ret = ret && nf7test_expect(nf7core_exec_pool_set_max(mod, &idea_, 0));
+    nf7core_exec_entity_del(c);
+    ret = ret &&
+      nf7test_expect(nf7core_exec_pool_get_stats(mod, &idea_, &stats)) &&
+      nf7test_expect(2 == stats.drops);
+  } else {
+    nf7core_exec_entity_del(a);
+    nf7core_exec_entity_del(b);
+  }
+  nf7core_exec_idea_unregister(mod, &idea_);
+  return ret;
+}
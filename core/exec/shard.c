@@ -0,0 +1,655 @@
+// No copyright
+#include "core/exec/shard.h"
+
+#include <assert.h>
+
+#include <uv.h>
+
+#include "nf7.h"
+
+#include "util/array.h"
+#include "util/log.h"
+#include "util/malloc.h"
+#include "util/mpsc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/idea.h"
+#include "core/exec/metrics.h"
+#include "core/exec/pool.h"
+
+
+// messages between the main loop and shards
+enum op_type_ {
+  // main -> shard
+  OP_NEW_,
+  OP_SEND_,
+  OP_CANCEL_,
+  OP_DEL_,
+  OP_STOP_,
+
+  // shard -> main
+  OP_ACK_,
+  OP_RECV_,
+  OP_FAILED_,
+  OP_DELETED_,
+};
+
+struct op_ {
+  struct nf7util_mpsc_node node;
+
+  enum op_type_  type;
+  struct proxy_* proxy;
+
+  struct nf7util_buffer* buf;
+  uint64_t               size;
+  uint64_t               id;
+};
+
+NF7UTIL_ARRAY_INLINE(nf7core_exec_shard_backlog, struct op_*);
+
+struct shard_ {
+  struct nf7core_exec_shards* shards;
+
+  uv_thread_t thread;
+  struct op_  stop;
+
+  // main -> shard
+  struct nf7util_mpsc inbox;
+
+  // touched only by the shard thread after it starts
+  uv_loop_t  uv;
+  uv_async_t async;
+  struct nf7         nf7;
+  struct nf7core_exec exec;
+};
+
+struct nf7core_exec_shards {
+  struct nf7util_malloc* malloc;
+
+  // shard -> main
+  struct nf7util_mpsc outbox;
+  uv_async_t          async;
+
+  // a number of alive proxies, which keep the main loop running
+  uint64_t proxies;
+
+  uint32_t      n;
+  struct shard_ items[];
+};
+
+struct proxy_ {
+  struct nf7core_exec_entity super;
+
+  struct shard_*                  shard;
+  const struct nf7core_exec_idea* idea;
+
+  // allocated in advance because deletion must not fail
+  struct op_* del;
+
+  // touched only by the shard thread
+  struct nf7core_exec_entity*       entity;
+  struct nf7core_exec_shard_backlog backlog;
+
+  // touched only by the main thread
+  bool deleted;
+};
+
+static bool shard_init_(
+    struct shard_*, struct nf7core_exec_shards*, const struct nf7core_exec*);
+static void shard_deinit_(struct shard_*);
+static void shard_main_(void*);
+static void shard_on_wake_(uv_async_t*);
+static void shard_flush_(struct proxy_*);
+static void shard_reply_(struct shard_*, struct op_*);
+
+static void main_on_wake_(uv_async_t*);
+static void main_handle_(struct nf7core_exec_shards*, struct op_*);
+static void main_on_close_(uv_handle_t*);
+
+static struct op_* op_new_(struct nf7util_malloc*, enum op_type_, struct proxy_*);
+static void op_push_(struct shard_*, struct op_*);
+
+static void proxy_del_(struct nf7core_exec_entity*);
+static bool proxy_send_(struct nf7core_exec_entity*, struct nf7util_buffer*);
+static bool proxy_cancel_(struct nf7core_exec_entity*, uint64_t);
+
+static void entity_on_recv_(struct nf7core_exec_entity*, struct nf7util_buffer*);
+static void entity_on_writable_(struct nf7core_exec_entity*);
+
+static const struct nf7core_exec_idea proxy_idea_ = {
+  .name    = (const uint8_t*) "nf7core_exec_shard",
+  .details = (const uint8_t*) "a proxy of an entity running on a shard",
+  .mod     = &nf7core_exec,
+  .del     = proxy_del_,
+  .send    = proxy_send_,
+  .cancel  = proxy_cancel_,
+};
+
+
+bool nf7core_exec_shard_start(struct nf7core_exec* mod, uint32_t n) {
+  assert(nullptr != mod);
+
+  if (nullptr != mod->shards) {
+    nf7util_log_warn("shards have already started");
+    return false;
+  }
+  if (0U == n) {
+    return true;
+  }
+
+  const struct nf7* nf7 = mod->super.nf7;
+
+  struct nf7core_exec_shards* this = nf7util_malloc_alloc(
+      mod->malloc, sizeof(*this) + n*sizeof(this->items[0]));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate shards");
+    return false;
+  }
+  this->malloc = mod->malloc;
+  nf7util_mpsc_init(&this->outbox);
+
+  if (0 != nf7util_log_uv(uv_async_init(nf7->uv, &this->async, main_on_wake_))) {
+    nf7util_log_error("failed to init async handle of shards");
+    nf7util_malloc_free(mod->malloc, this);
+    return false;
+  }
+  this->async.data = this;
+  uv_unref((uv_handle_t*) &this->async);
+  mod->shards = this;
+
+  for (; this->n < n; ++this->n) {
+    if (!shard_init_(&this->items[this->n], this, mod)) {
+      nf7util_log_error("failed to start shard #%" PRIu32, this->n);
+      nf7core_exec_shard_stop(mod);
+      return false;
+    }
+  }
+  nf7util_log_info("started %" PRIu32 " shards", n);
+  return true;
+}
+
+void nf7core_exec_shard_stop(struct nf7core_exec* mod) {
+  assert(nullptr != mod);
+
+  struct nf7core_exec_shards* this = mod->shards;
+  if (nullptr == this) {
+    return;
+  }
+  mod->shards = nullptr;
+  assert(0U == this->proxies);
+
+  for (uint32_t i = 0; i < this->n; ++i) {
+    struct shard_* shard = &this->items[i];
+    op_push_(shard, &shard->stop);
+    uv_thread_join(&shard->thread);
+  }
+
+  // shards may have left some replies
+  main_on_wake_(&this->async);
+  uv_close((uv_handle_t*) &this->async, main_on_close_);
+}
+
+uint32_t nf7core_exec_shard_count(const struct nf7core_exec* mod) {
+  assert(nullptr != mod);
+  return nullptr != mod->shards? mod->shards->n: 0U;
+}
+
+uint32_t nf7core_exec_shard_of(const struct nf7core_exec* mod, uint64_t key) {
+  assert(nullptr != mod);
+  assert(nullptr != mod->shards);
+  assert(0U < mod->shards->n);
+
+  // mixes the key not to bias sequential keys
+  key *= UINT64_C(0x9E3779B97F4A7C15);
+  return (uint32_t) ((key >> 32) % mod->shards->n);
+}
+
+struct nf7core_exec_entity* nf7core_exec_shard_entity_new(
+    struct nf7core_exec* mod, const uint8_t* name, size_t namelen, uint64_t key) {
+  assert(nullptr != mod);
+
+  if (0U == nf7core_exec_shard_count(mod)) {
+    return nf7core_exec_entity_new(mod, name, namelen);
+  }
+
+  const uint32_t atom = nf7util_str_atoms_find(mod->atoms, name, namelen);
+  const struct nf7core_exec_idea* idea = nf7core_exec_idea_find_by_atom(mod, atom);
+  if (nullptr == idea) {
+    nf7util_log_error("missing idea: %.*s", (int) namelen, name);
+    return nullptr;
+  }
+  if (0U == key) {
+    key = atom;
+  }
+
+  struct nf7core_exec_shards* shards = mod->shards;
+  struct shard_* shard = &shards->items[nf7core_exec_shard_of(mod, key)];
+
+  struct proxy_* this = nf7util_malloc_alloc(mod->malloc, sizeof(*this));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate a proxy");
+    return nullptr;
+  }
+  *this = (struct proxy_) {
+    .super = {
+      .idea = &proxy_idea_,
+      .mod  = mod,
+    },
+    .shard = shard,
+    .idea  = idea,
+  };
+  nf7core_exec_entity_credit_init(&this->super, NF7CORE_EXEC_SHARD_WINDOW, 0);
+
+  struct op_* new = op_new_(mod->malloc, OP_NEW_, this);
+  this->del = op_new_(mod->malloc, OP_DEL_, this);
+  if (nullptr == new || nullptr == this->del) {
+    nf7util_log_error("failed to allocate shard messages");
+    nf7util_malloc_free(mod->malloc, new);
+    nf7util_malloc_free(mod->malloc, this->del);
+    nf7util_malloc_free(mod->malloc, this);
+    return nullptr;
+  }
+  op_push_(shard, new);
+
+  if (1U == ++shards->proxies) {
+    uv_ref((uv_handle_t*) &shards->async);
+  }
+  if (mod->metrics_enabled && !nf7core_exec_metrics_attach(&this->super)) {
+    nf7util_log_warn("failed to instrument entity of '%.*s'", (int) namelen, name);
+  }
+  return &this->super;
+}
+
+
+static bool shard_init_(
+    struct shard_* this,
+    struct nf7core_exec_shards* shards,
+    const struct nf7core_exec* main) {
+  assert(nullptr != this);
+  assert(nullptr != shards);
+  assert(nullptr != main);
+
+  const struct nf7* nf7 = main->super.nf7;
+
+  *this = (struct shard_) {
+    .shards = shards,
+    .stop   = {
+      .type = OP_STOP_,
+    },
+    .nf7 = *nf7,
+  };
+  // mods on the main loop must not be touched from the shard
+  this->nf7.mods.n   = 0;
+  this->nf7.mods.ptr = nullptr;
+  nf7util_mpsc_init(&this->inbox);
+
+  if (0 != nf7util_log_uv(uv_loop_init(&this->uv))) {
+    return false;
+  }
+  this->nf7.uv = &this->uv;
+
+  if (0 != nf7util_log_uv(uv_async_init(&this->uv, &this->async, shard_on_wake_))) {
+    uv_loop_close(&this->uv);
+    return false;
+  }
+  this->async.data = this;
+
+  // entities on the shard see the shard-local module and loop
+  this->exec = (struct nf7core_exec) {
+    .super = {
+      .nf7  = &this->nf7,
+      .meta = &nf7core_exec,
+    },
+    .malloc = nf7->malloc,
+    .atoms  = nf7->atoms,
+  };
+  nf7core_exec_ideas_init(&this->exec.ideas, this->exec.malloc);
+  nf7core_exec_idea_index_init(&this->exec.idea_index, this->exec.malloc);
+  nf7core_exec_pools_init(&this->exec.pools, this->exec.malloc);
+  nf7core_exec_metrics_table_init(&this->exec.metrics, this->exec.malloc);
+
+  // copies the registry so ideas creating sub-entities work on the shard too
+  for (uint64_t i = 0; i < nf7core_exec_idea_count(main); ++i) {
+    if (!nf7core_exec_idea_register(&this->exec, nf7core_exec_idea_at(main, i))) {
+      nf7util_log_error("failed to copy the idea registry to the shard");
+      goto ABORT;
+    }
+  }
+
+  if (0 != nf7util_log_uv(uv_thread_create(&this->thread, shard_main_, this))) {
+    goto ABORT;
+  }
+  return true;
+
+ABORT:
+  shard_deinit_(this);
+  return false;
+}
+
+static void shard_deinit_(struct shard_* this) {
+  assert(nullptr != this);
+
+  nf7core_exec_pool_clear_all(&this->exec);
+  nf7core_exec_pools_deinit(&this->exec.pools);
+  nf7core_exec_metrics_clear_all(&this->exec);
+  nf7core_exec_metrics_table_deinit(&this->exec.metrics);
+  nf7core_exec_ideas_deinit(&this->exec.ideas);
+  nf7core_exec_idea_index_deinit(&this->exec.idea_index);
+
+  if (!uv_is_closing((uv_handle_t*) &this->async)) {
+    uv_close((uv_handle_t*) &this->async, nullptr);
+  }
+  uv_run(&this->uv, UV_RUN_DEFAULT);
+  if (0 != nf7util_log_uv(uv_loop_close(&this->uv))) {
+    nf7util_log_warn("failed to close shard loop gracefully");
+  }
+}
+
+static void shard_main_(void* data) {
+  struct shard_* this = data;
+  assert(nullptr != this);
+
+  uv_run(&this->uv, UV_RUN_DEFAULT);
+  shard_deinit_(this);
+}
+
+static void shard_on_wake_(uv_async_t* async) {
+  struct shard_* this = async->data;
+  assert(nullptr != this);
+
+  struct nf7util_malloc* malloc = this->exec.malloc;
+
+  struct nf7util_mpsc_node* next = nf7util_mpsc_take(&this->inbox);
+  while (nullptr != next) {
+    struct op_* op = (void*) next;
+    next = next->next;
+
+    struct proxy_* proxy = op->proxy;
+    switch (op->type) {
+    case OP_NEW_: {
+      const struct nf7core_exec_idea* idea = proxy->idea;
+      struct nf7core_exec_entity* entity = nullptr;
+      if (nullptr != idea->reset) {
+        entity = nf7core_exec_pool_take(&this->exec, idea);
+      }
+      if (nullptr == entity) {
+        entity = idea->new(&this->exec);
+      }
+      if (nullptr != entity) {
+        assert(idea == entity->idea);
+        entity->data        = proxy;
+        entity->on_recv     = entity_on_recv_;
+        entity->on_writable = entity_on_writable_;
+      }
+      proxy->entity = entity;
+      nf7core_exec_shard_backlog_init(&proxy->backlog, malloc);
+      if (nullptr != entity) {
+        nf7util_malloc_free(malloc, op);
+      } else {
+        nf7util_log_error("failed to create entity of '%s' on shard", idea->name);
+        shard_reply_(this, op);
+      }
+    } break;
+
+    case OP_SEND_:
+      if (!nf7core_exec_shard_backlog_insert(&proxy->backlog, UINT64_MAX, op)) {
+        nf7util_log_error("failed to queue a buffer on shard, the buffer is dropped");
+        nf7util_buffer_unref(op->buf);
+        shard_reply_(this, op);
+        break;
+      }
+      shard_flush_(proxy);
+      break;
+
+    case OP_CANCEL_: {
+      bool found = false;
+      for (uint64_t i = 0; i < proxy->backlog.n; ++i) {
+        struct op_* send = proxy->backlog.ptr[i];
+        if (send->buf->id == op->id) {
+          nf7core_exec_shard_backlog_remove(&proxy->backlog, i);
+          nf7util_buffer_unref(send->buf);
+          shard_reply_(this, send);
+          found = true;
+          break;
+        }
+      }
+      if (!found && nullptr != proxy->entity) {
+        nf7core_exec_entity_cancel(proxy->entity, op->id);
+      }
+      nf7util_malloc_free(malloc, op);
+    } break;
+
+    case OP_DEL_:
+      for (uint64_t i = 0; i < proxy->backlog.n; ++i) {
+        struct op_* send = proxy->backlog.ptr[i];
+        nf7util_buffer_unref(send->buf);
+        nf7util_malloc_free(malloc, send);
+      }
+      nf7core_exec_shard_backlog_deinit(&proxy->backlog);
+      nf7core_exec_entity_del(proxy->entity);
+      proxy->entity = nullptr;
+      shard_reply_(this, op);
+      break;
+
+    case OP_STOP_:
+      uv_close((uv_handle_t*) &this->async, nullptr);
+      break;
+
+    default:
+      assert(false);
+    }
+  }
+}
+
+static void shard_flush_(struct proxy_* this) {
+  assert(nullptr != this);
+
+  while (0U < this->backlog.n) {
+    struct op_* op = this->backlog.ptr[0];
+    if (nullptr == this->entity) {
+      nf7util_buffer_unref(op->buf);
+    } else if (!nf7core_exec_entity_send(this->entity, op->buf)) {
+      return;  // on_writable will flush again
+    }
+    nf7core_exec_shard_backlog_remove(&this->backlog, 0);
+    shard_reply_(this->shard, op);
+  }
+}
+
+static void shard_reply_(struct shard_* this, struct op_* op) {
+  assert(nullptr != this);
+  assert(nullptr != op);
+
+  switch (op->type) {
+  case OP_NEW_:
+    op->type = OP_FAILED_;
+    break;
+  case OP_SEND_:
+    op->type = OP_ACK_;
+    op->buf  = nullptr;
+    break;
+  case OP_DEL_:
+    op->type = OP_DELETED_;
+    break;
+  case OP_RECV_:
+    break;
+  default:
+    assert(false);
+  }
+
+  struct nf7core_exec_shards* shards = this->shards;
+  if (nf7util_mpsc_push(&shards->outbox, &op->node)) {
+    uv_async_send(&shards->async);
+  }
+}
+
+
+static void main_on_wake_(uv_async_t* async) {
+  struct nf7core_exec_shards* this = async->data;
+  assert(nullptr != this);
+
+  struct nf7util_mpsc_node* next = nf7util_mpsc_take(&this->outbox);
+  while (nullptr != next) {
+    struct op_* op = (void*) next;
+    next = next->next;
+    main_handle_(this, op);
+  }
+}
+
+static void main_handle_(struct nf7core_exec_shards* this, struct op_* op) {
+  assert(nullptr != this);
+  assert(nullptr != op);
+
+  struct proxy_* proxy = op->proxy;
+  switch (op->type) {
+  case OP_ACK_:
+    if (!proxy->deleted) {
+      nf7core_exec_entity_credit_return(&proxy->super, 1, op->size);
+    }
+    break;
+
+  case OP_RECV_:
+    if (!proxy->deleted) {
+      nf7core_exec_entity_recv(&proxy->super, op->buf);
+    } else {
+      nf7util_buffer_unref(op->buf);
+    }
+    break;
+
+  case OP_FAILED_:
+    if (!proxy->deleted) {
+      nf7core_exec_entity_die(&proxy->super);
+    }
+    break;
+
+  case OP_DELETED_:
+    assert(proxy->deleted);
+    assert(0U < this->proxies);
+    nf7util_malloc_free(this->malloc, proxy);
+    if (0U == --this->proxies) {
+      uv_unref((uv_handle_t*) &this->async);
+    }
+    break;
+
+  default:
+    assert(false);
+  }
+  nf7util_malloc_free(this->malloc, op);
+}
+
+static void main_on_close_(uv_handle_t* handle) {
+  struct nf7core_exec_shards* this = handle->data;
+  assert(nullptr != this);
+  nf7util_malloc_free(this->malloc, this);
+}
+
+
+static struct op_* op_new_(
+    struct nf7util_malloc* malloc, enum op_type_ type, struct proxy_* proxy) {
+  struct op_* this = nf7util_malloc_alloc(malloc, sizeof(*this));
+  if (nullptr != this) {
+    *this = (struct op_) {
+      .type  = type,
+      .proxy = proxy,
+    };
+  }
+  return this;
+}
+
+static void op_push_(struct shard_* shard, struct op_* op) {
+  assert(nullptr != shard);
+  assert(nullptr != op);
+
+  if (nf7util_mpsc_push(&shard->inbox, &op->node)) {
+    uv_async_send(&shard->async);
+  }
+}
+
+
+static void proxy_del_(struct nf7core_exec_entity* entity) {
+  struct proxy_* this = (void*) entity;
+  assert(nullptr != this);
+  assert(!this->deleted);
+
+  // the proxy is freed when the shard replies
+  this->deleted = true;
+  op_push_(this->shard, this->del);
+}
+
+static bool proxy_send_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  struct proxy_* this = (void*) entity;
+  assert(nullptr != this);
+  assert(nullptr != buf);
+
+  struct nf7util_malloc* malloc = entity->mod->malloc;
+
+  struct op_* op = op_new_(malloc, OP_SEND_, this);
+  if (nullptr == op) {
+    nf7util_log_error("failed to allocate a shard message");
+    return false;
+  }
+
+  // other owners may touch the buffer on the main loop
+  if (1U < buf->refcnt) {
+    struct nf7util_buffer* clone = nf7util_buffer_clone(buf, nullptr);
+    if (nullptr == clone) {
+      nf7util_log_error("failed to clone a shared buffer");
+      nf7util_malloc_free(malloc, op);
+      return false;
+    }
+    nf7util_buffer_unref(buf);
+    buf = clone;
+  }
+  op->buf  = buf;
+  op->size = buf->array.n;
+  op_push_(this->shard, op);
+  return true;
+}
+
+static bool proxy_cancel_(struct nf7core_exec_entity* entity, uint64_t id) {
+  struct proxy_* this = (void*) entity;
+  assert(nullptr != this);
+
+  struct op_* op = op_new_(entity->mod->malloc, OP_CANCEL_, this);
+  if (nullptr == op) {
+    nf7util_log_error("failed to allocate a shard message");
+    return false;
+  }
+  op->id = id;
+  op_push_(this->shard, op);
+  return true;
+}
+
+
+static void entity_on_recv_(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  struct proxy_* this = entity->data;
+  assert(nullptr != this);
+
+  struct op_* op = op_new_(entity->mod->malloc, OP_RECV_, this);
+  if (nullptr == op) {
+    nf7util_log_error("failed to allocate a shard message, the buffer is dropped");
+    nf7util_buffer_unref(buf);
+    return;
+  }
+
+  // the entity may keep touching the buffer on the shard
+  if (1U < buf->refcnt) {
+    struct nf7util_buffer* clone = nf7util_buffer_clone(buf, nullptr);
+    nf7util_buffer_unref(buf);
+    if (nullptr == clone) {
+      nf7util_log_error("failed to clone a shared buffer, the buffer is dropped");
+      nf7util_malloc_free(entity->mod->malloc, op);
+      return;
+    }
+    buf = clone;
+  }
+  op->buf = buf;
+  shard_reply_(this->shard, op);
+}
+
+static void entity_on_writable_(struct nf7core_exec_entity* entity) {
+  struct proxy_* this = entity->data;
+  assert(nullptr != this);
+  shard_flush_(this);
+}
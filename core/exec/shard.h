@@ -0,0 +1,75 @@
+// No copyright
+//
+// Sharding runs entities on additional loop threads, so independent entities
+// scale across cores instead of sharing the main loop.
+//
+// HOW TO USE
+//   Start shards by nf7core_exec_shard_start() once, and create entities by
+//   nf7core_exec_shard_entity_new() instead of nf7core_exec_entity_new(). The
+//   returned entity is a proxy living on the main loop, and the actual entity
+//   is created on a shard chosen by the key. Entities with the same key are
+//   always pinned to the same shard, and a key of 0 pins all entities of the
+//   idea to one shard.
+//
+//   Without shards, nf7core_exec_shard_entity_new() creates a local entity.
+//
+// RULES
+//   - The actual entity is created by `new` of the idea with a shard-local
+//     nf7core_exec, whose `nf7->uv` is the shard loop and whose `nf7->mods` is
+//     empty. It must not touch anything the main loop touches, including atoms
+//     interned after the shards start. Pools of the idea are separated for
+//     each shard.
+//   - Ideas registered before the shards start are copied to the shard-local
+//     registry, so an entity can create sub-entities of them on the shard.
+//     They must stay registered until the shards stop.
+//   - Buffers are handed off between threads without copies, and a buffer
+//     shared by other owners is cloned before it crosses threads in both
+//     directions.
+//   - When the actual entity fails to be created, the proxy dies after the
+//     failure is reported back to the main loop, see `dead` in
+//     core/exec/entity.h. Buffers sent before that are dropped on the shard.
+//   - Credit of the proxy is NF7CORE_EXEC_SHARD_WINDOW messages, and returned
+//     when the actual entity accepts them. Refused buffers wait on the shard
+//     until on_writable of the actual entity.
+//   - Buffers received by the actual entity are delivered to the client on the
+//     main loop in order.
+//   - Cancellation is forwarded without waiting the result, so it always
+//     succeeds on the proxy.
+//   - Deletion of the proxy is deferred until the actual entity is deleted on
+//     the shard, and alive proxies keep the main loop running.
+//   - All proxies must be deleted before the module is deleted.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+struct nf7core_exec;
+struct nf7core_exec_entity;
+struct nf7core_exec_shards;
+
+// A number of messages a proxy can send before the actual entity accepts them.
+#define NF7CORE_EXEC_SHARD_WINDOW 256
+
+
+// Starts the number of shard threads.
+// Returns false if shards have already started or failed to start.
+bool nf7core_exec_shard_start(struct nf7core_exec*, uint32_t n);
+
+// Stops all shard threads. Called when the module is deleted.
+// PRECONDS:
+//   - All proxies have been deleted.
+void nf7core_exec_shard_stop(struct nf7core_exec*);
+
+// Returns a number of running shards.
+uint32_t nf7core_exec_shard_count(const struct nf7core_exec*);
+
+// Returns an index of the shard which the key is pinned to.
+// PRECONDS:
+//   - `0 < nf7core_exec_shard_count(mod)`
+uint32_t nf7core_exec_shard_of(const struct nf7core_exec*, uint64_t key);
+
+// Creates an entity of the idea on a shard chosen by the key, and returns its
+// proxy. Returns nullptr on failure.
+struct nf7core_exec_entity* nf7core_exec_shard_entity_new(
+    struct nf7core_exec*, const uint8_t* name, size_t namelen, uint64_t key);
@@ -0,0 +1,248 @@
+// No copyright
+#include "core/exec/shard.h"
+
+#include <string.h>
+
+#include <uv.h>
+
+#include "util/buffer.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/idea.h"
+#include "core/exec/test_idea.h"
+
+#include "test/common.h"
+
+
+struct ctx_ {
+  struct nf7test*      test;
+  struct nf7core_exec* mod;
+  uv_thread_t          main;
+  uint32_t             recvs;
+};
+
+// written on the shard thread before replies
+static uv_thread_t worker_;
+
+static bool send_(struct nf7core_exec_entity* this, struct nf7util_buffer* buf) {
+  worker_ = uv_thread_self();
+
+  // keeps a reference while replying, so the buffer is cloned for the client
+  nf7util_buffer_ref(buf);
+  nf7core_exec_entity_recv(this, buf);
+  nf7util_buffer_unref(buf);
+  return true;
+}
+
+NF7CORE_EXEC_TEST_IDEA(idea_, "nf7core_exec_shard_test", send_);
+
+static struct nf7core_exec_entity* new_failed_(struct nf7core_exec*) {
+  return nullptr;
+}
+
+static const struct nf7core_exec_idea failed_idea_ = {
+  .name = (const uint8_t*) "nf7core_exec_shard_test_failed",
+  .new  = new_failed_,
+  .del  = nf7core_exec_test_idea_del,
+  .send = send_,
+};
+
+struct failed_ctx_ {
+  struct nf7test*             test;
+  struct nf7core_exec*        mod;
+  struct nf7core_exec_entity* sut;
+  uv_timer_t                  timer;
+  uint32_t                    polls;
+};
+
+static void failed_on_poll_(uv_timer_t*);
+static void failed_on_close_(uv_handle_t*);
+
+static void on_recv_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  struct ctx_*    ctx   = entity->data;
+  struct nf7test* test_ = ctx->test;
+
+  const uv_thread_t self = uv_thread_self();
+  nf7test_expect(uv_thread_equal(&self, &ctx->main));
+  nf7test_expect(!uv_thread_equal(&self, &worker_));
+  nf7test_expect(buf->array.n == 5 && 0 == memcmp(buf->array.ptr, "hello", 5));
+  nf7test_expect(buf->id == 1U + ctx->recvs);
+  nf7util_buffer_unref(buf);
+
+  if (2 == ++ctx->recvs) {
+    nf7core_exec_entity_del(entity);
+    nf7test_expect(nf7core_exec_idea_unregister(ctx->mod, &idea_));
+    nf7util_malloc_free(test_->malloc, ctx);
+    nf7test_unref(test_);
+  }
+}
+
+
+NF7TEST(nf7core_exec_shard_test_send) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+  if (0U == nf7core_exec_shard_count(mod) &&
+      !nf7test_expect(nf7core_exec_shard_start(mod, 2))) {
+    return false;
+  }
+  if (!nf7test_expect(nf7core_exec_idea_register(mod, &idea_))) {
+    return false;
+  }
+
+  struct ctx_* ctx = nf7util_malloc_alloc(test_->malloc, sizeof(*ctx));
+  if (!nf7test_expect(nullptr != ctx)) {
+    nf7core_exec_idea_unregister(mod, &idea_);
+    return false;
+  }
+  *ctx = (struct ctx_) {
+    .test = test_,
+    .mod  = mod,
+    .main = uv_thread_self(),
+  };
+
+  struct nf7core_exec_entity* sut = nf7core_exec_shard_entity_new(
+      mod, idea_.name, strlen((const char*) idea_.name), 0);
+  if (!nf7test_expect(nullptr != sut)) {
+    nf7util_malloc_free(test_->malloc, ctx);
+    nf7core_exec_idea_unregister(mod, &idea_);
+    return false;
+  }
+  sut->data    = ctx;
+  sut->on_recv = on_recv_;
+  nf7test_ref(test_);
+
+  // the second buffer is shared, so it's cloned before sending
+  struct nf7util_buffer* bufs[2] = {
+    nf7util_buffer_new_from_cstr(test_->malloc, "hello"),
+    nf7util_buffer_new_from_cstr(test_->malloc, "hello"),
+  };
+  bool ret = true;
+  for (uint32_t i = 0; i < 2; ++i) {
+    if (!nf7test_expect(nullptr != bufs[i])) {
+      ret = false;
+      continue;
+    }
+    bufs[i]->id = i + 1;
+    if (1U == i) {
+      nf7util_buffer_ref(bufs[i]);
+    }
+    if (!nf7test_expect(nf7core_exec_entity_send(sut, bufs[i]))) {
+      nf7util_buffer_unref(bufs[i]);
+      ret = false;
+    }
+  }
+  if (nullptr != bufs[1]) {
+    nf7util_buffer_unref(bufs[1]);
+  }
+  return ret;
+}
+
+NF7TEST(nf7core_exec_shard_test_affinity) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+  if (0U == nf7core_exec_shard_count(mod) &&
+      !nf7test_expect(nf7core_exec_shard_start(mod, 2))) {
+    return false;
+  }
+  const uint32_t n = nf7core_exec_shard_count(mod);
+
+  // the same key is always pinned to the same shard
+  bool     ret  = true;
+  uint32_t hits = 0;
+  for (uint64_t key = 1; ret && key <= 64; ++key) {
+    const uint32_t idx = nf7core_exec_shard_of(mod, key);
+    ret  = nf7test_expect(idx < n) && nf7test_expect(idx == nf7core_exec_shard_of(mod, key));
+    hits |= UINT32_C(1) << (idx % 32);
+  }
+  return ret && nf7test_expect(1U == n || 1U < (uint32_t) __builtin_popcount(hits));
+}
+
+NF7TEST(nf7core_exec_shard_test_failed) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+  if (0U == nf7core_exec_shard_count(mod) &&
+      !nf7test_expect(nf7core_exec_shard_start(mod, 2))) {
+    return false;
+  }
+  if (!nf7test_expect(nf7core_exec_idea_register(mod, &failed_idea_))) {
+    return false;
+  }
+
+  struct failed_ctx_* ctx = nf7util_malloc_alloc(test_->malloc, sizeof(*ctx));
+  if (!nf7test_expect(nullptr != ctx)) {
+    goto ABORT;
+  }
+  *ctx = (struct failed_ctx_) {
+    .test = test_,
+    .mod  = mod,
+  };
+
+  // the proxy is returned even though the shard fails to create the entity
+  ctx->sut = nf7core_exec_shard_entity_new(
+      mod, failed_idea_.name, strlen((const char*) failed_idea_.name), 0);
+  if (!nf7test_expect(nullptr != ctx->sut)) {
+    goto ABORT;
+  }
+  if (!nf7test_expect(0 == uv_timer_init(test_->nf7->uv, &ctx->timer))) {
+    nf7core_exec_entity_del(ctx->sut);
+    goto ABORT;
+  }
+  ctx->timer.data = ctx;
+  nf7test_ref(test_);
+  if (!nf7test_expect(0 == uv_timer_start(&ctx->timer, failed_on_poll_, 1, 1))) {
+    nf7core_exec_entity_del(ctx->sut);
+    uv_close((uv_handle_t*) &ctx->timer, failed_on_close_);
+    return false;
+  }
+  return true;
+
+ABORT:
+  nf7util_malloc_free(test_->malloc, ctx);
+  nf7core_exec_idea_unregister(mod, &failed_idea_);
+  return false;
+}
+
+static void failed_on_poll_(uv_timer_t* timer) {
+  struct failed_ctx_* ctx   = timer->data;
+  struct nf7test*     test_ = ctx->test;
+
+  // the proxy dies once the failure is reported back to the main loop, and
+  // refuses sends without waiting for on_writable
+  struct nf7util_buffer* buf = nf7util_buffer_new_from_cstr(test_->malloc, "hello");
+  if (!nf7test_expect(nullptr != buf)) {
+    goto EXIT;
+  }
+  if (nf7core_exec_entity_send(ctx->sut, buf)) {
+    if (++ctx->polls < 1000) {
+      return;
+    }
+    nf7test_expect(false && "the failure is never reported");
+  } else {
+    nf7test_expect(ctx->sut->dead);
+    nf7test_expect(!ctx->sut->credit.blocked);
+    nf7util_buffer_unref(buf);
+  }
+
+EXIT:
+  nf7core_exec_entity_del(ctx->sut);
+  uv_close((uv_handle_t*) timer, failed_on_close_);
+}
+
+static void failed_on_close_(uv_handle_t* handle) {
+  struct failed_ctx_* ctx   = handle->data;
+  struct nf7test*     test_ = ctx->test;
+
+  nf7test_expect(nf7core_exec_idea_unregister(ctx->mod, &failed_idea_));
+  nf7util_malloc_free(test_->malloc, ctx);
+  nf7test_unref(test_);
+}
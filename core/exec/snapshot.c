@@ -0,0 +1,438 @@
+// No copyright
+#include "core/exec/snapshot.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <uv.h>
+
+#include <sys/mman.h>
+
+#include "nf7.h"
+
+#include "util/array.h"
+#include "util/buffer.h"
+#include "util/hashmap.h"
+#include "util/log.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/idea.h"
+
+
+#define MAGIC_ "NF7SNAP1"
+#define MAGIC_SIZE_ 8U
+#define HEADER_SIZE_ (MAGIC_SIZE_ + sizeof(uint64_t))
+#define ENTRY_HEADER_SIZE_ (3*sizeof(uint64_t))
+
+NF7UTIL_ARRAY_INLINE(nf7core_exec_snapshot_states, struct nf7util_buffer*);
+NF7UTIL_HASHMAP_INLINE(nf7core_exec_snapshot_index, uint64_t);
+
+struct nf7core_exec_snapshot {
+  struct nf7core_exec*   mod;
+  struct nf7util_malloc* malloc;
+
+  const uint8_t* ptr;
+  uint64_t       size;
+
+  // offsets of entries in order of their save
+  struct nf7util_array_u64 offsets;
+
+  // maps a key to an index of `offsets`
+  struct nf7core_exec_snapshot_index index;
+};
+
+static bool write_file_(
+    struct nf7util_malloc*, uv_loop_t*, const char* path, const uint8_t*, uint64_t);
+static bool map_(struct nf7core_exec_snapshot*, uv_loop_t*, const char* path);
+static void unmap_(struct nf7core_exec_snapshot*);
+static bool parse_(struct nf7core_exec_snapshot*);
+static void read_entry_(
+    const struct nf7core_exec_snapshot*, uint64_t offset,
+    struct nf7core_exec_snapshot_entry*);
+
+static inline uint64_t pad_(uint64_t n) {
+  return (n + 7U) & ~UINT64_C(7);
+}
+static inline uint64_t put_(uint8_t* dst, const void* src, uint64_t n) {
+  if (0U < n) {
+    memcpy(dst, src, n);
+  }
+  return pad_(n);
+}
+static inline uint64_t load_u64_(const uint8_t* ptr) {
+  uint64_t ret;
+  memcpy(&ret, ptr, sizeof(ret));
+  return ret;
+}
+
+
+bool nf7core_exec_snapshot_save(
+    struct nf7core_exec* mod, const char* path,
+    const struct nf7core_exec_snapshot_item* items, uint64_t n) {
+  assert(nullptr != mod);
+  assert(nullptr != path);
+  assert(nullptr != items || 0U == n);
+
+  struct nf7core_exec_snapshot_states states;
+  nf7core_exec_snapshot_states_init(&states, mod->malloc);
+
+  struct nf7util_array_u8 image;
+  nf7util_array_u8_init(&image, mod->malloc);
+
+  struct nf7core_exec_snapshot_index keys;
+  nf7core_exec_snapshot_index_init(&keys, mod->malloc);
+
+  bool ret = false;
+
+  // rejects duplicated keys before taking any state, open() treats them as broken
+  for (uint64_t i = 0; i < n; ++i) {
+    if (nf7core_exec_snapshot_index_find(&keys, items[i].key, nullptr)) {
+      nf7util_log_error("duplicated key in snapshot: %" PRIu64, items[i].key);
+      goto EXIT;
+    }
+    if (!nf7core_exec_snapshot_index_insert(&keys, items[i].key, i)) {
+      nf7util_log_error("failed to allocate snapshot index");
+      goto EXIT;
+    }
+  }
+
+  // takes all states first to allocate the image at once
+  uint64_t size  = HEADER_SIZE_;
+  uint64_t count = 0;
+  for (uint64_t i = 0; i < n; ++i) {
+    struct nf7core_exec_entity*     entity = items[i].entity;
+    const struct nf7core_exec_idea* idea   = entity->idea;
+
+    struct nf7util_buffer* state = nullptr;
+    if (nullptr != idea->snapshot) {
+      state = idea->snapshot(entity);
+      if (nullptr == state) {
+        nf7util_log_error("failed to take a snapshot of '%s'", idea->name);
+        goto EXIT;
+      }
+      size += ENTRY_HEADER_SIZE_ +
+          pad_(strlen((const char*) idea->name)) + pad_(state->array.n);
+      ++count;
+    } else {
+      nf7util_log_debug("'%s' doesn't support snapshot, skipped", idea->name);
+    }
+    if (!nf7core_exec_snapshot_states_insert(&states, UINT64_MAX, state)) {
+      nf7util_buffer_unref(state);
+      goto EXIT;
+    }
+  }
+  if (!nf7util_array_u8_resize(&image, size)) {
+    nf7util_log_error("failed to allocate snapshot image");
+    goto EXIT;
+  }
+
+  // the image is zero-filled, so paddings are already zero
+  uint8_t* dst = image.ptr;
+  dst += put_(dst, MAGIC_, MAGIC_SIZE_);
+  dst += put_(dst, &count, sizeof(count));
+  for (uint64_t i = 0; i < n; ++i) {
+    const struct nf7util_buffer* state = states.ptr[i];
+    if (nullptr == state) {
+      continue;
+    }
+    const uint8_t* name = items[i].entity->idea->name;
+    const uint64_t header[] = {
+      items[i].key,
+      strlen((const char*) name),
+      state->array.n,
+    };
+    dst += put_(dst, header, sizeof(header));
+    dst += put_(dst, name, header[1]);
+    dst += put_(dst, state->array.ptr, header[2]);
+  }
+  assert(dst == image.ptr + image.n);
+
+  ret = write_file_(mod->malloc, mod->super.nf7->uv, path, image.ptr, image.n);
+  if (ret) {
+    nf7util_log_info("saved %" PRIu64 " entities to snapshot: %s", count, path);
+  }
+
+EXIT:
+  if (!ret) {
+    nf7util_log_error("failed to save snapshot: %s", path);
+  }
+  for (uint64_t i = 0; i < states.n; ++i) {
+    if (nullptr != states.ptr[i]) {
+      nf7util_buffer_unref(states.ptr[i]);
+    }
+  }
+  nf7core_exec_snapshot_states_deinit(&states);
+  nf7core_exec_snapshot_index_deinit(&keys);
+  nf7util_array_u8_deinit(&image);
+  return ret;
+}
+
+struct nf7core_exec_snapshot* nf7core_exec_snapshot_open(
+    struct nf7core_exec* mod, const char* path) {
+  assert(nullptr != mod);
+  assert(nullptr != path);
+
+  struct nf7core_exec_snapshot* this = nf7util_malloc_alloc(mod->malloc, sizeof(*this));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate snapshot context");
+    return nullptr;
+  }
+  *this = (struct nf7core_exec_snapshot) {
+    .mod    = mod,
+    .malloc = mod->malloc,
+  };
+  nf7util_array_u64_init(&this->offsets, this->malloc);
+  nf7core_exec_snapshot_index_init(&this->index, this->malloc);
+
+  if (!map_(this, mod->super.nf7->uv, path)) {
+    goto ABORT;
+  }
+  if (!parse_(this)) {
+    nf7util_log_error("snapshot is broken: %s", path);
+    goto ABORT;
+  }
+  return this;
+
+ABORT:
+  nf7core_exec_snapshot_close(this);
+  return nullptr;
+}
+
+void nf7core_exec_snapshot_close(struct nf7core_exec_snapshot* this) {
+  if (nullptr != this) {
+    unmap_(this);
+    nf7core_exec_snapshot_index_deinit(&this->index);
+    nf7util_array_u64_deinit(&this->offsets);
+    nf7util_malloc_free(this->malloc, this);
+  }
+}
+
+uint64_t nf7core_exec_snapshot_count(const struct nf7core_exec_snapshot* this) {
+  assert(nullptr != this);
+  return this->offsets.n;
+}
+
+bool nf7core_exec_snapshot_at(
+    const struct nf7core_exec_snapshot* this, uint64_t i,
+    struct nf7core_exec_snapshot_entry* entry) {
+  assert(nullptr != this);
+  assert(nullptr != entry);
+
+  if (i >= this->offsets.n) {
+    return false;
+  }
+  read_entry_(this, this->offsets.ptr[i], entry);
+  return true;
+}
+
+bool nf7core_exec_snapshot_find(
+    const struct nf7core_exec_snapshot* this, uint64_t key,
+    struct nf7core_exec_snapshot_entry* entry) {
+  assert(nullptr != this);
+  assert(nullptr != entry);
+
+  uint64_t i;
+  if (!nf7core_exec_snapshot_index_find(&this->index, key, &i)) {
+    return false;
+  }
+  return nf7core_exec_snapshot_at(this, i, entry);
+}
+
+struct nf7core_exec_entity* nf7core_exec_snapshot_restore(
+    const struct nf7core_exec_snapshot* this, uint64_t key) {
+  assert(nullptr != this);
+
+  struct nf7core_exec_snapshot_entry e;
+  if (!nf7core_exec_snapshot_find(this, key, &e)) {
+    nf7util_log_warn("no entity is saved with the key: %" PRIu64, key);
+    return nullptr;
+  }
+  return nf7core_exec_snapshot_new_entity(this->mod, e.name, e.namelen, e.state, e.size);
+}
+
+struct nf7core_exec_entity* nf7core_exec_snapshot_new_entity(
+    struct nf7core_exec* mod, const uint8_t* name, size_t namelen,
+    const uint8_t* state, uint64_t size) {
+  assert(nullptr != mod);
+  assert(nullptr != state || 0U == size);
+
+  struct nf7core_exec_entity* entity = nf7core_exec_entity_new(mod, name, namelen);
+  if (nullptr == entity) {
+    return nullptr;
+  }
+  if (nullptr == entity->idea->restore) {
+    nf7util_log_error("'%.*s' doesn't support restore", (int) namelen, name);
+    goto ABORT;
+  }
+  if (!entity->idea->restore(entity, state, size)) {
+    nf7util_log_error("failed to restore '%.*s'", (int) namelen, name);
+    goto ABORT;
+  }
+  return entity;
+
+ABORT:
+  nf7core_exec_entity_del(entity);
+  return nullptr;
+}
+
+
+static bool write_file_(
+    struct nf7util_malloc* malloc, uv_loop_t* uv,
+    const char* path, const uint8_t* ptr, uint64_t size) {
+  assert(nullptr != path);
+  assert(nullptr != ptr || 0U == size);
+
+  // writes to a temporary file, and renames it to replace the old one at once
+  const size_t pathlen = strlen(path);
+  char* tmp = nf7util_malloc_alloc(malloc, pathlen + sizeof(".tmp"));
+  if (nullptr == tmp) {
+    nf7util_log_error("failed to allocate a temporary path");
+    return false;
+  }
+  memcpy(tmp, path, pathlen);
+  memcpy(&tmp[pathlen], ".tmp", sizeof(".tmp"));
+
+  bool ret = false;
+
+  uv_fs_t req;
+  const int fd = uv_fs_open(
+      uv, &req, tmp, UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC, 0644, nullptr);
+  uv_fs_req_cleanup(&req);
+  if (0 != nf7util_log_uv(fd < 0? fd: 0)) {
+    goto EXIT;
+  }
+
+  // a single sequential write, split only when the OS writes partially
+  uint64_t written = 0;
+  while (written < size) {
+    const uint64_t rest = size - written;
+    uv_buf_t buf = uv_buf_init(
+        (char*) &ptr[written], (unsigned) (rest < UINT32_MAX? rest: UINT32_MAX));
+    const int n = uv_fs_write(uv, &req, fd, &buf, 1, -1, nullptr);
+    uv_fs_req_cleanup(&req);
+    if (0 != nf7util_log_uv(n < 0? n: 0) || 0 == n) {
+      break;
+    }
+    written += (uint64_t) n;
+  }
+  const bool synced =
+      written == size &&
+      0 == nf7util_log_uv(uv_fs_fsync(uv, &req, fd, nullptr));
+  uv_fs_req_cleanup(&req);
+  uv_fs_close(uv, &req, fd, nullptr);
+  uv_fs_req_cleanup(&req);
+
+  if (synced) {
+    ret = 0 == nf7util_log_uv(uv_fs_rename(uv, &req, tmp, path, nullptr));
+    uv_fs_req_cleanup(&req);
+  }
+  if (!ret) {
+    uv_fs_unlink(uv, &req, tmp, nullptr);
+    uv_fs_req_cleanup(&req);
+  }
+
+EXIT:
+  nf7util_malloc_free(malloc, tmp);
+  return ret;
+}
+
+static bool map_(struct nf7core_exec_snapshot* this, uv_loop_t* uv, const char* path) {
+  assert(nullptr != this);
+  assert(nullptr != path);
+
+  uv_fs_t req;
+  const int fd = uv_fs_open(uv, &req, path, UV_FS_O_RDONLY, 0, nullptr);
+  uv_fs_req_cleanup(&req);
+  if (fd < 0) {
+    nf7util_log_warn("failed to open snapshot: %s (%s)", path, uv_strerror(fd));
+    return false;
+  }
+
+  bool ret = false;
+  if (0 != nf7util_log_uv(uv_fs_fstat(uv, &req, fd, nullptr))) {
+    uv_fs_req_cleanup(&req);
+    goto EXIT;
+  }
+  const uint64_t size = req.statbuf.st_size;
+  uv_fs_req_cleanup(&req);
+  if (size < HEADER_SIZE_) {
+    nf7util_log_error("snapshot is too small: %s", path);
+    goto EXIT;
+  }
+
+  void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (MAP_FAILED == ptr) {
+    nf7util_log_error("failed to map snapshot: %s", path);
+    goto EXIT;
+  }
+  this->ptr  = ptr;
+  this->size = size;
+  ret = true;
+
+EXIT:
+  uv_fs_close(uv, &req, fd, nullptr);
+  uv_fs_req_cleanup(&req);
+  return ret;
+}
+
+static void unmap_(struct nf7core_exec_snapshot* this) {
+  assert(nullptr != this);
+
+  if (nullptr != this->ptr) {
+    munmap((void*) this->ptr, this->size);
+    this->ptr = nullptr;
+  }
+}
+
+static bool parse_(struct nf7core_exec_snapshot* this) {
+  assert(nullptr != this);
+
+  const uint8_t* ptr  = this->ptr;
+  const uint64_t size = this->size;
+  if (size < HEADER_SIZE_ || 0 != memcmp(ptr, MAGIC_, MAGIC_SIZE_)) {
+    return false;
+  }
+
+  const uint64_t count  = load_u64_(&ptr[MAGIC_SIZE_]);
+  uint64_t       offset = HEADER_SIZE_;
+  for (uint64_t i = 0; i < count; ++i) {
+    if (size - offset < ENTRY_HEADER_SIZE_) {
+      return false;
+    }
+    const uint64_t rest     = size - offset - ENTRY_HEADER_SIZE_;
+    const uint64_t key      = load_u64_(&ptr[offset]);
+    const uint64_t namelen  = load_u64_(&ptr[offset + sizeof(uint64_t)]);
+    const uint64_t statelen = load_u64_(&ptr[offset + 2*sizeof(uint64_t)]);
+    if (namelen > rest || statelen > rest || pad_(namelen) + pad_(statelen) > rest) {
+      return false;
+    }
+    if (nf7core_exec_snapshot_index_find(&this->index, key, nullptr)) {
+      return false;  // duplicated key
+    }
+    if (!nf7util_array_u64_insert(&this->offsets, UINT64_MAX, offset) ||
+        !nf7core_exec_snapshot_index_insert(&this->index, key, i)) {
+      nf7util_log_error("failed to allocate snapshot index");
+      return false;
+    }
+    offset += ENTRY_HEADER_SIZE_ + pad_(namelen) + pad_(statelen);
+  }
+  return true;
+}
+
+static void read_entry_(
+    const struct nf7core_exec_snapshot* this, uint64_t offset,
+    struct nf7core_exec_snapshot_entry* entry) {
+  assert(nullptr != this);
+  assert(nullptr != entry);
+
+  const uint8_t* ptr     = &this->ptr[offset];
+  const uint64_t namelen = load_u64_(&ptr[sizeof(uint64_t)]);
+  *entry = (struct nf7core_exec_snapshot_entry) {
+    .key     = load_u64_(ptr),
+    .name    = &ptr[ENTRY_HEADER_SIZE_],
+    .namelen = namelen,
+    .state   = &ptr[ENTRY_HEADER_SIZE_ + pad_(namelen)],
+    .size    = load_u64_(&ptr[2*sizeof(uint64_t)]),
+  };
+}
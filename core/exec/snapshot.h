@@ -0,0 +1,95 @@
+// No copyright
+//
+// Snapshot saves state of entities to a file and restores them in the next
+// process, so warm restarts take time proportional to the state size instead
+// of rebuilding it.
+//
+// HOW TO USE
+//   Implement `snapshot` and `restore` of your idea. Before exiting, pass
+//   entities with keys to nf7core_exec_snapshot_save(), which serializes them
+//   in memory and writes the file by a single sequential write. In the next
+//   process, open the file by nf7core_exec_snapshot_open(), which maps it into
+//   memory, and call nf7core_exec_snapshot_restore() with each key to create
+//   an entity and to restore its state directly from the mapped bytes.
+//
+// FILE FORMAT
+//   The file is in native byte order, so it's only for the same machine.
+//     header: magic "NF7SNAP1", a number of entries (u64)
+//     entry : key (u64), name length (u64), state size (u64),
+//             idea name, state, each of them padded to 8 bytes
+//
+// RULES
+//   - Entities whose idea doesn't implement `snapshot` are not saved.
+//   - Keys must be unique in a snapshot.
+//   - The file is replaced atomically, so a crash while saving leaves the
+//     previous snapshot.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+struct nf7core_exec;
+struct nf7core_exec_entity;
+struct nf7core_exec_snapshot;
+
+struct nf7core_exec_snapshot_item {
+  uint64_t                    key;
+  struct nf7core_exec_entity* entity;
+};
+
+// views into the mapped file, valid while the snapshot is open
+// `state` is aligned to 8 bytes
+struct nf7core_exec_snapshot_entry {
+  uint64_t key;
+
+  const uint8_t* name;
+  uint64_t       namelen;
+
+  const uint8_t* state;
+  uint64_t       size;
+};
+
+
+// Serializes the entities and writes them to the path.
+// Returns false if keys are duplicated, any entity fails to serialize, or the
+// file cannot be written. Nothing is written in that case.
+bool nf7core_exec_snapshot_save(
+    struct nf7core_exec*, const char* path,
+    const struct nf7core_exec_snapshot_item*, uint64_t n);
+
+// Maps the snapshot file at the path into memory.
+// Returns nullptr if the file is missing or broken.
+struct nf7core_exec_snapshot* nf7core_exec_snapshot_open(
+    struct nf7core_exec*, const char* path);
+
+void nf7core_exec_snapshot_close(struct nf7core_exec_snapshot*);
+
+// Returns a number of entries in the snapshot.
+uint64_t nf7core_exec_snapshot_count(const struct nf7core_exec_snapshot*);
+
+// Iterates all entries in order of their save like this:
+//   for (uint64_t i = 0; i < nf7core_exec_snapshot_count(snap); ++i) {
+//     struct nf7core_exec_snapshot_entry e;
+//     nf7core_exec_snapshot_at(snap, i, &e);
+//   }
+bool nf7core_exec_snapshot_at(
+    const struct nf7core_exec_snapshot*, uint64_t i,
+    struct nf7core_exec_snapshot_entry*);
+
+// Finds an entry by the key. Returns false if not found.
+bool nf7core_exec_snapshot_find(
+    const struct nf7core_exec_snapshot*, uint64_t key,
+    struct nf7core_exec_snapshot_entry*);
+
+// Creates an entity saved with the key and restores its state.
+// Returns nullptr if not found or failed.
+struct nf7core_exec_entity* nf7core_exec_snapshot_restore(
+    const struct nf7core_exec_snapshot*, uint64_t key);
+
+// Creates an entity of the idea and restores the state by `restore` of the
+// idea. Useful for an idea which restores its sub-entities.
+// Returns nullptr if failed.
+struct nf7core_exec_entity* nf7core_exec_snapshot_new_entity(
+    struct nf7core_exec*, const uint8_t* name, size_t namelen,
+    const uint8_t* state, uint64_t size);
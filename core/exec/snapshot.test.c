@@ -0,0 +1,206 @@
+// No copyright
+#include "core/exec/snapshot.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <uv.h>
+
+#include "util/buffer.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/idea.h"
+#include "core/exec/test_idea.h"
+
+#include "test/common.h"
+
+
+struct counter_ {
+  struct nf7core_exec_entity super;
+  uint64_t count;
+};
+
+static const struct nf7core_exec_idea idea_;
+static const struct nf7core_exec_idea idea_nosnap_;
+
+static struct nf7core_exec_entity* new_(struct nf7core_exec* exec) {
+  return nf7core_exec_test_idea_alloc(exec, &idea_, sizeof(struct counter_));
+}
+static struct nf7core_exec_entity* new_nosnap_(struct nf7core_exec* exec) {
+  return nf7core_exec_test_idea_alloc(exec, &idea_nosnap_, sizeof(struct counter_));
+}
+static bool send_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  struct counter_* this = (void*) entity;
+  ++this->count;
+  nf7util_buffer_unref(buf);
+  return true;
+}
+static struct nf7util_buffer* snapshot_(struct nf7core_exec_entity* entity) {
+  struct counter_* this = (void*) entity;
+  struct nf7util_buffer* buf = nf7util_buffer_new(entity->mod->malloc, sizeof(this->count));
+  if (nullptr != buf) {
+    memcpy(buf->array.ptr, &this->count, sizeof(this->count));
+  }
+  return buf;
+}
+static bool restore_(struct nf7core_exec_entity* entity, const uint8_t* ptr, uint64_t size) {
+  struct counter_* this = (void*) entity;
+  if (sizeof(this->count) != size) {
+    return false;
+  }
+  memcpy(&this->count, ptr, size);
+  return true;
+}
+
+static const struct nf7core_exec_idea idea_ = {
+  .name     = (const uint8_t*) "nf7core_exec_snapshot_test",
+  .new      = new_,
+  .del      = nf7core_exec_test_idea_del,
+  .send     = send_,
+  .snapshot = snapshot_,
+  .restore  = restore_,
+};
+static const struct nf7core_exec_idea idea_nosnap_ = {
+  .name = (const uint8_t*) "nf7core_exec_snapshot_test_nosnap",
+  .new  = new_nosnap_,
+  .del  = nf7core_exec_test_idea_del,
+  .send = send_,
+};
+
+static bool path_(char* path, size_t size) {
+  char   dir[1024];
+  size_t dirlen = sizeof(dir);
+  if (0 != uv_os_tmpdir(dir, &dirlen)) {
+    return false;
+  }
+  const int n = snprintf(
+      path, size, "%s/nf7core_exec_snapshot_test.%d", dir, (int) uv_os_getpid());
+  return 0 < n && (size_t) n < size;
+}
+
+
+NF7TEST(nf7core_exec_snapshot_test_save_and_restore) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  char path[1200];
+  if (!nf7test_expect(nullptr != mod) ||
+      !nf7test_expect(path_(path, sizeof(path))) ||
+      !nf7test_expect(nf7core_exec_idea_register(mod, &idea_))) {
+    return false;
+  }
+
+  struct nf7core_exec_entity* a = idea_.new(mod);
+  struct nf7core_exec_entity* b = idea_nosnap_.new(mod);
+  bool ret = nf7test_expect(nullptr != a && nullptr != b);
+  if (ret) {
+    a->idea = &idea_;
+    b->idea = &idea_nosnap_;
+    ((struct counter_*) a)->count = 42;
+
+    const struct nf7core_exec_snapshot_item items[] = {
+      {.key = 1, .entity = a},
+      {.key = 2, .entity = b},
+    };
+    ret = nf7test_expect(nf7core_exec_snapshot_save(mod, path, items, 2));
+  }
+  nf7core_exec_entity_del(a);
+  nf7core_exec_entity_del(b);
+
+  struct nf7core_exec_snapshot* snap = nullptr;
+  if (ret) {
+    snap = nf7core_exec_snapshot_open(mod, path);
+    ret = nf7test_expect(nullptr != snap);
+  }
+  if (ret) {
+    // the entity without snapshot is skipped
+    struct nf7core_exec_snapshot_entry e;
+    ret =
+        nf7test_expect(1U == nf7core_exec_snapshot_count(snap)) &&
+        nf7test_expect(nf7core_exec_snapshot_at(snap, 0, &e)) &&
+        nf7test_expect(1U == e.key && sizeof(uint64_t) == e.size) &&
+        nf7test_expect(0U == (uintptr_t) e.state % 8U) &&
+        nf7test_expect(!nf7core_exec_snapshot_find(snap, 2, &e)) &&
+        nf7test_expect(nullptr == nf7core_exec_snapshot_restore(snap, 2));
+  }
+  if (ret) {
+    struct nf7core_exec_entity* c = nf7core_exec_snapshot_restore(snap, 1);
+    ret =
+        nf7test_expect(nullptr != c) &&
+        nf7test_expect(42U == ((struct counter_*) c)->count);
+    nf7core_exec_entity_del(c);
+  }
+  nf7core_exec_snapshot_close(snap);
+
+  uv_fs_t req;
+  uv_fs_unlink(test_->nf7->uv, &req, path, nullptr);
+  uv_fs_req_cleanup(&req);
+  nf7core_exec_idea_unregister(mod, &idea_);
+  return ret;
+}
+
+NF7TEST(nf7core_exec_snapshot_test_broken) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  char path[1200];
+  if (!nf7test_expect(nullptr != mod) ||
+      !nf7test_expect(path_(path, sizeof(path)))) {
+    return false;
+  }
+  memcpy(&path[strlen(path)], ".broken", sizeof(".broken"));
+
+  // a header claims an entry which doesn't exist
+  uint8_t junk[16] = "NF7SNAP1";
+  junk[8] = 1;
+
+  uv_fs_t req;
+  const int fd = uv_fs_open(
+      test_->nf7->uv, &req, path, UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC, 0644, nullptr);
+  uv_fs_req_cleanup(&req);
+  if (!nf7test_expect(0 <= fd)) {
+    return false;
+  }
+  uv_buf_t buf = uv_buf_init((char*) junk, sizeof(junk));
+  uv_fs_write(test_->nf7->uv, &req, fd, &buf, 1, -1, nullptr);
+  uv_fs_req_cleanup(&req);
+  uv_fs_close(test_->nf7->uv, &req, fd, nullptr);
+  uv_fs_req_cleanup(&req);
+
+  const bool ret =
+      nf7test_expect(nullptr == nf7core_exec_snapshot_open(mod, path)) &&
+      nf7test_expect(nullptr == nf7core_exec_snapshot_open(mod, "/nonexistent/nf7snap"));
+
+  uv_fs_unlink(test_->nf7->uv, &req, path, nullptr);
+  uv_fs_req_cleanup(&req);
+  return ret;
+}
+
+NF7TEST(nf7core_exec_snapshot_test_duplicated_keys) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  char path[1200];
+  if (!nf7test_expect(nullptr != mod) ||
+      !nf7test_expect(path_(path, sizeof(path)))) {
+    return false;
+  }
+  memcpy(&path[strlen(path)], ".dup", sizeof(".dup"));
+
+  struct nf7core_exec_entity* a = idea_.new(mod);
+  struct nf7core_exec_entity* b = idea_.new(mod);
+  bool ret = nf7test_expect(nullptr != a && nullptr != b);
+  if (ret) {
+    // the file must not be written because open() refuses it
+    const struct nf7core_exec_snapshot_item items[] = {
+      {.key = 1, .entity = a},
+      {.key = 1, .entity = b},
+    };
+    uv_fs_t req;
+    ret =
+        nf7test_expect(!nf7core_exec_snapshot_save(mod, path, items, 2)) &&
+        nf7test_expect(0 > uv_fs_stat(test_->nf7->uv, &req, path, nullptr));
+    uv_fs_req_cleanup(&req);
+  }
+  nf7core_exec_entity_del(a);
+  nf7core_exec_entity_del(b);
+  return ret;
+}
@@ -0,0 +1,80 @@
+// No copyright
+//
+// Helpers to implement ideas for tests of entities, so that each test writes
+// only its own behaviour. Include this only from *.test.c.
+//
+// HOW TO USE
+//   An idea whose entities are plain nf7core_exec_entity is defined by
+//   NF7CORE_EXEC_TEST_IDEA() with a name and `send`, such as
+//   nf7core_exec_test_idea_echo():
+//       NF7CORE_EXEC_TEST_IDEA(
+//           idea_, "nf7core_xxx_test", nf7core_exec_test_idea_echo);
+//
+//   An idea with own context embeds nf7core_exec_entity at the head of the
+//   context, and allocates it by nf7core_exec_test_idea_alloc() in its `new`.
+//   nf7core_exec_test_idea_del() deletes both of them.
+#pragma once
+
+#include <assert.h>
+#include <string.h>
+
+#include "util/buffer.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/exec/idea.h"
+
+
+// Allocates a context of the size whose head is nf7core_exec_entity, and
+// fills it by zero except `idea` and `mod`.
+// Returns nullptr on allocation failure.
+static inline struct nf7core_exec_entity* nf7core_exec_test_idea_alloc(
+    struct nf7core_exec* exec, const struct nf7core_exec_idea* idea, uint64_t size) {
+  assert(nullptr != exec);
+  assert(nullptr != idea);
+  assert(sizeof(struct nf7core_exec_entity) <= size);
+
+  struct nf7core_exec_entity* this = nf7util_malloc_alloc(exec->malloc, size);
+  if (nullptr == this) {
+    return nullptr;
+  }
+  memset(this, 0, size);
+  *this = (struct nf7core_exec_entity) {
+    .idea = idea,
+    .mod  = exec,
+  };
+  return this;
+}
+
+// An implementation of `del` for contexts by nf7core_exec_test_idea_alloc().
+static inline void nf7core_exec_test_idea_del(struct nf7core_exec_entity* this) {
+  nf7util_malloc_free(this->mod->malloc, this);
+}
+
+// An implementation of `send` which returns the buffer to the client.
+static inline bool nf7core_exec_test_idea_echo(
+    struct nf7core_exec_entity* this, struct nf7util_buffer* buf) {
+  nf7core_exec_entity_recv(this, buf);
+  return true;
+}
+
+// An implementation of `send` which drops the buffer.
+static inline bool nf7core_exec_test_idea_sink(
+    struct nf7core_exec_entity*, struct nf7util_buffer* buf) {
+  nf7util_buffer_unref(buf);
+  return true;
+}
+
+// Defines a static idea, VAR, whose entities are plain nf7core_exec_entity.
+#define NF7CORE_EXEC_TEST_IDEA(VAR, NAME, SEND)  \
+  static const struct nf7core_exec_idea VAR;  \
+  static struct nf7core_exec_entity* VAR##new_(struct nf7core_exec* exec) {  \
+    return nf7core_exec_test_idea_alloc(  \
+        exec, &VAR, sizeof(struct nf7core_exec_entity));  \
+  }  \
+  static const struct nf7core_exec_idea VAR = {  \
+    .name = (const uint8_t*) (NAME),  \
+    .new  = VAR##new_,  \
+    .del  = nf7core_exec_test_idea_del,  \
+    .send = (SEND),  \
+  }
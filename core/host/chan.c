@@ -0,0 +1,334 @@
+// No copyright
+#include "core/host/chan.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <uv.h>
+
+#include "util/log.h"
+#include "util/malloc.h"
+
+
+#define MAGIC UINT64_C(0x6e66376873686d31)  // "nf7hshm1"
+
+struct shm_header_ {
+  uint64_t magic;
+  uint64_t cap;
+};
+
+static uint64_t ring_offset_(uint32_t i, uint64_t cap);
+static void enter_(struct nf7core_host_chan*);
+static void leave_(struct nf7core_host_chan*);
+static void del_(struct nf7core_host_chan*);
+static void wake_(struct nf7core_host_chan*);
+static void close_(struct nf7core_host_chan*);
+static void drain_(struct nf7core_host_chan*);
+
+static void on_alloc_(uv_handle_t*, size_t, uv_buf_t*);
+static void on_read_(uv_stream_t*, ssize_t, const uv_buf_t*);
+static void on_close_(uv_handle_t*);
+
+
+int nf7core_host_chan_shm_create(void) {
+  static uint32_t count = 0;
+
+  char name[64];
+  snprintf(name, sizeof(name), "/nf7core_host.%ld.%" PRIu32, (long) getpid(), count++);
+
+  const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (0 > fd) {
+    nf7util_log_error("failed to create shared memory: %s", name);
+    return -1;
+  }
+  // the object is kept alive by the fd
+  shm_unlink(name);
+  return fd;
+}
+
+struct nf7core_host_chan* nf7core_host_chan_new(
+    struct nf7util_malloc* malloc, uv_loop_t* uv, int shm_fd, uint64_t cap) {
+  assert(nullptr != malloc);
+  assert(nullptr != uv);
+  assert(0 <= shm_fd);
+
+  struct nf7core_host_chan* this = nf7util_malloc_alloc(malloc, sizeof(*this));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate a channel");
+    return nullptr;
+  }
+  *this = (struct nf7core_host_chan) {
+    .malloc = malloc,
+    .uv     = uv,
+  };
+  if (0 != nf7util_log_uv(uv_pipe_init(uv, &this->pipe, false))) {
+    nf7util_malloc_free(malloc, this);
+    return nullptr;
+  }
+  this->pipe.data = this;
+
+  const bool parent = 0U < cap;
+  if (parent) {
+    this->shm_size = ring_offset_(2, cap);
+    if (0 != ftruncate(shm_fd, (off_t) this->shm_size)) {
+      nf7util_log_error("failed to resize shared memory");
+      goto ABORT;
+    }
+  } else {
+    struct stat st;
+    if (0 != fstat(shm_fd, &st)) {
+      nf7util_log_error("failed to get size of shared memory");
+      goto ABORT;
+    }
+    this->shm_size = (uint64_t) st.st_size;
+  }
+
+  void* shm = mmap(
+      nullptr, (size_t) this->shm_size,
+      PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  if (MAP_FAILED == shm) {
+    nf7util_log_error("failed to map shared memory");
+    goto ABORT;
+  }
+  this->shm = shm;
+
+  struct shm_header_* header = shm;
+  if (parent) {
+    *header = (struct shm_header_) {
+      .magic = MAGIC,
+      .cap   = cap,
+    };
+    nf7core_host_ring_init((void*) ((uint8_t*) shm + ring_offset_(0, cap)), cap);
+    nf7core_host_ring_init((void*) ((uint8_t*) shm + ring_offset_(1, cap)), cap);
+  } else {
+    if (sizeof(*header) > this->shm_size || MAGIC != header->magic) {
+      nf7util_log_error("broken shared memory");
+      goto ABORT;
+    }
+    cap = header->cap;
+    if (64U > cap || cap > this->shm_size || ring_offset_(2, cap) != this->shm_size) {
+      nf7util_log_error("broken shared memory");
+      goto ABORT;
+    }
+  }
+  this->cap = nf7core_host_ring_align_(cap);
+
+  // parent -> child is the first ring
+  struct nf7core_host_ring* a = (void*) ((uint8_t*) shm + ring_offset_(0, cap));
+  struct nf7core_host_ring* b = (void*) ((uint8_t*) shm + ring_offset_(1, cap));
+  this->tx = parent? a: b;
+  this->rx = parent? b: a;
+  return this;
+
+ABORT:
+  del_(this);
+  return nullptr;
+}
+
+void nf7core_host_chan_del(struct nf7core_host_chan* this) {
+  if (nullptr == this) {
+    return;
+  }
+  if (0U < this->busy) {
+    this->deleted = true;
+    return;
+  }
+  del_(this);
+}
+
+bool nf7core_host_chan_open(struct nf7core_host_chan* this, int pipe_fd) {
+  assert(nullptr != this);
+  return 0 == nf7util_log_uv(uv_pipe_open(&this->pipe, pipe_fd));
+}
+
+bool nf7core_host_chan_start(struct nf7core_host_chan* this) {
+  assert(nullptr != this);
+
+  if (0 != nf7util_log_uv(uv_read_start((uv_stream_t*) &this->pipe, on_alloc_, on_read_))) {
+    return false;
+  }
+  // consumes messages written before start
+  nf7core_host_chan_resume(this);
+  return true;
+}
+
+void nf7core_host_chan_resume(struct nf7core_host_chan* this) {
+  assert(nullptr != this);
+
+  enter_(this);
+  drain_(this);
+  leave_(this);
+}
+
+bool nf7core_host_chan_send(
+    struct nf7core_host_chan* this, const struct nf7util_buffer* buf) {
+  assert(nullptr != this);
+  assert(nullptr != buf);
+  assert(buf->array.n <= nf7core_host_chan_max(this));
+
+  const struct nf7core_host_ring_meta meta = {
+    .id       = buf->id,
+    .deadline = buf->deadline,
+  };
+  bool wake = false;
+  if (!nf7core_host_ring_write(
+        this->tx, this->cap, buf->array.ptr, buf->array.n, &meta, &wake)) {
+    this->blocked = true;
+    return false;
+  }
+  if (wake) {
+    wake_(this);
+  }
+  return true;
+}
+
+
+static uint64_t ring_offset_(uint32_t i, uint64_t cap) {
+  const uint64_t header = (sizeof(struct shm_header_) + 63) & ~UINT64_C(63);
+  const uint64_t ring   = (nf7core_host_ring_size(cap) + 63) & ~UINT64_C(63);
+  return header + ring*i;
+}
+
+static void enter_(struct nf7core_host_chan* this) {
+  ++this->busy;
+}
+
+static void leave_(struct nf7core_host_chan* this) {
+  assert(0U < this->busy);
+  if (0U == --this->busy && this->deleted) {
+    del_(this);
+  }
+}
+
+static void del_(struct nf7core_host_chan* this) {
+  assert(nullptr != this);
+  assert(0U == this->busy);
+
+  if (nullptr != this->pending) {
+    nf7util_buffer_unref(this->pending);
+    this->pending = nullptr;
+  }
+  if (nullptr != this->shm) {
+    munmap(this->shm, (size_t) this->shm_size);
+    this->shm = nullptr;
+  }
+  uv_close((uv_handle_t*) &this->pipe, on_close_);
+}
+
+static void wake_(struct nf7core_host_chan* this) {
+  if (this->closed) {
+    return;
+  }
+  uv_buf_t buf = uv_buf_init("w", 1);
+
+  // a full pipe means the other side has notifications to be processed
+  const int ret = uv_try_write((uv_stream_t*) &this->pipe, &buf, 1);
+  if (0 > ret && UV_EAGAIN != ret) {
+    nf7util_log_debug("failed to wake the other side up: %s", uv_strerror(ret));
+  }
+}
+
+static void close_(struct nf7core_host_chan* this) {
+  if (this->closed) {
+    return;
+  }
+  uv_read_stop((uv_stream_t*) &this->pipe);
+  this->closed = true;
+  if (nullptr != this->on_close) {
+    this->on_close(this);
+  }
+}
+
+static void drain_(struct nf7core_host_chan* this) {
+  if (nullptr != this->pending) {
+    if (!this->on_recv(this, this->pending)) {
+      return;
+    }
+    this->pending = nullptr;
+  }
+
+  while (!this->deleted && !this->closed) {
+    const uint8_t* ptr;
+    uint64_t       len;
+    struct nf7core_host_ring_meta meta;
+    const uint8_t result = nf7core_host_ring_peek(this->rx, this->cap, &ptr, &len, &meta);
+    if (NF7CORE_HOST_RING_BROKEN == result) {
+      nf7util_log_error("the other side has broken the shared memory, closing");
+      close_(this);
+      return;
+    }
+    if (NF7CORE_HOST_RING_EMPTY == result) {
+      if (nf7core_host_ring_sleep(this->rx)) {
+        return;
+      }
+      continue;
+    }
+
+    struct nf7util_buffer* buf = nf7util_buffer_new(this->malloc, len);
+    if (nullptr != buf) {
+      if (0U < len) {
+        memcpy(buf->array.ptr, ptr, len);
+      }
+      buf->id       = meta.id;
+      buf->deadline = meta.deadline;
+    }
+    if (nf7core_host_ring_pop(this->rx, len)) {
+      wake_(this);
+    }
+
+    if (nullptr == buf) {
+      nf7util_log_error("failed to allocate a buffer, a message is dropped");
+      continue;
+    }
+    if (!this->on_recv(this, buf)) {
+      this->pending = buf;
+      return;
+    }
+  }
+}
+
+
+static void on_alloc_(uv_handle_t* handle, size_t, uv_buf_t* buf) {
+  struct nf7core_host_chan* this = handle->data;
+  *buf = uv_buf_init((char*) this->wakebuf, sizeof(this->wakebuf));
+}
+
+static void on_read_(uv_stream_t* stream, ssize_t n, const uv_buf_t*) {
+  struct nf7core_host_chan* this = stream->data;
+  if (0 == n || this->deleted) {
+    return;
+  }
+
+  enter_(this);
+  if (0 > n) {
+    if (UV_EOF != n) {
+      nf7util_log_warn("pipe error: %s", uv_strerror((int) n));
+    }
+    close_(this);
+    goto EXIT;
+  }
+
+  // a notification means either rx has messages or tx has a space
+  if (this->blocked) {
+    this->blocked = false;
+    if (nullptr != this->on_writable) {
+      this->on_writable(this);
+    }
+  }
+  if (!this->deleted) {
+    drain_(this);
+  }
+
+EXIT:
+  leave_(this);
+}
+
+static void on_close_(uv_handle_t* handle) {
+  struct nf7core_host_chan* this = handle->data;
+  nf7util_malloc_free(this->malloc, this);
+}
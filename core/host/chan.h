@@ -0,0 +1,105 @@
+// No copyright
+//
+// nf7core_host_chan is a bidirectional message channel between a parent and a
+// child process, which consists of a pair of rings on shared memory and a pipe
+// to wake each other up. Messages are copied into the shared memory directly
+// without serialization, and the pipe carries only 1-byte notifications.
+#pragma once
+
+#include <stdint.h>
+
+#include <uv.h>
+
+#include "util/buffer.h"
+#include "util/malloc.h"
+
+#include "core/host/ring.h"
+
+
+// A default capacity of each ring.
+#define NF7CORE_HOST_CHAN_DEFAULT_CAP (UINT64_C(4) << 20)
+
+struct nf7core_host_chan {
+  struct nf7util_malloc* malloc;
+  uv_loop_t*             uv;
+
+  // carries wakeup notifications only
+  uv_pipe_t pipe;
+  uint8_t   wakebuf[64];
+
+  void*    shm;
+  uint64_t shm_size;
+
+  // a capacity of each ring, kept out of the shared memory not to trust the
+  // other side
+  uint64_t cap;
+
+  struct nf7core_host_ring* rx;
+  struct nf7core_host_ring* tx;
+
+  // a received buffer refused by on_recv
+  struct nf7util_buffer* pending;
+
+  // true if tx has been full
+  bool blocked;
+
+  // true after the pipe is closed by the other side, or the other side has
+  // broken the shared memory
+  bool closed;
+
+  // a number of running callbacks, deletion is deferred while this is not 0
+  uint32_t busy;
+  bool     deleted;
+
+  void* data;
+
+  // takes ownership of the buffer only when returns true
+  // the channel stops receiving when returns false until
+  // nf7core_host_chan_resume() is called
+  bool (*on_recv)(struct nf7core_host_chan*, struct nf7util_buffer*);
+
+  // called when tx may have a space after nf7core_host_chan_send() fails
+  void (*on_writable)(struct nf7core_host_chan*);
+
+  // called when the other side has gone or broken the shared memory
+  void (*on_close)(struct nf7core_host_chan*);
+};
+
+
+// Creates a new shared memory object and returns its file descriptor,
+// or -1 on failure.
+int nf7core_host_chan_shm_create(void);
+
+// Maps the shared memory of the fd and creates a channel. The fd can be closed
+// after this. The parent passes a capacity of each ring to initialize the
+// shared memory, and the child passes 0 to use the parent's one.
+// The pipe is initialized but not opened.
+struct nf7core_host_chan* nf7core_host_chan_new(
+    struct nf7util_malloc*, uv_loop_t*, int shm_fd, uint64_t cap);
+
+// Deletes the channel. Can be called in any callback of the channel.
+void nf7core_host_chan_del(struct nf7core_host_chan*);
+
+// Opens the pipe by the fd (child only).
+bool nf7core_host_chan_open(struct nf7core_host_chan*, int pipe_fd);
+
+// Starts receiving.
+// PRECONDS:
+//   - The pipe is opened.
+bool nf7core_host_chan_start(struct nf7core_host_chan*);
+
+// Resumes receiving stopped by on_recv.
+void nf7core_host_chan_resume(struct nf7core_host_chan*);
+
+// Copies the buffer to the other side. Returns false when tx is full, and then
+// on_writable will be called.
+// PRECONDS:
+//   - `buf->array.n <= nf7core_host_chan_max(this)`
+bool nf7core_host_chan_send(
+    struct nf7core_host_chan*, const struct nf7util_buffer*);
+
+// Returns the maximum size of a message.
+static inline uint64_t nf7core_host_chan_max(const struct nf7core_host_chan* this) {
+  assert(nullptr != this);
+  return nf7core_host_ring_max(this->cap);
+}
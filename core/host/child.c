@@ -0,0 +1,233 @@
+// No copyright
+#include "core/host/child.h"
+
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <uv.h>
+
+#include "util/array.h"
+#include "util/log.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/host/chan.h"
+
+
+NF7UTIL_ARRAY_INLINE(nf7core_host_child_queue, struct nf7util_buffer*);
+
+struct nf7core_host_child {
+  struct nf7core_host*   mod;
+  struct nf7util_malloc* malloc;
+
+  // starts serving after all modules are loaded
+  uv_idle_t idle;
+
+  const char* idea_name;
+
+  struct nf7core_host_chan*   chan;
+  struct nf7core_exec_entity* entity;
+
+  // outputs of the entity waiting for a space of the ring
+  struct nf7core_host_child_queue queue;
+
+  bool stopped;
+};
+
+static void start_(uv_idle_t*);
+static void stop_(struct nf7core_host_child*);
+static void flush_(struct nf7core_host_child*);
+static void on_idle_close_(uv_handle_t*);
+
+static void on_entity_recv_(struct nf7core_exec_entity*, struct nf7util_buffer*);
+static void on_entity_writable_(struct nf7core_exec_entity*);
+static bool on_chan_recv_(struct nf7core_host_chan*, struct nf7util_buffer*);
+static void on_chan_writable_(struct nf7core_host_chan*);
+static void on_chan_close_(struct nf7core_host_chan*);
+
+
+struct nf7core_host_child* nf7core_host_child_new(
+    struct nf7core_host* mod, const char* idea_name) {
+  assert(nullptr != mod);
+  assert(nullptr != idea_name);
+
+  struct nf7core_host_child* this = nf7util_malloc_alloc(mod->malloc, sizeof(*this));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate child context");
+    return nullptr;
+  }
+  *this = (struct nf7core_host_child) {
+    .mod       = mod,
+    .malloc    = mod->malloc,
+    .idea_name = idea_name,
+  };
+  nf7core_host_child_queue_init(&this->queue, this->malloc);
+
+  if (0 != nf7util_log_uv(uv_idle_init(mod->uv, &this->idle))) {
+    nf7util_log_error("failed to init idle handle");
+    nf7core_host_child_queue_deinit(&this->queue);
+    nf7util_malloc_free(this->malloc, this);
+    return nullptr;
+  }
+  this->idle.data = this;
+  if (0 != nf7util_log_uv(uv_idle_start(&this->idle, start_))) {
+    nf7util_log_error("failed to start idle handle");
+    this->stopped = true;
+    nf7core_host_child_queue_deinit(&this->queue);
+    uv_close((uv_handle_t*) &this->idle, on_idle_close_);
+    return nullptr;
+  }
+  return this;
+}
+
+void nf7core_host_child_del(struct nf7core_host_child* this) {
+  if (nullptr != this) {
+    this->mod = nullptr;
+    stop_(this);
+  }
+}
+
+
+static void start_(uv_idle_t* idle) {
+  assert(nullptr != idle);
+  struct nf7core_host_child* this = idle->data;
+
+  uv_idle_stop(&this->idle);
+
+  const int fd = NF7CORE_HOST_SHM_FD;
+  this->chan = nf7core_host_chan_new(this->malloc, this->idle.loop, fd, 0);
+  close(fd);
+  if (nullptr == this->chan) {
+    nf7util_log_error("failed to attach to the parent process");
+    goto ABORT;
+  }
+  this->chan->data        = this;
+  this->chan->on_recv     = on_chan_recv_;
+  this->chan->on_writable = on_chan_writable_;
+  this->chan->on_close    = on_chan_close_;
+  if (!nf7core_host_chan_open(this->chan, NF7CORE_HOST_PIPE_FD)) {
+    nf7util_log_error("failed to open a pipe to the parent process");
+    goto ABORT;
+  }
+
+  this->entity = nf7core_exec_entity_new(
+      this->mod->exec,
+      (const uint8_t*) this->idea_name,
+      strlen(this->idea_name));
+  if (nullptr == this->entity) {
+    nf7util_log_error("failed to create an entity: %s", this->idea_name);
+    goto ABORT;
+  }
+  this->entity->data        = this;
+  this->entity->on_recv     = on_entity_recv_;
+  this->entity->on_writable = on_entity_writable_;
+
+  if (!nf7core_host_chan_start(this->chan)) {
+    nf7util_log_error("failed to start receiving from the parent process");
+    goto ABORT;
+  }
+  nf7util_log_info("serving idea to the parent process: %s", this->idea_name);
+  return;
+
+ABORT:
+  // the parent notices by the closed pipe
+  stop_(this);
+}
+
+static void stop_(struct nf7core_host_child* this) {
+  assert(nullptr != this);
+
+  if (this->stopped) {
+    return;
+  }
+  this->stopped = true;
+
+  if (nullptr != this->mod) {
+    this->mod->child = nullptr;
+    this->mod        = nullptr;
+  }
+  nf7core_exec_entity_del(this->entity);
+  this->entity = nullptr;
+
+  nf7core_host_chan_del(this->chan);
+  this->chan = nullptr;
+
+  for (uint64_t i = 0; i < this->queue.n; ++i) {
+    nf7util_buffer_unref(this->queue.ptr[i]);
+  }
+  nf7core_host_child_queue_deinit(&this->queue);
+
+  uv_idle_stop(&this->idle);
+  uv_close((uv_handle_t*) &this->idle, on_idle_close_);
+}
+
+static void flush_(struct nf7core_host_child* this) {
+  assert(nullptr != this);
+
+  uint64_t i = 0;
+  for (; i < this->queue.n; ++i) {
+    struct nf7util_buffer* buf = this->queue.ptr[i];
+    if (buf->array.n > nf7core_host_chan_max(this->chan)) {
+      nf7util_log_error("too large buffer is dropped: %" PRIu64 " bytes", buf->array.n);
+    } else if (!nf7core_host_chan_send(this->chan, buf)) {
+      break;  // on_chan_writable_ will be called
+    }
+    nf7util_buffer_unref(buf);
+  }
+
+  // removes the sent buffers
+  const uint64_t rest = this->queue.n - i;
+  memmove(this->queue.ptr, &this->queue.ptr[i], rest*sizeof(this->queue.ptr[0]));
+  nf7core_host_child_queue_resize(&this->queue, rest);
+}
+
+static void on_idle_close_(uv_handle_t* handle) {
+  assert(nullptr != handle);
+  struct nf7core_host_child* this = handle->data;
+  nf7util_malloc_free(this->malloc, this);
+}
+
+
+static void on_entity_recv_(
+    struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  assert(nullptr != entity);
+  struct nf7core_host_child* this = entity->data;
+
+  if (this->stopped || nullptr == this->chan) {
+    nf7util_buffer_unref(buf);
+    return;
+  }
+  if (!nf7core_host_child_queue_insert(&this->queue, UINT64_MAX, buf)) {
+    nf7util_log_error("failed to queue a buffer, it's dropped");
+    nf7util_buffer_unref(buf);
+    return;
+  }
+  flush_(this);
+}
+
+static void on_entity_writable_(struct nf7core_exec_entity* entity) {
+  assert(nullptr != entity);
+  struct nf7core_host_child* this = entity->data;
+  if (nullptr != this->chan) {
+    nf7core_host_chan_resume(this->chan);
+  }
+}
+
+static bool on_chan_recv_(
+    struct nf7core_host_chan* chan, struct nf7util_buffer* buf) {
+  assert(nullptr != chan);
+  struct nf7core_host_child* this = chan->data;
+  return nf7core_exec_entity_send(this->entity, buf);
+}
+
+static void on_chan_writable_(struct nf7core_host_chan* chan) {
+  assert(nullptr != chan);
+  flush_(chan->data);
+}
+
+static void on_chan_close_(struct nf7core_host_chan* chan) {
+  assert(nullptr != chan);
+  nf7util_log_info("the parent process has gone");
+  stop_(chan->data);
+}
@@ -0,0 +1,12 @@
+// No copyright
+#pragma once
+
+#include "core/host/mod.h"
+
+
+// Starts serving the idea to the parent process after all modules are loaded.
+struct nf7core_host_child* nf7core_host_child_new(
+    struct nf7core_host*, const char* idea_name);
+
+// Stops serving and deletes the entity.
+void nf7core_host_child_del(struct nf7core_host_child*);
@@ -0,0 +1,260 @@
+// No copyright
+#include "core/host/idea.h"
+
+#include <assert.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <uv.h>
+
+#include "util/log.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+#include "core/host/chan.h"
+
+
+struct nf7core_host_entity {
+  struct nf7core_exec_entity super;
+
+  struct nf7util_malloc* malloc;
+  uv_loop_t*             uv;
+
+  uv_process_t proc;
+  bool         spawned;
+  bool         exited;
+
+  struct nf7core_host_chan* chan;
+};
+
+static struct nf7core_exec_entity* new_(struct nf7core_exec*);
+static void del_(struct nf7core_exec_entity*);
+static bool send_(struct nf7core_exec_entity*, struct nf7util_buffer*);
+static bool spawn_(struct nf7core_host_entity*, const uint8_t*, uint64_t);
+
+static bool on_recv_(struct nf7core_host_chan*, struct nf7util_buffer*);
+static void on_writable_(struct nf7core_host_chan*);
+static void on_close_(struct nf7core_host_chan*);
+static void on_exit_(uv_process_t*, int64_t, int);
+static void on_proc_close_(uv_handle_t*);
+
+
+static struct nf7core_exec_entity* new_(struct nf7core_exec* exec) {
+  assert(nullptr != exec);
+
+  struct nf7core_host_entity* this = nf7util_malloc_alloc(exec->malloc, sizeof(*this));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate new entity");
+    return nullptr;
+  }
+  *this = (struct nf7core_host_entity) {
+    .super = {
+      .idea = &nf7core_host_idea,
+      .mod  = exec,
+    },
+    .malloc = exec->malloc,
+    .uv     = exec->super.nf7->uv,
+  };
+  return &this->super;
+}
+
+static void del_(struct nf7core_exec_entity* entity) {
+  struct nf7core_host_entity* this = (void*) entity;
+  if (nullptr == this) {
+    return;
+  }
+  nf7core_host_chan_del(this->chan);
+  this->chan = nullptr;
+
+  if (this->spawned) {
+    if (!this->exited) {
+      // the child exits by itself when the pipe is closed, but it may hang up
+      uv_process_kill(&this->proc, SIGTERM);
+    }
+    uv_close((uv_handle_t*) &this->proc, on_proc_close_);
+    return;
+  }
+  nf7util_malloc_free(this->malloc, this);
+}
+
+static bool send_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  assert(nullptr != entity);
+  assert(nullptr != buf);
+
+  struct nf7core_host_entity* this = (void*) entity;
+
+  // INIT state
+  if (!this->spawned) {
+    const uint8_t* name    = buf->array.ptr;
+    const uint64_t namelen = buf->array.n;
+    if (0U == namelen) {
+      nf7util_log_warn("expected an idea name, but got an empty string");
+      goto EXIT;
+    }
+
+    const bool ok = spawn_(this, name, namelen);
+    struct nf7util_buffer* result = nf7util_buffer_new_from_cstr(this->malloc, ok? "": "FAIL");
+    if (nullptr == result) {
+      nf7util_log_error("failed to allocate a buffer to return result");
+    } else {
+      nf7core_exec_entity_recv(&this->super, result);
+    }
+    if (!ok) {
+      nf7core_exec_entity_die(&this->super);
+    }
+    goto EXIT;
+  }
+
+  // PIPE state
+  //   the entity dies when the channel is closed, and sends are refused before
+  //   reaching here
+  assert(nullptr != this->chan && !this->chan->closed);
+  if (buf->array.n > NF7CORE_HOST_BUFFER_MAX) {
+    nf7util_log_error(
+        "too large buffer is refused: %" PRIu64 " > %" PRIu64 " bytes",
+        buf->array.n, NF7CORE_HOST_BUFFER_MAX);
+    return false;
+  }
+  if (!nf7core_host_chan_send(this->chan, buf)) {
+    return false;  // on_writable_ will be called
+  }
+
+EXIT:
+  nf7util_buffer_unref(buf);
+  return true;
+}
+
+static bool spawn_(
+    struct nf7core_host_entity* this, const uint8_t* name, uint64_t namelen) {
+  assert(nullptr != this);
+  assert(!this->spawned);
+
+  bool ret = false;
+
+  char   exe[4096];
+  size_t exelen = sizeof(exe);
+  if (0 != nf7util_log_uv(uv_exepath(exe, &exelen))) {
+    nf7util_log_error("failed to get a path to the executable");
+    return false;
+  }
+
+  char* idea = nf7util_malloc_alloc(this->malloc, namelen+1);
+  if (nullptr == idea) {
+    nf7util_log_error("failed to allocate an idea name");
+    return false;
+  }
+  memcpy(idea, name, namelen);
+  idea[namelen] = 0;
+
+  const int fd = nf7core_host_chan_shm_create();
+  if (0 > fd) {
+    goto EXIT;
+  }
+  this->chan = nf7core_host_chan_new(this->malloc, this->uv, fd, NF7CORE_HOST_CHAN_DEFAULT_CAP);
+  if (nullptr == this->chan) {
+    nf7util_log_error("failed to create a channel");
+    goto EXIT;
+  }
+  this->chan->data        = this;
+  this->chan->on_recv     = on_recv_;
+  this->chan->on_writable = on_writable_;
+  this->chan->on_close    = on_close_;
+
+  char* args[] = { exe, NF7CORE_HOST_ARG, idea, nullptr, };
+  uv_stdio_container_t stdio[] = {
+    [0] = { .flags = UV_INHERIT_FD, .data.fd = 0, },
+    [1] = { .flags = UV_INHERIT_FD, .data.fd = 1, },
+    [2] = { .flags = UV_INHERIT_FD, .data.fd = 2, },
+    [NF7CORE_HOST_PIPE_FD] = {
+      .flags       = UV_CREATE_PIPE | UV_READABLE_PIPE | UV_WRITABLE_PIPE,
+      .data.stream = (uv_stream_t*) &this->chan->pipe,
+    },
+    [NF7CORE_HOST_SHM_FD] = { .flags = UV_INHERIT_FD, .data.fd = fd, },
+  };
+  const uv_process_options_t opts = {
+    .exit_cb     = on_exit_,
+    .file        = exe,
+    .args        = args,
+    .stdio_count = sizeof(stdio)/sizeof(stdio[0]),
+    .stdio       = stdio,
+  };
+
+  // the handle needs to be closed even if failed
+  this->spawned   = true;
+  this->proc.data = this;
+  if (0 != nf7util_log_uv(uv_spawn(this->uv, &this->proc, &opts))) {
+    nf7util_log_error("failed to spawn child process for idea: %s", idea);
+    this->exited = true;
+    goto EXIT;
+  }
+  nf7util_log_info("child process for idea '%s' is spawned: pid=%d", idea, this->proc.pid);
+
+  if (!nf7core_host_chan_start(this->chan)) {
+    nf7util_log_error("failed to start receiving from child process");
+    goto EXIT;
+  }
+  ret = true;
+
+EXIT:
+  if (!ret) {
+    nf7core_host_chan_del(this->chan);
+    this->chan = nullptr;
+  }
+  if (0 <= fd) {
+    close(fd);
+  }
+  nf7util_malloc_free(this->malloc, idea);
+  return ret;
+}
+
+
+static bool on_recv_(struct nf7core_host_chan* chan, struct nf7util_buffer* buf) {
+  assert(nullptr != chan);
+  struct nf7core_host_entity* this = chan->data;
+  nf7core_exec_entity_recv(&this->super, buf);
+  return true;
+}
+
+static void on_writable_(struct nf7core_host_chan* chan) {
+  assert(nullptr != chan);
+  struct nf7core_host_entity* this = chan->data;
+  nf7core_exec_entity_credit_return(&this->super, 0, 0);
+}
+
+static void on_close_(struct nf7core_host_chan* chan) {
+  assert(nullptr != chan);
+  struct nf7core_host_entity* this = chan->data;
+
+  nf7util_log_error("lost connection to child process");
+  nf7core_exec_entity_die(&this->super);
+}
+
+static void on_exit_(uv_process_t* proc, int64_t status, int sig) {
+  assert(nullptr != proc);
+  struct nf7core_host_entity* this = proc->data;
+
+  this->exited = true;
+  if (0 != status || 0 != sig) {
+    nf7util_log_warn(
+        "child process exited abnormally: status=%" PRId64 ", signal=%d", status, sig);
+  } else {
+    nf7util_log_info("child process exited");
+  }
+}
+
+static void on_proc_close_(uv_handle_t* handle) {
+  assert(nullptr != handle);
+  struct nf7core_host_entity* this = handle->data;
+  nf7util_malloc_free(this->malloc, this);
+}
+
+
+const struct nf7core_exec_idea nf7core_host_idea = {
+  .name    = (const uint8_t*) "nf7core_host",
+  .details = (const uint8_t*) "runs an entity of other idea in a child process",
+  .mod     = &nf7core_host,
+
+  .new  = new_,
+  .del  = del_,
+  .send = send_,
+};
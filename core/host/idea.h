@@ -0,0 +1,12 @@
+// No copyright
+#pragma once
+
+#include "core/host/chan.h"
+#include "core/host/mod.h"
+
+
+extern const struct nf7core_exec_idea nf7core_host_idea;
+
+// The largest buffer that an entity of nf7core_host passes in PIPE state.
+#define NF7CORE_HOST_BUFFER_MAX  \
+    nf7core_host_ring_max(NF7CORE_HOST_CHAN_DEFAULT_CAP)
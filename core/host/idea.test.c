@@ -0,0 +1,207 @@
+// No copyright
+#include "core/host/idea.h"
+
+#include <string.h>
+
+#include <uv.h>
+
+#include "util/buffer.h"
+#include "util/malloc.h"
+
+#include "core/exec/entity.h"
+
+#include "test/common.h"
+
+
+// a time limit of a round trip to the child process
+#define TIMEOUT_ 10000
+
+// an interval to watch the entity die
+#define POLL_ 10
+
+struct ctx_ {
+  struct nf7test*             test;
+  struct nf7core_exec_entity* sut;
+  uv_timer_t                  timer;
+  uint32_t                    recvs;
+  uint64_t                    polls;
+};
+
+static struct ctx_* ctx_new_(struct nf7test*);
+static bool send_cstr_(struct ctx_*, const char* str, uint64_t chan);
+static void on_recv_(struct nf7core_exec_entity*, struct nf7util_buffer*);
+static void on_timeout_(uv_timer_t*);
+static void on_poll_(uv_timer_t*);
+static void finish_(struct ctx_*);
+static void on_close_(uv_handle_t*);
+
+
+// spawns a child process running nf7core_any_mux, and opens a channel on it
+NF7TEST(nf7core_host_idea_test_round_trip) {
+  struct ctx_* ctx = ctx_new_(test_);
+  if (nullptr == ctx) {
+    return false;
+  }
+  ctx->sut->on_recv = on_recv_;
+
+  const bool ret =
+      nf7test_expect(0 == uv_timer_start(&ctx->timer, on_timeout_, TIMEOUT_, 0)) &&
+      send_cstr_(ctx, "nf7core_any_mux", 0) &&
+      nf7test_expect(1U == ctx->recvs) &&
+      send_cstr_(ctx, "nf7core_any", 1);
+  if (!ret) {
+    finish_(ctx);
+  }
+  return ret;
+}
+
+// refuses a buffer over the limit, and dies after the child process exits
+// because of a missing idea
+NF7TEST(nf7core_host_idea_test_death) {
+  struct ctx_* ctx = ctx_new_(test_);
+  if (nullptr == ctx) {
+    return false;
+  }
+
+  // the child process is spawned successfully, and exits soon
+  if (!send_cstr_(ctx, "nf7core_host_idea_test_missing", 0)) {
+    finish_(ctx);
+    return false;
+  }
+
+  struct nf7util_buffer* buf =
+      nf7util_buffer_new(test_->malloc, NF7CORE_HOST_BUFFER_MAX + 1U);
+  if (!nf7test_expect(nullptr != buf)) {
+    finish_(ctx);
+    return false;
+  }
+  memset(buf->array.ptr, 0, buf->array.n);
+  const bool refused = !nf7core_exec_entity_send(ctx->sut, buf);
+  nf7util_buffer_unref(buf);
+
+  const bool ret =
+      nf7test_expect(refused) &&
+      nf7test_expect(!ctx->sut->dead) &&
+      nf7test_expect(0 == uv_timer_start(&ctx->timer, on_poll_, POLL_, POLL_));
+  if (!ret) {
+    finish_(ctx);
+  }
+  return ret;
+}
+
+static struct ctx_* ctx_new_(struct nf7test* test_) {
+  struct nf7core_exec* mod =
+      (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_exec);
+  if (!nf7test_expect(nullptr != mod)) {
+    return nullptr;
+  }
+
+  struct ctx_* ctx = nf7util_malloc_alloc(test_->malloc, sizeof(*ctx));
+  if (!nf7test_expect(nullptr != ctx)) {
+    return nullptr;
+  }
+  *ctx = (struct ctx_) {
+    .test = test_,
+  };
+
+  const char* name = (const char*) nf7core_host_idea.name;
+  ctx->sut = nf7core_exec_entity_new(mod, (const uint8_t*) name, strlen(name));
+  if (!nf7test_expect(nullptr != ctx->sut)) {
+    nf7util_malloc_free(test_->malloc, ctx);
+    return nullptr;
+  }
+  ctx->sut->data = ctx;
+
+  if (!nf7test_expect(0 == uv_timer_init(test_->nf7->uv, &ctx->timer))) {
+    nf7core_exec_entity_del(ctx->sut);
+    nf7util_malloc_free(test_->malloc, ctx);
+    return nullptr;
+  }
+  ctx->timer.data = ctx;
+  nf7test_ref(test_);
+  return ctx;
+}
+
+static bool send_cstr_(struct ctx_* ctx, const char* str, uint64_t chan) {
+  struct nf7test* test_ = ctx->test;
+
+  // a buffer to the mux is prefixed by a channel id
+  const uint64_t prefix = 0U < chan? 8U: 0U;
+  const uint64_t len    = strlen(str);
+  struct nf7util_buffer* buf = nf7util_buffer_new(test_->malloc, prefix + len);
+  if (!nf7test_expect(nullptr != buf)) {
+    return false;
+  }
+  if (0U < prefix) {
+    memset(buf->array.ptr, 0, prefix);
+    buf->array.ptr[7] = (uint8_t) chan;
+  }
+  memcpy(&buf->array.ptr[prefix], str, len);
+  if (!nf7test_expect(nf7core_exec_entity_send(ctx->sut, buf))) {
+    nf7util_buffer_unref(buf);
+    return false;
+  }
+  return true;
+}
+
+static void on_recv_(struct nf7core_exec_entity* entity, struct nf7util_buffer* buf) {
+  struct ctx_*    ctx   = entity->data;
+  struct nf7test* test_ = ctx->test;
+
+  switch (ctx->recvs++) {
+  case 0:
+    // the child process is spawned
+    nf7test_expect(0U == buf->array.n);
+    break;
+  case 1:
+    // the mux in the child process has opened the channel
+    nf7test_expect(8U == buf->array.n && 1U == buf->array.ptr[7]);
+    finish_(ctx);
+    break;
+  default:
+    nf7test_expect(false && "unexpected buffer");
+    break;
+  }
+  nf7util_buffer_unref(buf);
+}
+
+static void on_timeout_(uv_timer_t* timer) {
+  struct ctx_*    ctx   = timer->data;
+  struct nf7test* test_ = ctx->test;
+  nf7test_expect(false && "no reply from the child process");
+  finish_(ctx);
+}
+
+static void on_poll_(uv_timer_t* timer) {
+  struct ctx_*    ctx   = timer->data;
+  struct nf7test* test_ = ctx->test;
+
+  if (!ctx->sut->dead) {
+    if (!nf7test_expect(++ctx->polls < TIMEOUT_/POLL_)) {
+      finish_(ctx);
+    }
+    return;
+  }
+
+  struct nf7util_buffer* buf = nf7util_buffer_new(test_->malloc, 0);
+  if (nf7test_expect(nullptr != buf)) {
+    nf7test_expect(!nf7core_exec_entity_send(ctx->sut, buf));
+    nf7util_buffer_unref(buf);
+  }
+  finish_(ctx);
+}
+
+static void finish_(struct ctx_* ctx) {
+  if (nullptr != ctx->sut) {
+    nf7core_exec_entity_del(ctx->sut);
+    ctx->sut = nullptr;
+    uv_close((uv_handle_t*) &ctx->timer, on_close_);
+  }
+}
+
+static void on_close_(uv_handle_t* handle) {
+  struct ctx_*    ctx   = handle->data;
+  struct nf7test* test_ = ctx->test;
+  nf7util_malloc_free(test_->malloc, ctx);
+  nf7test_unref(test_);
+}
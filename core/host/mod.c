@@ -0,0 +1,84 @@
+// No copyright
+#include "core/host/mod.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util/log.h"
+
+#include "core/exec/idea.h"
+#include "core/host/child.h"
+#include "core/host/idea.h"
+
+
+static void del_(struct nf7_mod*);
+
+
+struct nf7_mod* nf7core_host_new(struct nf7* nf7) {
+  assert(nullptr != nf7);
+
+  // find nf7core_exec
+  struct nf7core_exec* exec = (void*) nf7_get_mod_by_meta(nf7, &nf7core_exec);
+  if (nullptr == exec) {
+    nf7util_log_error("not found nf7core_exec, nf7core_host is disabled");
+    return nullptr;
+  }
+
+  // create module data
+  struct nf7core_host* this = nf7util_malloc_alloc(nf7->malloc, sizeof(*this));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate module context");
+    return nullptr;
+  }
+  *this = (struct nf7core_host) {
+    .super = {
+      .nf7  = nf7,
+      .meta = &nf7core_host,
+    },
+    .malloc = nf7->malloc,
+    .uv     = nf7->uv,
+    .exec   = exec,
+  };
+
+  // register idea
+  if (!nf7core_exec_idea_register(exec, &nf7core_host_idea)) {
+    nf7util_log_error("failed to register an idea, nf7core_host");
+    goto ABORT;
+  }
+
+  // serve the parent process if launched as a child
+  for (uint32_t i = 1; i+1 < nf7->argc; ++i) {
+    if (0 == strcmp(nf7->argv[i], NF7CORE_HOST_ARG)) {
+      this->child = nf7core_host_child_new(this, nf7->argv[i+1]);
+      if (nullptr == this->child) {
+        nf7util_log_error("failed to start serving the parent process");
+        goto ABORT;
+      }
+      break;
+    }
+  }
+  return &this->super;
+
+ABORT:
+  del_(&this->super);
+  return nullptr;
+}
+
+static void del_(struct nf7_mod* mod) {
+  struct nf7core_host* this = (void*) mod;
+  if (nullptr != this) {
+    nf7core_host_child_del(this->child);
+    nf7util_malloc_free(this->malloc, this);
+  }
+}
+
+const struct nf7_mod_meta nf7core_host = {
+  .name = (const uint8_t*) "nf7core_host",
+  .desc = (const uint8_t*) "executes ideas in child processes",
+  .ver  = NF7_VERSION,
+
+  .hosted = true,
+
+  .del = del_,
+};
@@ -0,0 +1,56 @@
+// No copyright
+//
+// This module provides an idea, nf7core_host.  Its entity runs an entity of
+// other idea in a child process, so that a crash of the idea never takes Nf7
+// down.
+//
+// An entity of idea, nf7core_host, is composed of 2 states as same as
+// nf7core_any:
+// INIT state:
+//   Accepts a string that expressing idea name and returns a string.  If the
+//   returned string is empty, transitions to PIPE state with a child process
+//   running an entity of the specified idea, otherwise error.
+// PIPE state:
+//   All buffers from the client is passed to the entity in the child process,
+//   and from the entity is to the client.
+//   - A buffer from the client larger than NF7CORE_HOST_BUFFER_MAX is refused,
+//     so the client should split it by itself.  One from the entity is dropped
+//     with an error log.
+//   - When the child process has gone, the entity dies as described in
+//     core/exec/entity.h: a blocked client is notified by on_writable, and all
+//     buffers are refused after that.
+//   The entity dies also when it fails to spawn a child process in INIT state.
+//
+// The child process is Nf7 itself launched with `--nf7core-host <idea name>`,
+// which loads only modules marked as `hosted` in their meta, so tests, UI and
+// the initial entity never run in the child.
+// Buffers are exchanged through rings on shared memory, see core/host/chan.h.
+#pragma once
+
+#include <uv.h>
+
+#include "nf7.h"
+
+#include "core/exec/mod.h"
+
+
+struct nf7core_host_child;
+
+struct nf7core_host {
+  struct nf7_mod super;
+
+  struct nf7util_malloc* malloc;
+  uv_loop_t*             uv;
+  struct nf7core_exec*   exec;
+
+  // not nullptr only in the child process
+  struct nf7core_host_child* child;
+};
+extern const struct nf7_mod_meta nf7core_host;
+
+// an argument to launch the child process
+#define NF7CORE_HOST_ARG "--nf7core-host"
+
+// fds passed to the child process
+#define NF7CORE_HOST_PIPE_FD 3
+#define NF7CORE_HOST_SHM_FD  4
@@ -0,0 +1,246 @@
+// No copyright
+//
+// nf7core_host_ring is a lock-free single-producer single-consumer queue of
+// variable-length messages, which is placed on memory shared between 2
+// processes.
+//
+// LAYOUT
+//   Each message is an 8-byte length and nf7core_host_ring_meta followed by its
+//   payload padded to 8 bytes.
+//   When a message doesn't fit the rest of the data area, the producer puts a
+//   wrap marker (length of UINT64_MAX) and writes the message from the head.
+//   `head` and `tail` increase monotonically, so `head - tail` is the number of
+//   used bytes.
+//
+// TRUST
+//   The other process may be broken, so nothing it can write is trusted. Each
+//   side passes `cap` known by itself instead of reading it from the shared
+//   memory, and the consumer validates positions and lengths of messages
+//   before touching them. nf7core_host_ring_peek() reports a broken ring, and
+//   the consumer should treat the other side as dead then.
+//
+// WAKEUP
+//   The ring never sleeps by itself. It only tells when the other side should
+//   be woken up:
+//   - The consumer sets `waiting` before sleeping, and the producer wakes it
+//     when nf7core_host_ring_write() reports so.
+//   - The producer sets `blocked` when the ring is full, and the consumer wakes
+//     it when nf7core_host_ring_pop() reports so.
+#pragma once
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+
+#define NF7CORE_HOST_RING_WRAP UINT64_MAX
+
+// results of nf7core_host_ring_peek()
+#define NF7CORE_HOST_RING_EMPTY  0
+#define NF7CORE_HOST_RING_OK     1
+#define NF7CORE_HOST_RING_BROKEN 2
+
+// metadata of nf7util_buffer carried with each message
+struct nf7core_host_ring_meta {
+  uint64_t id;
+  uint64_t deadline;
+};
+
+// bytes before each payload
+#define NF7CORE_HOST_RING_HEADER  \
+    (sizeof(uint64_t) + sizeof(struct nf7core_host_ring_meta))
+
+static_assert(2 == ATOMIC_LLONG_LOCK_FREE, "the ring requires lock-free 64bit atomics");
+
+struct nf7core_host_ring {
+  // written by the producer
+  alignas(64) _Atomic uint64_t head;
+  _Atomic uint32_t blocked;
+
+  // written by the consumer
+  alignas(64) _Atomic uint64_t tail;
+  _Atomic uint32_t waiting;
+
+  // written by the parent at init, a multiple of 8
+  //   Don't read this after the other side starts, see TRUST.
+  alignas(64) uint64_t cap;
+  alignas(8)  uint8_t  data[];
+};
+
+
+static inline uint64_t nf7core_host_ring_align_(uint64_t n) {
+  return (n + 7) & ~UINT64_C(7);
+}
+
+// Returns bytes needed for a ring with the capacity.
+static inline uint64_t nf7core_host_ring_size(uint64_t cap) {
+  return sizeof(struct nf7core_host_ring) + nf7core_host_ring_align_(cap);
+}
+
+// Returns the maximum payload size that a ring with the capacity can accept.
+// Any message under this is accepted eventually when the consumer is working.
+static inline uint64_t nf7core_host_ring_max(uint64_t cap) {
+  return cap/2 - NF7CORE_HOST_RING_HEADER;
+}
+
+// PRECONDS:
+//   - The memory has nf7core_host_ring_size(cap) bytes.
+//   - The other side doesn't touch the ring until this returns.
+// POSTCONDS:
+//   - The ring's capacity is `nf7core_host_ring_align_(cap)`.
+static inline void nf7core_host_ring_init(
+    struct nf7core_host_ring* this, uint64_t cap) {
+  assert(nullptr != this);
+  assert(64U <= cap);
+
+  atomic_init(&this->head,    0);
+  atomic_init(&this->blocked, 0);
+  atomic_init(&this->tail,    0);
+  atomic_init(&this->waiting, 0);
+  this->cap = nf7core_host_ring_align_(cap);
+}
+
+static inline bool nf7core_host_ring_empty(struct nf7core_host_ring* this) {
+  assert(nullptr != this);
+  return
+      atomic_load_explicit(&this->head, memory_order_acquire) ==
+      atomic_load_explicit(&this->tail, memory_order_relaxed);
+}
+
+
+// ---- producer side
+// Copies the message into the ring. Returns false when the ring is full, and
+// then the consumer is asked to wake the producer up after the next pop.
+// `*wake` is set to true if the consumer should be woken up.
+// PRECONDS:
+//   - `cap` is the capacity of the ring known by the producer.
+//   - `len <= nf7core_host_ring_max(cap)`
+static inline bool nf7core_host_ring_write(
+    struct nf7core_host_ring* this, uint64_t cap,
+    const uint8_t* ptr, uint64_t len,
+    const struct nf7core_host_ring_meta* meta, bool* wake) {
+  assert(nullptr != this);
+  assert(0U == cap%8U);
+  assert(nullptr != ptr || 0U == len);
+  assert(nullptr != meta);
+  assert(len <= nf7core_host_ring_max(cap));
+  assert(nullptr != wake);
+
+  const uint64_t need = NF7CORE_HOST_RING_HEADER + nf7core_host_ring_align_(len);
+  const uint64_t head = atomic_load_explicit(&this->head, memory_order_relaxed);
+
+  const uint64_t pos    = head % cap;
+  const uint64_t contig = cap - pos;
+  const uint64_t total  = need > contig? contig + need: need;
+
+  // a broken tail beyond the head or too far behind is treated as full
+  const uint64_t tail = atomic_load_explicit(&this->tail, memory_order_acquire);
+  if (head - tail > cap || cap - (head - tail) < total) {
+    // asks the consumer for the notification and checks again because it may
+    // have popped before seeing the flag
+    atomic_store(&this->blocked, 1);
+    const uint64_t tail2 = atomic_load(&this->tail);
+    if (head - tail2 > cap || cap - (head - tail2) < total) {
+      *wake = false;
+      return false;
+    }
+  }
+
+  uint64_t at = head;
+  if (need > contig) {
+    const uint64_t wrap = NF7CORE_HOST_RING_WRAP;
+    memcpy(&this->data[pos], &wrap, sizeof(wrap));
+    at += contig;
+  }
+  uint8_t* dst = &this->data[at % cap];
+  memcpy(dst, &len, sizeof(len));
+  memcpy(dst + sizeof(len), meta, sizeof(*meta));
+  if (0U < len) {
+    memcpy(dst + NF7CORE_HOST_RING_HEADER, ptr, len);
+  }
+  atomic_store_explicit(&this->head, at + need, memory_order_seq_cst);
+
+  *wake = 0U != atomic_exchange(&this->waiting, 0);
+  return true;
+}
+
+
+// ---- consumer side
+// Finds the oldest message without removing it.
+// Returns NF7CORE_HOST_RING_OK with the message, NF7CORE_HOST_RING_EMPTY, or
+// NF7CORE_HOST_RING_BROKEN if the producer has written invalid positions or
+// lengths. Nothing outside the ring is read even if it's broken.
+// PRECONDS:
+//   - `cap` is the capacity of the ring known by the consumer.
+static inline uint8_t nf7core_host_ring_peek(
+    struct nf7core_host_ring* this, uint64_t cap,
+    const uint8_t** ptr, uint64_t* len, struct nf7core_host_ring_meta* meta) {
+  assert(nullptr != this);
+  assert(0U == cap%8U);
+  assert(nullptr != ptr);
+  assert(nullptr != len);
+  assert(nullptr != meta);
+
+  const uint64_t head = atomic_load_explicit(&this->head, memory_order_acquire);
+  uint64_t       tail = atomic_load_explicit(&this->tail, memory_order_relaxed);
+  for (;;) {
+    if (head == tail) {
+      return NF7CORE_HOST_RING_EMPTY;
+    }
+    // `tail` is written only by the consumer, so `pos` is aligned
+    const uint64_t used = head - tail;
+    const uint64_t pos  = tail % cap;
+    if (used > cap || used < sizeof(*len)) {
+      return NF7CORE_HOST_RING_BROKEN;
+    }
+    memcpy(len, &this->data[pos], sizeof(*len));
+    if (NF7CORE_HOST_RING_WRAP != *len) {
+      if (*len > nf7core_host_ring_max(cap) ||
+          pos + NF7CORE_HOST_RING_HEADER + *len > cap ||
+          NF7CORE_HOST_RING_HEADER + *len > used) {
+        return NF7CORE_HOST_RING_BROKEN;
+      }
+      memcpy(meta, &this->data[pos + sizeof(*len)], sizeof(*meta));
+      *ptr = &this->data[pos + NF7CORE_HOST_RING_HEADER];
+      return NF7CORE_HOST_RING_OK;
+    }
+    if (cap - pos > used) {
+      return NF7CORE_HOST_RING_BROKEN;
+    }
+    tail += cap - pos;
+    atomic_store_explicit(&this->tail, tail, memory_order_release);
+  }
+}
+
+// Removes the oldest message found by nf7core_host_ring_peek().
+// Returns true if the producer should be woken up.
+// PRECONDS:
+//   - The last nf7core_host_ring_peek() has returned NF7CORE_HOST_RING_OK with
+//     the `len`.
+static inline bool nf7core_host_ring_pop(
+    struct nf7core_host_ring* this, uint64_t len) {
+  assert(nullptr != this);
+
+  const uint64_t tail = atomic_load_explicit(&this->tail, memory_order_relaxed);
+  atomic_store_explicit(
+      &this->tail,
+      tail + NF7CORE_HOST_RING_HEADER + nf7core_host_ring_align_(len),
+      memory_order_seq_cst);
+  return 0U != atomic_exchange(&this->blocked, 0);
+}
+
+// Declares that the consumer is going to sleep.
+// Returns false if a message has come in the meantime, and then the consumer
+// should keep consuming.
+static inline bool nf7core_host_ring_sleep(struct nf7core_host_ring* this) {
+  assert(nullptr != this);
+
+  atomic_store(&this->waiting, 1);
+  if (atomic_load(&this->head) != atomic_load(&this->tail)) {
+    atomic_store(&this->waiting, 0);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,140 @@
+// No copyright
+#include "core/host/ring.h"
+
+#include <stdlib.h>
+
+#include "test/common.h"
+
+
+#define CAP_ 256
+
+static struct nf7core_host_ring* new_(void) {
+  struct nf7core_host_ring* this = aligned_alloc(64, nf7core_host_ring_size(CAP_));
+  if (nullptr != this) {
+    nf7core_host_ring_init(this, CAP_);
+  }
+  return this;
+}
+
+
+NF7TEST(nf7core_host_ring_test_fifo) {
+  struct nf7core_host_ring* ring = new_();
+  if (!nf7test_expect(nullptr != ring)) {
+    return false;
+  }
+
+  // goes around the ring many times to cover wrapping
+  bool ret = true;
+  uint8_t  buf[64];
+  uint32_t wrote = 0;
+  uint32_t read  = 0;
+  for (uint32_t i = 0; ret && i < 1000; ++i) {
+    const uint64_t len = i % sizeof(buf);
+    memset(buf, (int) i, len);
+
+    bool wake;
+    while (!nf7core_host_ring_write(ring, CAP_, buf, len, &(struct nf7core_host_ring_meta) {.id = i}, &wake)) {
+      // consumes one to make a space
+      const uint8_t* ptr;
+      uint64_t       n;
+      struct nf7core_host_ring_meta meta;
+      ret = ret &&
+        nf7test_expect(NF7CORE_HOST_RING_OK == nf7core_host_ring_peek(ring, CAP_, &ptr, &n, &meta)) &&
+        nf7test_expect(read == meta.id) &&
+        nf7test_expect(read % sizeof(buf) == n) &&
+        nf7test_expect(0U == n || (uint8_t) read == ptr[n-1]);
+      if (!ret) {
+        break;
+      }
+      ret = nf7test_expect(nf7core_host_ring_pop(ring, n));  // the producer is blocked
+      ++read;
+    }
+    ++wrote;
+  }
+
+  // drains the rest
+  const uint8_t* ptr;
+  uint64_t       n;
+  struct nf7core_host_ring_meta meta;
+  while (ret && NF7CORE_HOST_RING_OK == nf7core_host_ring_peek(ring, CAP_, &ptr, &n, &meta)) {
+    ret = nf7test_expect(read % sizeof(buf) == n) && nf7test_expect(read == meta.id);
+    nf7core_host_ring_pop(ring, n);
+    ++read;
+  }
+  ret = ret &&
+    nf7test_expect(wrote == read) &&
+    nf7test_expect(nf7core_host_ring_empty(ring));
+
+  free(ring);
+  return ret;
+}
+
+NF7TEST(nf7core_host_ring_test_wakeup) {
+  struct nf7core_host_ring* ring = new_();
+  if (!nf7test_expect(nullptr != ring)) {
+    return false;
+  }
+
+  const uint8_t* ptr;
+  uint64_t       n;
+  struct nf7core_host_ring_meta meta;
+  bool           wake;
+
+  // the consumer sleeps on the empty ring, and is woken up by the first write
+  bool ret =
+    nf7test_expect(nf7core_host_ring_sleep(ring)) &&
+    nf7test_expect(nf7core_host_ring_write(ring, CAP_, (const uint8_t*) "a", 1, &(struct nf7core_host_ring_meta) {.id = 7, .deadline = 8}, &wake)) &&
+    nf7test_expect(wake) &&
+    nf7test_expect(nf7core_host_ring_write(ring, CAP_, (const uint8_t*) "b", 1, &(struct nf7core_host_ring_meta) {0}, &wake)) &&
+    nf7test_expect(!wake) &&
+    nf7test_expect(!nf7core_host_ring_sleep(ring)) &&
+    nf7test_expect(NF7CORE_HOST_RING_OK == nf7core_host_ring_peek(ring, CAP_, &ptr, &n, &meta)) &&
+    nf7test_expect(1 == n && 'a' == ptr[0] && 7 == meta.id && 8 == meta.deadline) &&
+    nf7test_expect(!nf7core_host_ring_pop(ring, n));
+
+  // too large message never fits in the rest
+  uint8_t buf[CAP_] = {0};
+  const uint64_t max = nf7core_host_ring_max(CAP_);
+  ret = ret &&
+    nf7test_expect(nf7core_host_ring_write(ring, CAP_, buf, max, &(struct nf7core_host_ring_meta) {0}, &wake)) &&
+    nf7test_expect(!nf7core_host_ring_write(ring, CAP_, buf, max, &(struct nf7core_host_ring_meta) {0}, &wake));
+
+  free(ring);
+  return ret;
+}
+
+NF7TEST(nf7core_host_ring_test_broken) {
+  struct nf7core_host_ring* ring = new_();
+  if (!nf7test_expect(nullptr != ring)) {
+    return false;
+  }
+
+  const uint8_t* ptr;
+  uint64_t       n;
+  struct nf7core_host_ring_meta meta;
+  bool           wake;
+
+  // a length beyond the written bytes
+  bool ret =
+    nf7test_expect(nf7core_host_ring_write(ring, CAP_, (const uint8_t*) "a", 1, &(struct nf7core_host_ring_meta) {0}, &wake));
+  const uint64_t len = 64;
+  memcpy(ring->data, &len, sizeof(len));
+  ret = ret && nf7test_expect(NF7CORE_HOST_RING_BROKEN == nf7core_host_ring_peek(ring, CAP_, &ptr, &n, &meta));
+
+  // a length beyond the ring
+  const uint64_t huge = UINT64_MAX/2;
+  memcpy(ring->data, &huge, sizeof(huge));
+  ret = ret && nf7test_expect(NF7CORE_HOST_RING_BROKEN == nf7core_host_ring_peek(ring, CAP_, &ptr, &n, &meta));
+
+  // a head too far from the tail
+  atomic_store(&ring->head, CAP_*2);
+  ret = ret && nf7test_expect(NF7CORE_HOST_RING_BROKEN == nf7core_host_ring_peek(ring, CAP_, &ptr, &n, &meta));
+
+  // a capacity in the shared memory is not trusted
+  atomic_store(&ring->head, 0);
+  ring->cap = UINT64_MAX - 7;
+  ret = ret && nf7test_expect(NF7CORE_HOST_RING_EMPTY == nf7core_host_ring_peek(ring, CAP_, &ptr, &n, &meta));
+
+  free(ring);
+  return ret;
+}
@@ -81,7 +81,10 @@ static void start_(struct nf7core_init_factory* factory, struct nf7core_exec_ent
     nf7util_log_error("failed to allocate an empty buffer to send as the first trigger");
     goto EXIT;
   }
-  nf7core_exec_entity_send(this->entity, buf);
+  if (!nf7core_exec_entity_send(this->entity, buf)) {
+    nf7util_log_error("the first trigger is refused");
+    nf7util_buffer_unref(buf);
+  }
 
 EXIT:
   this->factory = nullptr;
@@ -0,0 +1,154 @@
+// No copyright
+#include "core/lua/buffer.h"
+
+#include <assert.h>
+
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "util/log.h"
+
+
+// defines methods which need FFI, called with (ffi, methods, unique)
+// they return nil instead of a null pointer for released or empty buffers
+static const char ffi_[] =
+    "local ffi, methods, unique = ...\n"
+    "ffi.cdef[[\n"
+    "  struct nf7core_lua_buffer_view { uint8_t* ptr; uint64_t size; };\n"
+    "]]\n"
+    "local view_t  = ffi.typeof('struct nf7core_lua_buffer_view*')\n"
+    "local const_t = ffi.typeof('const uint8_t*')\n"
+    "function methods:data()\n"
+    "  local ptr = ffi.cast(view_t, self).ptr\n"
+    "  if ptr == nil then return nil end\n"
+    "  return ffi.cast(const_t, ptr)\n"
+    "end\n"
+    "function methods:mut()\n"
+    "  local ptr = ffi.cast(view_t, self).ptr\n"
+    "  if ptr == nil or not unique(self) then return nil end\n"
+    "  return ptr\n"
+    "end\n";
+
+static struct nf7core_lua_buffer_view* check_(lua_State*, int);
+static void release_(struct nf7core_lua_buffer_view*);
+
+static int len_(lua_State*);
+static int gc_(lua_State*);
+static int release_method_(lua_State*);
+static int unique_(lua_State*);
+
+
+bool nf7core_lua_buffer_open(lua_State* L) {
+  assert(nullptr != L);
+
+  const int top = lua_gettop(L);
+
+  if (0 == luaL_newmetatable(L, NF7CORE_LUA_BUFFER_META)) {
+    nf7util_log_warn("buffer type is already registered");
+    goto ABORT;
+  }
+  lua_pushcfunction(L, len_);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, gc_);
+  lua_setfield(L, -2, "__gc");
+
+  lua_newtable(L);
+  lua_pushcfunction(L, release_method_);
+  lua_setfield(L, -2, "release");
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -3, "__index");
+
+  // methods table is at the top
+  if (0 != luaL_loadbuffer(L, ffi_, sizeof(ffi_)-1, "=nf7core_lua_buffer")) {
+    nf7util_log_warn("failed to compile buffer methods: %s", lua_tostring(L, -1));
+    goto ABORT;
+  }
+  lua_pushcfunction(L, luaopen_ffi);
+  if (0 != lua_pcall(L, 0, 1, 0)) {
+    nf7util_log_warn("failed to open FFI: %s", lua_tostring(L, -1));
+    goto ABORT;
+  }
+  lua_pushvalue(L, -3);
+  lua_pushcfunction(L, unique_);
+  if (0 != lua_pcall(L, 3, 0, 0)) {
+    nf7util_log_warn("failed to define buffer methods: %s", lua_tostring(L, -1));
+    goto ABORT;
+  }
+  lua_settop(L, top);
+  return true;
+
+ABORT:
+  lua_settop(L, top);
+  return false;
+}
+
+void nf7core_lua_buffer_push(lua_State* L, struct nf7util_buffer* buf) {
+  assert(nullptr != L);
+  assert(nullptr != buf);
+
+  struct nf7core_lua_buffer_view* view = lua_newuserdata(L, sizeof(*view));
+  *view = (struct nf7core_lua_buffer_view) {
+    .ptr  = buf->array.ptr,
+    .size = buf->array.n,
+    .buf  = buf,
+  };
+  nf7util_buffer_ref(buf);
+
+  luaL_getmetatable(L, NF7CORE_LUA_BUFFER_META);
+  lua_setmetatable(L, -2);
+}
+
+struct nf7util_buffer* nf7core_lua_buffer_get(lua_State* L, int idx) {
+  assert(nullptr != L);
+
+  struct nf7core_lua_buffer_view* view = check_(L, idx);
+  return nullptr != view? view->buf: nullptr;
+}
+
+
+static struct nf7core_lua_buffer_view* check_(lua_State* L, int idx) {
+  struct nf7core_lua_buffer_view* view = lua_touserdata(L, idx);
+  if (nullptr == view || 0 == lua_getmetatable(L, idx)) {
+    return nullptr;
+  }
+  luaL_getmetatable(L, NF7CORE_LUA_BUFFER_META);
+  const bool ok = lua_rawequal(L, -1, -2);
+  lua_pop(L, 2);
+  return ok? view: nullptr;
+}
+
+static void release_(struct nf7core_lua_buffer_view* view) {
+  if (nullptr != view->buf) {
+    nf7util_buffer_unref(view->buf);
+  }
+  *view = (struct nf7core_lua_buffer_view) {0};
+}
+
+
+static int len_(lua_State* L) {
+  struct nf7core_lua_buffer_view* view = check_(L, 1);
+  lua_pushnumber(L, nullptr != view? (lua_Number) view->size: 0);
+  return 1;
+}
+
+static int gc_(lua_State* L) {
+  struct nf7core_lua_buffer_view* view = check_(L, 1);
+  if (nullptr != view) {
+    release_(view);
+  }
+  return 0;
+}
+
+static int release_method_(lua_State* L) {
+  struct nf7core_lua_buffer_view* view =
+      luaL_checkudata(L, 1, NF7CORE_LUA_BUFFER_META);
+  release_(view);
+  return 0;
+}
+
+static int unique_(lua_State* L) {
+  struct nf7core_lua_buffer_view* view = check_(L, 1);
+  lua_pushboolean(
+      L, nullptr != view && nullptr != view->buf && 1U == view->buf->refcnt);
+  return 1;
+}
@@ -0,0 +1,59 @@
+// No copyright
+//
+// Buffer type exposes nf7util_buffer to lua scripts without copies.
+//
+// HOW TO USE
+//   Push a buffer by nf7core_lua_buffer_push(), which creates a userdata
+//   holding a reference of the buffer. Scripts use it like this:
+//       local p = buf:data()  -- `const uint8_t*` by FFI, or nil if empty
+//       for i = 0, #buf-1 do sum = sum + p[i] end
+//       local m = buf:mut()   -- `uint8_t*`, or nil if the buffer is shared
+//       if m then m[0] = 0 end
+//       buf:release()         -- drops the reference before GC
+//
+//   The userdata begins with nf7core_lua_buffer_view, which is also declared
+//   in FFI, so bytes are accessed through the pointers without a call for each.
+//   Note that the JIT may be turned off for a state, see `budget` in
+//   core/lua/thread.h.
+//
+// RULES
+//   - The type is registered to every lua state created without a base.
+//   - Pointers from `data` and `mut` are valid while the userdata is alive and
+//     not released, so keep the userdata referenced while using them.
+//   - A pointer from `mut` must not be kept after the buffer is handed to C,
+//     e.g. returned from a thread or passed to a function. C code may take
+//     another reference and treat the buffer as immutable from then on, so
+//     call `mut` again, which returns nil while the buffer is shared.
+//   - A buffer referred from lua must not be resized.
+#pragma once
+
+#include <stdint.h>
+
+#include <lua.h>
+
+#include "util/buffer.h"
+
+
+#define NF7CORE_LUA_BUFFER_META "nf7core_lua_buffer"
+
+struct nf7core_lua_buffer_view {
+  uint8_t* ptr;
+  uint64_t size;
+
+  // not visible from FFI
+  struct nf7util_buffer* buf;
+};
+
+
+// Registers the buffer type to the lua state.
+// Returns false if failed with a warning.
+bool nf7core_lua_buffer_open(lua_State*);
+// PRECONDS:
+//   - Called only once for each lua state.
+
+// Pushes a userdata of the buffer, which holds a reference.
+void nf7core_lua_buffer_push(lua_State*, struct nf7util_buffer*);
+
+// Returns a buffer of the userdata at the index without a reference.
+// Returns nullptr if the value is not a buffer or has been released.
+struct nf7util_buffer* nf7core_lua_buffer_get(lua_State*, int idx);
@@ -0,0 +1,105 @@
+// No copyright
+#include "core/lua/buffer.h"
+
+#include <string.h>
+
+#include <lauxlib.h>
+
+#include "util/buffer.h"
+
+#include "core/lua/thread.h"
+
+#include "test/common.h"
+
+
+// returns a sum of bytes and whether the buffer is mutable
+static const char script_[] =
+    "local buf = ...\n"
+    "local p, sum = buf:data(), 0\n"
+    "for i = 0, #buf-1 do sum = sum + p[i] end\n"
+    "local m = buf:mut()\n"
+    "if m then m[0] = 72 end\n"
+    "return sum, m ~= nil\n";
+
+static bool run_(
+    struct nf7test* test_, lua_State* L, lua_Number sum, bool mutable) {
+  // PRECONDS: the buffer is at the top
+  if (!nf7test_expect(0 == luaL_loadstring(L, script_))) {
+    return false;
+  }
+  lua_pushvalue(L, -2);
+  if (!nf7test_expect(0 == lua_pcall(L, 1, 2, 0))) {
+    return false;
+  }
+  const bool ret =
+      nf7test_expect(sum == lua_tonumber(L, -2)) &&
+      nf7test_expect(mutable == lua_toboolean(L, -1));
+  lua_pop(L, 2);
+  return ret;
+}
+
+NF7TEST(nf7core_lua_buffer_test_view) {
+  struct nf7core_lua* mod =
+    (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_lua);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  bool ret = false;
+
+  struct nf7util_buffer*     buf  = nullptr;
+  struct nf7core_lua_thread* base =
+      nf7core_lua_thread_new(mod, nullptr, nullptr);
+  if (!nf7test_expect(nullptr != base)) {
+    goto EXIT;
+  }
+  lua_State* L = base->lua;
+
+  buf = nf7util_buffer_new_from_cstr(test_->malloc, "hello");
+  if (!nf7test_expect(nullptr != buf)) {
+    goto EXIT;
+  }
+  nf7core_lua_buffer_push(L, buf);
+  if (!nf7test_expect(buf == nf7core_lua_buffer_get(L, -1)) ||
+      !nf7test_expect(2U == buf->refcnt)) {
+    goto EXIT;
+  }
+
+  // shared with this test, so the script cannot mutate it
+  const lua_Number sum = 'h' + 'e' + 'l' + 'l' + 'o';
+  if (!run_(test_, L, sum, false) ||
+      !nf7test_expect(0 == memcmp(buf->array.ptr, "hello", 5))) {
+    goto EXIT;
+  }
+
+  // only the script refers it now
+  struct nf7util_buffer* view = buf;
+  nf7util_buffer_unref(buf);
+  buf = nullptr;
+  if (!run_(test_, L, sum, true) ||
+      !nf7test_expect(0 == memcmp(view->array.ptr, "Hello", 5))) {
+    goto EXIT;
+  }
+
+  // a released buffer is empty
+  const char* release = "local b = ... b:release() return #b, b:data()";
+  if (!nf7test_expect(0 == luaL_loadstring(L, release))) {
+    goto EXIT;
+  }
+  lua_pushvalue(L, -2);
+  ret =
+      nf7test_expect(0 == lua_pcall(L, 1, 2, 0)) &&
+      nf7test_expect(0 == lua_tonumber(L, -2)) &&
+      nf7test_expect(lua_isnil(L, -1)) &&
+      nf7test_expect(nullptr == nf7core_lua_buffer_get(L, -3));
+  lua_settop(L, 0);
+
+EXIT:
+  if (nullptr != buf) {
+    nf7util_buffer_unref(buf);
+  }
+  if (nullptr != base) {
+    nf7core_lua_thread_unref(base);
+  }
+  return ret;
+}
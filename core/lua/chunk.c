@@ -0,0 +1,371 @@
+// No copyright
+#include "core/lua/chunk.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <lauxlib.h>
+
+#include "util/array.h"
+#include "util/log.h"
+#include "util/str.h"
+
+#include "core/lua/thread.h"
+
+
+// a header of cache files, followed by a length of the key, the key and bytecode
+static const uint8_t magic_[8] = "nf7luac";
+#define HEADER_ (sizeof(magic_) + sizeof(uint64_t))
+
+static uint64_t key_hash_(
+    const uint8_t* name, uint64_t namelen, const uint8_t* src, uint64_t len);
+static bool key_equal_(
+    const uint8_t* key, uint64_t keylen,
+    const uint8_t* name, uint64_t namelen, const uint8_t* src, uint64_t len);
+static void key_write_(
+    uint8_t* key,
+    const uint8_t* name, uint64_t namelen, const uint8_t* src, uint64_t len);
+static char* path_(struct nf7core_lua_chunk_cache*, uint64_t hash, uint64_t len);
+static bool read_file_(
+    struct nf7core_lua_chunk_cache*, const char* path, struct nf7util_array_u8*);
+static bool write_file_(
+    struct nf7core_lua_chunk_cache*, const char* path, const struct nf7util_array_u8*);
+static int dump_(lua_State*, const void*, size_t, void*);
+
+
+struct nf7core_lua_chunk_cache* nf7core_lua_chunk_cache_new(
+    struct nf7core_lua_thread* base, const char* dir) {
+  assert(nullptr != base);
+
+  struct nf7core_lua_chunk_cache* this =
+      nf7util_malloc_alloc(base->malloc, sizeof(*this));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate a chunk cache");
+    return nullptr;
+  }
+  *this = (struct nf7core_lua_chunk_cache) {
+    .malloc = base->malloc,
+    .uv     = base->uv,
+    .base   = base,
+  };
+  nf7core_lua_chunk_map_init(&this->map, this->malloc);
+  nf7core_lua_thread_ref(this->base);
+
+  if (nullptr != dir) {
+    const size_t n = strlen(dir);
+    this->dir = nf7util_malloc_alloc(this->malloc, n+1);
+    if (nullptr == this->dir) {
+      nf7util_log_error("failed to allocate a path of chunk cache");
+      nf7core_lua_chunk_cache_del(this);
+      return nullptr;
+    }
+    memcpy(this->dir, dir, n+1);
+
+    // an existing directory is not an error
+    uv_fs_t req;
+    uv_fs_mkdir(this->uv, &req, dir, 0755, nullptr);
+    uv_fs_req_cleanup(&req);
+  }
+  return this;
+}
+
+void nf7core_lua_chunk_cache_del(struct nf7core_lua_chunk_cache* this) {
+  if (nullptr == this) {
+    return;
+  }
+  nf7core_lua_chunk_cache_clear(this);
+  nf7core_lua_chunk_map_deinit(&this->map);
+  nf7core_lua_thread_unref(this->base);
+  nf7util_malloc_free(this->malloc, this->dir);
+  nf7util_malloc_free(this->malloc, this);
+}
+
+void nf7core_lua_chunk_cache_clear(struct nf7core_lua_chunk_cache* this) {
+  assert(nullptr != this);
+
+  lua_State* L = this->base->lua;
+  for (uint64_t i = 0; i < this->map.cap; ++i) {
+    if (this->map.ptr[i].used) {
+      luaL_unref(L, LUA_REGISTRYINDEX, this->map.ptr[i].value.ref);
+      nf7util_malloc_free(this->malloc, this->map.ptr[i].value.key);
+    }
+  }
+  nf7core_lua_chunk_map_deinit(&this->map);
+  nf7core_lua_chunk_map_init(&this->map, this->malloc);
+}
+
+int nf7core_lua_chunk_load(
+    struct nf7core_lua_chunk_cache* this,
+    lua_State*     L,
+    const uint8_t* src,
+    uint64_t       len,
+    const char*    name) {
+  assert(nullptr != this);
+  assert(nullptr != L);
+  assert(nullptr != src || 0U == len);
+
+  // the name is a part of the key because the bytecode embeds it
+  if (nullptr == name) {
+    name = "?";  // as well as lua_load()
+  }
+  const uint8_t* nameb   = (const uint8_t*) name;
+  const uint64_t namelen = strlen(name);
+  const uint64_t keylen  = namelen + 1U + len;
+  const uint64_t hash    = key_hash_(nameb, namelen, src, len);
+
+  struct nf7core_lua_chunk_entry entry;
+  const bool found = nf7core_lua_chunk_map_find(&this->map, hash, &entry);
+  if (found && key_equal_(entry.key, entry.len, nameb, namelen, src, len)) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, entry.ref);
+    ++this->stats.hits;
+    return 0;
+  }
+
+  char* path = nullptr;
+  struct nf7util_array_u8 bytes;
+  nf7util_array_u8_init(&bytes, this->malloc);
+
+  bool loaded = false;
+  if (nullptr != this->dir) {
+    path = path_(this, hash, keylen);
+    if (nullptr != path && read_file_(this, path, &bytes)) {
+      uint64_t filekeylen = 0;
+      if (HEADER_ <= bytes.n) {
+        memcpy(&filekeylen, &bytes.ptr[sizeof(magic_)], sizeof(filekeylen));
+      }
+      const bool match =
+          HEADER_ <= bytes.n &&
+          0 == memcmp(bytes.ptr, magic_, sizeof(magic_)) &&
+          filekeylen == keylen &&
+          keylen <= bytes.n - HEADER_ &&
+          key_equal_(&bytes.ptr[HEADER_], keylen, nameb, namelen, src, len);
+      const uint64_t offset = HEADER_ + keylen;
+      if (!match) {
+        nf7util_log_warn(
+            "chunk cache doesn't match the source, it's compiled again: %s", path);
+      } else if (0 == luaL_loadbuffer(
+          L, (const char*) &bytes.ptr[offset], bytes.n - offset, name)) {
+        ++this->stats.loads;
+        loaded = true;
+      } else {
+        nf7util_log_warn(
+            "broken chunk cache, the source is compiled again: %s (%s)",
+            path, lua_tostring(L, -1));
+        lua_pop(L, 1);
+      }
+    }
+  }
+
+  if (!loaded) {
+    const int ret = luaL_loadbuffer(L, (const char*) src, len, name);
+    if (0 != ret) {
+      nf7util_array_u8_deinit(&bytes);
+      nf7util_malloc_free(this->malloc, path);
+      return ret;
+    }
+    ++this->stats.compiles;
+
+    if (nullptr != path) {
+      nf7util_array_u8_deinit(&bytes);
+      nf7util_array_u8_init(&bytes, this->malloc);
+
+      const bool header = nf7util_array_u8_resize(&bytes, HEADER_ + keylen);
+      if (header) {
+        memcpy(bytes.ptr, magic_, sizeof(magic_));
+        memcpy(&bytes.ptr[sizeof(magic_)], &keylen, sizeof(keylen));
+        key_write_(&bytes.ptr[HEADER_], nameb, namelen, src, len);
+      }
+      if (header &&
+          0 == lua_dump(L, dump_, &bytes) &&
+          write_file_(this, path, &bytes)) {
+        ++this->stats.stores;
+      } else {
+        nf7util_log_warn("failed to store chunk cache: %s", path);
+      }
+    }
+  }
+  nf7util_array_u8_deinit(&bytes);
+  nf7util_malloc_free(this->malloc, path);
+
+  // a key colliding with another is not cached
+  if (!found) {
+    entry = (struct nf7core_lua_chunk_entry) {
+      .key = nf7util_malloc_alloc(this->malloc, keylen),
+      .len = keylen,
+    };
+    if (nullptr == entry.key) {
+      nf7util_log_warn("failed to keep a chunk in memory");
+      return 0;
+    }
+    key_write_(entry.key, nameb, namelen, src, len);
+
+    lua_pushvalue(L, -1);
+    entry.ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    if (!nf7core_lua_chunk_map_insert(&this->map, hash, entry)) {
+      nf7util_log_warn("failed to keep a chunk in memory");
+      luaL_unref(L, LUA_REGISTRYINDEX, entry.ref);
+      nf7util_malloc_free(this->malloc, entry.key);
+    }
+  }
+  return 0;
+}
+
+
+static uint64_t key_hash_(
+    const uint8_t* name, uint64_t namelen, const uint8_t* src, uint64_t len) {
+  // FNV-1a over the key without building it
+  uint64_t ret = nf7util_str_hash(name, namelen);
+  ret *= UINT64_C(0x100000001b3);  // NUL
+  for (uint64_t i = 0; i < len; ++i) {
+    ret ^= src[i];
+    ret *= UINT64_C(0x100000001b3);
+  }
+  return ret;
+}
+
+static bool key_equal_(
+    const uint8_t* key, uint64_t keylen,
+    const uint8_t* name, uint64_t namelen, const uint8_t* src, uint64_t len) {
+  return
+      keylen == namelen + 1U + len &&
+      0 == memcmp(key, name, namelen) &&
+      0U == key[namelen] &&
+      (0U == len || 0 == memcmp(&key[namelen+1], src, len));
+}
+
+static void key_write_(
+    uint8_t* key,
+    const uint8_t* name, uint64_t namelen, const uint8_t* src, uint64_t len) {
+  memcpy(key, name, namelen);
+  key[namelen] = 0;
+  if (0U < len) {
+    memcpy(&key[namelen+1], src, len);
+  }
+}
+
+
+static char* path_(
+    struct nf7core_lua_chunk_cache* this, uint64_t hash, uint64_t len) {
+  const int n = snprintf(
+      nullptr, 0, "%s/%016" PRIx64 "-%" PRIu64 ".luac", this->dir, hash, len);
+  char* ret = nf7util_malloc_alloc(this->malloc, (uint64_t) n + 1U);
+  if (nullptr == ret) {
+    nf7util_log_error("failed to allocate a path of chunk cache");
+    return nullptr;
+  }
+  snprintf(ret, (size_t) n + 1U,
+           "%s/%016" PRIx64 "-%" PRIu64 ".luac", this->dir, hash, len);
+  return ret;
+}
+
+static bool read_file_(
+    struct nf7core_lua_chunk_cache* this,
+    const char* path,
+    struct nf7util_array_u8* bytes) {
+  uv_loop_t* uv = this->uv;
+
+  uv_fs_t req;
+  const int fd = uv_fs_open(uv, &req, path, UV_FS_O_RDONLY, 0, nullptr);
+  uv_fs_req_cleanup(&req);
+  if (fd < 0) {
+    return false;  // not cached yet
+  }
+
+  bool ret = false;
+  if (0 != nf7util_log_uv(uv_fs_fstat(uv, &req, fd, nullptr))) {
+    uv_fs_req_cleanup(&req);
+    goto EXIT;
+  }
+  const uint64_t size = req.statbuf.st_size;
+  uv_fs_req_cleanup(&req);
+
+  if (!nf7util_array_u8_resize(bytes, size)) {
+    nf7util_log_error("failed to allocate a buffer for chunk cache");
+    goto EXIT;
+  }
+  for (uint64_t read = 0; read < size;) {
+    const uint64_t rest = size - read;
+    uv_buf_t buf = uv_buf_init(
+        (char*) &bytes->ptr[read], (unsigned) (rest < UINT32_MAX? rest: UINT32_MAX));
+    const int n = uv_fs_read(uv, &req, fd, &buf, 1, -1, nullptr);
+    uv_fs_req_cleanup(&req);
+    if (0 != nf7util_log_uv(n < 0? n: 0) || 0 == n) {
+      goto EXIT;
+    }
+    read += (uint64_t) n;
+  }
+  ret = 0U < size;
+
+EXIT:
+  uv_fs_close(uv, &req, fd, nullptr);
+  uv_fs_req_cleanup(&req);
+  return ret;
+}
+
+static bool write_file_(
+    struct nf7core_lua_chunk_cache* this,
+    const char* path,
+    const struct nf7util_array_u8* bytes) {
+  uv_loop_t* uv = this->uv;
+
+  // writes to a temporary file, and renames it not to leave a broken file
+  const size_t pathlen = strlen(path);
+  char* tmp = nf7util_malloc_alloc(this->malloc, pathlen + sizeof(".tmp"));
+  if (nullptr == tmp) {
+    nf7util_log_error("failed to allocate a temporary path");
+    return false;
+  }
+  memcpy(tmp, path, pathlen);
+  memcpy(&tmp[pathlen], ".tmp", sizeof(".tmp"));
+
+  bool ret = false;
+
+  uv_fs_t req;
+  const int fd = uv_fs_open(
+      uv, &req, tmp, UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC, 0644, nullptr);
+  uv_fs_req_cleanup(&req);
+  if (0 != nf7util_log_uv(fd < 0? fd: 0)) {
+    goto EXIT;
+  }
+
+  uint64_t written = 0;
+  while (written < bytes->n) {
+    const uint64_t rest = bytes->n - written;
+    uv_buf_t buf = uv_buf_init(
+        (char*) &bytes->ptr[written], (unsigned) (rest < UINT32_MAX? rest: UINT32_MAX));
+    const int n = uv_fs_write(uv, &req, fd, &buf, 1, -1, nullptr);
+    uv_fs_req_cleanup(&req);
+    if (0 != nf7util_log_uv(n < 0? n: 0) || 0 == n) {
+      break;
+    }
+    written += (uint64_t) n;
+  }
+  uv_fs_close(uv, &req, fd, nullptr);
+  uv_fs_req_cleanup(&req);
+
+  if (written == bytes->n) {
+    ret = 0 == nf7util_log_uv(uv_fs_rename(uv, &req, tmp, path, nullptr));
+    uv_fs_req_cleanup(&req);
+  }
+  if (!ret) {
+    uv_fs_unlink(uv, &req, tmp, nullptr);
+    uv_fs_req_cleanup(&req);
+  }
+
+EXIT:
+  nf7util_malloc_free(this->malloc, tmp);
+  return ret;
+}
+
+static int dump_(lua_State*, const void* ptr, size_t size, void* data) {
+  struct nf7util_array_u8* bytes = data;
+
+  const uint64_t n = bytes->n;
+  if (!nf7util_array_u8_resize(bytes, n + size)) {
+    return 1;
+  }
+  memcpy(&bytes->ptr[n], ptr, size);
+  return 0;
+}
@@ -0,0 +1,82 @@
+// No copyright
+//
+// Chunk cache keeps compiled lua chunks keyed by their source and name, so
+// loading the same script again skips parsing.
+//
+// HOW TO USE
+//   Create a cache for a base thread, and load scripts by
+//   nf7core_lua_chunk_load() instead of luaL_loadbuffer(). The first load of
+//   a source compiles it, and later loads push the same function from memory.
+//
+//   With a cache directory, compiled chunks are also dumped to files named by
+//   a hash of the key, and the next process loads the bytecode instead of the
+//   source. Each file begins with the key it was compiled from.
+//   The directory of the main state is given by a command line arg,
+//   `NF7CORE_LUA_CACHE_ARG <dir>`.
+//
+// RULES
+//   - Loaded functions are shared by all loads of the same source and name,
+//     so don't change their environment.
+//   - A key is the name followed by the source. Keys are looked up by FNV-1a
+//     hash, and compared byte by byte before reuse, so a colliding key is
+//     compiled again instead of returning another chunk.
+//   - Files in the directory are trusted, so don't share it with others.
+//   - Chunks stay in memory until nf7core_lua_chunk_cache_clear().
+#pragma once
+
+#include <stdint.h>
+
+#include <lua.h>
+#include <uv.h>
+
+#include "util/hashmap.h"
+#include "util/malloc.h"
+
+
+struct nf7core_lua_thread;
+
+struct nf7core_lua_chunk_entry {
+  int      ref;  // a reference in registry of the base
+  uint8_t* key;  // a copy of the name, NUL, and the source
+  uint64_t len;  // a length of the key
+};
+NF7UTIL_HASHMAP_INLINE(nf7core_lua_chunk_map, struct nf7core_lua_chunk_entry);
+
+struct nf7core_lua_chunk_stats {
+  uint64_t hits;      // a number of loads from memory
+  uint64_t loads;     // a number of loads of bytecode files
+  uint64_t compiles;  // a number of compiles of sources
+  uint64_t stores;    // a number of bytecode files written
+};
+
+struct nf7core_lua_chunk_cache {
+  struct nf7util_malloc*     malloc;
+  uv_loop_t*                 uv;
+  struct nf7core_lua_thread* base;
+
+  char* dir;  // nullptr if chunks are kept only in memory
+
+  struct nf7core_lua_chunk_map   map;
+  struct nf7core_lua_chunk_stats stats;
+};
+
+
+// Creates a cache for the base thread. The dir can be nullptr.
+struct nf7core_lua_chunk_cache* nf7core_lua_chunk_cache_new(
+    struct nf7core_lua_thread* base, const char* dir);
+
+void nf7core_lua_chunk_cache_del(struct nf7core_lua_chunk_cache*);
+
+// Forgets all chunks in memory. Files are left.
+void nf7core_lua_chunk_cache_clear(struct nf7core_lua_chunk_cache*);
+
+// Pushes a function of the source, as well as luaL_loadbuffer().
+// Returns 0 if succeeded, otherwise an error code with a message pushed.
+int nf7core_lua_chunk_load(
+    struct nf7core_lua_chunk_cache*,
+    lua_State*     L,
+    const uint8_t* src,
+    uint64_t       len,
+    const char*    name);
+// PRECONDS:
+//   - `L` is the base or its thread.
@@ -0,0 +1,166 @@
+// No copyright
+#include "core/lua/chunk.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <uv.h>
+
+#include "core/lua/thread.h"
+
+#include "test/common.h"
+
+
+static const char src_[] = "return 40 + 2";
+
+static bool path_(char* path, size_t size) {
+  char   dir[1024];
+  size_t dirlen = sizeof(dir);
+  if (0 != uv_os_tmpdir(dir, &dirlen)) {
+    return false;
+  }
+  const int n = snprintf(
+      path, size, "%s/nf7core_lua_chunk_test.%d", dir, (int) uv_os_getpid());
+  return 0 < n && (size_t) n < size;
+}
+
+static void remove_dir_(uv_loop_t* uv, const char* path) {
+  uv_fs_t req;
+  if (0 <= uv_fs_scandir(uv, &req, path, 0, nullptr)) {
+    uv_dirent_t ent;
+    while (UV_EOF != uv_fs_scandir_next(&req, &ent)) {
+      char file[1400];
+      snprintf(file, sizeof(file), "%s/%s", path, ent.name);
+      uv_fs_t unlink;
+      uv_fs_unlink(uv, &unlink, file, nullptr);
+      uv_fs_req_cleanup(&unlink);
+    }
+  }
+  uv_fs_req_cleanup(&req);
+  uv_fs_rmdir(uv, &req, path, nullptr);
+  uv_fs_req_cleanup(&req);
+}
+
+static void break_files_(uv_loop_t* uv, const char* path) {
+  uv_fs_t req;
+  if (0 <= uv_fs_scandir(uv, &req, path, 0, nullptr)) {
+    uv_dirent_t ent;
+    while (UV_EOF != uv_fs_scandir_next(&req, &ent)) {
+      char file[1400];
+      snprintf(file, sizeof(file), "%s/%s", path, ent.name);
+      FILE* fp = fopen(file, "wb");
+      if (nullptr != fp) {
+        fputs("nf7luac broken", fp);
+        fclose(fp);
+      }
+    }
+  }
+  uv_fs_req_cleanup(&req);
+}
+
+static bool call_(struct nf7test* test_, lua_State* L) {
+  lua_call(L, 0, 1);
+  const bool ret = nf7test_expect(42 == lua_tointeger(L, -1));
+  lua_pop(L, 1);
+  return ret;
+}
+
+
+NF7TEST(nf7core_lua_chunk_test_cache) {
+  struct nf7core_lua* mod =
+    (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_lua);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  char dir[1200];
+  if (!nf7test_expect(path_(dir, sizeof(dir)))) {
+    return false;
+  }
+
+  bool ret = false;
+
+  struct nf7core_lua_chunk_cache* a = nullptr;
+  struct nf7core_lua_chunk_cache* b = nullptr;
+  struct nf7core_lua_chunk_cache* c = nullptr;
+
+  struct nf7core_lua_thread* base = nf7core_lua_thread_new(mod, nullptr, nullptr);
+  if (!nf7test_expect(nullptr != base)) {
+    goto EXIT;
+  }
+  lua_State* L = base->lua;
+
+  // compiles at first, and reuses the function later
+  a = nf7core_lua_chunk_cache_new(base, dir);
+  if (!nf7test_expect(nullptr != a)) {
+    goto EXIT;
+  }
+  const uint8_t* src = (const uint8_t*) src_;
+  const uint64_t len = sizeof(src_)-1;
+  if (!nf7test_expect(0 == nf7core_lua_chunk_load(a, L, src, len, "=test")) ||
+      !nf7test_expect(0 == nf7core_lua_chunk_load(a, L, src, len, "=test"))) {
+    goto EXIT;
+  }
+  if (!nf7test_expect(lua_rawequal(L, -1, -2)) ||
+      !nf7test_expect(1 == a->stats.compiles) ||
+      !nf7test_expect(1 == a->stats.stores) ||
+      !nf7test_expect(1 == a->stats.hits) ||
+      !call_(test_, L) ||
+      !call_(test_, L)) {
+    goto EXIT;
+  }
+
+  // syntax errors are not cached
+  const uint8_t broken[] = "return +";
+  if (!nf7test_expect(
+        0 != nf7core_lua_chunk_load(a, L, broken, sizeof(broken)-1, "=test")) ||
+      !nf7test_expect(nullptr != lua_tostring(L, -1)) ||
+      !nf7test_expect(1 == a->stats.compiles)) {
+    goto EXIT;
+  }
+  lua_settop(L, 0);
+
+  // the same source with another name is another chunk
+  if (!nf7test_expect(0 == nf7core_lua_chunk_load(a, L, src, len, "=test")) ||
+      !nf7test_expect(0 == nf7core_lua_chunk_load(a, L, src, len, "=other")) ||
+      !nf7test_expect(!lua_rawequal(L, -1, -2)) ||
+      !nf7test_expect(2 == a->stats.compiles) ||
+      !call_(test_, L)) {
+    goto EXIT;
+  }
+  lua_settop(L, 0);
+
+  // another cache loads the bytecode file without compiling
+  b = nf7core_lua_chunk_cache_new(base, dir);
+  if (!nf7test_expect(nullptr != b) ||
+      !nf7test_expect(0 == nf7core_lua_chunk_load(b, L, src, len, "=test"))) {
+    goto EXIT;
+  }
+  if (!nf7test_expect(1 == b->stats.loads) ||
+      !nf7test_expect(0 == b->stats.compiles) ||
+      !call_(test_, L)) {
+    goto EXIT;
+  }
+
+  // a file not matching the source is compiled again
+  break_files_(test_->nf7->uv, dir);
+  c = nf7core_lua_chunk_cache_new(base, dir);
+  if (!nf7test_expect(nullptr != c) ||
+      !nf7test_expect(0 == nf7core_lua_chunk_load(c, L, src, len, "=test"))) {
+    goto EXIT;
+  }
+  ret =
+      nf7test_expect(0 == c->stats.loads) &&
+      nf7test_expect(1 == c->stats.compiles) &&
+      call_(test_, L);
+
+EXIT:
+  nf7core_lua_chunk_cache_del(c);
+  nf7core_lua_chunk_cache_del(b);
+  nf7core_lua_chunk_cache_del(a);
+  if (nullptr != base) {
+    nf7core_lua_thread_unref(base);
+  }
+  remove_dir_(test_->nf7->uv, dir);
+  return ret;
+}
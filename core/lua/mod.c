@@ -2,10 +2,15 @@
 #include "core/lua/mod.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include "util/log.h"
 
+#include "core/lua/chunk.h"
+#include "core/lua/profiler.h"
+#include "core/lua/sched.h"
 #include "core/lua/thread.h"
+#include "core/lua/worker.h"
 
 
 static void del_(struct nf7core_lua*);
@@ -28,11 +33,35 @@ struct nf7_mod* nf7core_lua_new(struct nf7* nf7) {
     .uv     = nf7->uv,
   };
 
+  this->sched = nf7core_lua_sched_new(this->malloc, this->uv);
+  if (nullptr == this->sched) {
+    nf7util_log_error("failed to create scheduler");
+    goto ABORT;
+  }
+
   this->thread = nf7core_lua_thread_new(this, nullptr, nullptr);
   if (nullptr == this->thread) {
     nf7util_log_error("failed to create main thread");
     goto ABORT;
   }
+
+  const char* cache_dir    = nullptr;
+  const char* profile_path = nullptr;
+  for (uint32_t i = 1; i+1 < nf7->argc; ++i) {
+    if (0 == strcmp(nf7->argv[i], NF7CORE_LUA_CACHE_ARG)) {
+      cache_dir = nf7->argv[i+1];
+    } else if (0 == strcmp(nf7->argv[i], NF7CORE_LUA_PROFILE_ARG)) {
+      profile_path = nf7->argv[i+1];
+    }
+  }
+  this->chunks = nf7core_lua_chunk_cache_new(this->thread, cache_dir);
+  if (nullptr == this->chunks) {
+    nf7util_log_error("failed to create chunk cache");
+    goto ABORT;
+  }
+  if (nullptr != profile_path && !nf7core_lua_profiler_start(this, profile_path)) {
+    nf7util_log_warn("lua scripts are not profiled");
+  }
   return &this->super;
 
 ABORT:
@@ -46,9 +75,15 @@ static void del_(struct nf7core_lua* this) {
     return;
   }
 
+  nf7core_lua_worker_stop(this);
+  if (!nf7core_lua_profiler_stop(this)) {
+    nf7util_log_warn("failed to write lua profile");
+  }
+  nf7core_lua_chunk_cache_del(this->chunks);
   if (nullptr != this->thread) {
     nf7core_lua_thread_unref(this->thread);
   }
+  nf7core_lua_sched_del(this->sched);
   nf7util_malloc_free(this->malloc, this);
 }
 
@@ -62,5 +97,7 @@ const struct nf7_mod_meta nf7core_lua = {
   .desc = (const uint8_t*) "lua script execution",
   .ver  = NF7_VERSION,
 
+  .hosted = true,
+
   .del = del_mod_,
 };
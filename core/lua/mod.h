@@ -13,13 +13,29 @@
 
 extern const struct nf7_mod_meta nf7core_lua;
 
+// A command line arg followed by a directory to store compiled chunks.
+#define NF7CORE_LUA_CACHE_ARG "--nf7core-lua-cache"
+
 struct nf7core_lua {
   struct nf7_mod super;
 
   struct nf7util_malloc* malloc;
   uv_loop_t*             uv;
 
+  struct nf7core_lua_sched*  sched;
   struct nf7core_lua_thread* thread;
+
+  // compiled chunks of the thread, see core/lua/chunk.h
+  struct nf7core_lua_chunk_cache* chunks;
+
+  // worker threads, or nullptr if not started, see core/lua/worker.h
+  struct nf7core_lua_workers* workers;
+
+  // a profiler, or nullptr if not started, see core/lua/profiler.h
+  struct nf7core_lua_profiler* profiler;
+
+  // a number of threads created, which gives `id` of each thread
+  uint64_t threads;
 };
 
 struct nf7_mod* nf7core_lua_new(struct nf7*);
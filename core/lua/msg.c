@@ -0,0 +1,285 @@
+// No copyright
+#include "core/lua/msg.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include <lauxlib.h>
+
+#include "util/buffer.h"
+#include "util/log.h"
+#include "util/msg.h"
+
+#include "core/lua/buffer.h"
+
+
+static const char* write_(
+    lua_State*, struct nf7util_msg_writer*, int idx, uint32_t depth);
+static const char* write_table_(
+    lua_State*, struct nf7util_msg_writer*, int idx, uint32_t depth);
+static const char* read_(lua_State*, struct nf7util_msg_reader*, uint32_t depth);
+
+static int pack_(lua_State*);
+static int unpack_(lua_State*);
+
+
+bool nf7core_lua_msg_open(lua_State* L, struct nf7util_malloc* malloc) {
+  assert(nullptr != L);
+  assert(nullptr != malloc);
+
+  const int top = lua_gettop(L);
+
+  luaL_getmetatable(L, NF7CORE_LUA_BUFFER_META);
+  if (!lua_istable(L, -1)) {
+    nf7util_log_warn("buffer type is not registered");
+    goto ABORT;
+  }
+  lua_getfield(L, -1, "__index");
+  if (!lua_istable(L, -1)) {
+    nf7util_log_warn("buffer type has no methods");
+    goto ABORT;
+  }
+  lua_pushlightuserdata(L, malloc);
+  lua_pushcclosure(L, pack_, 1);
+  lua_setfield(L, -2, "pack");
+  lua_pushcfunction(L, unpack_);
+  lua_setfield(L, -2, "unpack");
+  lua_settop(L, top);
+  return true;
+
+ABORT:
+  lua_settop(L, top);
+  return false;
+}
+
+
+// returns an error message, or nullptr on success
+static const char* write_(
+    lua_State* L, struct nf7util_msg_writer* w, int idx, uint32_t depth) {
+  if (idx < 0) {
+    idx = lua_gettop(L) + idx + 1;
+  }
+  switch (lua_type(L, idx)) {
+  case LUA_TNIL:
+    nf7util_msg_write_nil(w);
+    return nullptr;
+
+  case LUA_TBOOLEAN:
+    nf7util_msg_write_bool(w, lua_toboolean(L, idx));
+    return nullptr;
+
+  case LUA_TNUMBER: {
+    const lua_Number v = lua_tonumber(L, idx);
+    if (-0x1p63 <= v && v < 0x1p63 && (lua_Number) (int64_t) v == v) {
+      nf7util_msg_write_int(w, (int64_t) v);
+    } else {
+      nf7util_msg_write_float(w, v);
+    }
+    return nullptr;
+  }
+
+  case LUA_TSTRING: {
+    size_t      len;
+    const char* str = lua_tolstring(L, idx, &len);
+    nf7util_msg_write_str(w, (const uint8_t*) str, len);
+    return nullptr;
+  }
+
+  case LUA_TUSERDATA: {
+    const struct nf7util_buffer* buf = nf7core_lua_buffer_get(L, idx);
+    if (nullptr == buf) {
+      return "only buffers can be packed as userdata";
+    }
+    nf7util_msg_write_bin(w, buf->array.ptr, buf->array.n);
+    return nullptr;
+  }
+
+  case LUA_TTABLE:
+    return write_table_(L, w, idx, depth);
+
+  default:
+    return "unsupported type to pack";
+  }
+}
+
+static const char* write_table_(
+    lua_State* L, struct nf7util_msg_writer* w, int idx, uint32_t depth) {
+  assert(0 < idx);
+
+  if (depth+1 >= NF7UTIL_MSG_MAX_DEPTH) {
+    return "too deep tables to pack";
+  }
+  if (!lua_checkstack(L, 3)) {
+    return "stack overflow while packing";
+  }
+
+  // an array needs keys of exactly 1..n, which are n distinct integers whose
+  // max is n
+  uint64_t n   = 0;
+  uint64_t max = 0;
+  bool     seq = true;
+  lua_pushnil(L);
+  while (0 != lua_next(L, idx)) {
+    ++n;
+    if (seq) {
+      const lua_Number k = lua_tonumber(L, -2);
+      seq =
+          LUA_TNUMBER == lua_type(L, -2) &&
+          1 <= k && k <= INT_MAX && (lua_Number) (uint64_t) k == k;
+      if (seq && max < (uint64_t) k) {
+        max = (uint64_t) k;
+      }
+    }
+    lua_pop(L, 1);
+  }
+  if (n > INT_MAX) {
+    return "too many elements to pack";
+  }
+
+  if (seq && max == n) {
+    nf7util_msg_write_array(w, (uint32_t) n);
+    for (uint64_t i = 1; i <= n; ++i) {
+      lua_rawgeti(L, idx, (int) i);
+      const char* err = write_(L, w, -1, depth+1);
+      lua_pop(L, 1);
+      if (nullptr != err) {
+        return err;
+      }
+    }
+    return nullptr;
+  }
+
+  nf7util_msg_write_map(w, (uint32_t) n);
+  lua_pushnil(L);
+  while (0 != lua_next(L, idx)) {
+    const char* err = write_(L, w, -2, depth+1);
+    if (nullptr == err) {
+      err = write_(L, w, -1, depth+1);
+    }
+    lua_pop(L, 1);
+    if (nullptr != err) {
+      lua_pop(L, 1);
+      return err;
+    }
+  }
+  return nullptr;
+}
+
+// pushes the next value, or returns an error message
+static const char* read_(lua_State* L, struct nf7util_msg_reader* r, uint32_t depth) {
+  if (!lua_checkstack(L, 3)) {
+    return "stack overflow while unpacking";
+  }
+
+  struct nf7util_msg_value v;
+  if (!nf7util_msg_read(r, &v)) {
+    return "broken bytes to unpack";
+  }
+  switch (v.type) {
+  case NF7UTIL_MSG_NIL:
+    lua_pushnil(L);
+    return nullptr;
+  case NF7UTIL_MSG_BOOL:
+    lua_pushboolean(L, v.b);
+    return nullptr;
+  case NF7UTIL_MSG_INT:
+    lua_pushnumber(L, (lua_Number) v.i);
+    return nullptr;
+  case NF7UTIL_MSG_UINT:
+    lua_pushnumber(L, (lua_Number) v.u);
+    return nullptr;
+  case NF7UTIL_MSG_FLOAT:
+    lua_pushnumber(L, v.f);
+    return nullptr;
+  case NF7UTIL_MSG_STR:
+  case NF7UTIL_MSG_BIN:
+    lua_pushlstring(L, (const char*) v.bytes.ptr, v.bytes.len);
+    return nullptr;
+  case NF7UTIL_MSG_ARRAY:
+  case NF7UTIL_MSG_MAP:
+    break;
+  }
+
+  // each element takes 1 byte at least, so a broken count is found before
+  // allocating a table for it
+  const bool     map  = NF7UTIL_MSG_MAP == v.type;
+  const uint64_t vals = (map? UINT64_C(2): UINT64_C(1)) * v.n;
+  if (depth+1 >= NF7UTIL_MSG_MAX_DEPTH) {
+    return "too deep tables to unpack";
+  }
+  if (v.n > INT_MAX || vals > r->len - r->pos) {
+    return "broken bytes to unpack";
+  }
+  lua_createtable(L, map? 0: (int) v.n, map? (int) v.n: 0);
+  for (uint32_t i = 0; i < v.n; ++i) {
+    const char* err = read_(L, r, depth+1);
+    if (nullptr != err) {
+      return err;
+    }
+    if (!map) {
+      lua_rawseti(L, -2, (int) i+1);
+      continue;
+    }
+    if (nullptr != (err = read_(L, r, depth+1))) {
+      return err;
+    }
+    if (lua_isnil(L, -2)) {
+      return "nil key to unpack";
+    }
+    lua_rawset(L, -3);
+  }
+  return nullptr;
+}
+
+
+static int pack_(lua_State* L) {
+  struct nf7util_malloc* malloc = lua_touserdata(L, lua_upvalueindex(1));
+  assert(nullptr != malloc);
+
+  struct nf7util_buffer* buf = nf7util_buffer_new(malloc, 0);
+  if (nullptr == buf) {
+    return luaL_error(L, "failed to allocate a buffer to pack");
+  }
+
+  // the buffer is not visible from lua until finished, so errors are raised
+  // after releasing it
+  struct nf7util_msg_writer w;
+  nf7util_msg_writer_init(&w, buf);
+  const char* err = nullptr;
+  const int   n   = lua_gettop(L);
+  for (int i = 1; nullptr == err && i <= n; ++i) {
+    err = write_(L, &w, i, 0);
+  }
+  if (!nf7util_msg_writer_finish(&w) && nullptr == err) {
+    err = "failed to allocate a buffer to pack";
+  }
+  if (nullptr != err) {
+    nf7util_buffer_unref(buf);
+    return luaL_error(L, "%s", err);
+  }
+
+  nf7core_lua_buffer_push(L, buf);
+  nf7util_buffer_unref(buf);
+  return 1;
+}
+
+static int unpack_(lua_State* L) {
+  const struct nf7util_buffer* buf = nf7core_lua_buffer_get(L, 1);
+  if (nullptr == buf) {
+    return luaL_argerror(L, 1, "expected an alive buffer");
+  }
+
+  struct nf7util_msg_reader r;
+  nf7util_msg_reader_init(&r, buf->array.ptr, buf->array.n);
+
+  int n = 0;
+  while (!nf7util_msg_reader_end(&r)) {
+    const char* err = read_(L, &r, 0);
+    if (nullptr != err) {
+      return luaL_error(L, "%s", err);
+    }
+    ++n;
+  }
+  return n;
+}
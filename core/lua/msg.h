@@ -0,0 +1,35 @@
+// No copyright
+//
+// Msg binding lets lua scripts encode and decode buffers in the format of
+// util/msg.h, so that they exchange structured data with C entities.
+//
+// HOW TO USE
+//   The binding adds 2 methods to the buffer type of core/lua/buffer.h:
+//       local buf = other.pack(1, "name", { x = 1.5, y = { 1, 2 } })
+//       local n, name, pos = buf:unpack()
+//   `pack` is called through any buffer, e.g. one passed to the script, and
+//   returns a new buffer holding values in order. `unpack` returns all values
+//   in the buffer.
+//
+// RULES
+//   - nil, boolean, string and number are encoded as same types. Numbers are
+//     encoded as int when integral, otherwise float.
+//   - A buffer is encoded as bin, and bin is decoded as a string.
+//   - A table whose keys are exactly 1..n is encoded as an array, and other
+//     tables are as a map. An empty table is an empty array.
+//   - Both raise an error with other types, nesting deeper than
+//     NF7UTIL_MSG_MAX_DEPTH, or broken bytes.
+//   - Numbers of lua are double, so integers over 2^53 lose precision.
+#pragma once
+
+#include <lua.h>
+
+#include "util/malloc.h"
+
+
+// Adds the methods to the buffer type of the lua state.
+// Returns false if failed with a warning.
+bool nf7core_lua_msg_open(lua_State*, struct nf7util_malloc*);
+// PRECONDS:
+//   - nf7core_lua_buffer_open() has succeeded on the lua state.
+//   - The malloc is alive while the lua state is.
@@ -0,0 +1,117 @@
+// No copyright
+#include "core/lua/msg.h"
+
+#include <string.h>
+
+#include <lauxlib.h>
+
+#include "util/buffer.h"
+
+#include "core/lua/buffer.h"
+#include "core/lua/thread.h"
+
+#include "test/common.h"
+
+
+// returns whether the script succeeded, which leaves a result or an error
+static bool call_(lua_State* L, const char* script) {
+  // PRECONDS: the buffer is at the top
+  if (0 != luaL_loadstring(L, script)) {
+    return false;
+  }
+  lua_pushvalue(L, -2);
+  return 0 == lua_pcall(L, 1, 1, 0);
+}
+
+NF7TEST(nf7core_lua_msg_test_pack) {
+  struct nf7core_lua* mod =
+    (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_lua);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  bool ret = false;
+
+  struct nf7util_buffer*     buf  = nullptr;
+  struct nf7core_lua_thread* base =
+      nf7core_lua_thread_new(mod, nullptr, nullptr);
+  if (!nf7test_expect(nullptr != base)) {
+    goto EXIT;
+  }
+  lua_State* L = base->lua;
+
+  buf = nf7util_buffer_new_from_cstr(test_->malloc, "xy");
+  if (!nf7test_expect(nullptr != buf)) {
+    goto EXIT;
+  }
+  nf7core_lua_buffer_push(L, buf);
+
+  const char* pack =
+      "local buf = ...\n"
+      "return buf.pack(1, -2, 1.5, 'ab', true, buf, {1, 2}, {a = 1})\n";
+  if (!nf7test_expect(call_(L, pack))) {
+    goto EXIT;
+  }
+  const struct nf7util_buffer* packed = nf7core_lua_buffer_get(L, -1);
+  if (!nf7test_expect(nullptr != packed)) {
+    goto EXIT;
+  }
+
+  static const uint8_t kExpect[] = {
+    0x01, 0xFE,
+    0xCB, 0x3F, 0xF8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xA2, 'a', 'b',
+    0xC3,
+    0xC4, 0x02, 'x', 'y',
+    0x92, 0x01, 0x02,
+    0x81, 0xA1, 'a', 0x01,
+  };
+  if (!nf7test_expect(sizeof(kExpect) == packed->array.n) ||
+      !nf7test_expect(0 == memcmp(kExpect, packed->array.ptr, sizeof(kExpect)))) {
+    goto EXIT;
+  }
+
+  // the packed buffer is unpacked to the same values
+  const char* unpack =
+      "local a, b, c, d, e, f, g, h = (...):unpack()\n"
+      "return a == 1 and b == -2 and c == 1.5 and d == 'ab' and e == true and\n"
+      "       f == 'xy' and #g == 2 and g[1] == 1 and g[2] == 2 and h.a == 1\n";
+  if (!nf7test_expect(call_(L, unpack)) ||
+      !nf7test_expect(lua_toboolean(L, -1))) {
+    goto EXIT;
+  }
+  lua_pop(L, 2);
+
+  // a sparse table is a map
+  const char* sparse = "return (...).pack({[1] = 1, [3] = 3}):data()[0]";
+  if (!nf7test_expect(call_(L, sparse)) ||
+      !nf7test_expect(0x82 == lua_tonumber(L, -1))) {
+    goto EXIT;
+  }
+  lua_pop(L, 2);
+
+  // an array of 2 with 1 element is broken
+  nf7util_buffer_unref(buf);
+  buf = nf7util_buffer_new_from_cstr(test_->malloc, "\x92\x01");
+  if (!nf7test_expect(nullptr != buf)) {
+    goto EXIT;
+  }
+  nf7core_lua_buffer_push(L, buf);
+
+  // unsupported types and broken bytes raise errors
+  if (!nf7test_expect(!call_(L, "return (...).pack(function() end)"))) {
+    goto EXIT;
+  }
+  lua_pop(L, 1);
+  ret = nf7test_expect(!call_(L, "return (...):unpack()"));
+  lua_settop(L, 0);
+
+EXIT:
+  if (nullptr != buf) {
+    nf7util_buffer_unref(buf);
+  }
+  if (nullptr != base) {
+    nf7core_lua_thread_unref(base);
+  }
+  return ret;
+}
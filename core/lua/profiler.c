@@ -0,0 +1,263 @@
+// No copyright
+#include "core/lua/profiler.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util/log.h"
+
+#include "core/lua/thread.h"
+
+
+static int bottom_level_(lua_State*, int depth);
+static uint64_t append_root_(
+    char* dst, const struct nf7core_lua_thread*, lua_State*, int level);
+static uint64_t append_frame_(char* dst, uint64_t n, lua_State*, lua_Debug*);
+static uint64_t escape_(char* dst, uint64_t n, int len);
+
+
+bool nf7core_lua_profiler_start(struct nf7core_lua* mod, const char* path) {
+  assert(nullptr != mod);
+  assert(nullptr != path);
+
+  if (nullptr != mod->profiler) {
+    nf7util_log_warn("profiler has already started");
+    return false;
+  }
+
+  struct nf7core_lua_profiler* this =
+      nf7util_malloc_alloc(mod->malloc, sizeof(*this));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate a profiler");
+    return false;
+  }
+  *this = (struct nf7core_lua_profiler) {
+    .malloc = mod->malloc,
+    .uv     = mod->uv,
+  };
+  nf7util_str_atoms_init(&this->stacks, this->malloc);
+  nf7util_array_u64_init(&this->counts, this->malloc);
+
+  const size_t n = strlen(path);
+  this->path = nf7util_malloc_alloc(this->malloc, n+1);
+  if (nullptr == this->path) {
+    nf7util_log_error("failed to allocate a path of profile");
+    goto ABORT;
+  }
+  memcpy(this->path, path, n+1);
+
+  mod->profiler = this;
+  nf7util_log_info("lua profiler started: %s", path);
+  return true;
+
+ABORT:
+  nf7util_str_atoms_deinit(&this->stacks);
+  nf7util_array_u64_deinit(&this->counts);
+  nf7util_malloc_free(this->malloc, this);
+  return false;
+}
+
+bool nf7core_lua_profiler_stop(struct nf7core_lua* mod) {
+  assert(nullptr != mod);
+
+  struct nf7core_lua_profiler* this = mod->profiler;
+  if (nullptr == this) {
+    return true;
+  }
+  mod->profiler = nullptr;
+
+  const bool ret = nf7core_lua_profiler_write(this);
+  nf7util_log_info(
+      "lua profiler stopped with %" PRIu64 " samples: %s",
+      this->stats.samples, this->path);
+
+  nf7util_str_atoms_deinit(&this->stacks);
+  nf7util_array_u64_deinit(&this->counts);
+  nf7util_malloc_free(this->malloc, this->path);
+  nf7util_malloc_free(this->malloc, this);
+  return ret;
+}
+
+bool nf7core_lua_profiler_write(struct nf7core_lua_profiler* this) {
+  assert(nullptr != this);
+
+  uv_loop_t* uv = this->uv;
+
+  bool ret = false;
+
+  // measures the output at first to allocate it at once
+  uint64_t size = 0;
+  for (uint64_t i = 0; i < this->counts.n; ++i) {
+    if (0U < this->counts.ptr[i]) {
+      const struct nf7util_str_atom* stack =
+          nf7util_str_atoms_get(&this->stacks, (uint32_t) i+1);
+      size += stack->len +
+          (uint64_t) snprintf(nullptr, 0, " %" PRIu64 "\n", this->counts.ptr[i]);
+    }
+  }
+
+  struct nf7util_array_u8 out;
+  nf7util_array_u8_init(&out, this->malloc);
+  if (!nf7util_array_u8_resize(&out, size+1)) {  // +1 for NUL by snprintf
+    nf7util_log_error("failed to allocate a profile output");
+    goto EXIT;
+  }
+  uint64_t n = 0;
+  for (uint64_t i = 0; i < this->counts.n; ++i) {
+    if (0U < this->counts.ptr[i]) {
+      const struct nf7util_str_atom* stack =
+          nf7util_str_atoms_get(&this->stacks, (uint32_t) i+1);
+      memcpy(&out.ptr[n], stack->ptr, stack->len);
+      n += stack->len;
+      n += (uint64_t) snprintf(
+          (char*) &out.ptr[n], size+1-n, " %" PRIu64 "\n", this->counts.ptr[i]);
+    }
+  }
+
+  uv_fs_t req;
+  const int fd = uv_fs_open(
+      uv, &req, this->path,
+      UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC, 0644, nullptr);
+  uv_fs_req_cleanup(&req);
+  if (0 != nf7util_log_uv(fd < 0? fd: 0)) {
+    goto EXIT;
+  }
+  uint64_t written = 0;
+  while (written < size) {
+    const uint64_t rest = size - written;
+    uv_buf_t buf = uv_buf_init(
+        (char*) &out.ptr[written], (unsigned) (rest < UINT32_MAX? rest: UINT32_MAX));
+    const int len = uv_fs_write(uv, &req, fd, &buf, 1, -1, nullptr);
+    uv_fs_req_cleanup(&req);
+    if (0 != nf7util_log_uv(len < 0? len: 0) || 0 == len) {
+      break;
+    }
+    written += (uint64_t) len;
+  }
+  uv_fs_close(uv, &req, fd, nullptr);
+  uv_fs_req_cleanup(&req);
+  ret = written == size;
+
+EXIT:
+  nf7util_array_u8_deinit(&out);
+  return ret;
+}
+
+void nf7core_lua_profiler_sample(
+    struct nf7core_lua_profiler* this,
+    struct nf7core_lua_thread*   thread,
+    lua_State*                   L) {
+  assert(nullptr != this);
+  assert(nullptr != thread);
+  assert(nullptr != L);
+
+  // counts frames to write them from the root
+  lua_Debug ar;
+  int depth = 0;
+  while (depth < NF7CORE_LUA_PROFILER_MAX_DEPTH && lua_getstack(L, depth, &ar)) {
+    ++depth;
+  }
+
+  // the root is named by the thread's function, which is stable across runs
+  char     stack[NF7CORE_LUA_PROFILER_MAX_STACK];
+  uint64_t n = append_root_(stack, thread, L, bottom_level_(L, depth));
+  for (int level = depth-1; 0 <= level; --level) {
+    if (!lua_getstack(L, level, &ar) || 0 == lua_getinfo(L, "Sn", &ar)) {
+      continue;
+    }
+    n = append_frame_(stack, n, L, &ar);
+  }
+
+  const uint32_t atom =
+      nf7util_str_atoms_intern(&this->stacks, (const uint8_t*) stack, n);
+  if (0U == atom) {
+    ++this->stats.drops;
+    return;
+  }
+  if (atom > this->counts.n) {
+    const uint64_t prev = this->counts.n;
+    if (!nf7util_array_u64_resize(&this->counts, atom)) {
+      ++this->stats.drops;
+      return;
+    }
+    memset(&this->counts.ptr[prev], 0, (atom - prev)*sizeof(uint64_t));
+  }
+  ++this->counts.ptr[atom-1];
+  ++this->stats.samples;
+}
+
+
+static int bottom_level_(lua_State* L, int depth) {
+  lua_Debug ar;
+  if (depth < NF7CORE_LUA_PROFILER_MAX_DEPTH) {
+    return depth-1;
+  }
+
+  // the stack is deeper than sampled, so searches the bottom by doubling
+  int lo = depth-1;
+  int hi = depth;
+  while (lua_getstack(L, hi, &ar)) {
+    lo = hi;
+    if (hi > INT_MAX/2) {
+      return lo;
+    }
+    hi *= 2;
+  }
+  while (lo+1 < hi) {
+    const int mid = lo + (hi-lo)/2;
+    if (lua_getstack(L, mid, &ar)) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static uint64_t append_root_(
+    char* dst, const struct nf7core_lua_thread* thread, lua_State* L, int level) {
+  const uint64_t cap   = NF7CORE_LUA_PROFILER_MAX_STACK;
+  const char*    chunk = "?";
+
+  lua_Debug ar;
+  if (0 <= level && lua_getstack(L, level, &ar) && 0 != lua_getinfo(L, "S", &ar)) {
+    chunk = ar.short_src;
+  }
+  const uint64_t n = escape_(dst, 0, snprintf(dst, cap, "thread:%s", chunk));
+  if (n+1 >= cap) {
+    return n;
+  }
+  const int len = snprintf(&dst[n], cap-n, ";#%" PRIu64, thread->id);
+  return escape_(dst, n, len);
+}
+
+static uint64_t append_frame_(char* dst, uint64_t n, lua_State*, lua_Debug* ar) {
+  const uint64_t cap = NF7CORE_LUA_PROFILER_MAX_STACK;
+  if (n+1 >= cap) {
+    return n;
+  }
+  const char* name =
+      nullptr != ar->name? ar->name: ('m' == ar->what[0]? "main": "?");
+  const int len = snprintf(
+      &dst[n], cap-n, ";%s:%s:%d", ar->short_src, name, ar->linedefined);
+  return escape_(dst, n, len);
+}
+
+static uint64_t escape_(char* dst, uint64_t n, int len) {
+  const uint64_t cap = NF7CORE_LUA_PROFILER_MAX_STACK;
+  if (len < 0) {
+    return n;
+  }
+  const uint64_t end = n + (uint64_t) len < cap? n + (uint64_t) len: cap-1;
+
+  // separators of the format cannot appear in frames, skipping the leading one
+  for (uint64_t i = n+1; i < end; ++i) {
+    if (';' == dst[i] || ' ' == dst[i] || '\n' == dst[i]) {
+      dst[i] = '_';
+    }
+  }
+  return end;
+}
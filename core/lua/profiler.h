@@ -0,0 +1,94 @@
+// No copyright
+//
+// Profiler samples stacks of lua threads and writes them in collapsed-stack
+// format, which flame graph tools read.
+//
+// HOW TO USE
+//   Start profiling by nf7core_lua_profiler_start() with a path of the output,
+//   and stop it by nf7core_lua_profiler_stop(), which writes the samples. The
+//   main state is profiled from its init to exit with a command line arg,
+//   `NF7CORE_LUA_PROFILE_ARG <path>`.
+//
+//   Each line of the output is a stack from the root to the leaf followed by a
+//   number of samples:
+//       thread:main;#3;main:main:0;main:heavy:1 42
+//   The first frame is the thread named by the chunk of its function, so the
+//   same code is merged across threads and runs at the root. The second is
+//   `id` of the thread, see core/lua/thread.h, which keeps each thread apart
+//   under the root. The others are lua functions named by
+//   `<chunk>:<function>:<line defined>`.
+//
+// RULES
+//   - Threads are sampled every NF7CORE_LUA_THREAD_BUDGET_INTERVAL VM
+//     instructions, so a sample counts instructions rather than time.
+//   - Sampling turns the JIT off for each profiled lua state until profiled
+//     threads stop being hooked, so the profile shows the interpreter, see
+//     `budget` in core/lua/thread.h.
+//   - Starting or stopping takes effect from the next resume of each thread.
+//   - The profiler is shared by all threads of the module, so threads running
+//     at the same time are mixed into one profile.
+//   - Threads on lua states of workers (core/lua/worker.h) are never sampled,
+//     because they run out of the loop thread and are not hooked.
+#pragma once
+
+#include <stdint.h>
+
+#include <lua.h>
+#include <uv.h>
+
+#include "util/array.h"
+#include "util/malloc.h"
+#include "util/str.h"
+
+#include "core/lua/mod.h"
+
+
+// A command line arg followed by a path to write a profile of the main state.
+#define NF7CORE_LUA_PROFILE_ARG "--nf7core-lua-profile"
+
+// A number of frames sampled from the leaf.
+#define NF7CORE_LUA_PROFILER_MAX_DEPTH 64
+
+// A maximum length of a sampled stack.
+#define NF7CORE_LUA_PROFILER_MAX_STACK 4096
+
+struct nf7core_lua_thread;
+
+struct nf7core_lua_profiler {
+  struct nf7util_malloc* malloc;
+  uv_loop_t*             uv;
+
+  char* path;
+
+  // collapsed stacks, and a number of samples of each stack at `atom-1`
+  struct nf7util_str_atoms stacks;
+  struct nf7util_array_u64 counts;
+
+  struct {
+    uint64_t samples;  // a number of samples taken
+    uint64_t drops;    // a number of samples dropped by allocation failure
+  } stats;
+};
+
+
+// Starts profiling threads of the module.
+// Returns false if the profiler has already started or failed to start.
+bool nf7core_lua_profiler_start(struct nf7core_lua* mod, const char* path);
+// PRECONDS:
+//   - `nullptr != mod`
+//   - `nullptr != path`
+// POSTCONDS:
+//   - When returns true, `nullptr != mod->profiler`
+
+// Stops profiling and writes the samples.
+// Returns false if failed to write. Nothing happens if not started.
+bool nf7core_lua_profiler_stop(struct nf7core_lua* mod);
+// POSTCONDS:
+//   - `nullptr == mod->profiler`
+
+// Writes the samples taken until now.
+bool nf7core_lua_profiler_write(struct nf7core_lua_profiler*);
+
+// Takes a sample of the thread running on the lua state.
+void nf7core_lua_profiler_sample(
+    struct nf7core_lua_profiler*, struct nf7core_lua_thread*, lua_State*);
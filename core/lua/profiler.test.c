@@ -0,0 +1,130 @@
+// No copyright
+#include "core/lua/profiler.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <lauxlib.h>
+#include <uv.h>
+
+#include "core/lua/thread.h"
+
+#include "test/common.h"
+
+
+static const char script_[] =
+    "local function heavy(n)\n"
+    "  local x = 0\n"
+    "  for i = 1, n do x = x + i end\n"
+    "  return x\n"
+    "end\n"
+    "local x = heavy(100000)\n"
+    "return x\n";
+
+// a chunk name to find stacks of this test
+//   The profiler is module-wide, so stacks of other tests running at the same
+//   time can be mixed into the output.
+#define CHUNK_ "nf7core_lua_profiler_test"
+
+struct ctx_ {
+  struct nf7test* test;
+  char path[1200];
+};
+
+static bool path_(char* path, size_t size) {
+  char   dir[1024];
+  size_t dirlen = sizeof(dir);
+  if (0 != uv_os_tmpdir(dir, &dirlen)) {
+    return false;
+  }
+  const int n = snprintf(
+      path, size, "%s/nf7core_lua_profiler_test.%d", dir, (int) uv_os_getpid());
+  return 0 < n && (size_t) n < size;
+}
+
+static void finalize_(struct nf7core_lua_thread* this, lua_State*) {
+  struct ctx_*    ctx   = this->data;
+  struct nf7test* test_ = ctx->test;
+
+  nf7test_expect(NF7CORE_LUA_THREAD_DONE == this->state);
+  nf7test_expect(nf7core_lua_profiler_stop(this->mod));
+
+  static char text[64*1024];
+  size_t n  = 0;
+  FILE*  fp = fopen(ctx->path, "rb");
+  if (nf7test_expect(nullptr != fp)) {
+    n = fread(text, 1, sizeof(text)-1, fp);
+    nf7test_expect(0 == ferror(fp));
+    fclose(fp);
+  }
+  text[n] = 0;
+
+  char expected[256];
+  snprintf(
+      expected, sizeof(expected),
+      "thread:" CHUNK_ ";#%" PRIu64 ";" CHUNK_ ":main:0;" CHUNK_ ":heavy:1 ",
+      this->id);
+  nf7test_expect(nullptr != strstr(text, expected));
+  remove(ctx->path);
+
+  nf7test_unref(test_);
+  nf7util_malloc_free(test_->malloc, ctx);
+}
+
+NF7TEST(nf7core_lua_profiler_test_collapsed) {
+  struct nf7core_lua* mod =
+    (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_lua);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  struct ctx_* ctx = nf7util_malloc_alloc(test_->malloc, sizeof(*ctx));
+  if (!nf7test_expect(nullptr != ctx)) {
+    return false;
+  }
+  *ctx = (struct ctx_) { .test = test_, };
+  if (!nf7test_expect(path_(ctx->path, sizeof(ctx->path))) ||
+      !nf7test_expect(nf7core_lua_profiler_start(mod, ctx->path)) ||
+      !nf7test_expect(!nf7core_lua_profiler_start(mod, ctx->path))) {
+    goto ABORT;
+  }
+
+  // an independent state not to turn the JIT off for the main state
+  struct nf7core_lua_thread* base = nf7core_lua_thread_new(mod, nullptr, nullptr);
+  if (!nf7test_expect(nullptr != base)) {
+    goto ABORT;
+  }
+  lua_State* L = base->lua;
+  if (!nf7test_expect(
+        0 == luaL_loadbuffer(L, script_, sizeof(script_)-1, "=" CHUNK_))) {
+    nf7core_lua_thread_unref(base);
+    goto ABORT;
+  }
+  struct nf7core_lua_value_ptr* func = nf7core_lua_value_ptr_new(base, L);
+  if (!nf7test_expect(nullptr != func)) {
+    nf7core_lua_thread_unref(base);
+    goto ABORT;
+  }
+  struct nf7core_lua_thread* thread = nf7core_lua_thread_new(mod, base, func);
+  nf7core_lua_value_ptr_unref(func);
+  nf7core_lua_thread_unref(base);
+  if (!nf7test_expect(nullptr != thread)) {
+    goto ABORT;
+  }
+  thread->data      = ctx;
+  thread->post_exec = finalize_;
+  if (!nf7test_expect(nf7core_lua_thread_resume(thread, nullptr))) {
+    nf7core_lua_thread_unref(thread);
+    goto ABORT;
+  }
+  nf7core_lua_thread_unref(thread);
+  nf7test_ref(test_);
+  return true;
+
+ABORT:
+  nf7core_lua_profiler_stop(mod);
+  remove(ctx->path);
+  nf7util_malloc_free(test_->malloc, ctx);
+  return false;
+}
@@ -0,0 +1,283 @@
+// No copyright
+#include "core/lua/sched.h"
+
+#include <assert.h>
+#include <inttypes.h>
+
+#include "util/log.h"
+
+
+#define MASK_ (NF7CORE_LUA_SCHED_WHEEL_SLOTS - 1U)
+#define SPAN_(level) (UINT64_C(1) << (NF7CORE_LUA_SCHED_WHEEL_BITS*(level)))
+
+static void ready_push_(
+    struct nf7core_lua_sched*, struct nf7core_lua_sched_task*);
+static bool ready_start_(struct nf7core_lua_sched*);
+static void wheel_insert_(
+    struct nf7core_lua_sched*, struct nf7core_lua_sched_task*);
+static void wheel_remove_(
+    struct nf7core_lua_sched*, const struct nf7core_lua_sched_task*);
+static void wheel_advance_(struct nf7core_lua_sched*, uint64_t);
+static bool wheel_arm_(struct nf7core_lua_sched*);
+
+static void on_check_(uv_check_t*);
+static void on_idle_(uv_idle_t*);
+static void on_time_(uv_timer_t*);
+static void on_close_(uv_handle_t*);
+
+
+struct nf7core_lua_sched* nf7core_lua_sched_new(
+    struct nf7util_malloc* malloc, uv_loop_t* uv) {
+  assert(nullptr != malloc);
+  assert(nullptr != uv);
+
+  struct nf7core_lua_sched* this = nf7util_malloc_alloc(malloc, sizeof(*this));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate a scheduler");
+    return nullptr;
+  }
+  *this = (struct nf7core_lua_sched) {
+    .malloc = malloc,
+    .uv     = uv,
+    .wheel  = {
+      .now = uv_now(uv),
+    },
+  };
+
+  nf7util_log_uv_assert(uv_check_init(uv, &this->check));
+  nf7util_log_uv_assert(uv_idle_init(uv, &this->idle));
+  nf7util_log_uv_assert(uv_timer_init(uv, &this->timer));
+  this->check.data = this;
+  this->idle.data  = this;
+  this->timer.data = this;
+  return this;
+}
+
+void nf7core_lua_sched_del(struct nf7core_lua_sched* this) {
+  if (nullptr == this) {
+    return;
+  }
+  if (nullptr != this->ready.head || 0 < this->wheel.n) {
+    nf7util_log_warn(
+        "scheduler is deleted with %" PRIu64 " pending timer tasks%s",
+        this->wheel.n, nullptr != this->ready.head? " and ready tasks": "");
+  }
+  this->closing = 3;
+  uv_close((uv_handle_t*) &this->check, on_close_);
+  uv_close((uv_handle_t*) &this->idle,  on_close_);
+  uv_close((uv_handle_t*) &this->timer, on_close_);
+}
+
+bool nf7core_lua_sched_push(
+    struct nf7core_lua_sched* this,
+    struct nf7core_lua_sched_task* task,
+    uint64_t timeout) {
+  assert(nullptr != this);
+  assert(nullptr != task);
+  assert(nullptr != task->func);
+
+  task->next = nullptr;
+  if (0 == timeout) {
+    if (!ready_start_(this)) {
+      return false;
+    }
+    ready_push_(this, task);
+    return true;
+  }
+
+  // the wheel doesn't advance while it's empty
+  const uint64_t now = uv_now(this->uv);
+  if (0 == this->wheel.n) {
+    this->wheel.now = now;
+  }
+  task->due = now + timeout;
+  wheel_insert_(this, task);
+  if (!wheel_arm_(this)) {
+    nf7util_log_error("failed to arm the timing wheel");
+    wheel_remove_(this, task);
+    return false;
+  }
+  return true;
+}
+
+
+static void ready_push_(
+    struct nf7core_lua_sched* this, struct nf7core_lua_sched_task* task) {
+  task->next = nullptr;
+  if (nullptr == this->ready.tail) {
+    this->ready.head = task;
+  } else {
+    this->ready.tail->next = task;
+  }
+  this->ready.tail = task;
+}
+
+static bool ready_start_(struct nf7core_lua_sched* this) {
+  if (nullptr != this->ready.head) {
+    return true;
+  }
+  // the idle handle makes the loop poll without blocking while tasks are ready
+  if (0 != nf7util_log_uv(uv_check_start(&this->check, on_check_)) ||
+      0 != nf7util_log_uv(uv_idle_start(&this->idle, on_idle_))) {
+    nf7util_log_error("failed to start the ready queue");
+    return false;
+  }
+  return true;
+}
+
+static void wheel_insert_(
+    struct nf7core_lua_sched* this, struct nf7core_lua_sched_task* task) {
+  const uint64_t now = this->wheel.now;
+  if (task->due <= now) {
+    if (ready_start_(this)) {
+      ready_push_(this, task);
+      return;
+    }
+    task->due = now + 1;
+  }
+
+  // finds the lowest level whose range covers the delay
+  // tasks too far are put in the top level and cascaded again later
+  const uint64_t delta = task->due - now;
+  uint32_t level = 0;
+  while (level+1 < NF7CORE_LUA_SCHED_WHEEL_LEVELS && delta >= SPAN_(level+1)) {
+    ++level;
+  }
+  const uint64_t due =
+      delta < SPAN_(level+1)? task->due: now + SPAN_(level+1) - 1;
+  const uint64_t idx = (due >> (NF7CORE_LUA_SCHED_WHEEL_BITS*level)) & MASK_;
+
+  struct nf7core_lua_sched_task** slot = &this->wheel.slots[level][idx];
+  task->next = *slot;
+  *slot      = task;
+  ++this->wheel.n;
+}
+
+static void wheel_remove_(
+    struct nf7core_lua_sched* this, const struct nf7core_lua_sched_task* task) {
+  for (uint32_t level = 0; level < NF7CORE_LUA_SCHED_WHEEL_LEVELS; ++level) {
+    for (uint32_t idx = 0; idx < NF7CORE_LUA_SCHED_WHEEL_SLOTS; ++idx) {
+      struct nf7core_lua_sched_task** itr = &this->wheel.slots[level][idx];
+      for (; nullptr != *itr; itr = &(*itr)->next) {
+        if (task == *itr) {
+          *itr = task->next;
+          --this->wheel.n;
+          return;
+        }
+      }
+    }
+  }
+  assert(false && "the task is not in the wheel");
+}
+
+static void wheel_advance_(struct nf7core_lua_sched* this, uint64_t target) {
+  if (0 == this->wheel.n) {
+    this->wheel.now = target;
+    return;
+  }
+  while (this->wheel.now < target && 0 < this->wheel.n) {
+    const uint64_t now = ++this->wheel.now;
+
+    // cascades upper levels whose lower level has just wrapped
+    for (uint32_t level = 1; level < NF7CORE_LUA_SCHED_WHEEL_LEVELS; ++level) {
+      if (0 != (now & (SPAN_(level) - 1))) {
+        break;
+      }
+      const uint64_t idx =
+          (now >> (NF7CORE_LUA_SCHED_WHEEL_BITS*level)) & MASK_;
+      struct nf7core_lua_sched_task* task = this->wheel.slots[level][idx];
+      this->wheel.slots[level][idx] = nullptr;
+      while (nullptr != task) {
+        struct nf7core_lua_sched_task* next = task->next;
+        --this->wheel.n;
+        wheel_insert_(this, task);
+        task = next;
+      }
+    }
+
+    struct nf7core_lua_sched_task* task = this->wheel.slots[0][now & MASK_];
+    this->wheel.slots[0][now & MASK_] = nullptr;
+    while (nullptr != task) {
+      struct nf7core_lua_sched_task* next = task->next;
+      --this->wheel.n;
+      wheel_insert_(this, task);
+      task = next;
+    }
+  }
+  if (this->wheel.now < target) {
+    this->wheel.now = target;
+  }
+}
+
+static bool wheel_arm_(struct nf7core_lua_sched* this) {
+  if (0 == this->wheel.n) {
+    uv_timer_stop(&this->timer);
+    return true;
+  }
+
+  // finds the nearest tick which has something to do in each level
+  const uint64_t now     = this->wheel.now;
+  uint64_t       timeout = UINT64_MAX;
+  for (uint32_t level = 0; level < NF7CORE_LUA_SCHED_WHEEL_LEVELS; ++level) {
+    const uint32_t shift = NF7CORE_LUA_SCHED_WHEEL_BITS*level;
+    const uint64_t cur   = now >> shift;
+    for (uint64_t k = 1; k <= NF7CORE_LUA_SCHED_WHEEL_SLOTS; ++k) {
+      if (nullptr != this->wheel.slots[level][(cur+k) & MASK_]) {
+        const uint64_t t = ((cur+k) << shift) - now;
+        if (t < timeout) {
+          timeout = t;
+        }
+        break;
+      }
+    }
+  }
+  assert(UINT64_MAX != timeout);
+
+  // the wheel may lag behind the loop
+  const uint64_t lag = uv_now(this->uv) - now;
+  timeout = timeout > lag? timeout - lag: 0;
+  return 0 == nf7util_log_uv(
+      uv_timer_start(&this->timer, on_time_, timeout, 0));
+}
+
+
+static void on_check_(uv_check_t* check) {
+  struct nf7core_lua_sched* this = check->data;
+
+  const uint64_t begin = uv_hrtime();
+  while (nullptr != this->ready.head) {
+    struct nf7core_lua_sched_task* task = this->ready.head;
+    this->ready.head = task->next;
+    if (nullptr == this->ready.head) {
+      this->ready.tail = nullptr;
+    }
+    task->next = nullptr;
+    task->func(task);
+
+    if (uv_hrtime() - begin >= NF7CORE_LUA_SCHED_BUDGET) {
+      break;
+    }
+  }
+  if (nullptr == this->ready.head) {
+    uv_check_stop(&this->check);
+    uv_idle_stop(&this->idle);
+  }
+}
+
+static void on_idle_(uv_idle_t*) {
+}
+
+static void on_time_(uv_timer_t* timer) {
+  struct nf7core_lua_sched* this = timer->data;
+  wheel_advance_(this, uv_now(this->uv));
+  if (!wheel_arm_(this)) {
+    nf7util_log_error("failed to re-arm the timing wheel");
+  }
+}
+
+static void on_close_(uv_handle_t* handle) {
+  struct nf7core_lua_sched* this = handle->data;
+  if (0 == --this->closing) {
+    nf7util_malloc_free(this->malloc, this);
+  }
+}
@@ -0,0 +1,80 @@
+// No copyright
+//
+// Scheduler runs tasks of lua threads on the main loop without a uv handle for
+// each of them.
+//
+// HOW TO USE
+//   Embed nf7core_lua_sched_task in your context, fill `func` and `data`, and
+//   pass it to nf7core_lua_sched_push() with a timeout. Tasks whose timeout is
+//   0 go into a ready queue, which is drained in a uv_check callback, up to a
+//   time budget for each drain. Others go into a hierarchical timing wheel
+//   backed by one uv timer, and move to the ready queue when they expire.
+//
+// RULES
+//   - A task must not be pushed again until its `func` is called.
+//   - The task must be alive until its `func` is called.
+//   - Tasks remaining when the scheduler is deleted are never called.
+#pragma once
+
+#include <stdint.h>
+
+#include <uv.h>
+
+#include "util/malloc.h"
+
+
+// Max duration of a single drain of the ready queue. [ns]
+// Tasks over the budget are postponed to the next loop iteration so I/O is not
+// starved by many runnable threads.
+#define NF7CORE_LUA_SCHED_BUDGET (5*1000*1000)
+
+#define NF7CORE_LUA_SCHED_WHEEL_BITS   6
+#define NF7CORE_LUA_SCHED_WHEEL_SLOTS  (1U << NF7CORE_LUA_SCHED_WHEEL_BITS)
+#define NF7CORE_LUA_SCHED_WHEEL_LEVELS 4
+
+struct nf7core_lua_sched_task {
+  struct nf7core_lua_sched_task* next;
+  uint64_t due;  // in ms of uv_now()
+
+  void* data;
+  void (*func)(struct nf7core_lua_sched_task*);
+};
+
+struct nf7core_lua_sched {
+  struct nf7util_malloc* malloc;
+  uv_loop_t*             uv;
+
+  uv_check_t check;
+  uv_idle_t  idle;
+  uv_timer_t timer;
+  uint32_t   closing;
+
+  struct {
+    struct nf7core_lua_sched_task* head;
+    struct nf7core_lua_sched_task* tail;
+  } ready;
+
+  struct {
+    uint64_t now;  // current tick in ms of uv_now()
+    uint64_t n;
+    struct nf7core_lua_sched_task*
+        slots[NF7CORE_LUA_SCHED_WHEEL_LEVELS][NF7CORE_LUA_SCHED_WHEEL_SLOTS];
+  } wheel;
+};
+
+
+struct nf7core_lua_sched* nf7core_lua_sched_new(
+    struct nf7util_malloc*, uv_loop_t*);
+
+void nf7core_lua_sched_del(struct nf7core_lua_sched*);
+
+// Schedules the task to be called after the timeout [ms].
+bool nf7core_lua_sched_push(
+    struct nf7core_lua_sched*,
+    struct nf7core_lua_sched_task*,
+    uint64_t timeout);
+// PRECONDS:
+//   - `nullptr != task->func`
+// POSTCONDS:
+//   - When returns true, `task->func` will be called on the loop.
+//   - Otherwise, `task->func` is never called.
@@ -0,0 +1,75 @@
+// No copyright
+#include "core/lua/sched.h"
+
+#include <uv.h>
+
+#include "util/malloc.h"
+
+#include "core/lua/mod.h"
+
+#include "test/common.h"
+
+
+#define TASKS_ 6
+
+static const uint64_t timeouts_[TASKS_] = {70, 0, 30, 1, 0, 300};
+
+struct ctx_ {
+  struct nf7test* test;
+  uint64_t        begin;
+
+  uint32_t done;
+  uint32_t order[TASKS_];
+
+  struct nf7core_lua_sched_task tasks[TASKS_];
+};
+
+static void on_task_(struct nf7core_lua_sched_task* task) {
+  struct ctx_*    this  = task->data;
+  struct nf7test* test_ = this->test;
+
+  const uint32_t idx = (uint32_t) (task - this->tasks);
+  nf7test_expect(uv_now(test_->nf7->uv) - this->begin >= timeouts_[idx]);
+  this->order[this->done++] = idx;
+  if (TASKS_ > this->done) {
+    return;
+  }
+
+  // ready tasks run in FIFO, and others in order of their timeout
+  nf7test_expect(
+      1 == this->order[0] && 4 == this->order[1] && 3 == this->order[2] &&
+      2 == this->order[3] && 0 == this->order[4] && 5 == this->order[5]);
+  nf7util_malloc_free(test_->malloc, this);
+  nf7test_unref(test_);
+}
+
+NF7TEST(nf7core_lua_sched_test_order) {
+  struct nf7core_lua* mod =
+    (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_lua);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  struct ctx_* this = nf7util_malloc_alloc(test_->malloc, sizeof(*this));
+  if (!nf7test_expect(nullptr != this)) {
+    return false;
+  }
+  *this = (struct ctx_) {
+    .test  = test_,
+    .begin = uv_now(test_->nf7->uv),
+  };
+  nf7test_ref(test_);
+
+  for (uint32_t i = 0; i < TASKS_; ++i) {
+    this->tasks[i] = (struct nf7core_lua_sched_task) {
+      .data = this,
+      .func = on_task_,
+    };
+    if (!nf7test_expect(
+          nf7core_lua_sched_push(mod->sched, &this->tasks[i], timeouts_[i]))) {
+      // the pushed tasks would access the context, so it's leaked
+      return false;
+    }
+  }
+  return true;
+}
@@ -2,15 +2,37 @@
 #include "core/lua/thread.h"
 
 #include <assert.h>
+#include <inttypes.h>
+#include <limits.h>
+
+#include <lauxlib.h>
+#include <luajit.h>
 
 #include "util/log.h"
 
+#include "core/lua/buffer.h"
+#include "core/lua/msg.h"
+#include "core/lua/profiler.h"
+
 
 static void* alloc_(void*, void*, size_t, size_t);
 static void del_(struct nf7core_lua_thread*);
+static struct nf7core_lua_thread* pool_take_(struct nf7core_lua_thread*);
+static bool pool_put_(struct nf7core_lua_thread*);
+static void pool_trim_(struct nf7core_lua_thread*, uint64_t);
+
+static bool schedule_(struct nf7core_lua_thread*, uint64_t timeout, uint64_t n);
+static void capture_(struct nf7core_lua_thread*, lua_State*);
+static struct nf7core_lua_value to_value_(
+    struct nf7core_lua_thread*, lua_State*, int idx);
+
+static struct nf7core_lua_thread* root_(struct nf7core_lua_thread*);
+static void hook_enter_(struct nf7core_lua_thread*);
+static void hook_leave_(struct nf7core_lua_thread*);
+static void hook_(lua_State*, lua_Debug*);
+static bool yieldable_(lua_State*);
 
-static void on_time_(uv_timer_t*);
-static void on_close_(uv_handle_t*);
+static void on_task_(struct nf7core_lua_sched_task*);
 
 NF7UTIL_REFCNT_IMPL(, nf7core_lua_thread, {del_(this);});
 
@@ -20,23 +42,29 @@ struct nf7core_lua_thread* nf7core_lua_thread_new(
     struct nf7core_lua_value_ptr* func) {
   assert(nullptr != mod);
 
-  struct nf7core_lua_thread* this =
-      nf7util_malloc_alloc(mod->malloc, sizeof(*this));
+  struct nf7core_lua_thread* this = pool_take_(base);
+  if (nullptr != this) {
+    goto PREPARE;
+  }
+
+  this = nf7util_malloc_alloc(mod->malloc, sizeof(*this));
   if (nullptr == this) {
     nf7util_log_error("failed to allocate new thread context");
     return nullptr;
   }
   *this = (struct nf7core_lua_thread) {
-    .mod    = mod,
-    .malloc = mod->malloc,
-    .uv     = mod->uv,
+    .mod      = mod,
+    .malloc   = mod->malloc,
+    .uv       = mod->uv,
+    .base_ref = LUA_NOREF,
+    .pool     = {
+      .max = NF7CORE_LUA_THREAD_POOL_DEFAULT_MAX,
+    },
+    .task = {
+      .func = on_task_,
+    },
   };
-
-  if (0 != nf7util_log_uv(uv_timer_init(this->uv, &this->timer))) {
-    nf7util_log_error("failed to init uv timer");
-    goto ABORT;
-  }
-  this->timer.data = this;
+  this->task.data = this;
 
   if (nullptr != base) {
     this->lua = lua_newthread(base->lua);
@@ -44,8 +72,10 @@ struct nf7core_lua_thread* nf7core_lua_thread_new(
       nf7util_log_error("failed to allocate new lua thread");
       goto ABORT;
     }
-    this->base  = base;
+    this->base_ref = luaL_ref(base->lua, LUA_REGISTRYINDEX);
+    this->base     = base;
     nf7core_lua_thread_ref(this->base);
+    ++base->pool.stats.misses;
   } else {
     this->lua_owned = true;
     this->lua       = lua_newstate(alloc_, this);
@@ -54,8 +84,22 @@ struct nf7core_lua_thread* nf7core_lua_thread_new(
       goto ABORT;
     }
     nf7util_log_debug("new lua state is created");
+    nf7core_lua_value_ptr_slab_init(&this->values, this->malloc, this->lua);
+
+    if (!nf7core_lua_buffer_open(this->lua)) {
+      nf7util_log_warn("buffer type is not available on the new lua state");
+    }
+    if (!nf7core_lua_msg_open(this->lua, this->malloc)) {
+      nf7util_log_warn("msg binding is not available on the new lua state");
+    }
   }
 
+PREPARE:
+  this->id = ++mod->threads;
+  if (nullptr != base) {
+    this->budget.insts = base->budget.insts;
+    this->budget.time  = base->budget.time;
+  }
   if (nullptr != func) {
     this->state = NF7CORE_LUA_THREAD_PAUSED;
     nf7core_lua_value_ptr_push(func, this->lua);
@@ -72,41 +116,130 @@ ABORT:
   return nullptr;
 }
 
+void nf7core_lua_thread_pool_set_max(
+    struct nf7core_lua_thread* base, uint64_t max) {
+  assert(nullptr != base);
+  base->pool.max = max;
+  pool_trim_(base, max);
+}
+
+bool nf7core_lua_thread_resume_array_after(
+    struct nf7core_lua_thread* this, uint64_t timeout,
+    const struct nf7core_lua_value* args, uint64_t n) {
+  assert(nullptr != this);
+  assert(NF7CORE_LUA_THREAD_PAUSED == this->state);
+  assert(nullptr != args || 0U == n);
+
+  lua_State* L = this->lua;
+  if (n > INT_MAX/2 || !lua_checkstack(L, (int) n)) {
+    nf7util_log_error("too many values to resume thread: %" PRIu64, n);
+    return false;
+  }
+  for (uint64_t i = 0; i < n; ++i) {
+    nf7core_lua_value_push(&args[i], L);
+  }
+  return schedule_(this, timeout, n);
+}
+
 bool nf7core_lua_thread_resume_varg_after(
     struct nf7core_lua_thread* this, uint64_t timeout, va_list vargs) {
   assert(nullptr != this);
   assert(NF7CORE_LUA_THREAD_PAUSED == this->state);
 
-  // stores parameters
-  for (uint32_t i = 0;; ++i) {
-    struct nf7core_lua_value* src = va_arg(vargs, struct nf7core_lua_value*);
+  // pushes parameters directly, so there's no limit of them
+  lua_State* L = this->lua;
+  uint64_t   n = 0;
+  for (;;) {
+    const struct nf7core_lua_value* src =
+        va_arg(vargs, const struct nf7core_lua_value*);
     if (nullptr == src) {
-      this->args.n = i;
       break;
     }
-    assert(i < NF7CORE_LUA_THREAD_MAX_ARGS &&
-            "too many args or forgotten last nullptr");
-
-    struct nf7core_lua_value* dst = &this->args.ptr[i];
-    if (!nf7core_lua_value_set(dst, src)) {
-      nf7core_lua_value_set(dst, &NF7CORE_LUA_VALUE_NIL());
-      nf7util_log_warn(
-          "failed to store parameter value, it's replaced by nil");
+    if (!lua_checkstack(L, 1)) {
+      nf7util_log_error("too many values to resume thread");
+      lua_pop(L, (int) n);
+      return false;
     }
+    nf7core_lua_value_push(src, L);
+    ++n;
   }
+  return schedule_(this, timeout, n);
+}
 
-  if (0 != nf7util_log_uv(uv_timer_start(&this->timer, on_time_, timeout, 0))) {
-    nf7util_log_error(
-        "failed to start timer for resuming thread");
+static bool schedule_(
+    struct nf7core_lua_thread* this, uint64_t timeout, uint64_t n) {
+  if (!nf7core_lua_sched_push(this->mod->sched, &this->task, timeout)) {
+    nf7util_log_error("failed to schedule resuming thread");
+    lua_pop(this->lua, (int) n);
     return false;
   }
   nf7core_lua_thread_ref(this);
 
   nf7util_log_debug("lua thread state change: PAUSED -> SCHEDULED");
+  this->nargs = n;
   this->state = NF7CORE_LUA_THREAD_SCHEDULED;
   return true;
 }
 
+static void capture_(struct nf7core_lua_thread* this, lua_State* L) {
+  // an aborted thread has only the error message to be captured on the top
+  const int top   = lua_gettop(L);
+  const int begin = NF7CORE_LUA_THREAD_ABORTED == this->state? top: 1;
+  const uint64_t n = 0 < top? (uint64_t) (top - begin + 1): 0U;
+
+  struct nf7core_lua_value  inline_[NF7CORE_LUA_THREAD_INLINE_RESULTS];
+  struct nf7core_lua_value* values = inline_;
+  if (n > NF7CORE_LUA_THREAD_INLINE_RESULTS) {
+    values = nf7util_malloc_alloc(this->malloc, n*sizeof(*values));
+    if (nullptr == values) {
+      nf7util_log_error("failed to allocate results, they are dropped");
+      this->on_results(this, nullptr, 0);
+      return;
+    }
+  }
+  for (uint64_t i = 0; i < n; ++i) {
+    values[i] = to_value_(this, L, begin + (int) i);
+  }
+  this->on_results(this, values, n);
+
+  for (uint64_t i = 0; i < n; ++i) {
+    nf7core_lua_value_unset(&values[i]);
+  }
+  if (values != inline_) {
+    nf7util_malloc_free(this->malloc, values);
+  }
+}
+
+static struct nf7core_lua_value to_value_(
+    struct nf7core_lua_thread* this, lua_State* L, int idx) {
+  switch (lua_type(L, idx)) {
+  case LUA_TNONE:
+  case LUA_TNIL:
+    return NF7CORE_LUA_VALUE_NIL();
+  case LUA_TBOOLEAN:
+    return NF7CORE_LUA_VALUE_BOOL(lua_toboolean(L, idx));
+  case LUA_TNUMBER:
+    return NF7CORE_LUA_VALUE_NUM(lua_tonumber(L, idx));
+  case LUA_TSTRING: {
+    size_t      len;
+    const char* ptr = lua_tolstring(L, idx, &len);
+    return NF7CORE_LUA_VALUE_STR(ptr, len);
+  }
+  case LUA_TUSERDATA: {
+    struct nf7util_buffer* buf = nf7core_lua_buffer_get(L, idx);
+    if (nullptr != buf) {
+      nf7util_buffer_ref(buf);
+      return NF7CORE_LUA_VALUE_BUF(buf);
+    }
+  } [[fallthrough]];
+  default:
+    // the base outlives this thread, so a value copied from the borrowed
+    // slot refers the base
+    return NF7CORE_LUA_VALUE_BORROW(
+        nullptr != this->base? this->base: this, L, idx);
+  }
+}
+
 static void* alloc_(void* data, void* ptr, size_t, size_t nsize) {
   struct nf7core_lua_thread* this = data;
   return nf7util_malloc_realloc(this->malloc, ptr, nsize);
@@ -116,37 +249,211 @@ static void del_(struct nf7core_lua_thread* this) {
   if (nullptr == this) {
     return;
   }
-  if (nullptr != this->timer.data) {
-    uv_close((uv_handle_t*) &this->timer, on_close_);
+  hook_leave_(this);
+  if (pool_put_(this)) {
     return;
   }
+  pool_trim_(this, 0);
 
   if (nullptr != this->lua && this->lua_owned) {
     lua_close(this->lua);
+    nf7core_lua_value_ptr_slab_deinit(&this->values);
     nf7util_log_debug("lua state is closed");
   }
   if (nullptr != this->base) {
+    luaL_unref(this->base->lua, LUA_REGISTRYINDEX, this->base_ref);
     nf7core_lua_thread_unref(this->base);
   }
   nf7util_malloc_free(this->malloc, this);
 }
 
-static void on_time_(uv_timer_t* timer) {
-  struct nf7core_lua_thread* this = timer->data;
+static struct nf7core_lua_thread* pool_take_(struct nf7core_lua_thread* base) {
+  if (nullptr == base || nullptr == base->pool.head) {
+    return nullptr;
+  }
+  struct nf7core_lua_thread* this = base->pool.head;
+  base->pool.head = this->pool_next;
+  --base->pool.n;
+  ++base->pool.stats.hits;
+
+  this->pool_next = nullptr;
+  this->base      = base;
+  nf7core_lua_thread_ref(base);
+  return this;
+}
+
+static bool pool_put_(struct nf7core_lua_thread* this) {
+  struct nf7core_lua_thread* base = this->base;
+  if (nullptr == base) {
+    return false;
+  }
+
+  // a finished co-routine can execute a new function, but an aborted or
+  // yielded one cannot
+  const bool reusable =
+      0 == lua_status(this->lua) &&
+      (NF7CORE_LUA_THREAD_DONE   == this->state ||
+       NF7CORE_LUA_THREAD_PAUSED == this->state);
+  if (!reusable || base->pool.n >= base->pool.max) {
+    ++base->pool.stats.drops;
+    return false;
+  }
+
+  lua_settop(this->lua, 0);
+  this->state      = NF7CORE_LUA_THREAD_DONE;
+  this->nargs       = 0;
+  this->data        = nullptr;
+  this->on_results  = nullptr;
+  this->post_exec   = nullptr;
+  this->preemptions = 0;
+
+  this->pool_next = base->pool.head;
+  base->pool.head = this;
+  ++base->pool.n;
+  ++base->pool.stats.recycles;
+
+  // the base may be deleted here with the pool including this
+  this->base = nullptr;
+  nf7core_lua_thread_unref(base);
+  return true;
+}
+
+static void pool_trim_(struct nf7core_lua_thread* this, uint64_t n) {
+  while (this->pool.n > n) {
+    struct nf7core_lua_thread* item = this->pool.head;
+    this->pool.head = item->pool_next;
+    --this->pool.n;
+
+    luaL_unref(this->lua, LUA_REGISTRYINDEX, item->base_ref);
+    item->base_ref  = LUA_NOREF;
+    item->lua       = nullptr;
+    item->pool_next = nullptr;
+    del_(item);
+  }
+}
+
+static struct nf7core_lua_thread* root_(struct nf7core_lua_thread* this) {
+  while (!this->lua_owned) {
+    assert(nullptr != this->base);
+    this = this->base;
+  }
+  return this;
+}
+
+static void hook_enter_(struct nf7core_lua_thread* this) {
+  if (this->hooked) {
+    return;
+  }
+  struct nf7core_lua_thread* root = root_(this);
+  this->hooked = true;
+  if (0U == root->hooks++) {
+    // the hook is never called inside compiled traces
+    luaJIT_setmode(root->lua, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_FLUSH);
+    luaJIT_setmode(root->lua, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+    nf7util_log_debug("JIT is turned off for hooks");
+  }
+}
+
+static void hook_leave_(struct nf7core_lua_thread* this) {
+  if (!this->hooked) {
+    return;
+  }
+  struct nf7core_lua_thread* root = root_(this);
+  this->hooked = false;
+  assert(0U < root->hooks);
+  if (0U == --root->hooks) {
+    luaJIT_setmode(root->lua, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_ON);
+    nf7util_log_debug("JIT is turned on again");
+  }
+}
+
+static void hook_(lua_State* L, lua_Debug*) {
+  // the allocator data is the thread owning the lua state
+  void* data;
+  lua_getallocf(L, &data);
+  struct nf7core_lua_thread* root = data;
+
+  struct nf7core_lua_thread* this = root->running;
+  if (nullptr == this || L != this->lua) {
+    return;
+  }
+  this->budget.used += NF7CORE_LUA_THREAD_BUDGET_INTERVAL;
+
+  struct nf7core_lua_profiler* profiler = this->mod->profiler;
+  if (nullptr != profiler) {
+    nf7core_lua_profiler_sample(profiler, this, L);
+  }
+
+  const bool exceeded =
+      (0U < this->budget.insts && this->budget.used >= this->budget.insts) ||
+      (0U < this->budget.time  && uv_hrtime() >= this->budget.deadline);
+  if (exceeded && yieldable_(L)) {
+    this->budget.preempted = true;
+    lua_yield(L, 0);
+  }
+}
+
+static bool yieldable_(lua_State* L) {
+  // yielding across a C function raises an error, so waits for it to return
+  lua_Debug ar;
+  for (int level = 0; lua_getstack(L, level, &ar); ++level) {
+    if (0 == lua_getinfo(L, "S", &ar) || 'C' == ar.what[0]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void on_task_(struct nf7core_lua_sched_task* task) {
+  struct nf7core_lua_thread* this = task->data;
   assert(nullptr != this);
   assert(NF7CORE_LUA_THREAD_SCHEDULED == this->state);
 
   lua_State* L = this->lua;
-  for (uint32_t i = 0; i < this->args.n; ++i) {
-    struct nf7core_lua_value* v = &this->args.ptr[i];
-    nf7core_lua_value_push(v, L);
-    nf7core_lua_value_unset(v);
-  }
 
   nf7util_log_debug("lua thread state change: SCHEDULED -> RUNNING");
   this->state = NF7CORE_LUA_THREAD_RUNNING;
 
-  const int result = lua_resume(L, (int) this->args.n);
+  struct nf7core_lua_thread* root = root_(this);
+  struct nf7core_lua_thread* prev = root->running;
+  root->running = this;
+
+  struct nf7core_lua_profiler* profiler = this->mod->profiler;
+
+  const bool hooked =
+      0U < this->budget.insts || 0U < this->budget.time || nullptr != profiler;
+  if (hooked) {
+    this->budget.used      = 0;
+    this->budget.deadline  = uv_hrtime() + this->budget.time;
+    this->budget.preempted = false;
+    hook_enter_(this);
+    lua_sethook(L, hook_, LUA_MASKCOUNT, NF7CORE_LUA_THREAD_BUDGET_INTERVAL);
+  } else {
+    hook_leave_(this);
+  }
+  const int result = lua_resume(L, (int) this->nargs);
+  if (hooked) {
+    lua_sethook(L, nullptr, 0, 0);
+  }
+  root->running = prev;
+  this->nargs   = 0;
+
+  if (LUA_YIELD == result && this->budget.preempted) {
+    // goes to the back of the queue with the reference taken on scheduling
+    this->budget.preempted = false;
+    ++this->preemptions;
+    if (nf7core_lua_sched_push(this->mod->sched, &this->task, 0)) {
+      nf7util_log_debug("lua thread state change: RUNNING -> SCHEDULED (preempted)");
+      this->state = NF7CORE_LUA_THREAD_SCHEDULED;
+      return;
+    }
+    nf7util_log_error("failed to reschedule preempted thread, it's aborted");
+    lua_pushstring(L, "failed to reschedule preempted thread");
+    nf7util_log_debug("lua thread state change: RUNNING -> ABORTED");
+    this->state = NF7CORE_LUA_THREAD_ABORTED;
+    goto EXIT;
+  }
+
   switch (result) {
   case 0:
     nf7util_log_debug("lua thread state change: RUNNING -> DONE");
@@ -159,22 +466,26 @@ static void on_time_(uv_timer_t* timer) {
   case LUA_ERRMEM:
   case LUA_ERRRUN:
   case LUA_ERRERR:
-    nf7util_log_warn("lua execution failed: ", lua_tostring(L, -1));
+    nf7util_log_warn("lua execution failed: %s", lua_tostring(L, -1));
     nf7util_log_debug("lua thread state change: RUNNING -> ABORTED");
     this->state = NF7CORE_LUA_THREAD_ABORTED;
     break;
   }
 
+EXIT:
+  if (NF7CORE_LUA_THREAD_PAUSED != this->state) {
+    hook_leave_(this);  // never resumes again
+  }
+  if (nullptr != this->on_results) {
+    capture_(this, L);
+  }
   if (nullptr != this->post_exec) {
     this->post_exec(this, L);
   }
   lua_settop(L, 0);
 
-  nf7core_lua_thread_unref(this);
-}
+  // frees registry slots released while running in a batch
+  nf7core_lua_value_ptr_slab_flush(&root->values);
 
-static void on_close_(uv_handle_t* handle) {
-  struct nf7core_lua_thread* this = handle->data;
-  this->timer.data = nullptr;
-  del_(this);
+  nf7core_lua_thread_unref(this);
 }
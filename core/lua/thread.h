@@ -10,21 +10,72 @@
 #include "util/refcnt.h"
 
 #include "core/lua/mod.h"
+#include "core/lua/sched.h"
 #include "core/lua/value.h"
 #include "core/lua/value_ptr.h"
 
 
+struct nf7core_lua_thread;
+
+// A number of finished threads kept in a pool of base thread by default.
+#define NF7CORE_LUA_THREAD_POOL_DEFAULT_MAX 64
+
+// A number of results captured without allocation.
+#define NF7CORE_LUA_THREAD_INLINE_RESULTS 16
+
+// A number of VM instructions between budget checks.
+#define NF7CORE_LUA_THREAD_BUDGET_INTERVAL 1000
+
+struct nf7core_lua_thread_pool_stats {
+  uint64_t hits;      // a number of threads taken from the pool
+  uint64_t misses;    // a number of threads created by lua_newthread
+  uint64_t recycles;  // a number of threads put into the pool
+  uint64_t drops;     // a number of threads deleted because the pool is full
+                      // or they are not reusable
+};
+
 struct nf7core_lua_thread {
   struct nf7core_lua*    mod;
   struct nf7util_malloc* malloc;
   uv_loop_t*             uv;
 
+  // a serial number in order of creation, which is stable across runs of the
+  // same program, a thread taken from the pool gets new one
+  uint64_t id;
+
   bool       lua_owned;
   lua_State* lua;
 
   struct nf7core_lua_thread* base;
 
-  uv_timer_t timer;
+  // an allocator of value_ptr for `lua`, only used when `lua_owned`
+  struct nf7core_lua_value_ptr_slab values;
+
+  // a thread being resumed on `lua`, only used when `lua_owned`
+  struct nf7core_lua_thread* running;
+
+  // a number of hooked threads on `lua`, only used when `lua_owned`
+  //   The JIT of `lua` is off while it's not zero.
+  uint64_t hooks;
+
+  // true while this is counted in `hooks` of the root
+  bool hooked;
+
+  // a reference in registry of the base to keep `lua` from GC
+  int base_ref;
+
+  // finished threads whose base is this, reused by nf7core_lua_thread_new()
+  //   A thread is recycled when it's released after DONE, or before its first
+  //   resume. Pooled threads don't hold the base.
+  struct {
+    uint64_t max;
+    uint64_t n;
+    struct nf7core_lua_thread* head;
+    struct nf7core_lua_thread_pool_stats stats;
+  } pool;
+  struct nf7core_lua_thread* pool_next;
+
+  struct nf7core_lua_sched_task task;
 
   uint32_t refcnt;
 
@@ -35,13 +86,41 @@ struct nf7core_lua_thread {
 # define NF7CORE_LUA_THREAD_DONE      3
 # define NF7CORE_LUA_THREAD_ABORTED   4
 
+  // a number of values pushed on `lua` for the next resume
+  uint64_t nargs;
+
+  // limits of each resume, or zero to disable
+  //   When the thread runs out of them, it's forced to yield and rescheduled
+  //   at the back of the ready queue, unless it's in a C function which cannot
+  //   yield. New threads inherit the limits of their base.
+  //   Limits are checked by a hook which LuaJIT never calls in compiled code,
+  //   so the JIT of the whole lua state is off while any thread on it is
+  //   hooked. A thread is hooked from a resume with limits or with an active
+  //   profiler, until it finishes, is released, or resumes without them.
+  //   Turning the JIT off flushes compiled code of the state.
   struct {
-#   define NF7CORE_LUA_THREAD_MAX_ARGS 4
-    uint32_t n;
-    struct nf7core_lua_value ptr[NF7CORE_LUA_THREAD_MAX_ARGS];
-  } args;
+    uint64_t insts;  // a number of VM instructions, rounded up to
+                     // NF7CORE_LUA_THREAD_BUDGET_INTERVAL
+    uint64_t time;   // [ns]
+
+    // internal
+    uint64_t used;
+    uint64_t deadline;
+    bool     preempted;
+  } budget;
+  uint64_t preemptions;  // a number of forced yields
 
   void* data;
+
+  // called with values returned or yielded by the function, or with an error
+  // message when aborted
+  //   Values of STR and BORROW are valid only in the callback. Tables,
+  //   functions and other userdata are captured as BORROW, so copy them by
+  //   nf7core_lua_value_set() to keep.
+  void (*on_results)(
+      struct nf7core_lua_thread*, const struct nf7core_lua_value*, uint64_t n);
+
+  // called after `on_results`, with the raw stack
   void (*post_exec)(struct nf7core_lua_thread*, lua_State*);
 };
 NF7UTIL_REFCNT_DECL(, nf7core_lua_thread);
@@ -58,6 +137,34 @@ struct nf7core_lua_thread* nf7core_lua_thread_new(
 //   - If the func is not nullptr, the returned thread prepares to execute a
 //     function in the value,
 //     otherwise, it can execute nothing (this is for the base thread)
+//   - If the base has a pooled thread, it's reused instead of a new one.
+
+// Changes a maximum number of threads kept in the pool of the base thread.
+// Pooled threads over the max are deleted immediately.
+void nf7core_lua_thread_pool_set_max(
+    struct nf7core_lua_thread* base, uint64_t max);
+
+// Resumes the co-routine with the array of values.
+bool nf7core_lua_thread_resume_array_after(
+    struct nf7core_lua_thread* this, uint64_t timeout,
+    const struct nf7core_lua_value* args, uint64_t n);
+// PRECONDS:
+//   - `nullptr != this`
+//   - `NF7CORE_LUA_THREAD_PAUSED == this->state`
+//   - `nullptr != args || 0 == n`
+// POSTCONDS:
+//   - When returns true:
+//     - `NF7CORE_LUA_THREAD_SCHEDULED == this->state`
+//     - the state will changes to RUNNING after `timeout` [ms]
+//     - the values are pushed to the thread immediately, so STR views are not
+//       referred after this returns
+//   - Otherwise, nothing happens.
+
+static inline bool nf7core_lua_thread_resume_array(
+    struct nf7core_lua_thread* this,
+    const struct nf7core_lua_value* args, uint64_t n) {
+  return nf7core_lua_thread_resume_array_after(this, 0, args, n);
+}
 
 // Resumes the co-routine with the values.
 bool nf7core_lua_thread_resume_varg_after(
@@ -1,13 +1,22 @@
 // No copyright
 #include "core/lua/thread.h"
 
+#include <inttypes.h>
+#include <string.h>
+
 #include <lauxlib.h>
+#include <uv.h>
 
+#include "util/buffer.h"
 #include "util/log.h"
+#include "util/malloc.h"
 
 #include "test/common.h"
 
 
+#define BENCH_RESUMES_ 10000
+
+
 static void finalize_(struct nf7core_lua_thread* this, lua_State*) {
   struct nf7test* test_ = this->data;
   nf7test_expect(NF7CORE_LUA_THREAD_DONE == this->state);
@@ -65,3 +74,351 @@ NF7TEST(nf7core_lua_thread_test_invalid_syntax) {
   }
   return true;
 }
+
+// takes more args than the old fixed limit, and returns more results than
+// captured inline
+static const char values_script_[] =
+    "local a, b, c, d, e = ...\n"
+    "return a+1, b..'!', not c, #d, d, e, {}, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11\n";
+
+static void values_results_(
+    struct nf7core_lua_thread* this,
+    const struct nf7core_lua_value* v, uint64_t n) {
+  struct nf7test* test_ = this->data;
+  nf7test_expect(NF7CORE_LUA_THREAD_DONE == this->state);
+  if (!nf7test_expect(18U == n)) {
+    return;
+  }
+  nf7test_expect(NF7CORE_LUA_VALUE_TYPE_NUM == v[0].type && 42 == v[0].n);
+  nf7test_expect(
+      NF7CORE_LUA_VALUE_TYPE_STR == v[1].type && 3U == v[1].str.len &&
+      0 == memcmp(v[1].str.ptr, "hi!", 3));
+  nf7test_expect(NF7CORE_LUA_VALUE_TYPE_BOOL == v[2].type && !v[2].b);
+  nf7test_expect(NF7CORE_LUA_VALUE_TYPE_NUM == v[3].type && 5 == v[3].n);
+  nf7test_expect(
+      NF7CORE_LUA_VALUE_TYPE_BUF == v[4].type &&
+      0 == memcmp(v[4].buf->array.ptr, "hello", 5));
+  nf7test_expect(NF7CORE_LUA_VALUE_TYPE_NUM == v[5].type && .5 == v[5].n);
+
+  // a borrowed table is kept by copying
+  struct nf7core_lua_value kept = NF7CORE_LUA_VALUE_NIL();
+  nf7test_expect(
+      NF7CORE_LUA_VALUE_TYPE_BORROW == v[6].type &&
+      nf7core_lua_value_set(&kept, &v[6]) &&
+      NF7CORE_LUA_VALUE_TYPE_PTR == kept.type);
+  nf7core_lua_value_unset(&kept);
+
+  nf7test_expect(NF7CORE_LUA_VALUE_TYPE_NUM == v[17].type && 11 == v[17].n);
+}
+
+static void values_finalize_(struct nf7core_lua_thread* this, lua_State*) {
+  nf7test_unref(this->data);
+}
+
+NF7TEST(nf7core_lua_thread_test_values) {
+  struct nf7core_lua* mod =
+    (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_lua);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  struct nf7core_lua_thread* base = mod->thread;
+  lua_State* L = base->lua;
+
+  if (!nf7test_expect(0 == luaL_loadstring(L, values_script_))) {
+    return false;
+  }
+  struct nf7core_lua_value_ptr* func = nf7core_lua_value_ptr_new(base, L);
+  if (!nf7test_expect(nullptr != func)) {
+    return false;
+  }
+  struct nf7core_lua_thread* thread = nf7core_lua_thread_new(mod, base, func);
+  nf7core_lua_value_ptr_unref(func);
+  if (!nf7test_expect(nullptr != thread)) {
+    return false;
+  }
+  thread->data       = test_;
+  thread->on_results = values_results_;
+  thread->post_exec  = values_finalize_;
+
+  struct nf7util_buffer* buf = nf7util_buffer_new_from_cstr(test_->malloc, "hello");
+  if (!nf7test_expect(nullptr != buf)) {
+    nf7core_lua_thread_unref(thread);
+    return false;
+  }
+  const struct nf7core_lua_value args[] = {
+    NF7CORE_LUA_VALUE_INT(41),
+    NF7CORE_LUA_VALUE_STR("hi", 2),
+    NF7CORE_LUA_VALUE_BOOL(true),
+    NF7CORE_LUA_VALUE_BUF(buf),
+    NF7CORE_LUA_VALUE_NUM(.5),
+  };
+  const bool ret = nf7test_expect(nf7core_lua_thread_resume_array(
+      thread, args, sizeof(args)/sizeof(args[0])));
+  nf7util_buffer_unref(buf);
+  nf7core_lua_thread_unref(thread);
+  if (ret) {
+    nf7test_ref(test_);
+  }
+  return ret;
+}
+
+// runs far longer than the budget
+static const char budget_script_[] =
+    "local x = 0\n"
+    "for i = 1, 1000000 do x = x + i end\n"
+    "return x\n";
+
+static void budget_results_(
+    struct nf7core_lua_thread* this,
+    const struct nf7core_lua_value* v, uint64_t n) {
+  struct nf7test* test_ = this->data;
+  nf7test_expect(NF7CORE_LUA_THREAD_DONE == this->state);
+  nf7test_expect(0U < this->preemptions);
+  nf7test_expect(1U == n && 500000500000. == v[0].n);
+  nf7util_log_info("preempted %" PRIu64 " times", this->preemptions);
+
+  // the JIT is back because no thread is hooked anymore
+  nf7test_expect(0U == this->base->hooks);
+}
+
+NF7TEST(nf7core_lua_thread_test_budget) {
+  struct nf7core_lua* mod =
+    (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_lua);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  static const struct {
+    uint64_t insts;
+    uint64_t time;
+  } cases[] = {
+    { .insts = 100000, },
+    { .time  = 50000, },  // the script takes some milliseconds at least
+  };
+
+  bool ret = true;
+  for (uint64_t i = 0; ret && i < sizeof(cases)/sizeof(cases[0]); ++i) {
+    // an independent state not to turn the JIT off for the main state
+    struct nf7core_lua_thread* base = nf7core_lua_thread_new(mod, nullptr, nullptr);
+    if (!nf7test_expect(nullptr != base)) {
+      return false;
+    }
+    lua_State* L = base->lua;
+
+    struct nf7core_lua_value_ptr* func = nullptr;
+    struct nf7core_lua_thread*    thread = nullptr;
+    ret =
+        nf7test_expect(0 == luaL_loadstring(L, budget_script_)) &&
+        nf7test_expect(nullptr != (func = nf7core_lua_value_ptr_new(base, L))) &&
+        nf7test_expect(nullptr != (thread = nf7core_lua_thread_new(mod, base, func)));
+    if (ret) {
+      thread->data         = test_;
+      thread->on_results   = budget_results_;
+      thread->post_exec    = values_finalize_;
+      thread->budget.insts = cases[i].insts;
+      thread->budget.time  = cases[i].time;
+      ret = nf7test_expect(nf7core_lua_thread_resume(thread, nullptr));
+      if (ret) {
+        nf7test_ref(test_);
+      }
+    }
+    if (nullptr != func) {
+      nf7core_lua_value_ptr_unref(func);
+    }
+    if (nullptr != thread) {
+      nf7core_lua_thread_unref(thread);
+    }
+    nf7core_lua_thread_unref(base);
+  }
+  return ret;
+}
+
+NF7TEST(nf7core_lua_thread_test_pool) {
+  struct nf7core_lua* mod =
+    (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_lua);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  bool ret = false;
+
+  struct nf7core_lua_value_ptr* func = nullptr;
+  struct nf7core_lua_thread*    base =
+      nf7core_lua_thread_new(mod, nullptr, nullptr);
+  if (!nf7test_expect(nullptr != base)) {
+    goto EXIT;
+  }
+  if (!nf7test_expect(0 == luaL_loadstring(base->lua, "local x = 100"))) {
+    goto EXIT;
+  }
+  func = nf7core_lua_value_ptr_new(base, base->lua);
+  if (!nf7test_expect(nullptr != func)) {
+    goto EXIT;
+  }
+
+  struct nf7core_lua_thread* a = nf7core_lua_thread_new(mod, base, func);
+  if (!nf7test_expect(nullptr != a)) {
+    goto EXIT;
+  }
+  nf7core_lua_thread_unref(a);  // a thread never resumed is also reusable
+  if (!nf7test_expect(1 == base->pool.n) ||
+      !nf7test_expect(1 == base->pool.stats.recycles)) {
+    goto EXIT;
+  }
+
+  struct nf7core_lua_thread* b = nf7core_lua_thread_new(mod, base, func);
+  if (!nf7test_expect(nullptr != b)) {
+    goto EXIT;
+  }
+  ret =
+      nf7test_expect(a == b) &&
+      nf7test_expect(base == b->base) &&
+      nf7test_expect(NF7CORE_LUA_THREAD_PAUSED == b->state) &&
+      nf7test_expect(0 == base->pool.n) &&
+      nf7test_expect(1 == base->pool.stats.hits) &&
+      nf7test_expect(1 == base->pool.stats.misses);
+
+  nf7core_lua_thread_pool_set_max(base, 0);
+  nf7core_lua_thread_unref(b);
+  ret = ret &&
+      nf7test_expect(0 == base->pool.n) &&
+      nf7test_expect(1 == base->pool.stats.drops);
+
+EXIT:
+  if (nullptr != func) {
+    nf7core_lua_value_ptr_unref(func);
+  }
+  if (nullptr != base) {
+    nf7core_lua_thread_unref(base);
+  }
+  return ret;
+}
+
+
+struct bench_ {
+  struct nf7test*               test;
+  struct nf7core_lua*           mod;
+  struct nf7core_lua_thread*    base;
+  struct nf7core_lua_value_ptr* func;
+
+  uint32_t phase;
+  uint32_t remain;
+  uint64_t begin;
+};
+static bool bench_start_(struct bench_*);
+static bool bench_next_(struct bench_*);
+static void bench_post_exec_(struct nf7core_lua_thread*, lua_State*);
+static void bench_end_(struct bench_*);
+
+NF7TEST(nf7core_lua_thread_test_bench_resume) {
+  if (!test_->bench) {
+    return true;
+  }
+  struct nf7core_lua* mod =
+    (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_lua);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  struct bench_* this = nf7util_malloc_alloc(test_->malloc, sizeof(*this));
+  if (!nf7test_expect(nullptr != this)) {
+    return false;
+  }
+  *this = (struct bench_) {
+    .test = test_,
+    .mod  = mod,
+  };
+  nf7test_ref(test_);
+
+  this->base = nf7core_lua_thread_new(mod, nullptr, nullptr);
+  if (!nf7test_expect(nullptr != this->base)) {
+    goto ABORT;
+  }
+  if (!nf7test_expect(0 == luaL_loadstring(this->base->lua, "local x = 100"))) {
+    goto ABORT;
+  }
+  this->func = nf7core_lua_value_ptr_new(this->base, this->base->lua);
+  if (!nf7test_expect(nullptr != this->func)) {
+    goto ABORT;
+  }
+
+  // the first phase runs without the pool to compare
+  nf7core_lua_thread_pool_set_max(this->base, 0);
+  if (!bench_start_(this)) {
+    goto ABORT;
+  }
+  return true;
+
+ABORT:
+  bench_end_(this);
+  return false;
+}
+
+static bool bench_start_(struct bench_* this) {
+  this->remain = BENCH_RESUMES_;
+  this->begin  = uv_hrtime();
+  return bench_next_(this);
+}
+
+static bool bench_next_(struct bench_* this) {
+  struct nf7test* test_ = this->test;
+
+  struct nf7core_lua_thread* thread =
+      nf7core_lua_thread_new(this->mod, this->base, this->func);
+  if (!nf7test_expect(nullptr != thread)) {
+    return false;
+  }
+  thread->data      = this;
+  thread->post_exec = bench_post_exec_;
+
+  const bool ret = nf7test_expect(nf7core_lua_thread_resume(thread, nullptr));
+  nf7core_lua_thread_unref(thread);
+  return ret;
+}
+
+static void bench_post_exec_(struct nf7core_lua_thread* thread, lua_State*) {
+  struct bench_*  this  = thread->data;
+  struct nf7test* test_ = this->test;
+
+  if (!nf7test_expect(NF7CORE_LUA_THREAD_DONE == thread->state)) {
+    goto EXIT;
+  }
+  if (0 < --this->remain) {
+    if (!bench_next_(this)) {
+      goto EXIT;
+    }
+    return;
+  }
+
+  const uint64_t elapsed = uv_hrtime() - this->begin;
+  nf7util_log_info(
+      "resumed %" PRIu32 " lua threads %s pool: %" PRIu64 " ns/resume",
+      BENCH_RESUMES_, 0 == this->phase? "without": "with",
+      elapsed/BENCH_RESUMES_);
+
+  if (0 == this->phase++) {
+    nf7core_lua_thread_pool_set_max(
+        this->base, NF7CORE_LUA_THREAD_POOL_DEFAULT_MAX);
+    if (!bench_start_(this)) {
+      goto EXIT;
+    }
+    return;
+  }
+  nf7test_expect(0 < this->base->pool.stats.hits);
+
+EXIT:
+  bench_end_(this);
+}
+
+static void bench_end_(struct bench_* this) {
+  struct nf7test* test_ = this->test;
+  if (nullptr != this->func) {
+    nf7core_lua_value_ptr_unref(this->func);
+  }
+  if (nullptr != this->base) {
+    nf7core_lua_thread_unref(this->base);
+  }
+  nf7util_malloc_free(test_->malloc, this);
+  nf7test_unref(test_);
+}
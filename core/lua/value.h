@@ -4,19 +4,44 @@
 #include <assert.h>
 #include <stdint.h>
 
+#include "util/buffer.h"
+
+#include "core/lua/buffer.h"
 #include "core/lua/value_ptr.h"
 
 
 struct nf7core_lua_value {
   uint32_t type;
-# define NF7CORE_LUA_VALUE_TYPE_NIL 0
-# define NF7CORE_LUA_VALUE_TYPE_INT 1
-# define NF7CORE_LUA_VALUE_TYPE_NUM 2
-# define NF7CORE_LUA_VALUE_TYPE_PTR 3
+# define NF7CORE_LUA_VALUE_TYPE_NIL    0
+# define NF7CORE_LUA_VALUE_TYPE_INT    1
+# define NF7CORE_LUA_VALUE_TYPE_NUM    2
+# define NF7CORE_LUA_VALUE_TYPE_PTR    3
+# define NF7CORE_LUA_VALUE_TYPE_BOOL   4
+# define NF7CORE_LUA_VALUE_TYPE_STR    5
+# define NF7CORE_LUA_VALUE_TYPE_BUF    6
+# define NF7CORE_LUA_VALUE_TYPE_BORROW 7
   union {
     lua_Integer i;
     lua_Number  n;
+    bool        b;
     struct nf7core_lua_value_ptr* ptr;
+
+    // a view which is not owned, copied into lua when pushed
+    struct {
+      const uint8_t* ptr;
+      uint64_t       len;
+    } str;
+
+    // pushed as a zero-copy view, see core/lua/buffer.h
+    struct nf7util_buffer* buf;
+
+    // a stack slot valid only while the value is passed to a callback
+    //   nf7core_lua_value_set() copies it into a PTR referring `thread`.
+    struct {
+      struct nf7core_lua_thread* thread;
+      lua_State*                 lua;
+      int                        index;
+    } borrow;
   };
 };
 
@@ -31,6 +56,23 @@ struct nf7core_lua_value {
       .type = NF7CORE_LUA_VALUE_TYPE_PTR,  \
       .ptr  = (v),  \
     }
+#define NF7CORE_LUA_VALUE_BOOL(v)  \
+    (struct nf7core_lua_value) { .type = NF7CORE_LUA_VALUE_TYPE_BOOL, .b = (v), }
+#define NF7CORE_LUA_VALUE_STR(p, n)  \
+    (struct nf7core_lua_value) {  \
+      .type = NF7CORE_LUA_VALUE_TYPE_STR,  \
+      .str  = { .ptr = (const uint8_t*) (p), .len = (n), },  \
+    }
+#define NF7CORE_LUA_VALUE_BUF(v)  \
+    (struct nf7core_lua_value) {  \
+      .type = NF7CORE_LUA_VALUE_TYPE_BUF,  \
+      .buf  = (v),  \
+    }
+#define NF7CORE_LUA_VALUE_BORROW(t, L, idx)  \
+    (struct nf7core_lua_value) {  \
+      .type   = NF7CORE_LUA_VALUE_TYPE_BORROW,  \
+      .borrow = { .thread = (t), .lua = (L), .index = (idx), },  \
+    }
 
 static inline void nf7core_lua_value_push(
     const struct nf7core_lua_value* this, lua_State* L) {
@@ -51,6 +93,24 @@ static inline void nf7core_lua_value_push(
     assert(nullptr != this->ptr);
     nf7core_lua_value_ptr_push(this->ptr, L);
     break;
+  case NF7CORE_LUA_VALUE_TYPE_BOOL:
+    lua_pushboolean(L, this->b);
+    break;
+  case NF7CORE_LUA_VALUE_TYPE_STR:
+    assert(nullptr != this->str.ptr || 0U == this->str.len);
+    lua_pushlstring(L, (const char*) this->str.ptr, (size_t) this->str.len);
+    break;
+  case NF7CORE_LUA_VALUE_TYPE_BUF:
+    assert(nullptr != this->buf);
+    nf7core_lua_buffer_push(L, this->buf);
+    break;
+  case NF7CORE_LUA_VALUE_TYPE_BORROW:
+    assert(nullptr != this->borrow.lua);
+    lua_pushvalue(this->borrow.lua, this->borrow.index);
+    if (L != this->borrow.lua) {
+      lua_xmove(this->borrow.lua, L, 1);
+    }
+    break;
   default:
     assert(false);
   }
@@ -63,6 +123,9 @@ static inline void nf7core_lua_value_unset(struct nf7core_lua_value* this) {
   case NF7CORE_LUA_VALUE_TYPE_PTR:
     nf7core_lua_value_ptr_unref(this->ptr);
     break;
+  case NF7CORE_LUA_VALUE_TYPE_BUF:
+    nf7util_buffer_unref(this->buf);
+    break;
   default:
     break;
   }
@@ -81,6 +144,21 @@ static inline bool nf7core_lua_value_set(
     *this = *src;
     nf7core_lua_value_ptr_ref(this->ptr);
     return true;
+  case NF7CORE_LUA_VALUE_TYPE_BUF:
+    *this = *src;
+    nf7util_buffer_ref(this->buf);
+    return true;
+  case NF7CORE_LUA_VALUE_TYPE_BORROW: {
+    lua_State* L = src->borrow.lua;
+    lua_pushvalue(L, src->borrow.index);
+    struct nf7core_lua_value_ptr* ptr =
+        nf7core_lua_value_ptr_new(src->borrow.thread, L);
+    if (nullptr == ptr) {
+      return false;
+    }
+    *this = NF7CORE_LUA_VALUE_PTR(ptr);
+    return true;
+  }
   default:
     *this = *src;
     return true;
@@ -1,46 +1,103 @@
 // No copyright
 #include "core/lua/value_ptr.h"
 
+#include <assert.h>
+
 #include <lua.h>
 #include <lauxlib.h>
 
+#include "util/log.h"
+
 #include "core/lua/thread.h"
 
 
 struct nf7core_lua_value_ptr {
-  struct nf7core_lua_thread* thread;
-  struct nf7util_malloc*     malloc;
-  lua_State*                  lua;
+  struct nf7core_lua_thread*         thread;
+  struct nf7core_lua_value_ptr_slab* slab;
+  struct nf7core_lua_value_ptr*      next;
 
   uint32_t refcnt;
   int index;
 };
 
+struct nf7core_lua_value_ptr_slab_chunk {
+  struct nf7core_lua_value_ptr_slab_chunk* next;
+  struct nf7core_lua_value_ptr items[NF7CORE_LUA_VALUE_PTR_SLAB_CHUNK];
+};
+
+static struct nf7core_lua_value_ptr_slab* slab_of_(struct nf7core_lua_thread*);
+static struct nf7core_lua_value_ptr* take_(struct nf7core_lua_value_ptr_slab*);
 static void del_(struct nf7core_lua_value_ptr*);
 
 NF7UTIL_REFCNT_IMPL(, nf7core_lua_value_ptr, {del_(this);});
 
 
+void nf7core_lua_value_ptr_slab_init(
+    struct nf7core_lua_value_ptr_slab* this,
+    struct nf7util_malloc*             malloc,
+    lua_State*                         L) {
+  assert(nullptr != this);
+  assert(nullptr != malloc);
+  assert(nullptr != L);
+
+  *this = (struct nf7core_lua_value_ptr_slab) {
+    .malloc = malloc,
+    .lua    = L,
+  };
+}
+
+void nf7core_lua_value_ptr_slab_deinit(struct nf7core_lua_value_ptr_slab* this) {
+  assert(nullptr != this);
+
+  while (nullptr != this->chunks) {
+    struct nf7core_lua_value_ptr_slab_chunk* chunk = this->chunks;
+    this->chunks = chunk->next;
+    nf7util_malloc_free(this->malloc, chunk);
+  }
+  this->free      = nullptr;
+  this->garbage   = nullptr;
+  this->garbage_n = 0;
+}
+
+void nf7core_lua_value_ptr_slab_flush(struct nf7core_lua_value_ptr_slab* this) {
+  assert(nullptr != this);
+
+  while (nullptr != this->garbage) {
+    struct nf7core_lua_value_ptr* item = this->garbage;
+    this->garbage = item->next;
+
+    luaL_unref(this->lua, LUA_REGISTRYINDEX, item->index);
+    item->index = LUA_NOREF;
+    item->next  = this->free;
+    this->free  = item;
+    ++this->stats.unrefs;
+  }
+  this->garbage_n = 0;
+}
+
+
 struct nf7core_lua_value_ptr* nf7core_lua_value_ptr_new(
     struct nf7core_lua_thread* thread, lua_State* L) {
   assert(nullptr != thread);
   assert(nullptr != L);
 
-  struct nf7core_lua_value_ptr* this =
-      nf7util_malloc_alloc(thread->malloc, sizeof(*this));
+  struct nf7core_lua_value_ptr_slab* slab = slab_of_(thread);
+
+  struct nf7core_lua_value_ptr* this = take_(slab);
   if (nullptr == this) {
     goto ABORT;
   }
-  *this = (struct nf7core_lua_value_ptr) {
-    .malloc = thread->malloc,
-    .lua    = L,
-  };
+  if (LUA_NOREF != this->index) {
+    // overwrites the slot released previously
+    lua_rawseti(L, LUA_REGISTRYINDEX, this->index);
+    ++slab->stats.reuses;
+  } else {
+    this->index = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
 
   this->thread = thread;
   nf7core_lua_thread_ref(this->thread);
 
-  this->index = luaL_ref(this->lua, LUA_REGISTRYINDEX);
-
   nf7core_lua_value_ptr_ref(this);
   return this;
 
@@ -56,9 +113,69 @@ void nf7core_lua_value_ptr_push(
   lua_rawgeti(lua, LUA_REGISTRYINDEX, this->index);
 }
 
+
+static struct nf7core_lua_value_ptr_slab* slab_of_(
+    struct nf7core_lua_thread* thread) {
+  // the thread owning the lua state has the slab
+  while (!thread->lua_owned) {
+    assert(nullptr != thread->base);
+    thread = thread->base;
+  }
+  return &thread->values;
+}
+
+static struct nf7core_lua_value_ptr* take_(
+    struct nf7core_lua_value_ptr_slab* slab) {
+  struct nf7core_lua_value_ptr* ret = nullptr;
+  if (nullptr != slab->garbage) {
+    ret = slab->garbage;
+    slab->garbage = ret->next;
+    --slab->garbage_n;
+    ret->next = nullptr;
+    return ret;
+  }
+
+  if (nullptr == slab->free) {
+    struct nf7core_lua_value_ptr_slab_chunk* chunk =
+        nf7util_malloc_alloc(slab->malloc, sizeof(*chunk));
+    if (nullptr == chunk) {
+      nf7util_log_error("failed to allocate value_ptr chunk");
+      return nullptr;
+    }
+    chunk->next  = slab->chunks;
+    slab->chunks = chunk;
+    ++slab->stats.chunks;
+
+    for (uint64_t i = 0; i < NF7CORE_LUA_VALUE_PTR_SLAB_CHUNK; ++i) {
+      chunk->items[i] = (struct nf7core_lua_value_ptr) {
+        .slab  = slab,
+        .next  = slab->free,
+        .index = LUA_NOREF,
+      };
+      slab->free = &chunk->items[i];
+    }
+  }
+  ret = slab->free;
+  slab->free = ret->next;
+  ret->next  = nullptr;
+  return ret;
+}
+
 static void del_(struct nf7core_lua_value_ptr* this) {
   assert(nullptr != this);
-  luaL_unref(this->lua, LUA_REGISTRYINDEX, this->index);
-  nf7core_lua_thread_unref(this->thread);
-  nf7util_malloc_free(this->malloc, this);
+
+  struct nf7core_lua_value_ptr_slab* slab   = this->slab;
+  struct nf7core_lua_thread*         thread = this->thread;
+
+  // the slot is freed later in a batch, or reused by the next object
+  this->thread  = nullptr;
+  this->next    = slab->garbage;
+  slab->garbage = this;
+  ++slab->garbage_n;
+  if (slab->garbage_n >= NF7CORE_LUA_VALUE_PTR_SLAB_GARBAGE_MAX) {
+    nf7core_lua_value_ptr_slab_flush(slab);
+  }
+
+  // the slab may be deleted here with the owner thread
+  nf7core_lua_thread_unref(thread);
 }
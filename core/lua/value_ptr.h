@@ -1,10 +1,27 @@
 // No copyright
+//
+// A reference to a lua value in the registry, which can be kept in C.
+//
+// HOW TO USE
+//   Push a value and call nf7core_lua_value_ptr_new() to take it from the top.
+//   Push it later by nf7core_lua_value_ptr_push() to any thread sharing the
+//   lua state.
+//
+// RULES
+//   - Objects are allocated from a slab of the thread owning the lua state,
+//     and returned to it when released.
+//   - A registry slot of a released object is not freed immediately. It's
+//     reused by the next object or freed on nf7core_lua_value_ptr_slab_flush(),
+//     so the value can live a little longer than the object.
+//   - To pass a value just for one callback, borrow the stack slot instead
+//     (NF7CORE_LUA_VALUE_TYPE_BORROW in core/lua/value.h).
 #pragma once
 
 #include <stdint.h>
 
 #include <lua.h>
 
+#include "util/malloc.h"
 #include "util/refcnt.h"
 
 
@@ -13,8 +30,52 @@ struct nf7core_lua_thread;
 struct nf7core_lua_value_ptr;
 NF7UTIL_REFCNT_DECL(, nf7core_lua_value_ptr);
 
+// A number of objects allocated at once by a slab.
+#define NF7CORE_LUA_VALUE_PTR_SLAB_CHUNK 64
+
+// A number of released slots kept before flushing them automatically.
+#define NF7CORE_LUA_VALUE_PTR_SLAB_GARBAGE_MAX 256
+
+struct nf7core_lua_value_ptr_slab_chunk;
+
+struct nf7core_lua_value_ptr_slab {
+  struct nf7util_malloc* malloc;
+  lua_State*             lua;
+
+  struct nf7core_lua_value_ptr_slab_chunk* chunks;
+
+  // released objects without any slot
+  struct nf7core_lua_value_ptr* free;
+
+  // released objects still holding their slots
+  struct nf7core_lua_value_ptr* garbage;
+  uint64_t                      garbage_n;
+
+  struct {
+    uint64_t chunks;  // a number of chunks allocated
+    uint64_t reuses;  // a number of slots reused without luaL_ref
+    uint64_t unrefs;  // a number of slots freed by flushing
+  } stats;
+};
+
+void nf7core_lua_value_ptr_slab_init(
+    struct nf7core_lua_value_ptr_slab*, struct nf7util_malloc*, lua_State*);
+
+void nf7core_lua_value_ptr_slab_deinit(struct nf7core_lua_value_ptr_slab*);
+// PRECONDS:
+//   - All objects from the slab have been released.
+//   - `lua` has been closed or is going to be closed, slots are not freed.
+
+// Frees all slots of released objects.
+void nf7core_lua_value_ptr_slab_flush(struct nf7core_lua_value_ptr_slab*);
+// PRECONDS:
+//   - Must be called from the thread using the lua state.
+
+
 struct nf7core_lua_value_ptr* nf7core_lua_value_ptr_new(
     struct nf7core_lua_thread*, lua_State*);
+// PRECONDS:
+//   - `L` shares the lua state with the thread.
 // POSTCONDS:
 //   - the top value is always popped
 
@@ -0,0 +1,77 @@
+// No copyright
+#include "core/lua/value_ptr.h"
+
+#include <lauxlib.h>
+
+#include "core/lua/thread.h"
+
+#include "test/common.h"
+
+
+NF7TEST(nf7core_lua_value_ptr_test_slab) {
+  struct nf7core_lua* mod =
+    (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_lua);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+
+  bool ret = false;
+
+  struct nf7core_lua_value_ptr* a = nullptr;
+  struct nf7core_lua_value_ptr* b = nullptr;
+
+  struct nf7core_lua_thread* base =
+      nf7core_lua_thread_new(mod, nullptr, nullptr);
+  if (!nf7test_expect(nullptr != base)) {
+    goto EXIT;
+  }
+  lua_State* L = base->lua;
+  struct nf7core_lua_value_ptr_slab* slab = &base->values;
+
+  lua_pushinteger(L, 1);
+  a = nf7core_lua_value_ptr_new(base, L);
+  if (!nf7test_expect(nullptr != a) ||
+      !nf7test_expect(1 == slab->stats.chunks)) {
+    goto EXIT;
+  }
+
+  // the released object and its slot are reused without luaL_ref
+  struct nf7core_lua_value_ptr* released = a;
+  nf7core_lua_value_ptr_unref(a);
+  a = nullptr;
+  if (!nf7test_expect(1 == slab->garbage_n)) {
+    goto EXIT;
+  }
+  lua_pushinteger(L, 2);
+  b = nf7core_lua_value_ptr_new(base, L);
+  if (!nf7test_expect(released == b) ||
+      !nf7test_expect(1 == slab->stats.reuses) ||
+      !nf7test_expect(0 == slab->garbage_n)) {
+    goto EXIT;
+  }
+  nf7core_lua_value_ptr_push(b, L);
+  if (!nf7test_expect(2 == lua_tointeger(L, -1))) {
+    goto EXIT;
+  }
+  lua_pop(L, 1);
+
+  // slots are freed in a batch
+  nf7core_lua_value_ptr_unref(b);
+  b = nullptr;
+  nf7core_lua_value_ptr_slab_flush(slab);
+  ret =
+      nf7test_expect(0 == slab->garbage_n) &&
+      nf7test_expect(1 == slab->stats.unrefs);
+
+EXIT:
+  if (nullptr != b) {
+    nf7core_lua_value_ptr_unref(b);
+  }
+  if (nullptr != a) {
+    nf7core_lua_value_ptr_unref(a);
+  }
+  if (nullptr != base) {
+    nf7core_lua_thread_unref(base);
+  }
+  return ret;
+}
@@ -0,0 +1,489 @@
+// No copyright
+#include "core/lua/worker.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include <uv.h>
+
+#include "nf7.h"
+
+#include "util/log.h"
+#include "util/malloc.h"
+
+#include "core/lua/chunk.h"
+#include "core/lua/thread.h"
+
+
+struct queue_ {
+  struct nf7core_lua_job* head;
+  struct nf7core_lua_job* tail;
+};
+
+struct worker_ {
+  struct nf7core_lua_workers* workers;
+  uint32_t                    index;
+
+  uv_thread_t thread;
+
+  // main -> worker, guarded by the mutex
+  //   `local` can be stolen by other workers but `pinned` cannot
+  uv_mutex_t    mtx;
+  struct queue_ local;
+  struct queue_ pinned;
+  bool          stop;
+
+  // whether the worker is waiting for jobs
+  atomic_bool idle;
+
+  // touched only by the worker thread after it starts
+  uv_loop_t          uv;
+  uv_async_t         async;
+  struct nf7         nf7;
+  struct nf7core_lua lua;
+};
+
+struct nf7core_lua_workers {
+  struct nf7util_malloc* malloc;
+
+  // worker -> main
+  struct nf7util_mpsc outbox;
+  uv_async_t          async;
+
+  // a number of pending jobs, which keep the main loop running
+  uint64_t jobs;
+  uint32_t next;
+
+  uint32_t       n;
+  struct worker_ items[];
+};
+
+static bool worker_init_(
+    struct worker_*, struct nf7core_lua_workers*, const struct nf7*);
+static void worker_deinit_(struct worker_*);
+static void worker_main_(void*);
+static void worker_on_wake_(uv_async_t*);
+static struct nf7core_lua_job* worker_take_(struct worker_*, bool* stop);
+static struct nf7core_lua_job* worker_steal_(struct worker_*);
+
+static void main_on_wake_(uv_async_t*);
+static void main_on_close_(uv_handle_t*);
+static void main_on_task_(struct nf7core_lua_sched_task*);
+
+static void queue_push_(struct queue_*, struct nf7core_lua_job*);
+static struct nf7core_lua_job* queue_pop_(struct queue_*);
+
+static void exec_(struct nf7core_lua*, struct nf7core_lua_job*);
+
+
+bool nf7core_lua_worker_start(struct nf7core_lua* mod, uint32_t n) {
+  assert(nullptr != mod);
+
+  if (nullptr != mod->workers) {
+    nf7util_log_warn("workers have already started");
+    return false;
+  }
+  if (0U == n) {
+    return true;
+  }
+
+  const struct nf7* nf7 = mod->super.nf7;
+
+  struct nf7core_lua_workers* this = nf7util_malloc_alloc(
+      mod->malloc, sizeof(*this) + n*sizeof(this->items[0]));
+  if (nullptr == this) {
+    nf7util_log_error("failed to allocate workers");
+    return false;
+  }
+  *this = (struct nf7core_lua_workers) {
+    .malloc = mod->malloc,
+  };
+  nf7util_mpsc_init(&this->outbox);
+
+  if (0 != nf7util_log_uv(uv_async_init(mod->uv, &this->async, main_on_wake_))) {
+    nf7util_log_error("failed to init async handle of workers");
+    nf7util_malloc_free(mod->malloc, this);
+    return false;
+  }
+  this->async.data = this;
+  uv_unref((uv_handle_t*) &this->async);
+  mod->workers = this;
+
+  for (; this->n < n; ++this->n) {
+    if (!worker_init_(&this->items[this->n], this, nf7)) {
+      nf7util_log_error("failed to start worker #%" PRIu32, this->n);
+      nf7core_lua_worker_stop(mod);
+      return false;
+    }
+  }
+  nf7util_log_info("started %" PRIu32 " lua workers", n);
+  return true;
+}
+
+void nf7core_lua_worker_stop(struct nf7core_lua* mod) {
+  assert(nullptr != mod);
+
+  struct nf7core_lua_workers* this = mod->workers;
+  if (nullptr == this) {
+    return;
+  }
+  mod->workers = nullptr;
+  assert(0U == this->jobs);
+
+  for (uint32_t i = 0; i < this->n; ++i) {
+    struct worker_* worker = &this->items[i];
+    uv_mutex_lock(&worker->mtx);
+    worker->stop = true;
+    uv_mutex_unlock(&worker->mtx);
+    uv_async_send(&worker->async);
+  }
+  for (uint32_t i = 0; i < this->n; ++i) {
+    struct worker_* worker = &this->items[i];
+    uv_thread_join(&worker->thread);
+    uv_mutex_destroy(&worker->mtx);
+  }
+  uv_close((uv_handle_t*) &this->async, main_on_close_);
+}
+
+uint32_t nf7core_lua_worker_count(const struct nf7core_lua* mod) {
+  assert(nullptr != mod);
+  return nullptr != mod->workers? mod->workers->n: 0U;
+}
+
+uint32_t nf7core_lua_worker_of(const struct nf7core_lua* mod, uint64_t pin) {
+  assert(nullptr != mod);
+  assert(nullptr != mod->workers);
+  assert(0U < mod->workers->n);
+
+  // mixes the pin not to bias sequential pins
+  pin *= UINT64_C(0x9E3779B97F4A7C15);
+  return (uint32_t) ((pin >> 32) % mod->workers->n);
+}
+
+bool nf7core_lua_worker_run(struct nf7core_lua* mod, struct nf7core_lua_job* job) {
+  assert(nullptr != mod);
+  assert(nullptr != job);
+  assert(nullptr != job->script);
+  assert(nullptr != job->on_done);
+
+  // other owners may touch the buffers on the main loop
+  struct nf7util_buffer* script = job->script;
+  struct nf7util_buffer* arg    = job->arg;
+  if (1U < script->refcnt) {
+    script = nf7util_buffer_clone(script, nullptr);
+  }
+  if (nullptr != arg && 1U < arg->refcnt) {
+    arg = nf7util_buffer_clone(arg, nullptr);
+  }
+  if (nullptr == script || (nullptr != job->arg && nullptr == arg)) {
+    nf7util_log_error("failed to clone a shared buffer");
+    if (script != job->script) { nf7util_buffer_unref(script); }
+    if (arg    != job->arg)    { nf7util_buffer_unref(arg); }
+    return false;
+  }
+  if (script != job->script) {
+    nf7util_buffer_unref(job->script);
+    job->script = script;
+  }
+  if (arg != job->arg) {
+    nf7util_buffer_unref(job->arg);
+    job->arg = arg;
+  }
+
+  job->ok     = false;
+  job->result = nullptr;
+  job->worker = 0;
+  job->next   = nullptr;
+
+  struct nf7core_lua_workers* this = mod->workers;
+  if (nullptr == this) {
+    // the job runs on the main loop later, as well as on workers
+    job->task = (struct nf7core_lua_sched_task) {
+      .data = mod,
+      .func = main_on_task_,
+    };
+    return nf7core_lua_sched_push(mod->sched, &job->task, 0);
+  }
+
+  struct worker_* worker;
+  if (0U != job->pin) {
+    worker = &this->items[nf7core_lua_worker_of(mod, job->pin)];
+    uv_mutex_lock(&worker->mtx);
+    queue_push_(&worker->pinned, job);
+    uv_mutex_unlock(&worker->mtx);
+  } else {
+    worker = &this->items[this->next];
+    this->next = (this->next + 1U) % this->n;
+    uv_mutex_lock(&worker->mtx);
+    queue_push_(&worker->local, job);
+    uv_mutex_unlock(&worker->mtx);
+  }
+  uv_async_send(&worker->async);
+
+  // wakes an idle worker to steal the job if the worker is busy
+  if (0U == job->pin && !atomic_load(&worker->idle)) {
+    for (uint32_t i = 0; i < this->n; ++i) {
+      struct worker_* thief = &this->items[i];
+      if (thief != worker && atomic_load(&thief->idle)) {
+        uv_async_send(&thief->async);
+        break;
+      }
+    }
+  }
+
+  if (1U == ++this->jobs) {
+    uv_ref((uv_handle_t*) &this->async);
+  }
+  return true;
+}
+
+
+static bool worker_init_(
+    struct worker_* this, struct nf7core_lua_workers* workers, const struct nf7* nf7) {
+  assert(nullptr != this);
+  assert(nullptr != workers);
+  assert(nullptr != nf7);
+
+  *this = (struct worker_) {
+    .workers = workers,
+    .index   = workers->n,
+    .nf7     = *nf7,
+  };
+  atomic_init(&this->idle, true);
+
+  if (0 != nf7util_log_uv(uv_mutex_init(&this->mtx))) {
+    return false;
+  }
+  if (0 != nf7util_log_uv(uv_loop_init(&this->uv))) {
+    uv_mutex_destroy(&this->mtx);
+    return false;
+  }
+  this->nf7.uv = &this->uv;
+
+  if (0 != nf7util_log_uv(uv_async_init(&this->uv, &this->async, worker_on_wake_))) {
+    uv_loop_close(&this->uv);
+    uv_mutex_destroy(&this->mtx);
+    return false;
+  }
+  this->async.data = this;
+
+  // scripts on the worker see the worker-local module and loop
+  this->lua = (struct nf7core_lua) {
+    .super = {
+      .nf7  = &this->nf7,
+      .meta = &nf7core_lua,
+    },
+    .malloc = nf7->malloc,
+    .uv     = &this->uv,
+  };
+  this->lua.sched = nf7core_lua_sched_new(this->lua.malloc, &this->uv);
+  if (nullptr == this->lua.sched) {
+    goto ABORT;
+  }
+  this->lua.thread = nf7core_lua_thread_new(&this->lua, nullptr, nullptr);
+  if (nullptr == this->lua.thread) {
+    goto ABORT;
+  }
+  // workers keep chunks only in memory not to race on the files
+  this->lua.chunks = nf7core_lua_chunk_cache_new(this->lua.thread, nullptr);
+  if (nullptr == this->lua.chunks) {
+    goto ABORT;
+  }
+
+  if (0 != nf7util_log_uv(uv_thread_create(&this->thread, worker_main_, this))) {
+    goto ABORT;
+  }
+  return true;
+
+ABORT:
+  worker_deinit_(this);
+  uv_mutex_destroy(&this->mtx);
+  return false;
+}
+
+static void worker_deinit_(struct worker_* this) {
+  assert(nullptr != this);
+
+  nf7core_lua_chunk_cache_del(this->lua.chunks);
+  if (nullptr != this->lua.thread) {
+    nf7core_lua_thread_unref(this->lua.thread);
+  }
+  nf7core_lua_sched_del(this->lua.sched);
+
+  if (!uv_is_closing((uv_handle_t*) &this->async)) {
+    uv_close((uv_handle_t*) &this->async, nullptr);
+  }
+  uv_run(&this->uv, UV_RUN_DEFAULT);
+  if (0 != nf7util_log_uv(uv_loop_close(&this->uv))) {
+    nf7util_log_warn("failed to close worker loop gracefully");
+  }
+}
+
+static void worker_main_(void* data) {
+  struct worker_* this = data;
+  assert(nullptr != this);
+
+  uv_run(&this->uv, UV_RUN_DEFAULT);
+  worker_deinit_(this);
+}
+
+static void worker_on_wake_(uv_async_t* async) {
+  struct worker_* this = async->data;
+  assert(nullptr != this);
+
+  struct nf7core_lua_workers* workers = this->workers;
+
+  atomic_store(&this->idle, false);
+  for (;;) {
+    bool stop = false;
+    struct nf7core_lua_job* job = worker_take_(this, &stop);
+    if (stop) {
+      uv_close((uv_handle_t*) &this->async, nullptr);
+      return;
+    }
+    if (nullptr == job) {
+      job = worker_steal_(this);
+    }
+    if (nullptr == job) {
+      break;
+    }
+
+    job->worker = this->index;
+    exec_(&this->lua, job);
+    if (nf7util_mpsc_push(&workers->outbox, &job->node)) {
+      uv_async_send(&workers->async);
+    }
+  }
+  atomic_store(&this->idle, true);
+
+  // a job pushed while setting the flag might not wake any thieves
+  for (uint32_t i = 0; i < workers->n; ++i) {
+    struct worker_* victim = &workers->items[i];
+    uv_mutex_lock(&victim->mtx);
+    const bool pending = nullptr != victim->local.head;
+    uv_mutex_unlock(&victim->mtx);
+    if (pending) {
+      uv_async_send(&this->async);
+      break;
+    }
+  }
+}
+
+static struct nf7core_lua_job* worker_take_(struct worker_* this, bool* stop) {
+  uv_mutex_lock(&this->mtx);
+  struct nf7core_lua_job* job = queue_pop_(&this->pinned);
+  if (nullptr == job) {
+    job = queue_pop_(&this->local);
+  }
+  *stop = this->stop;
+  uv_mutex_unlock(&this->mtx);
+  return job;
+}
+
+static struct nf7core_lua_job* worker_steal_(struct worker_* this) {
+  struct nf7core_lua_workers* workers = this->workers;
+  for (uint32_t i = 1; i < workers->n; ++i) {
+    struct worker_* victim = &workers->items[(this->index + i) % workers->n];
+    uv_mutex_lock(&victim->mtx);
+    struct nf7core_lua_job* job = queue_pop_(&victim->local);
+    uv_mutex_unlock(&victim->mtx);
+    if (nullptr != job) {
+      return job;
+    }
+  }
+  return nullptr;
+}
+
+
+static void main_on_wake_(uv_async_t* async) {
+  struct nf7core_lua_workers* this = async->data;
+  assert(nullptr != this);
+
+  struct nf7util_mpsc_node* next = nf7util_mpsc_take(&this->outbox);
+  while (nullptr != next) {
+    struct nf7core_lua_job* job =
+        (void*) ((uint8_t*) next - offsetof(struct nf7core_lua_job, node));
+    next = next->next;
+
+    assert(0U < this->jobs);
+    if (0U == --this->jobs) {
+      uv_unref((uv_handle_t*) &this->async);
+    }
+    job->on_done(job);
+  }
+}
+
+static void main_on_close_(uv_handle_t* handle) {
+  struct nf7core_lua_workers* this = handle->data;
+  assert(nullptr != this);
+  nf7util_malloc_free(this->malloc, this);
+}
+
+static void main_on_task_(struct nf7core_lua_sched_task* task) {
+  struct nf7core_lua*     mod = task->data;
+  struct nf7core_lua_job* job =
+      (void*) ((uint8_t*) task - offsetof(struct nf7core_lua_job, task));
+  exec_(mod, job);
+  job->on_done(job);
+}
+
+
+static void queue_push_(struct queue_* this, struct nf7core_lua_job* job) {
+  job->next = nullptr;
+  if (nullptr == this->tail) {
+    this->head = job;
+  } else {
+    this->tail->next = job;
+  }
+  this->tail = job;
+}
+
+static struct nf7core_lua_job* queue_pop_(struct queue_* this) {
+  struct nf7core_lua_job* job = this->head;
+  if (nullptr != job) {
+    this->head = job->next;
+    if (nullptr == this->head) {
+      this->tail = nullptr;
+    }
+    job->next = nullptr;
+  }
+  return job;
+}
+
+
+static void exec_(struct nf7core_lua* mod, struct nf7core_lua_job* job) {
+  lua_State* L = mod->thread->lua;
+
+  int err = nf7core_lua_chunk_load(
+      mod->chunks, L, job->script->array.ptr, job->script->array.n, "=job");
+  if (0 == err) {
+    if (nullptr != job->arg) {
+      lua_pushlstring(
+          L, (const char*) job->arg->array.ptr, (size_t) job->arg->array.n);
+    } else {
+      lua_pushnil(L);
+    }
+    err = lua_pcall(L, 1, 1, 0);
+  }
+  job->ok = 0 == err;
+
+  size_t      len;
+  const char* str = lua_tolstring(L, -1, &len);
+  if (nullptr != str) {
+    job->result = nf7util_buffer_new(mod->malloc, len);
+    if (nullptr != job->result) {
+      if (0U < len) {
+        memcpy(job->result->array.ptr, str, len);
+      }
+    } else {
+      nf7util_log_error("failed to allocate a result of lua job");
+      job->ok = false;
+    }
+  }
+  if (!job->ok) {
+    nf7util_log_warn("lua job failed: %s", nullptr != str? str: "(unknown)");
+  }
+  lua_settop(L, 0);
+}
@@ -0,0 +1,84 @@
+// No copyright
+//
+// Workers run independent lua scripts on additional threads, each of which
+// has its own loop and lua state, so script-heavy workloads scale across cores
+// instead of sharing the state on the main loop.
+//
+// HOW TO USE
+//   Start workers by nf7core_lua_worker_start() once, fill nf7core_lua_job and
+//   pass it to nf7core_lua_worker_run(). The script is compiled and called on
+//   a worker with the arg as a string, and `on_done` is called on the main loop
+//   with a string returned from the script, or an error message.
+//
+//   A job with a `pin` of 0 goes to a local queue of a worker in round-robin,
+//   and idle workers steal it if the worker is busy. Jobs with the same
+//   non-zero `pin` always run on the same worker, so they can share globals.
+//
+//   Without workers, jobs run on the lua state of the main loop.
+//
+// RULES
+//   - The script must not yield.
+//   - The job and its buffers must not be touched until `on_done`.
+//   - Buffers shared by other owners are cloned before handed off.
+//   - Pending jobs keep the main loop running.
+//   - All jobs must be done before the module is deleted.
+#pragma once
+
+#include <stdint.h>
+
+#include "util/buffer.h"
+#include "util/mpsc.h"
+
+#include "core/lua/mod.h"
+#include "core/lua/sched.h"
+
+
+struct nf7core_lua_workers;
+
+struct nf7core_lua_job {
+  // filled by the caller
+  struct nf7util_buffer* script;  // lua source code
+  struct nf7util_buffer* arg;     // passed to the script as a string, nullable
+  uint64_t               pin;
+
+  void* data;
+  void (*on_done)(struct nf7core_lua_job*);
+
+  // filled before `on_done`
+  bool                   ok;
+  struct nf7util_buffer* result;  // nullptr if the script returns no string
+  uint32_t               worker;  // an index of the worker ran the job
+
+  // used internally
+  struct nf7util_mpsc_node      node;
+  struct nf7core_lua_job*       next;
+  struct nf7core_lua_sched_task task;
+};
+
+
+// Starts the number of worker threads.
+// Returns false if workers have already started or failed to start.
+bool nf7core_lua_worker_start(struct nf7core_lua*, uint32_t n);
+
+// Stops all worker threads. Called when the module is deleted.
+// PRECONDS:
+//   - All jobs have been done.
+void nf7core_lua_worker_stop(struct nf7core_lua*);
+
+// Returns a number of running workers.
+uint32_t nf7core_lua_worker_count(const struct nf7core_lua*);
+
+// Returns an index of the worker which the pin is pinned to.
+// PRECONDS:
+//   - `0 < nf7core_lua_worker_count(mod)`
+uint32_t nf7core_lua_worker_of(const struct nf7core_lua*, uint64_t pin);
+
+// Runs the job asynchronously.
+bool nf7core_lua_worker_run(struct nf7core_lua*, struct nf7core_lua_job*);
+// PRECONDS:
+//   - `nullptr != job->script`
+//   - `nullptr != job->on_done`
+// POSTCONDS:
+//   - When returns true, the job owns `script` and `arg`, and `on_done` will
+//     be called on the main loop, where the caller takes them and `result`.
+//   - Otherwise, nothing happens.
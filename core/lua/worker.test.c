@@ -0,0 +1,115 @@
+// No copyright
+#include "core/lua/worker.h"
+
+#include <string.h>
+
+#include "util/buffer.h"
+#include "util/malloc.h"
+
+#include "test/common.h"
+
+
+#define FREE_JOBS_   8
+#define PINNED_JOBS_ 4
+#define JOBS_        (FREE_JOBS_ + PINNED_JOBS_ + 1)
+
+#define PIN_ UINT64_C(1234)
+
+struct ctx_ {
+  struct nf7test*     test;
+  struct nf7core_lua* mod;
+
+  uint32_t done;
+  uint32_t pinned;
+
+  struct nf7core_lua_job jobs[JOBS_];
+};
+
+static bool result_is_(const struct nf7core_lua_job* job, const char* expect) {
+  const size_t n = strlen(expect);
+  return
+      nullptr != job->result &&
+      n == job->result->array.n &&
+      0 == memcmp(job->result->array.ptr, expect, n);
+}
+
+static void on_done_(struct nf7core_lua_job* job) {
+  struct ctx_*    this  = job->data;
+  struct nf7test* test_ = this->test;
+
+  const uint32_t idx = (uint32_t) (job - this->jobs);
+  if (idx < FREE_JOBS_) {
+    nf7test_expect(job->ok);
+    nf7test_expect(result_is_(job, "hello!"));
+  } else if (idx < FREE_JOBS_ + PINNED_JOBS_) {
+    // pinned jobs share globals of the worker in order
+    static const char* const expects[PINNED_JOBS_] = {"1", "2", "3", "4"};
+    nf7test_expect(job->ok);
+    nf7test_expect(result_is_(job, expects[this->pinned++]));
+    nf7test_expect(job->worker == nf7core_lua_worker_of(this->mod, PIN_));
+  } else {
+    nf7test_expect(!job->ok);
+    nf7test_expect(nullptr != job->result);
+  }
+
+  nf7util_buffer_unref(job->script);
+  if (nullptr != job->arg) {
+    nf7util_buffer_unref(job->arg);
+  }
+  if (nullptr != job->result) {
+    nf7util_buffer_unref(job->result);
+  }
+
+  if (JOBS_ == ++this->done) {
+    nf7util_malloc_free(test_->malloc, this);
+    nf7test_unref(test_);
+  }
+}
+
+NF7TEST(nf7core_lua_worker_test_run) {
+  struct nf7core_lua* mod =
+    (void*) nf7_get_mod_by_meta(test_->nf7, &nf7core_lua);
+  if (!nf7test_expect(nullptr != mod)) {
+    return false;
+  }
+  if (0U == nf7core_lua_worker_count(mod) &&
+      !nf7test_expect(nf7core_lua_worker_start(mod, 2))) {
+    return false;
+  }
+
+  struct ctx_* this = nf7util_malloc_alloc(test_->malloc, sizeof(*this));
+  if (!nf7test_expect(nullptr != this)) {
+    return false;
+  }
+  *this = (struct ctx_) {
+    .test = test_,
+    .mod  = mod,
+  };
+
+  for (uint32_t i = 0; i < JOBS_; ++i) {
+    const char* script =
+        i < FREE_JOBS_?
+            "local s = ... return s..'!'":
+        i < FREE_JOBS_ + PINNED_JOBS_?
+            "nf7core_lua_worker_test = (nf7core_lua_worker_test or 0) + 1 "
+            "return nf7core_lua_worker_test..''":
+            "local f = nil f()";
+
+    struct nf7core_lua_job* job = &this->jobs[i];
+    *job = (struct nf7core_lua_job) {
+      .script  = nf7util_buffer_new_from_cstr(test_->malloc, script),
+      .arg     = i < FREE_JOBS_?
+          nf7util_buffer_new_from_cstr(test_->malloc, "hello"): nullptr,
+      .pin     = FREE_JOBS_ <= i && i < FREE_JOBS_ + PINNED_JOBS_? PIN_: 0U,
+      .data    = this,
+      .on_done = on_done_,
+    };
+    if (!nf7test_expect(nullptr != job->script) ||
+        !nf7test_expect(nf7core_lua_worker_run(mod, job))) {
+      // submitted jobs would access the context, so it's leaked
+      return false;
+    }
+  }
+  nf7test_ref(test_);
+  return true;
+}
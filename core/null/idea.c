@@ -52,7 +52,10 @@ static void del_(struct nf7core_exec_entity* this) {
   }
 }
 
-static void send_(struct nf7core_exec_entity*, struct nf7util_buffer*) { }
+static bool send_(struct nf7core_exec_entity*, struct nf7util_buffer* buf) {
+  nf7util_buffer_unref(buf);
+  return true;
+}
 
 const struct nf7core_exec_idea nf7core_null_idea = {
   .name    = (const uint8_t*) "nf7core_null_idea",
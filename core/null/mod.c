@@ -37,5 +37,7 @@ const struct nf7_mod_meta nf7core_null = {
   .desc = (const uint8_t*) "null implementations of each interfaces",
   .ver  = NF7_VERSION,
 
+  .hosted = true,
+
   .del = del_,
 };
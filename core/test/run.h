@@ -2,6 +2,7 @@
 #pragma once
 
 #include <assert.h>
+#include <string.h>
 
 #include <uv.h>
 
@@ -61,6 +62,13 @@ static bool run_trigger_setup_(struct nf7core_test* mod) {
   };
   nf7test_ref(&this->test);
 
+  const struct nf7* nf7 = mod->super.nf7;
+  for (uint32_t i = 0; i < nf7->argc; ++i) {
+    if (0 == strcmp(nf7->argv[i], NF7TEST_BENCH_ARG)) {
+      this->test.bench = true;
+    }
+  }
+
   nf7util_log_uv_assert(uv_idle_init(this->uv, &this->idle));
   this->idle.data = this;
   nf7util_log_uv_assert(uv_idle_start(&this->idle, run_trigger_));
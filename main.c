@@ -11,6 +11,7 @@
 
 #include "util/log.h"
 #include "util/malloc.h"
+#include "util/str.h"
 
 #include "core/all.h"
 
@@ -22,6 +23,9 @@ int main(int argc, char** argv) {
   nf7util_log_info("HELLO :)");
   struct nf7util_malloc malloc = {0};
 
+  struct nf7util_str_atoms atoms;
+  nf7util_str_atoms_init(&atoms, &malloc);
+
   // init loop
   uv_loop_t uv;
   if (0 != nf7util_log_uv(uv_loop_init(&uv))) {
@@ -29,11 +33,12 @@ int main(int argc, char** argv) {
     return EXIT_FAILURE;
   }
   struct nf7 nf7 = {
-    .ver  = 0,
-    .argc = argc,
-    .argv = (const char* const*) argv,
-    .uv   = &uv,
+    .ver    = 0,
+    .argc   = argc,
+    .argv   = (const char* const*) argv,
+    .uv     = &uv,
     .malloc = &malloc,
+    .atoms  = &atoms,
   };
 
   // load modules
@@ -48,9 +53,9 @@ int main(int argc, char** argv) {
   }
   nf7util_log_info("exiting Nf7...");
 
-  // destroy modules
-  for (uint32_t i = 0; i < nf7.mods.n; ++i) {
-    struct nf7_mod* mod = nf7.mods.ptr[i];
+  // destroy modules in reverse order because later ones may depend on earlier
+  for (uint32_t i = nf7.mods.n; i > 0; --i) {
+    struct nf7_mod* mod = nf7.mods.ptr[i-1];
     assert(mod->meta->del);
 
     nf7util_log_debug("unloading module: %s", mod->meta->name);
@@ -65,6 +70,7 @@ int main(int argc, char** argv) {
     nf7util_log_warn("failed to close main loop gracefully");
     return EXIT_FAILURE;
   }
+  nf7util_str_atoms_deinit(&atoms);
 
   const uint64_t leaks = nf7util_malloc_get_count(&malloc);
   if (0 < leaks) {
@@ -6,6 +6,7 @@
 #include <uv.h>
 
 #include "util/malloc.h"
+#include "util/str.h"
 
 
 #define NF7_VERSION UINT32_C(0)
@@ -21,8 +22,9 @@ struct nf7 {
   uint32_t argc;
   const char* const* argv;
 
-  uv_loop_t*             uv;
-  struct nf7util_malloc* malloc;
+  uv_loop_t*                uv;
+  struct nf7util_malloc*    malloc;
+  struct nf7util_str_atoms* atoms;
 
   struct {
     uint32_t n;
@@ -33,6 +35,9 @@ struct nf7 {
 struct nf7_mod {
   const struct nf7*          nf7;
   const struct nf7_mod_meta* meta;
+
+  // an atom of `meta->name`, assigned by the loader
+  uint32_t name;
 };
 
 struct nf7_mod_meta {
@@ -40,6 +45,12 @@ struct nf7_mod_meta {
   const uint8_t* desc;
   uint32_t       ver;
 
+  // true if the module is also loaded in a child process hosting an idea, see
+  // core/host/mod.h
+  //   Modules driving the process by themselves, e.g. tests and UI, leave it
+  //   false.
+  bool hosted;
+
   void (*del)(struct nf7_mod*);
 };
 
@@ -53,3 +64,17 @@ static inline struct nf7_mod* nf7_get_mod_by_meta(
   }
   return nullptr;
 }
+
+static inline struct nf7_mod* nf7_get_mod_by_name(
+    const struct nf7* nf7, const uint8_t* name, uint64_t namelen) {
+  const uint32_t atom = nf7util_str_atoms_find(nf7->atoms, name, namelen);
+  if (0U == atom) {
+    return nullptr;
+  }
+  for (uint32_t i = 0; i < nf7->mods.n; ++i) {
+    if (atom == nf7->mods.ptr[i]->name) {
+      return nf7->mods.ptr[i];
+    }
+  }
+  return nullptr;
+}
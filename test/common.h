@@ -6,6 +6,9 @@
 
 #define NF7TEST(name) bool name([[maybe_unused]] struct nf7test* test_)
 
+// A command line arg to run benchmarks, which are skipped by default.
+#define NF7TEST_BENCH_ARG "--nf7test-bench"
+
 struct nf7;
 struct nf7test;
 struct nf7util_malloc;
@@ -17,6 +20,10 @@ struct nf7test {
   struct nf7util_malloc* malloc;
   void*                  data;
 
+  // true if NF7TEST_BENCH_ARG is given, benchmarks should return true
+  // immediately otherwise
+  bool bench;
+
   uint64_t refcnt;
 
   void (*run)(struct nf7test*, const char* name, nf7test_func);
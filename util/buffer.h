@@ -3,6 +3,13 @@
 // nf7util_buffer is a generic buffer object which can be shared between
 // multiple owners. Only a unique owner can modify the buffer contents.
 //
+// `id` is an optional number carried along with the buffer without being a
+// part of the contents, 0 means none. core/exec uses it as a correlation id to
+// pair a response with its request, see core/exec/pending.h.
+//
+// `deadline` is an optional time in uv_hrtime() nanoseconds after which the
+// buffer is no longer worth processing, 0 means none, see core/exec/deadline.h.
+//
 #pragma once
 
 #include <stdint.h>
@@ -18,6 +25,9 @@ struct nf7util_buffer {
 
   uint32_t refcnt;
   struct nf7util_array_u8 array;
+
+  uint64_t id;
+  uint64_t deadline;
 };
 NF7UTIL_REFCNT_IMPL(
     static inline, nf7util_buffer,
@@ -56,7 +66,7 @@ static inline struct nf7util_buffer* nf7util_buffer_new_from_cstr(
 
   const uint64_t n = cstr? strlen(cstr): 0U;
   struct nf7util_buffer* buf = nf7util_buffer_new(malloc, n);
-  if (nullptr != buf) {
+  if (nullptr != buf && 0U < n) {
     memcpy(buf->array.ptr, cstr, n);
   }
   return buf;
@@ -77,5 +87,7 @@ static inline struct nf7util_buffer* nf7util_buffer_clone(
   }
 
   memcpy(this->array.ptr, src->array.ptr, (size_t) src->array.n);
+  this->id       = src->id;
+  this->deadline = src->deadline;
   return this;
 }
@@ -0,0 +1,282 @@
+// No copyright
+//
+// Byte utilities for binary-safe scanning of buffer contents.
+//
+// All functions never stop at NUL bytes, so they are usable for any binary
+// payload. They use SIMD instructions when the compiler targets them:
+//   - AVX2 (e.g. `-mavx2` or `-march=native`)
+//   - SSE2 (always on x86_64)
+// otherwise, the scalar fallback is used.
+//
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+# define NF7UTIL_BYTES_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && 2 <= _M_IX86_FP)
+# include <emmintrin.h>
+# define NF7UTIL_BYTES_SSE2
+#endif
+#if defined(_MSC_VER)
+# include <intrin.h>
+#endif
+
+#include "util/buffer.h"
+
+
+// A maximum number of delimiters which can be passed to the functions.
+#define NF7UTIL_BYTES_MAX_DELIMS 16
+
+
+static inline uint32_t nf7util_bytes_ctz32_(uint32_t v) {
+  assert(0U != v);
+#if defined(_MSC_VER)
+  unsigned long ret;
+  _BitScanForward(&ret, v);
+  return (uint32_t) ret;
+#else
+  return (uint32_t) __builtin_ctz(v);
+#endif
+}
+
+
+// Returns an offset of the first byte which equals to any of the delimiters,
+// or `len` if no such byte is found.
+// PRECONDS:
+//   - `nullptr != ptr || 0 == len`
+//   - `nullptr != delims || 0 == ndelims`
+//   - `ndelims <= NF7UTIL_BYTES_MAX_DELIMS`
+static inline uint64_t nf7util_bytes_find_any(
+    const uint8_t* ptr, uint64_t len, const uint8_t* delims, uint32_t ndelims) {
+  assert(nullptr != ptr || 0U == len);
+  assert(nullptr != delims || 0U == ndelims);
+  assert(ndelims <= NF7UTIL_BYTES_MAX_DELIMS);
+
+  if (0U == ndelims) {
+    return len;
+  }
+
+  uint64_t i = 0;
+#if defined(NF7UTIL_BYTES_AVX2)
+  if (32U <= len) {
+    __m256i d[NF7UTIL_BYTES_MAX_DELIMS];
+    for (uint32_t j = 0; j < ndelims; ++j) {
+      d[j] = _mm256_set1_epi8((char) delims[j]);
+    }
+    for (; i+32U <= len; i += 32U) {
+      const __m256i v = _mm256_loadu_si256((const __m256i*) &ptr[i]);
+
+      __m256i m = _mm256_cmpeq_epi8(v, d[0]);
+      for (uint32_t j = 1; j < ndelims; ++j) {
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, d[j]));
+      }
+      const uint32_t bits = (uint32_t) _mm256_movemask_epi8(m);
+      if (0U != bits) {
+        return i + nf7util_bytes_ctz32_(bits);
+      }
+    }
+  }
+#endif
+#if defined(NF7UTIL_BYTES_SSE2)
+  if (i+16U <= len) {
+    __m128i d[NF7UTIL_BYTES_MAX_DELIMS];
+    for (uint32_t j = 0; j < ndelims; ++j) {
+      d[j] = _mm_set1_epi8((char) delims[j]);
+    }
+    for (; i+16U <= len; i += 16U) {
+      const __m128i v = _mm_loadu_si128((const __m128i*) &ptr[i]);
+
+      __m128i m = _mm_cmpeq_epi8(v, d[0]);
+      for (uint32_t j = 1; j < ndelims; ++j) {
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, d[j]));
+      }
+      const uint32_t bits = (uint32_t) _mm_movemask_epi8(m);
+      if (0U != bits) {
+        return i + nf7util_bytes_ctz32_(bits);
+      }
+    }
+  }
+#endif
+  for (; i < len; ++i) {
+    for (uint32_t j = 0; j < ndelims; ++j) {
+      if (ptr[i] == delims[j]) {
+        return i;
+      }
+    }
+  }
+  return len;
+}
+
+// Returns a number of leading ASCII bytes.
+static inline uint64_t nf7util_bytes_count_ascii(
+    const uint8_t* ptr, uint64_t len) {
+  assert(nullptr != ptr || 0U == len);
+
+  uint64_t i = 0;
+#if defined(NF7UTIL_BYTES_AVX2)
+  for (; i+32U <= len; i += 32U) {
+    const __m256i v = _mm256_loadu_si256((const __m256i*) &ptr[i]);
+    const uint32_t bits = (uint32_t) _mm256_movemask_epi8(v);
+    if (0U != bits) {
+      return i + nf7util_bytes_ctz32_(bits);
+    }
+  }
+#endif
+#if defined(NF7UTIL_BYTES_SSE2)
+  for (; i+16U <= len; i += 16U) {
+    const __m128i v = _mm_loadu_si128((const __m128i*) &ptr[i]);
+    const uint32_t bits = (uint32_t) _mm_movemask_epi8(v);
+    if (0U != bits) {
+      return i + nf7util_bytes_ctz32_(bits);
+    }
+  }
+#endif
+  for (; i < len; ++i) {
+    if (0x80U <= ptr[i]) {
+      return i;
+    }
+  }
+  return len;
+}
+
+// Returns true if the bytes are valid UTF-8 defined by RFC 3629.
+// Runs of ASCII are skipped by SIMD, and others are decoded one by one.
+static inline bool nf7util_bytes_utf8_valid(const uint8_t* ptr, uint64_t len) {
+  assert(nullptr != ptr || 0U == len);
+
+  uint64_t i = 0;
+  while (i < len) {
+    if (0x80U > ptr[i]) {
+      i += nf7util_bytes_count_ascii(&ptr[i], len-i);
+      continue;
+    }
+
+    const uint8_t c = ptr[i];
+    uint8_t  lo = 0x80U, hi = 0xBFU;
+    uint32_t tails;
+    if (0xC2U > c) {
+      return false;
+    } else if (0xE0U > c) {
+      tails = 1;
+    } else if (0xF0U > c) {
+      tails = 2;
+      if (0xE0U == c) { lo = 0xA0U; }  // overlong
+      if (0xEDU == c) { hi = 0x9FU; }  // surrogates
+    } else if (0xF5U > c) {
+      tails = 3;
+      if (0xF0U == c) { lo = 0x90U; }  // overlong
+      if (0xF4U == c) { hi = 0x8FU; }  // over U+10FFFF
+    } else {
+      return false;
+    }
+    if (len-i <= tails) {
+      return false;
+    }
+    if (ptr[i+1] < lo || ptr[i+1] > hi) {
+      return false;
+    }
+    for (uint32_t j = 2; j <= tails; ++j) {
+      if (0x80U != (ptr[i+j] & 0xC0U)) {
+        return false;
+      }
+    }
+    i += tails+1;
+  }
+  return true;
+}
+
+
+// ---- record splitter
+// Splits bytes into records separated by any of the delimiters.
+// The delimiters are not included in the records.
+//
+// HOW TO USE
+//   struct nf7util_bytes_split sp;
+//   nf7util_bytes_split_init_lines_buffer(&sp, buf);
+//   const uint8_t* rec;
+//   uint64_t       reclen;
+//   while (nf7util_bytes_split_next(&sp, &rec, &reclen)) { ... }
+struct nf7util_bytes_split {
+  const uint8_t* ptr;
+  uint64_t       len;
+
+  // an offset of the next record
+  uint64_t pos;
+
+  const uint8_t* delims;
+  uint32_t       ndelims;
+
+  // removes '\r' at the tail of each record
+  bool trim_cr;
+
+  // when true, the last record which is not terminated by any delimiter is not
+  // returned and `pos` keeps pointing its head after the iteration,
+  // this is useful to process a stream which is received chunk by chunk
+  bool keep_tail;
+};
+
+static inline void nf7util_bytes_split_init(
+    struct nf7util_bytes_split* this,
+    const uint8_t* ptr, uint64_t len, const uint8_t* delims, uint32_t ndelims) {
+  assert(nullptr != this);
+  assert(nullptr != ptr || 0U == len);
+  assert(nullptr != delims || 0U == ndelims);
+  assert(ndelims <= NF7UTIL_BYTES_MAX_DELIMS);
+
+  *this = (struct nf7util_bytes_split) {
+    .ptr     = ptr,
+    .len     = len,
+    .delims  = delims,
+    .ndelims = ndelims,
+  };
+}
+static inline void nf7util_bytes_split_init_buffer(
+    struct nf7util_bytes_split* this, const struct nf7util_buffer* buf,
+    const uint8_t* delims, uint32_t ndelims) {
+  assert(nullptr != buf);
+  nf7util_bytes_split_init(this, buf->array.ptr, buf->array.n, delims, ndelims);
+}
+
+static inline void nf7util_bytes_split_init_lines(
+    struct nf7util_bytes_split* this, const uint8_t* ptr, uint64_t len) {
+  nf7util_bytes_split_init(this, ptr, len, (const uint8_t*) "\n", 1);
+  this->trim_cr = true;
+}
+static inline void nf7util_bytes_split_init_lines_buffer(
+    struct nf7util_bytes_split* this, const struct nf7util_buffer* buf) {
+  assert(nullptr != buf);
+  nf7util_bytes_split_init_lines(this, buf->array.ptr, buf->array.n);
+}
+
+// Returns true and sets the next record if there is.
+static inline bool nf7util_bytes_split_next(
+    struct nf7util_bytes_split* this, const uint8_t** rec, uint64_t* reclen) {
+  assert(nullptr != this);
+  assert(nullptr != rec);
+  assert(nullptr != reclen);
+
+  if (this->pos >= this->len) {
+    return false;
+  }
+
+  const uint8_t* head = &this->ptr[this->pos];
+  const uint64_t rest = this->len - this->pos;
+
+  const uint64_t n = nf7util_bytes_find_any(head, rest, this->delims, this->ndelims);
+  if (n == rest) {
+    if (this->keep_tail) {
+      return false;
+    }
+    this->pos = this->len;
+  } else {
+    this->pos += n+1;
+  }
+
+  *rec    = head;
+  *reclen = this->trim_cr && 0U < n && '\r' == head[n-1]? n-1: n;
+  return true;
+}
@@ -0,0 +1,109 @@
+// No copyright
+#include "util/bytes.h"
+
+#include <string.h>
+
+#include "util/buffer.h"
+
+#include "test/common.h"
+
+
+NF7TEST(nf7util_bytes_test_find_any) {
+  uint8_t buf[100];
+
+  // checks all positions to cover SIMD paths and their boundaries
+  for (uint32_t i = 0; i <= sizeof(buf); ++i) {
+    memset(buf, 'a', sizeof(buf));
+    if (i < sizeof(buf)) {
+      buf[i] = ',';
+    }
+    const uint64_t ret = nf7util_bytes_find_any(buf, sizeof(buf), (const uint8_t*) ";,", 2);
+    if (!nf7test_expect(i == ret)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+NF7TEST(nf7util_bytes_test_find_any_nul) {
+  static const uint8_t kBytes[] = {'a', 0, 'b', '\n'};
+  return
+    nf7test_expect(3 == nf7util_bytes_find_any(kBytes, sizeof(kBytes), (const uint8_t*) "\n", 1)) &&
+    nf7test_expect(1 == nf7util_bytes_find_any(kBytes, sizeof(kBytes), (const uint8_t*) "\0", 1)) &&
+    nf7test_expect(4 == nf7util_bytes_find_any(kBytes, sizeof(kBytes), nullptr, 0));
+}
+
+NF7TEST(nf7util_bytes_test_utf8_valid) {
+  static const char kValid[] =
+      "this is a long ascii text to go through simd paths: "
+      "\xE3\x81\x82\xE3\x81\x84\xE3\x81\x86 \xC2\xA9 \xF0\x9F\x98\x80 \xF4\x8F\xBF\xBF";
+  return
+    nf7test_expect(nf7util_bytes_utf8_valid((const uint8_t*) kValid, sizeof(kValid)-1)) &&
+    nf7test_expect(nf7util_bytes_utf8_valid(nullptr, 0));
+}
+
+NF7TEST(nf7util_bytes_test_utf8_invalid) {
+  static const char* kInvalid[] = {
+    "\x80",              // unexpected continuation
+    "\xC0\xAF",          // overlong
+    "\xE0\x80\xAF",      // overlong
+    "\xED\xA0\x80",      // surrogate
+    "\xF4\x90\x80\x80",  // over U+10FFFF
+    "\xF5\x80\x80\x80",  // invalid lead byte
+    "\xE3\x81",          // truncated
+    "abcdefghijklmnopqrstuvwxyz0123456789\xE3\x81",  // truncated after ascii
+  };
+  for (uint32_t i = 0; i < sizeof(kInvalid)/sizeof(kInvalid[0]); ++i) {
+    const uint8_t* ptr = (const uint8_t*) kInvalid[i];
+    if (!nf7test_expect(!nf7util_bytes_utf8_valid(ptr, strlen(kInvalid[i])))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+NF7TEST(nf7util_bytes_test_split_lines) {
+  struct nf7util_buffer* buf =
+      nf7util_buffer_new_from_cstr(test_->malloc, "hello\r\n\nworld\nfoo");
+  if (!nf7test_expect(nullptr != buf)) {
+    return false;
+  }
+
+  struct nf7util_bytes_split sut;
+  nf7util_bytes_split_init_lines_buffer(&sut, buf);
+
+  const uint8_t* rec;
+  uint64_t       len;
+  const bool ret =
+    nf7test_expect(nf7util_bytes_split_next(&sut, &rec, &len)) &&
+    nf7test_expect(5 == len && 0 == memcmp(rec, "hello", 5)) &&
+    nf7test_expect(nf7util_bytes_split_next(&sut, &rec, &len)) &&
+    nf7test_expect(0 == len) &&
+    nf7test_expect(nf7util_bytes_split_next(&sut, &rec, &len)) &&
+    nf7test_expect(5 == len && 0 == memcmp(rec, "world", 5)) &&
+    nf7test_expect(nf7util_bytes_split_next(&sut, &rec, &len)) &&
+    nf7test_expect(3 == len && 0 == memcmp(rec, "foo", 3)) &&
+    nf7test_expect(!nf7util_bytes_split_next(&sut, &rec, &len));
+
+  nf7util_buffer_unref(buf);
+  return ret;
+}
+
+NF7TEST(nf7util_bytes_test_split_keep_tail) {
+  static const char kText[] = "a,b;c";
+
+  struct nf7util_bytes_split sut;
+  nf7util_bytes_split_init(
+      &sut, (const uint8_t*) kText, sizeof(kText)-1, (const uint8_t*) ",;", 2);
+  sut.keep_tail = true;
+
+  const uint8_t* rec;
+  uint64_t       len;
+  return
+    nf7test_expect(nf7util_bytes_split_next(&sut, &rec, &len)) &&
+    nf7test_expect(1 == len && 'a' == rec[0]) &&
+    nf7test_expect(nf7util_bytes_split_next(&sut, &rec, &len)) &&
+    nf7test_expect(1 == len && 'b' == rec[0]) &&
+    nf7test_expect(!nf7util_bytes_split_next(&sut, &rec, &len)) &&
+    nf7test_expect(4 == sut.pos);
+}
@@ -0,0 +1,221 @@
+// No copyright
+//
+// Hashmap util is a template macro of a hash map type whose keys are uint64_t.
+//
+// HOW TO USE
+//   Same as Array util, expand NF7UTIL_HASHMAP macro on your *.h like this:
+//       `NF7UTIL_HASHMAP(my_map, struct A*);`
+//   and expand `NF7UTIL_HASHMAP_IMPL` macro on your *.c like this:
+//       `NF7UTIL_HASHMAP_IMPL(, my_map, struct A*);`
+//   or use NF7UTIL_HASHMAP_INLINE on your *.h to make the functions inline.
+//
+//   You can see declarations of the functions on a definition of
+//   NF7UTIL_HASHMAP_DECL macro. They all are prefixed by a name of your map
+//   struct.
+//
+//   To iterate all items, check `used` of each slot in `ptr[0..cap)`:
+//       for (uint64_t i = 0; i < map.cap; ++i) {
+//         if (map.ptr[i].used) { ... map.ptr[i].key, map.ptr[i].value ... }
+//       }
+//   Inserting or removing items while the iteration is not allowed.
+//
+// IMPLEMENTATION
+//   Open addressing with linear probing. Removal shifts following items back
+//   instead of leaving tombstones, so lookups never get slower by removals.
+//
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util/malloc.h"
+
+
+// finalizer of splitmix64, scatters sequential keys such as ids
+static inline uint64_t nf7util_hashmap_hash(uint64_t key) {
+  key ^= key >> 30;
+  key *= UINT64_C(0xbf58476d1ce4e5b9);
+  key ^= key >> 27;
+  key *= UINT64_C(0x94d049bb133111eb);
+  key ^= key >> 31;
+  return key;
+}
+
+
+#define NF7UTIL_HASHMAP_TYPE(PREFIX, V)  \
+  struct PREFIX##_slot {  \
+    bool     used;  \
+    uint64_t key;  \
+    V        value;  \
+  };  \
+  struct PREFIX {  \
+    struct nf7util_malloc* malloc;  \
+    \
+    uint64_t n;  \
+    uint64_t cap;  \
+    struct PREFIX##_slot* ptr;  \
+  };  \
+  static_assert(true)
+
+
+#define NF7UTIL_HASHMAP_DECL(ATTR, PREFIX, V)  \
+  ATTR void PREFIX##_init(struct PREFIX*, struct nf7util_malloc*);  \
+  ATTR void PREFIX##_deinit(struct PREFIX*);  \
+  ATTR bool PREFIX##_reserve(struct PREFIX*, uint64_t);  \
+  ATTR V*   PREFIX##_get(struct PREFIX*, uint64_t);  \
+  ATTR bool PREFIX##_find(const struct PREFIX*, uint64_t, V*);  \
+  ATTR bool PREFIX##_insert(struct PREFIX*, uint64_t, V);  \
+  ATTR bool PREFIX##_set(struct PREFIX*, uint64_t, V);  \
+  ATTR bool PREFIX##_remove(struct PREFIX*, uint64_t, V*);  \
+  static_assert(true)
+
+
+#define NF7UTIL_HASHMAP_IMPL(ATTR, PREFIX, V)  \
+  ATTR void PREFIX##_init(struct PREFIX* this, struct nf7util_malloc* malloc) {  \
+    assert(nullptr != this);  \
+    assert(nullptr != malloc);  \
+    *this = (struct PREFIX) {  \
+      .malloc = malloc,  \
+    };  \
+  }  \
+  ATTR void PREFIX##_deinit(struct PREFIX* this) {  \
+    assert(nullptr != this);  \
+    nf7util_malloc_free(this->malloc, this->ptr);  \
+    *this = (struct PREFIX) {0};  \
+  }  \
+  \
+  static inline uint64_t PREFIX##_probe_(  \
+      const struct PREFIX* this, uint64_t key) {  \
+    assert(0U < this->cap);  \
+    const uint64_t mask = this->cap - 1;  \
+    uint64_t i = nf7util_hashmap_hash(key) & mask;  \
+    while (this->ptr[i].used && this->ptr[i].key != key) {  \
+      i = (i+1) & mask;  \
+    }  \
+    return i;  \
+  }  \
+  \
+  ATTR bool PREFIX##_reserve(struct PREFIX* this, uint64_t n) {  \
+    assert(nullptr != this);  \
+    \
+    /* keeps the load factor under 3/4 */  \
+    if (n*4 <= this->cap*3) {  \
+      return true;  \
+    }  \
+    uint64_t cap = 0U < this->cap? this->cap: 8U;  \
+    while (n*4 > cap*3) {  \
+      cap *= 2;  \
+    }  \
+    \
+    struct PREFIX##_slot* ptr =  \
+        nf7util_malloc_alloc(this->malloc, cap*sizeof(*ptr));  \
+    if (nullptr == ptr) {  \
+      return false;  \
+    }  \
+    struct PREFIX##_slot* const old_ptr = this->ptr;  \
+    const uint64_t old_cap = this->cap;  \
+    \
+    this->ptr = ptr;  \
+    this->cap = cap;  \
+    for (uint64_t i = 0; i < old_cap; ++i) {  \
+      if (old_ptr[i].used) {  \
+        this->ptr[PREFIX##_probe_(this, old_ptr[i].key)] = old_ptr[i];  \
+      }  \
+    }  \
+    nf7util_malloc_free(this->malloc, old_ptr);  \
+    return true;  \
+  }  \
+  \
+  ATTR V* PREFIX##_get(struct PREFIX* this, uint64_t key) {  \
+    assert(nullptr != this);  \
+    if (0U == this->n) {  \
+      return nullptr;  \
+    }  \
+    struct PREFIX##_slot* slot = &this->ptr[PREFIX##_probe_(this, key)];  \
+    return slot->used? &slot->value: nullptr;  \
+  }  \
+  ATTR bool PREFIX##_find(const struct PREFIX* this, uint64_t key, V* value) {  \
+    assert(nullptr != this);  \
+    if (0U == this->n) {  \
+      return false;  \
+    }  \
+    const struct PREFIX##_slot* slot = &this->ptr[PREFIX##_probe_(this, key)];  \
+    if (!slot->used) {  \
+      return false;  \
+    }  \
+    if (nullptr != value) {  \
+      *value = slot->value;  \
+    }  \
+    return true;  \
+  }  \
+  \
+  ATTR bool PREFIX##_insert(struct PREFIX* this, uint64_t key, V value) {  \
+    assert(nullptr != this);  \
+    if (!PREFIX##_reserve(this, this->n+1)) {  \
+      return false;  \
+    }  \
+    struct PREFIX##_slot* slot = &this->ptr[PREFIX##_probe_(this, key)];  \
+    if (slot->used) {  \
+      return false;  \
+    }  \
+    *slot = (struct PREFIX##_slot) {  \
+      .used  = true,  \
+      .key   = key,  \
+      .value = value,  \
+    };  \
+    ++this->n;  \
+    return true;  \
+  }  \
+  ATTR bool PREFIX##_set(struct PREFIX* this, uint64_t key, V value) {  \
+    assert(nullptr != this);  \
+    V* dst = PREFIX##_get(this, key);  \
+    if (nullptr != dst) {  \
+      *dst = value;  \
+      return true;  \
+    }  \
+    return PREFIX##_insert(this, key, value);  \
+  }  \
+  \
+  ATTR bool PREFIX##_remove(struct PREFIX* this, uint64_t key, V* value) {  \
+    assert(nullptr != this);  \
+    if (0U == this->n) {  \
+      return false;  \
+    }  \
+    const uint64_t mask = this->cap - 1;  \
+    uint64_t i = PREFIX##_probe_(this, key);  \
+    if (!this->ptr[i].used) {  \
+      return false;  \
+    }  \
+    if (nullptr != value) {  \
+      *value = this->ptr[i].value;  \
+    }  \
+    \
+    /* shifts following items back to fill the hole */  \
+    for (uint64_t j = (i+1) & mask; this->ptr[j].used; j = (j+1) & mask) {  \
+      const uint64_t home = nf7util_hashmap_hash(this->ptr[j].key) & mask;  \
+      const bool movable = i <= j?  \
+          (home <= i || home > j):  \
+          (home <= i && home > j);  \
+      if (movable) {  \
+        this->ptr[i] = this->ptr[j];  \
+        i = j;  \
+      }  \
+    }  \
+    this->ptr[i] = (struct PREFIX##_slot) {0};  \
+    --this->n;  \
+    return true;  \
+  }  \
+  static_assert(true)
+
+
+#define NF7UTIL_HASHMAP(PREFIX, V)  \
+  NF7UTIL_HASHMAP_TYPE(PREFIX, V);  \
+  NF7UTIL_HASHMAP_DECL(, PREFIX, V);  \
+  static_assert(true)
+
+#define NF7UTIL_HASHMAP_INLINE(PREFIX, V)  \
+  NF7UTIL_HASHMAP_TYPE(PREFIX, V);  \
+  NF7UTIL_HASHMAP_DECL(static inline, PREFIX, V);  \
+  NF7UTIL_HASHMAP_IMPL(static inline, PREFIX, V);  \
+  static_assert(true)
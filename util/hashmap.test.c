@@ -0,0 +1,75 @@
+// No copyright
+#include "util/hashmap.h"
+
+#include "test/common.h"
+
+
+NF7UTIL_HASHMAP_INLINE(nf7util_hashmap_test_map, uint64_t);
+
+
+NF7TEST(nf7util_hashmap_test_insert_find) {
+  struct nf7util_hashmap_test_map sut;
+  nf7util_hashmap_test_map_init(&sut, test_->malloc);
+
+  uint64_t v = 0;
+  const bool ret =
+    nf7test_expect(!nf7util_hashmap_test_map_find(&sut, 1, &v)) &&
+    nf7test_expect(nf7util_hashmap_test_map_insert(&sut, 1, 11)) &&
+    nf7test_expect(!nf7util_hashmap_test_map_insert(&sut, 1, 22)) &&
+    nf7test_expect(nf7util_hashmap_test_map_find(&sut, 1, &v)) &&
+    nf7test_expect(11 == v) &&
+    nf7test_expect(nf7util_hashmap_test_map_set(&sut, 1, 33)) &&
+    nf7test_expect(33 == *nf7util_hashmap_test_map_get(&sut, 1)) &&
+    nf7test_expect(1 == sut.n);
+
+  nf7util_hashmap_test_map_deinit(&sut);
+  return ret;
+}
+
+NF7TEST(nf7util_hashmap_test_remove) {
+  struct nf7util_hashmap_test_map sut;
+  nf7util_hashmap_test_map_init(&sut, test_->malloc);
+
+  bool ret = true;
+  for (uint64_t i = 0; ret && i < 1000; ++i) {
+    ret = nf7test_expect(nf7util_hashmap_test_map_insert(&sut, i, i*2));
+  }
+  // removes odd keys
+  for (uint64_t i = 1; ret && i < 1000; i += 2) {
+    uint64_t v;
+    ret =
+      nf7test_expect(nf7util_hashmap_test_map_remove(&sut, i, &v)) &&
+      nf7test_expect(i*2 == v);
+  }
+  for (uint64_t i = 0; ret && i < 1000; ++i) {
+    uint64_t v;
+    const bool found = nf7util_hashmap_test_map_find(&sut, i, &v);
+    ret = 0 == i%2?
+      nf7test_expect(found && i*2 == v):
+      nf7test_expect(!found);
+  }
+  ret = ret && nf7test_expect(500 == sut.n);
+
+  nf7util_hashmap_test_map_deinit(&sut);
+  return ret;
+}
+
+NF7TEST(nf7util_hashmap_test_iterate) {
+  struct nf7util_hashmap_test_map sut;
+  nf7util_hashmap_test_map_init(&sut, test_->malloc);
+
+  bool ret = true;
+  for (uint64_t i = 0; ret && i < 100; ++i) {
+    ret = nf7test_expect(nf7util_hashmap_test_map_insert(&sut, i, i));
+  }
+  uint64_t sum = 0;
+  for (uint64_t i = 0; i < sut.cap; ++i) {
+    if (sut.ptr[i].used) {
+      sum += sut.ptr[i].value;
+    }
+  }
+  ret = ret && nf7test_expect(4950 == sum);
+
+  nf7util_hashmap_test_map_deinit(&sut);
+  return ret;
+}
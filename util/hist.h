@@ -0,0 +1,142 @@
+// No copyright
+//
+// Histogram util records uint64_t values into log-linear buckets like HDR
+// histogram, so that percentiles can be queried in constant memory.
+//
+// Each power of 2 range is split into 2^NF7UTIL_HIST_SUB_BITS linear buckets,
+// so a value read from the histogram has relative error under
+// 1/2^NF7UTIL_HIST_SUB_BITS. Values under 2^NF7UTIL_HIST_SUB_BITS are exact.
+//
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+# include <intrin.h>
+#endif
+
+
+#define NF7UTIL_HIST_SUB_BITS 3
+#define NF7UTIL_HIST_BUCKETS  ((64 - NF7UTIL_HIST_SUB_BITS + 1) << NF7UTIL_HIST_SUB_BITS)
+
+
+struct nf7util_hist {
+  uint64_t n;
+  uint64_t min;
+  uint64_t max;
+  uint64_t sum;  // wraps around on overflow
+
+  uint64_t counts[NF7UTIL_HIST_BUCKETS];
+};
+
+
+static inline uint32_t nf7util_hist_log2_(uint64_t v) {
+  assert(0U != v);
+#if defined(_MSC_VER)
+  unsigned long ret;
+  _BitScanReverse64(&ret, v);
+  return (uint32_t) ret;
+#else
+  return (uint32_t) (63 - __builtin_clzll(v));
+#endif
+}
+
+static inline uint32_t nf7util_hist_index(uint64_t v) {
+  const uint64_t sub = UINT64_C(1) << NF7UTIL_HIST_SUB_BITS;
+  if (v < sub) {
+    return (uint32_t) v;
+  }
+  const uint32_t e     = nf7util_hist_log2_(v);
+  const uint32_t shift = e - NF7UTIL_HIST_SUB_BITS;
+  return
+      ((shift + 1) << NF7UTIL_HIST_SUB_BITS) +
+      (uint32_t) ((v >> shift) & (sub - 1));
+}
+
+// Returns the lowest value which falls into the bucket.
+static inline uint64_t nf7util_hist_lower(uint32_t idx) {
+  assert(idx < NF7UTIL_HIST_BUCKETS);
+
+  const uint64_t sub = UINT64_C(1) << NF7UTIL_HIST_SUB_BITS;
+  if (idx < sub) {
+    return idx;
+  }
+  const uint32_t shift = (idx >> NF7UTIL_HIST_SUB_BITS) - 1;
+  return (sub + (idx & (sub - 1))) << shift;
+}
+
+// Returns the highest value which falls into the bucket.
+static inline uint64_t nf7util_hist_upper(uint32_t idx) {
+  assert(idx < NF7UTIL_HIST_BUCKETS);
+
+  const uint64_t sub = UINT64_C(1) << NF7UTIL_HIST_SUB_BITS;
+  if (idx < sub) {
+    return idx;
+  }
+  const uint32_t shift = (idx >> NF7UTIL_HIST_SUB_BITS) - 1;
+  return nf7util_hist_lower(idx) + ((UINT64_C(1) << shift) - 1);
+}
+
+
+static inline void nf7util_hist_init(struct nf7util_hist* this) {
+  assert(nullptr != this);
+  *this = (struct nf7util_hist) {
+    .min = UINT64_MAX,
+  };
+}
+
+static inline void nf7util_hist_record(struct nf7util_hist* this, uint64_t v) {
+  assert(nullptr != this);
+
+  ++this->counts[nf7util_hist_index(v)];
+  ++this->n;
+  this->sum += v;
+  if (v < this->min) { this->min = v; }
+  if (v > this->max) { this->max = v; }
+}
+
+// Adds all records of the src to this.
+static inline void nf7util_hist_merge(
+    struct nf7util_hist* this, const struct nf7util_hist* src) {
+  assert(nullptr != this);
+  assert(nullptr != src);
+
+  for (uint32_t i = 0; i < NF7UTIL_HIST_BUCKETS; ++i) {
+    this->counts[i] += src->counts[i];
+  }
+  this->n   += src->n;
+  this->sum += src->sum;
+  if (src->min < this->min) { this->min = src->min; }
+  if (src->max > this->max) { this->max = src->max; }
+}
+
+// Returns a value at the percentile (0-100), or 0 if no value is recorded.
+// The value is an upper bound of the bucket, but never exceeds the max.
+static inline uint64_t nf7util_hist_percentile(
+    const struct nf7util_hist* this, double percentile) {
+  assert(nullptr != this);
+  assert(0. <= percentile && percentile <= 100.);
+
+  if (0U == this->n) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t) ((double) this->n * percentile / 100. + .5);
+  if (0U == rank) {
+    rank = 1;
+  }
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < NF7UTIL_HIST_BUCKETS; ++i) {
+    sum += this->counts[i];
+    if (sum >= rank) {
+      const uint64_t upper = nf7util_hist_upper(i);
+      return upper < this->max? upper: this->max;
+    }
+  }
+  return this->max;
+}
+
+static inline uint64_t nf7util_hist_mean(const struct nf7util_hist* this) {
+  assert(nullptr != this);
+  return 0U < this->n? this->sum / this->n: 0U;
+}
@@ -0,0 +1,56 @@
+// No copyright
+#include "util/hist.h"
+
+#include "test/common.h"
+
+
+NF7TEST(nf7util_hist_test_index) {
+  // every value falls into a bucket whose range contains the value
+  static const uint64_t kValues[] = {
+    0, 1, 7, 8, 9, 15, 16, 17, 100, 1000, 12345, 1000000007,
+    UINT64_C(1) << 40, UINT64_MAX - 1, UINT64_MAX,
+  };
+  for (uint32_t i = 0; i < sizeof(kValues)/sizeof(kValues[0]); ++i) {
+    const uint64_t v   = kValues[i];
+    const uint32_t idx = nf7util_hist_index(v);
+    if (!nf7test_expect(idx < NF7UTIL_HIST_BUCKETS) ||
+        !nf7test_expect(nf7util_hist_lower(idx) <= v) ||
+        !nf7test_expect(v <= nf7util_hist_upper(idx))) {
+      return false;
+    }
+  }
+
+  // buckets are contiguous
+  for (uint32_t i = 1; i < NF7UTIL_HIST_BUCKETS; ++i) {
+    if (!nf7test_expect(nf7util_hist_upper(i-1) + 1 == nf7util_hist_lower(i))) {
+      return false;
+    }
+  }
+  return nf7test_expect(UINT64_MAX == nf7util_hist_upper(NF7UTIL_HIST_BUCKETS-1));
+}
+
+NF7TEST(nf7util_hist_test_percentile) {
+  struct nf7util_hist a, b;
+  nf7util_hist_init(&a);
+  nf7util_hist_init(&b);
+
+  for (uint64_t i = 1; i <= 500; ++i) {
+    nf7util_hist_record(&a, i);
+  }
+  for (uint64_t i = 501; i <= 1000; ++i) {
+    nf7util_hist_record(&b, i);
+  }
+  nf7util_hist_merge(&a, &b);
+
+  const uint64_t p50 = nf7util_hist_percentile(&a, 50);
+  const uint64_t p99 = nf7util_hist_percentile(&a, 99);
+  return
+    nf7test_expect(1000 == a.n) &&
+    nf7test_expect(1 == a.min) &&
+    nf7test_expect(1000 == a.max) &&
+    nf7test_expect(500 == nf7util_hist_mean(&a)) &&
+    nf7test_expect(500 <= p50 && p50 < 500 + 500/8) &&
+    nf7test_expect(990 <= p99 && p99 <= 1000) &&
+    nf7test_expect(1000 == nf7util_hist_percentile(&a, 100)) &&
+    nf7test_expect(1 == nf7util_hist_percentile(&a, 0));
+}
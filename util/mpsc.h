@@ -0,0 +1,66 @@
+// No copyright
+//
+// nf7util_mpsc is a lock-free intrusive queue with multiple producers and a
+// single consumer.
+//
+// HOW TO USE
+//   Embed nf7util_mpsc_node in your struct, and push it from any threads by
+//   nf7util_mpsc_push(). The consumer takes all pushed nodes at once by
+//   nf7util_mpsc_take(), and walks them by `next` in order of their pushes.
+//
+//   nf7util_mpsc_push() returns true when the queue was empty, so producers
+//   can wake the consumer only once for a batch, e.g. by uv_async_send().
+//
+#pragma once
+
+#include <assert.h>
+#include <stdatomic.h>
+
+
+struct nf7util_mpsc_node {
+  struct nf7util_mpsc_node* next;
+};
+
+struct nf7util_mpsc {
+  _Atomic(struct nf7util_mpsc_node*) head;
+};
+
+
+static inline void nf7util_mpsc_init(struct nf7util_mpsc* this) {
+  assert(nullptr != this);
+  atomic_init(&this->head, nullptr);
+}
+
+// Pushes the node. Thread-safe.
+// Returns true if the queue was empty.
+static inline bool nf7util_mpsc_push(
+    struct nf7util_mpsc* this, struct nf7util_mpsc_node* node) {
+  assert(nullptr != this);
+  assert(nullptr != node);
+
+  struct nf7util_mpsc_node* head = atomic_load_explicit(&this->head, memory_order_relaxed);
+  do {
+    node->next = head;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &this->head, &head, node, memory_order_release, memory_order_relaxed));
+  return nullptr == head;
+}
+
+// Takes all pushed nodes and returns the first one, or nullptr if empty.
+// Only the consumer thread can call this.
+static inline struct nf7util_mpsc_node* nf7util_mpsc_take(struct nf7util_mpsc* this) {
+  assert(nullptr != this);
+
+  struct nf7util_mpsc_node* node =
+      atomic_exchange_explicit(&this->head, nullptr, memory_order_acquire);
+
+  // the nodes are linked in reverse order of their pushes
+  struct nf7util_mpsc_node* ret = nullptr;
+  while (nullptr != node) {
+    struct nf7util_mpsc_node* next = node->next;
+    node->next = ret;
+    ret  = node;
+    node = next;
+  }
+  return ret;
+}
@@ -0,0 +1,90 @@
+// No copyright
+#include "util/mpsc.h"
+
+#include <uv.h>
+
+#include "test/common.h"
+
+
+#define PRODUCERS_ 4
+#define ITEMS_     1000
+
+struct item_ {
+  struct nf7util_mpsc_node node;
+  uint32_t producer;
+  uint32_t seq;
+};
+
+struct producer_ {
+  struct nf7util_mpsc* queue;
+  uint32_t             index;
+  struct item_         items[ITEMS_];
+};
+
+static void produce_(void* data) {
+  struct producer_* this = data;
+  for (uint32_t i = 0; i < ITEMS_; ++i) {
+    this->items[i] = (struct item_) {
+      .producer = this->index,
+      .seq      = i,
+    };
+    nf7util_mpsc_push(this->queue, &this->items[i].node);
+  }
+}
+
+
+NF7TEST(nf7util_mpsc_test_order) {
+  struct nf7util_mpsc queue;
+  nf7util_mpsc_init(&queue);
+
+  struct item_ a = {0}, b = {0};
+  const bool ret =
+      nf7test_expect(nullptr == nf7util_mpsc_take(&queue)) &&
+      nf7test_expect(nf7util_mpsc_push(&queue, &a.node)) &&
+      nf7test_expect(!nf7util_mpsc_push(&queue, &b.node));
+  if (!ret) {
+    return false;
+  }
+  struct nf7util_mpsc_node* node = nf7util_mpsc_take(&queue);
+  return
+      nf7test_expect(&a.node == node) &&
+      nf7test_expect(&b.node == node->next) &&
+      nf7test_expect(nullptr == node->next->next) &&
+      nf7test_expect(nullptr == nf7util_mpsc_take(&queue));
+}
+
+NF7TEST(nf7util_mpsc_test_threads) {
+  static struct producer_ producers[PRODUCERS_];
+  uv_thread_t threads[PRODUCERS_];
+
+  struct nf7util_mpsc queue;
+  nf7util_mpsc_init(&queue);
+
+  uint32_t started = 0;
+  for (; started < PRODUCERS_; ++started) {
+    producers[started] = (struct producer_) {
+      .queue = &queue,
+      .index = started,
+    };
+    if (0 != uv_thread_create(&threads[started], produce_, &producers[started])) {
+      break;
+    }
+  }
+
+  // consumes while producing, every producer's items keep their order
+  uint32_t next[PRODUCERS_] = {0};
+  uint32_t total = 0;
+  bool     ret   = true;
+  while (ret && total < started*ITEMS_) {
+    for (struct nf7util_mpsc_node* node = nf7util_mpsc_take(&queue);
+         nullptr != node; node = node->next) {
+      const struct item_* item = (const void*) node;
+      ret = ret && nf7test_expect(item->seq == next[item->producer]++);
+      ++total;
+    }
+  }
+  for (uint32_t i = 0; i < started; ++i) {
+    uv_thread_join(&threads[i]);
+  }
+  return ret && nf7test_expect(PRODUCERS_ == started);
+}
@@ -0,0 +1,462 @@
+// No copyright
+//
+// Msg util encodes and decodes structured messages in a subset of MessagePack:
+// nil, bool, int, uint, float, str, bin, array and map. Extension types are
+// not supported.
+//
+// WRITER
+//   nf7util_msg_writer appends values to a buffer directly. The buffer grows
+//   geometrically while writing, and nf7util_msg_writer_finish() trims it to
+//   the written size. Once an allocation fails, the writer ignores all
+//   following writes and finish returns false.
+//
+//       struct nf7util_msg_writer w;
+//       nf7util_msg_writer_init(&w, buf);
+//       nf7util_msg_write_map(&w, 1);
+//       nf7util_msg_write_cstr(&w, "name");
+//       nf7util_msg_write_cstr(&w, "nf7core_null");
+//       if (!nf7util_msg_writer_finish(&w)) { ... }
+//
+// READER
+//   nf7util_msg_reader reads values one by one from bytes without any
+//   allocation. str and bin are returned as views into the bytes, so they are
+//   valid while the bytes are alive. Elements of array and map follow the
+//   header value, so read them by the count, or skip them all by
+//   nf7util_msg_skip().
+//
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util/buffer.h"
+
+
+// A maximum depth of nested arrays and maps that nf7util_msg_skip() accepts.
+#define NF7UTIL_MSG_MAX_DEPTH 64
+
+enum nf7util_msg_type {
+  NF7UTIL_MSG_NIL,
+  NF7UTIL_MSG_BOOL,
+  NF7UTIL_MSG_INT,    // negative integers
+  NF7UTIL_MSG_UINT,   // non-negative integers
+  NF7UTIL_MSG_FLOAT,
+  NF7UTIL_MSG_STR,
+  NF7UTIL_MSG_BIN,
+  NF7UTIL_MSG_ARRAY,
+  NF7UTIL_MSG_MAP,
+};
+
+struct nf7util_msg_value {
+  enum nf7util_msg_type type;
+  union {
+    bool     b;
+    int64_t  i;
+    uint64_t u;
+    double   f;
+    struct {
+      const uint8_t* ptr;
+      uint64_t       len;
+    } bytes;     // str and bin
+    uint32_t n;  // a number of elements of array, or pairs of map
+  };
+};
+
+
+// ---- writer
+struct nf7util_msg_writer {
+  struct nf7util_buffer* buf;
+
+  uint64_t n;  // written bytes, the rest of buf is reserved
+  bool     error;
+};
+
+// PRECONDS:
+//   - The writer is a unique owner of the buffer while writing.
+static inline void nf7util_msg_writer_init(
+    struct nf7util_msg_writer* this, struct nf7util_buffer* buf) {
+  assert(nullptr != this);
+  assert(nullptr != buf);
+
+  *this = (struct nf7util_msg_writer) {
+    .buf = buf,
+    .n   = buf->array.n,
+  };
+}
+
+// Trims the buffer to the written size. Returns false if any write failed.
+static inline bool nf7util_msg_writer_finish(struct nf7util_msg_writer* this) {
+  assert(nullptr != this);
+  nf7util_array_u8_resize(&this->buf->array, this->n);
+  return !this->error;
+}
+
+// Returns a pointer to reserved N bytes, or nullptr on failure.
+static inline uint8_t* nf7util_msg_writer_reserve_(
+    struct nf7util_msg_writer* this, uint64_t n) {
+  assert(nullptr != this);
+  if (this->error) {
+    return nullptr;
+  }
+
+  struct nf7util_array_u8* array = &this->buf->array;
+  if (this->n + n > array->n) {
+    uint64_t cap = 0U < array->n? array->n: 64U;
+    while (cap < this->n + n) {
+      cap *= 2;
+    }
+    if (!nf7util_array_u8_resize(array, cap)) {
+      this->error = true;
+      return nullptr;
+    }
+  }
+  uint8_t* ret = &array->ptr[this->n];
+  this->n += n;
+  return ret;
+}
+
+static inline void nf7util_msg_writer_put_(
+    struct nf7util_msg_writer* this, uint8_t head, uint64_t v, uint8_t bytes) {
+  uint8_t* dst = nf7util_msg_writer_reserve_(this, 1U + bytes);
+  if (nullptr == dst) {
+    return;
+  }
+  dst[0] = head;
+  for (uint8_t i = 0; i < bytes; ++i) {
+    dst[1+i] = (uint8_t) (v >> (8*(bytes-1-i)));
+  }
+}
+
+static inline void nf7util_msg_write_nil(struct nf7util_msg_writer* this) {
+  nf7util_msg_writer_put_(this, 0xC0, 0, 0);
+}
+
+static inline void nf7util_msg_write_bool(struct nf7util_msg_writer* this, bool v) {
+  nf7util_msg_writer_put_(this, v? 0xC3: 0xC2, 0, 0);
+}
+
+static inline void nf7util_msg_write_uint(struct nf7util_msg_writer* this, uint64_t v) {
+  if (v <= 0x7F) {
+    nf7util_msg_writer_put_(this, (uint8_t) v, 0, 0);
+  } else if (v <= UINT8_MAX) {
+    nf7util_msg_writer_put_(this, 0xCC, v, 1);
+  } else if (v <= UINT16_MAX) {
+    nf7util_msg_writer_put_(this, 0xCD, v, 2);
+  } else if (v <= UINT32_MAX) {
+    nf7util_msg_writer_put_(this, 0xCE, v, 4);
+  } else {
+    nf7util_msg_writer_put_(this, 0xCF, v, 8);
+  }
+}
+
+static inline void nf7util_msg_write_int(struct nf7util_msg_writer* this, int64_t v) {
+  if (0 <= v) {
+    nf7util_msg_write_uint(this, (uint64_t) v);
+  } else if (-32 <= v) {
+    nf7util_msg_writer_put_(this, (uint8_t) v, 0, 0);
+  } else if (INT8_MIN <= v) {
+    nf7util_msg_writer_put_(this, 0xD0, (uint64_t) v, 1);
+  } else if (INT16_MIN <= v) {
+    nf7util_msg_writer_put_(this, 0xD1, (uint64_t) v, 2);
+  } else if (INT32_MIN <= v) {
+    nf7util_msg_writer_put_(this, 0xD2, (uint64_t) v, 4);
+  } else {
+    nf7util_msg_writer_put_(this, 0xD3, (uint64_t) v, 8);
+  }
+}
+
+static inline void nf7util_msg_write_float(struct nf7util_msg_writer* this, double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  nf7util_msg_writer_put_(this, 0xCB, bits, 8);
+}
+
+static inline void nf7util_msg_writer_bytes_(
+    struct nf7util_msg_writer* this, const uint8_t* ptr, uint64_t len) {
+  assert(nullptr != ptr || 0U == len);
+  uint8_t* dst = nf7util_msg_writer_reserve_(this, len);
+  if (nullptr != dst && 0U < len) {
+    memcpy(dst, ptr, len);
+  }
+}
+
+static inline void nf7util_msg_write_str(
+    struct nf7util_msg_writer* this, const uint8_t* ptr, uint64_t len) {
+  if (len > UINT32_MAX) {
+    this->error = true;
+  } else if (len <= 31) {
+    nf7util_msg_writer_put_(this, (uint8_t) (0xA0 | len), 0, 0);
+  } else if (len <= UINT8_MAX) {
+    nf7util_msg_writer_put_(this, 0xD9, len, 1);
+  } else if (len <= UINT16_MAX) {
+    nf7util_msg_writer_put_(this, 0xDA, len, 2);
+  } else {
+    nf7util_msg_writer_put_(this, 0xDB, len, 4);
+  }
+  nf7util_msg_writer_bytes_(this, ptr, len);
+}
+
+static inline void nf7util_msg_write_cstr(
+    struct nf7util_msg_writer* this, const char* cstr) {
+  assert(nullptr != cstr);
+  nf7util_msg_write_str(this, (const uint8_t*) cstr, strlen(cstr));
+}
+
+static inline void nf7util_msg_write_bin(
+    struct nf7util_msg_writer* this, const uint8_t* ptr, uint64_t len) {
+  if (len > UINT32_MAX) {
+    this->error = true;
+  } else if (len <= UINT8_MAX) {
+    nf7util_msg_writer_put_(this, 0xC4, len, 1);
+  } else if (len <= UINT16_MAX) {
+    nf7util_msg_writer_put_(this, 0xC5, len, 2);
+  } else {
+    nf7util_msg_writer_put_(this, 0xC6, len, 4);
+  }
+  nf7util_msg_writer_bytes_(this, ptr, len);
+}
+
+// Writes a header of array. N values must follow.
+static inline void nf7util_msg_write_array(struct nf7util_msg_writer* this, uint32_t n) {
+  if (n <= 15) {
+    nf7util_msg_writer_put_(this, (uint8_t) (0x90 | n), 0, 0);
+  } else if (n <= UINT16_MAX) {
+    nf7util_msg_writer_put_(this, 0xDC, n, 2);
+  } else {
+    nf7util_msg_writer_put_(this, 0xDD, n, 4);
+  }
+}
+
+// Writes a header of map. N pairs of key and value must follow.
+static inline void nf7util_msg_write_map(struct nf7util_msg_writer* this, uint32_t n) {
+  if (n <= 15) {
+    nf7util_msg_writer_put_(this, (uint8_t) (0x80 | n), 0, 0);
+  } else if (n <= UINT16_MAX) {
+    nf7util_msg_writer_put_(this, 0xDE, n, 2);
+  } else {
+    nf7util_msg_writer_put_(this, 0xDF, n, 4);
+  }
+}
+
+
+// ---- reader
+struct nf7util_msg_reader {
+  const uint8_t* ptr;
+  uint64_t       len;
+  uint64_t       pos;
+};
+
+static inline void nf7util_msg_reader_init(
+    struct nf7util_msg_reader* this, const uint8_t* ptr, uint64_t len) {
+  assert(nullptr != this);
+  assert(nullptr != ptr || 0U == len);
+
+  *this = (struct nf7util_msg_reader) {
+    .ptr = ptr,
+    .len = len,
+  };
+}
+
+static inline bool nf7util_msg_reader_end(const struct nf7util_msg_reader* this) {
+  assert(nullptr != this);
+  return this->pos >= this->len;
+}
+
+// Reads a big-endian integer of N bytes.
+static inline bool nf7util_msg_reader_get_(
+    struct nf7util_msg_reader* this, uint8_t bytes, uint64_t* v) {
+  if (this->len - this->pos < bytes) {
+    return false;
+  }
+  uint64_t ret = 0;
+  for (uint8_t i = 0; i < bytes; ++i) {
+    ret = (ret << 8) | this->ptr[this->pos+i];
+  }
+  this->pos += bytes;
+  *v = ret;
+  return true;
+}
+
+static inline bool nf7util_msg_reader_bytes_(
+    struct nf7util_msg_reader* this, uint8_t bytes,
+    struct nf7util_msg_value* value) {
+  uint64_t len;
+  if (!nf7util_msg_reader_get_(this, bytes, &len) ||
+      this->len - this->pos < len) {
+    return false;
+  }
+  value->bytes.ptr = &this->ptr[this->pos];
+  value->bytes.len = len;
+  this->pos += len;
+  return true;
+}
+
+// Reads the next value. Returns false at the end or if the bytes are broken,
+// and then the reader is left at an unspecified position.
+static inline bool nf7util_msg_read(
+    struct nf7util_msg_reader* this, struct nf7util_msg_value* value) {
+  assert(nullptr != this);
+  assert(nullptr != value);
+
+  if (nf7util_msg_reader_end(this)) {
+    return false;
+  }
+  const uint8_t head = this->ptr[this->pos++];
+
+  uint64_t v;
+  switch (head) {
+  case 0xC0:
+    value->type = NF7UTIL_MSG_NIL;
+    return true;
+  case 0xC2:
+  case 0xC3:
+    value->type = NF7UTIL_MSG_BOOL;
+    value->b    = 0xC3 == head;
+    return true;
+
+  case 0xCC:
+  case 0xCD:
+  case 0xCE:
+  case 0xCF:
+    value->type = NF7UTIL_MSG_UINT;
+    return nf7util_msg_reader_get_(this, (uint8_t) (1U << (head - 0xCC)), &value->u);
+
+  case 0xD0:
+  case 0xD1:
+  case 0xD2:
+  case 0xD3: {
+    const uint8_t bytes = (uint8_t) (1U << (head - 0xD0));
+    if (!nf7util_msg_reader_get_(this, bytes, &v)) {
+      return false;
+    }
+    // sign extension
+    const uint32_t shift = 64U - 8U*bytes;
+    const int64_t  i     = (int64_t) (v << shift) >> shift;
+    value->type = 0 <= i? NF7UTIL_MSG_UINT: NF7UTIL_MSG_INT;
+    value->i    = i;
+    return true;
+  }
+
+  case 0xCA: {
+    if (!nf7util_msg_reader_get_(this, 4, &v)) {
+      return false;
+    }
+    const uint32_t bits = (uint32_t) v;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    value->type = NF7UTIL_MSG_FLOAT;
+    value->f    = f;
+    return true;
+  }
+  case 0xCB:
+    if (!nf7util_msg_reader_get_(this, 8, &v)) {
+      return false;
+    }
+    value->type = NF7UTIL_MSG_FLOAT;
+    memcpy(&value->f, &v, sizeof(value->f));
+    return true;
+
+  case 0xD9:
+  case 0xDA:
+  case 0xDB:
+    value->type = NF7UTIL_MSG_STR;
+    return nf7util_msg_reader_bytes_(this, (uint8_t) (1U << (head - 0xD9)), value);
+  case 0xC4:
+  case 0xC5:
+  case 0xC6:
+    value->type = NF7UTIL_MSG_BIN;
+    return nf7util_msg_reader_bytes_(this, (uint8_t) (1U << (head - 0xC4)), value);
+
+  case 0xDC:
+  case 0xDD:
+    value->type = NF7UTIL_MSG_ARRAY;
+    if (!nf7util_msg_reader_get_(this, 0xDC == head? 2: 4, &v)) {
+      return false;
+    }
+    value->n = (uint32_t) v;
+    return true;
+  case 0xDE:
+  case 0xDF:
+    value->type = NF7UTIL_MSG_MAP;
+    if (!nf7util_msg_reader_get_(this, 0xDE == head? 2: 4, &v)) {
+      return false;
+    }
+    value->n = (uint32_t) v;
+    return true;
+  }
+
+  if (head <= 0x7F) {
+    value->type = NF7UTIL_MSG_UINT;
+    value->u    = head;
+    return true;
+  }
+  if (0xE0 <= head) {
+    value->type = NF7UTIL_MSG_INT;
+    value->i    = (int8_t) head;
+    return true;
+  }
+  switch (head & 0xF0) {
+  case 0x80:
+    value->type = NF7UTIL_MSG_MAP;
+    value->n    = head & 0x0F;
+    return true;
+  case 0x90:
+    value->type = NF7UTIL_MSG_ARRAY;
+    value->n    = head & 0x0F;
+    return true;
+  }
+  if (0xA0 == (head & 0xE0)) {
+    value->type      = NF7UTIL_MSG_STR;
+    value->bytes.len = head & 0x1F;
+    if (this->len - this->pos < value->bytes.len) {
+      return false;
+    }
+    value->bytes.ptr = &this->ptr[this->pos];
+    this->pos += value->bytes.len;
+    return true;
+  }
+  return false;  // extension types and reserved
+}
+
+// Skips the next value including all elements if it's array or map.
+static inline bool nf7util_msg_skip(struct nf7util_msg_reader* this) {
+  assert(nullptr != this);
+
+  // a number of values to be skipped at each depth
+  uint64_t rest[NF7UTIL_MSG_MAX_DEPTH];
+  uint32_t depth = 0;
+  rest[0] = 1;
+
+  for (;;) {
+    while (0U == rest[depth]) {
+      if (0U == depth) {
+        return true;
+      }
+      --depth;
+    }
+    --rest[depth];
+
+    struct nf7util_msg_value value;
+    if (!nf7util_msg_read(this, &value)) {
+      return false;
+    }
+    if (NF7UTIL_MSG_ARRAY == value.type || NF7UTIL_MSG_MAP == value.type) {
+      if (depth+1 >= NF7UTIL_MSG_MAX_DEPTH) {
+        return false;
+      }
+      rest[++depth] = NF7UTIL_MSG_ARRAY == value.type? value.n: UINT64_C(2)*value.n;
+    }
+  }
+}
+
+// Returns true if the value is a str that equals to the cstr.
+static inline bool nf7util_msg_value_is_cstr(
+    const struct nf7util_msg_value* value, const char* cstr) {
+  assert(nullptr != value);
+  assert(nullptr != cstr);
+  return
+      NF7UTIL_MSG_STR == value->type &&
+      value->bytes.len == strlen(cstr) &&
+      (0U == value->bytes.len || 0 == memcmp(value->bytes.ptr, cstr, value->bytes.len));
+}
@@ -0,0 +1,124 @@
+// No copyright
+#include "util/msg.h"
+
+#include <string.h>
+
+#include "util/buffer.h"
+
+#include "test/common.h"
+
+
+NF7TEST(nf7util_msg_test_compat) {
+  struct nf7util_buffer* buf = nf7util_buffer_new(test_->malloc, 0);
+  if (!nf7test_expect(nullptr != buf)) {
+    return false;
+  }
+
+  // {"a": [1, -1, nil, true]}
+  struct nf7util_msg_writer w;
+  nf7util_msg_writer_init(&w, buf);
+  nf7util_msg_write_map(&w, 1);
+  nf7util_msg_write_cstr(&w, "a");
+  nf7util_msg_write_array(&w, 4);
+  nf7util_msg_write_int(&w, 1);
+  nf7util_msg_write_int(&w, -1);
+  nf7util_msg_write_nil(&w);
+  nf7util_msg_write_bool(&w, true);
+
+  static const uint8_t kExpect[] = {
+    0x81, 0xA1, 'a', 0x94, 0x01, 0xFF, 0xC0, 0xC3,
+  };
+  const bool ret =
+    nf7test_expect(nf7util_msg_writer_finish(&w)) &&
+    nf7test_expect(sizeof(kExpect) == buf->array.n) &&
+    nf7test_expect(0 == memcmp(kExpect, buf->array.ptr, sizeof(kExpect)));
+
+  nf7util_buffer_unref(buf);
+  return ret;
+}
+
+NF7TEST(nf7util_msg_test_roundtrip) {
+  struct nf7util_buffer* buf = nf7util_buffer_new(test_->malloc, 0);
+  if (!nf7test_expect(nullptr != buf)) {
+    return false;
+  }
+
+  static const int64_t kInts[] = {
+    0, 127, 128, 255, 256, 65535, 65536, INT64_MAX,
+    -1, -32, -33, -128, -129, -32768, -32769, INT32_MIN, INT64_MIN,
+  };
+  static const uint8_t kBin[] = {0, 1, 2};
+  char str[300];
+  memset(str, 'x', sizeof(str));
+
+  struct nf7util_msg_writer w;
+  nf7util_msg_writer_init(&w, buf);
+  for (uint32_t i = 0; i < sizeof(kInts)/sizeof(kInts[0]); ++i) {
+    nf7util_msg_write_int(&w, kInts[i]);
+  }
+  nf7util_msg_write_uint(&w, UINT64_MAX);
+  nf7util_msg_write_float(&w, 1.5);
+  nf7util_msg_write_str(&w, (const uint8_t*) str, 31);
+  nf7util_msg_write_str(&w, (const uint8_t*) str, 32);
+  nf7util_msg_write_str(&w, (const uint8_t*) str, sizeof(str));
+  nf7util_msg_write_bin(&w, kBin, sizeof(kBin));
+  nf7util_msg_write_array(&w, 16);
+  bool ret = nf7test_expect(nf7util_msg_writer_finish(&w));
+
+  struct nf7util_msg_reader r;
+  nf7util_msg_reader_init(&r, buf->array.ptr, buf->array.n);
+
+  struct nf7util_msg_value v;
+  for (uint32_t i = 0; ret && i < sizeof(kInts)/sizeof(kInts[0]); ++i) {
+    ret =
+      nf7test_expect(nf7util_msg_read(&r, &v)) &&
+      nf7test_expect((0 <= kInts[i]? NF7UTIL_MSG_UINT: NF7UTIL_MSG_INT) == v.type) &&
+      nf7test_expect(kInts[i] == v.i);
+  }
+  ret = ret &&
+    nf7test_expect(nf7util_msg_read(&r, &v)) &&
+    nf7test_expect(NF7UTIL_MSG_UINT == v.type && UINT64_MAX == v.u) &&
+    nf7test_expect(nf7util_msg_read(&r, &v)) &&
+    nf7test_expect(NF7UTIL_MSG_FLOAT == v.type && 1.5 == v.f);
+
+  static const uint64_t kStrs[] = {31, 32, sizeof(str)};
+  for (uint32_t i = 0; ret && i < sizeof(kStrs)/sizeof(kStrs[0]); ++i) {
+    ret =
+      nf7test_expect(nf7util_msg_read(&r, &v)) &&
+      nf7test_expect(NF7UTIL_MSG_STR == v.type) &&
+      nf7test_expect(kStrs[i] == v.bytes.len) &&
+      nf7test_expect(0 == memcmp(str, v.bytes.ptr, v.bytes.len)) &&
+      nf7test_expect(buf->array.ptr < v.bytes.ptr &&
+                     v.bytes.ptr < buf->array.ptr + buf->array.n);
+  }
+  ret = ret &&
+    nf7test_expect(nf7util_msg_read(&r, &v)) &&
+    nf7test_expect(NF7UTIL_MSG_BIN == v.type && sizeof(kBin) == v.bytes.len) &&
+    nf7test_expect(0 == memcmp(kBin, v.bytes.ptr, sizeof(kBin))) &&
+    nf7test_expect(nf7util_msg_read(&r, &v)) &&
+    nf7test_expect(NF7UTIL_MSG_ARRAY == v.type && 16 == v.n) &&
+    nf7test_expect(nf7util_msg_reader_end(&r)) &&
+    nf7test_expect(!nf7util_msg_read(&r, &v));
+
+  nf7util_buffer_unref(buf);
+  return ret;
+}
+
+NF7TEST(nf7util_msg_test_skip) {
+  // [{"k": [1, 2]}, "x"], 7
+  static const uint8_t kBytes[] = {
+    0x92, 0x81, 0xA1, 'k', 0x92, 0x01, 0x02, 0xA1, 'x', 0x07,
+  };
+  struct nf7util_msg_reader r;
+  nf7util_msg_reader_init(&r, kBytes, sizeof(kBytes));
+
+  struct nf7util_msg_value v;
+  const bool ret =
+    nf7test_expect(nf7util_msg_skip(&r)) &&
+    nf7test_expect(nf7util_msg_read(&r, &v)) &&
+    nf7test_expect(NF7UTIL_MSG_UINT == v.type && 7 == v.u);
+
+  // truncated bytes
+  nf7util_msg_reader_init(&r, kBytes, sizeof(kBytes) - 3);
+  return ret && nf7test_expect(!nf7util_msg_skip(&r));
+}
@@ -1,20 +1,216 @@
 // No copyright
+//
+// String utilities.
+//
+// ATOMS
+//   nf7util_str_atoms is an interning table that maps byte strings to stable
+//   integer ids, called atoms. Interning the same bytes to the same table
+//   always returns the same atom, so once names are interned they can be
+//   compared as integers. Each atom keeps a copy of its bytes with the
+//   precomputed hash and length. An atom 0 means no atom.
+//
 #pragma once
 
+#include <assert.h>
 #include <stdint.h>
 #include <string.h>
 
+#include "util/array.h"
+#include "util/malloc.h"
+
 
 static inline bool nf7util_str_equal_str(
     const uint8_t* a, uint64_t alen, const uint8_t* b, uint64_t blen) {
   return
       alen == blen &&
-      0 == strncmp((const char*) a, (const char*) b, alen);
+      (0U == alen || 0 == memcmp(a, b, alen));
 }
 
 static inline bool nf7util_str_equal_cstr(
     const uint8_t* a, uint64_t alen, const uint8_t* b) {
   return
       alen == strlen((const char*) b) &&
-      0 == strncmp((const char*) a, (const char*) b, alen);
+      (0U == alen || 0 == memcmp(a, b, alen));
+}
+
+// Returns FNV-1a hash of the bytes.
+static inline uint64_t nf7util_str_hash(const uint8_t* ptr, uint64_t len) {
+  assert(nullptr != ptr || 0U == len);
+
+  uint64_t ret = UINT64_C(0xcbf29ce484222325);
+  for (uint64_t i = 0; i < len; ++i) {
+    ret ^= ptr[i];
+    ret *= UINT64_C(0x100000001b3);
+  }
+  return ret;
+}
+
+
+// ---- atoms
+struct nf7util_str_atom {
+  uint32_t id;
+  uint64_t hash;
+  uint64_t len;
+  uint8_t  ptr[];  // always terminated by NUL
+};
+
+NF7UTIL_ARRAY_INLINE(nf7util_str_atom_ptrs, struct nf7util_str_atom*);
+
+struct nf7util_str_atoms {
+  struct nf7util_malloc* malloc;
+
+  // an item at N is an atom whose id is N+1
+  struct nf7util_str_atom_ptrs atoms;
+
+  // open addressing table of atom ids, 0 means an empty slot
+  // the size is always 0 or power of 2
+  struct nf7util_array_u32 index;
+};
+
+static inline void nf7util_str_atoms_init(
+    struct nf7util_str_atoms* this, struct nf7util_malloc* malloc) {
+  assert(nullptr != this);
+  assert(nullptr != malloc);
+
+  *this = (struct nf7util_str_atoms) {
+    .malloc = malloc,
+  };
+  nf7util_str_atom_ptrs_init(&this->atoms, malloc);
+  nf7util_array_u32_init(&this->index, malloc);
+}
+
+static inline void nf7util_str_atoms_deinit(struct nf7util_str_atoms* this) {
+  assert(nullptr != this);
+
+  for (uint64_t i = 0; i < this->atoms.n; ++i) {
+    nf7util_malloc_free(this->malloc, this->atoms.ptr[i]);
+  }
+  nf7util_str_atom_ptrs_deinit(&this->atoms);
+  nf7util_array_u32_deinit(&this->index);
+}
+
+static inline const struct nf7util_str_atom* nf7util_str_atoms_get(
+    const struct nf7util_str_atoms* this, uint32_t atom) {
+  assert(nullptr != this);
+
+  if (0U == atom || atom > this->atoms.n) {
+    return nullptr;
+  }
+  return this->atoms.ptr[atom-1];
+}
+
+// Returns an index of the slot which holds the atom of the bytes, or an empty
+// slot where the atom should be placed.
+// PRECONDS:
+//   - `0 < this->index.n`
+static inline uint64_t nf7util_str_atoms_probe_(
+    const struct nf7util_str_atoms* this,
+    const uint8_t* ptr, uint64_t len, uint64_t hash) {
+  assert(nullptr != this);
+  assert(0U < this->index.n);
+
+  const uint64_t mask = this->index.n - 1;
+  for (uint64_t i = hash & mask;; i = (i+1) & mask) {
+    const uint32_t id = this->index.ptr[i];
+    if (0U == id) {
+      return i;
+    }
+    const struct nf7util_str_atom* atom = this->atoms.ptr[id-1];
+    if (atom->hash == hash && atom->len == len &&
+        0 == memcmp(atom->ptr, ptr, len)) {
+      return i;
+    }
+  }
+}
+
+static inline bool nf7util_str_atoms_rehash_(
+    struct nf7util_str_atoms* this, uint64_t n) {
+  assert(nullptr != this);
+  assert(0U < n && 0U == (n & (n-1)));
+
+  struct nf7util_array_u32 index;
+  nf7util_array_u32_init(&index, this->malloc);
+  if (!nf7util_array_u32_resize(&index, n)) {
+    return false;
+  }
+
+  const uint64_t mask = n - 1;
+  for (uint64_t i = 0; i < this->atoms.n; ++i) {
+    const struct nf7util_str_atom* atom = this->atoms.ptr[i];
+
+    uint64_t j = atom->hash & mask;
+    while (0U != index.ptr[j]) {
+      j = (j+1) & mask;
+    }
+    index.ptr[j] = atom->id;
+  }
+  nf7util_array_u32_deinit(&this->index);
+  this->index = index;
+  return true;
+}
+
+// Returns an atom of the bytes, or 0 if the bytes are not interned yet.
+static inline uint32_t nf7util_str_atoms_find(
+    const struct nf7util_str_atoms* this, const uint8_t* ptr, uint64_t len) {
+  assert(nullptr != this);
+  assert(nullptr != ptr || 0U == len);
+
+  if (0U == this->index.n) {
+    return 0;
+  }
+  const uint64_t hash = nf7util_str_hash(ptr, len);
+  return this->index.ptr[nf7util_str_atoms_probe_(this, ptr, len, hash)];
+}
+
+// Returns an atom of the bytes, and interns them if they are not yet.
+// Returns 0 when failed to allocate memory.
+static inline uint32_t nf7util_str_atoms_intern(
+    struct nf7util_str_atoms* this, const uint8_t* ptr, uint64_t len) {
+  assert(nullptr != this);
+  assert(nullptr != ptr || 0U == len);
+
+  const uint64_t hash = nf7util_str_hash(ptr, len);
+  if (0U < this->index.n) {
+    const uint64_t i = nf7util_str_atoms_probe_(this, ptr, len, hash);
+    if (0U != this->index.ptr[i]) {
+      return this->index.ptr[i];
+    }
+  }
+  if (UINT32_MAX <= this->atoms.n) {
+    return 0;
+  }
+
+  // keep the load factor under 1/2
+  if ((this->atoms.n+1)*2 > this->index.n) {
+    const uint64_t n = 0U < this->index.n? this->index.n*2: 16U;
+    if (!nf7util_str_atoms_rehash_(this, n)) {
+      return 0;
+    }
+  }
+
+  struct nf7util_str_atom* atom =
+      nf7util_malloc_alloc(this->malloc, sizeof(*atom) + len + 1);
+  if (nullptr == atom) {
+    return 0;
+  }
+  atom->id   = (uint32_t) this->atoms.n + 1;
+  atom->hash = hash;
+  atom->len  = len;
+  if (0U < len) {
+    memcpy(atom->ptr, ptr, len);
+  }
+  atom->ptr[len] = 0;
+
+  if (!nf7util_str_atom_ptrs_insert(&this->atoms, UINT64_MAX, atom)) {
+    nf7util_malloc_free(this->malloc, atom);
+    return 0;
+  }
+  this->index.ptr[nf7util_str_atoms_probe_(this, ptr, len, hash)] = atom->id;
+  return atom->id;
+}
+
+static inline uint32_t nf7util_str_atoms_intern_cstr(
+    struct nf7util_str_atoms* this, const uint8_t* cstr) {
+  assert(nullptr != cstr);
+  return nf7util_str_atoms_intern(this, cstr, strlen((const char*) cstr));
 }
@@ -0,0 +1,82 @@
+// No copyright
+#include "util/str.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "test/common.h"
+
+
+NF7TEST(nf7util_str_atoms_test_intern_same) {
+  struct nf7util_str_atoms sut;
+  nf7util_str_atoms_init(&sut, test_->malloc);
+
+  const uint32_t a = nf7util_str_atoms_intern(&sut, (const uint8_t*) "hello", 5);
+  const uint32_t b = nf7util_str_atoms_intern(&sut, (const uint8_t*) "hello", 5);
+  const uint32_t c = nf7util_str_atoms_intern(&sut, (const uint8_t*) "world", 5);
+
+  const bool ret =
+    nf7test_expect(0U != a) &&
+    nf7test_expect(a == b) &&
+    nf7test_expect(a != c);
+
+  nf7util_str_atoms_deinit(&sut);
+  return ret;
+}
+
+NF7TEST(nf7util_str_atoms_test_find) {
+  struct nf7util_str_atoms sut;
+  nf7util_str_atoms_init(&sut, test_->malloc);
+
+  const bool ret =
+    nf7test_expect(0U == nf7util_str_atoms_find(&sut, (const uint8_t*) "a", 1)) &&
+    nf7test_expect(0U != nf7util_str_atoms_intern(&sut, (const uint8_t*) "ab", 2)) &&
+    nf7test_expect(0U == nf7util_str_atoms_find(&sut, (const uint8_t*) "a", 1)) &&
+    nf7test_expect(0U != nf7util_str_atoms_find(&sut, (const uint8_t*) "ab", 2));
+
+  nf7util_str_atoms_deinit(&sut);
+  return ret;
+}
+
+NF7TEST(nf7util_str_atoms_test_get) {
+  static const uint8_t kBytes[] = {'a', 0, 'b'};
+
+  struct nf7util_str_atoms sut;
+  nf7util_str_atoms_init(&sut, test_->malloc);
+
+  const uint32_t atom = nf7util_str_atoms_intern(&sut, kBytes, sizeof(kBytes));
+  const struct nf7util_str_atom* got = nf7util_str_atoms_get(&sut, atom);
+
+  const bool ret =
+    nf7test_expect(nullptr != got) &&
+    nf7test_expect(atom == got->id) &&
+    nf7test_expect(sizeof(kBytes) == got->len) &&
+    nf7test_expect(nf7util_str_hash(kBytes, sizeof(kBytes)) == got->hash) &&
+    nf7test_expect(0 == memcmp(kBytes, got->ptr, sizeof(kBytes))) &&
+    nf7test_expect(nullptr == nf7util_str_atoms_get(&sut, atom+1));
+
+  nf7util_str_atoms_deinit(&sut);
+  return ret;
+}
+
+NF7TEST(nf7util_str_atoms_test_many) {
+  struct nf7util_str_atoms sut;
+  nf7util_str_atoms_init(&sut, test_->malloc);
+
+  bool ret = true;
+  for (uint32_t i = 0; ret && i < 1000; ++i) {
+    char name[16];
+    const int len = snprintf(name, sizeof(name), "atom%" PRIu32, i);
+    ret = nf7test_expect(
+        i+1 == nf7util_str_atoms_intern(&sut, (const uint8_t*) name, len));
+  }
+  for (uint32_t i = 0; ret && i < 1000; ++i) {
+    char name[16];
+    const int len = snprintf(name, sizeof(name), "atom%" PRIu32, i);
+    ret = nf7test_expect(
+        i+1 == nf7util_str_atoms_find(&sut, (const uint8_t*) name, len));
+  }
+
+  nf7util_str_atoms_deinit(&sut);
+  return ret;
+}